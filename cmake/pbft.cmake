@@ -183,6 +183,18 @@ if("virtual" IN_LIST TARGET)
   use_libbyz(test_ledger_replay)
   add_san(test_ledger_replay)
 
+  add_unit_test(
+    test_verify_order
+    ${CMAKE_SOURCE_DIR}/src/consensus/pbft/libbyz/test/test_verify_order.cpp
+  )
+  target_include_directories(
+    test_verify_order
+    PRIVATE ${CMAKE_SOURCE_DIR}/src/consensus/pbft/libbyz/test/mocks
+  )
+  target_link_libraries(test_verify_order PRIVATE libcommontest.mock)
+  use_libbyz(test_verify_order)
+  add_san(test_verify_order)
+
   add_test(
     NAME test_UDP_with_delay
     COMMAND
@@ -1,10 +1,13 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the Apache 2.0 License.
+#include "ds/spinlock.h"
 #include "enclave/appinterface.h"
 #include "node/rpc/userfrontend.h"
 #include "quickjs.h"
 
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
 namespace ccfapp
@@ -32,7 +35,7 @@ namespace ccfapp
       ss << str;
       JS_FreeCString(ctx, str);
     }
-    LOG_INFO_FMT(ss.str());
+    LOG_INFO_FMT("{}", ss.str());
     return JS_UNDEFINED;
   }
 
@@ -95,20 +98,211 @@ namespace ccfapp
     return JS_NULL;
   }
 
+  // An app script compiled to QuickJS bytecode. The bytecode is independent
+  // of the context that produced it, so it can be loaded by every thread.
+  struct CompiledScript
+  {
+    size_t hash;
+    std::string text;
+    std::vector<uint8_t> bytecode;
+  };
+
+  // A QuickJS runtime, kept by each thread and reused across requests. Each
+  // request runs in a fresh context on it, so that nothing a script does to
+  // its globals or to the built-in objects is seen by later requests.
+  class Interpreter
+  {
+  private:
+    JSRuntime* rt = nullptr;
+
+  public:
+    Interpreter()
+    {
+      rt = JS_NewRuntime();
+      if (rt == nullptr)
+      {
+        throw std::runtime_error("Failed to initialise QuickJS runtime");
+      }
+    }
+
+    ~Interpreter()
+    {
+      JS_FreeRuntime(rt);
+    }
+
+    // A context with the CCF globals installed, bound to a request
+    class Context
+    {
+    private:
+      JSContext* ctx;
+
+    public:
+      Context(
+        JSRuntime* rt,
+        LogTable::TxView* log_table_view,
+        const std::vector<uint8_t>& body)
+      {
+        ctx = JS_NewContext(rt);
+        if (ctx == nullptr)
+        {
+          throw std::runtime_error("Failed to initialise QuickJS context");
+        }
+
+        JS_SetContextOpaque(ctx, (void*)log_table_view);
+
+        auto global_obj = JS_GetGlobalObject(ctx);
+
+        auto console = JS_NewObject(ctx);
+        JS_SetPropertyStr(
+          ctx,
+          console,
+          "log",
+          JS_NewCFunction(ctx, ccfapp::js_print, "log", 1));
+        JS_SetPropertyStr(ctx, global_obj, "console", console);
+
+        auto log = JS_NewObject(ctx);
+        JS_SetPropertyStr(
+          ctx, log, "get", JS_NewCFunction(ctx, ccfapp::js_get, "get", 1));
+        JS_SetPropertyStr(
+          ctx, log, "put", JS_NewCFunction(ctx, ccfapp::js_put, "put", 2));
+        auto tables_ = JS_NewObject(ctx);
+        JS_SetPropertyStr(ctx, tables_, "log", log);
+        JS_SetPropertyStr(ctx, global_obj, "tables", tables_);
+
+        auto args_str =
+          JS_NewStringLen(ctx, (const char*)body.data(), body.size());
+        JS_SetPropertyStr(ctx, global_obj, "args", args_str);
+
+        JS_FreeValue(ctx, global_obj);
+      }
+
+      Context(const Context&) = delete;
+
+      ~Context()
+      {
+        JS_FreeContext(ctx);
+      }
+
+      JSContext* get()
+      {
+        return ctx;
+      }
+
+      // Compiles a script to bytecode, which is independent of this context
+      std::shared_ptr<const CompiledScript> compile(
+        const std::string& method, const std::string& text, size_t hash)
+      {
+        const auto path = fmt::format("app_scripts::{}", method);
+        JSValue fn = JS_Eval(
+          ctx,
+          text.c_str(),
+          text.size(),
+          path.c_str(),
+          JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+        if (JS_IsException(fn))
+        {
+          js_dump_error(ctx);
+          return nullptr;
+        }
+
+        size_t size;
+        auto buf = JS_WriteObject(ctx, &size, fn, JS_WRITE_OBJ_BYTECODE);
+        JS_FreeValue(ctx, fn);
+        if (buf == nullptr)
+        {
+          js_dump_error(ctx);
+          return nullptr;
+        }
+
+        auto compiled = std::make_shared<CompiledScript>();
+        compiled->hash = hash;
+        compiled->text = text;
+        compiled->bytecode.assign(buf, buf + size);
+        js_free(ctx, buf);
+        return compiled;
+      }
+
+      // Reads a compiled script into this context and runs it
+      JSValue run(const CompiledScript& script)
+      {
+        JSValue fn = JS_ReadObject(
+          ctx,
+          script.bytecode.data(),
+          script.bytecode.size(),
+          JS_READ_OBJ_BYTECODE);
+        if (JS_IsException(fn))
+        {
+          return fn;
+        }
+
+        // Consumes fn
+        return JS_EvalFunction(ctx, fn);
+      }
+    };
+
+    Context new_context(
+      LogTable::TxView* log_table_view, const std::vector<uint8_t>& body)
+    {
+      return Context(rt, log_table_view, body);
+    }
+  };
+
   class JSHandlers : public UserHandlerRegistry
   {
   private:
     NetworkTables& network;
     LogTable& log_table;
 
+    // Bytecode for each app script, shared by all threads and keyed by
+    // method name. An entry is only used while the hash and text of the
+    // script it was compiled from match the current app table entry.
+    SpinLock compiled_lock;
+    std::unordered_map<std::string, std::shared_ptr<const CompiledScript>>
+      compiled;
+
+    static Interpreter& get_interpreter()
+    {
+      thread_local std::unique_ptr<Interpreter> interpreter;
+      if (interpreter == nullptr)
+      {
+        interpreter = std::make_unique<Interpreter>();
+      }
+      return *interpreter;
+    }
+
+    std::shared_ptr<const CompiledScript> get_compiled(
+      Interpreter::Context& context,
+      const std::string& method,
+      const std::string& text)
+    {
+      const auto hash = std::hash<std::string>()(text);
+
+      {
+        std::lock_guard<SpinLock> guard(compiled_lock);
+        auto it = compiled.find(method);
+        if (
+          it != compiled.end() && it->second->hash == hash &&
+          it->second->text == text)
+        {
+          return it->second;
+        }
+      }
+
+      auto script = context.compile(method, text, hash);
+      if (script != nullptr)
+      {
+        std::lock_guard<SpinLock> guard(compiled_lock);
+        compiled[method] = script;
+      }
+      return script;
+    }
+
   public:
     JSHandlers(NetworkTables& network) :
       UserHandlerRegistry(network),
       network(network),
       log_table(network.tables->create<LogTable>("log"))
     {
-      auto& tables = *network.tables;
-
       auto default_handler = [this](RequestArgs& args) {
         const auto method = args.rpc_ctx->get_method();
         const auto local_method = method.substr(method.find_first_not_of('/'));
@@ -132,81 +326,42 @@ namespace ccfapp
           return;
         }
 
-        JSRuntime* rt = JS_NewRuntime();
-        if (rt == nullptr)
-        {
-          throw std::runtime_error("Failed to initialise QuickJS runtime");
-        }
-
-        JSContext* ctx = JS_NewContext(rt);
-        if (ctx == nullptr)
+        if (!handler_script.value().text.has_value())
         {
-          JS_FreeRuntime(rt);
-          throw std::runtime_error("Failed to initialise QuickJS context");
+          throw std::runtime_error("Could not find script text");
         }
 
-        auto ltv = args.tx.get_view(log_table);
-        JS_SetContextOpaque(ctx, (void*)ltv);
+        auto context = get_interpreter().new_context(
+          args.tx.get_view(log_table), args.rpc_ctx->get_request_body());
+        auto ctx = context.get();
 
-        auto global_obj = JS_GetGlobalObject(ctx);
-
-        auto console = JS_NewObject(ctx);
-        JS_SetPropertyStr(
-          ctx,
-          console,
-          "log",
-          JS_NewCFunction(ctx, ccfapp::js_print, "log", 1));
-        JS_SetPropertyStr(ctx, global_obj, "console", console);
-
-        auto log = JS_NewObject(ctx);
-        JS_SetPropertyStr(
-          ctx, log, "get", JS_NewCFunction(ctx, ccfapp::js_get, "get", 1));
-        JS_SetPropertyStr(
-          ctx, log, "put", JS_NewCFunction(ctx, ccfapp::js_put, "put", 2));
-        auto tables_ = JS_NewObject(ctx);
-        JS_SetPropertyStr(ctx, tables_, "log", log);
-        JS_SetPropertyStr(ctx, global_obj, "tables", tables_);
-
-        const auto& request_body = args.rpc_ctx->get_request_body();
-        auto args_str = JS_NewStringLen(
-          ctx, (const char*)request_body.data(), request_body.size());
-        JS_SetPropertyStr(ctx, global_obj, "args", args_str);
-        JS_FreeValue(ctx, global_obj);
-
-        if (!handler_script.value().text.has_value())
+        auto script = get_compiled(
+          context, local_method, handler_script.value().text.value());
+        if (script == nullptr)
         {
-          throw std::runtime_error("Could not find script text");
+          args.rpc_ctx->set_response_error(
+            jsonrpc::CCFErrorCodes::SCRIPT_ERROR, "");
+          return;
         }
 
-        std::string code = handler_script.value().text.value();
-        auto path = fmt::format("app_scripts::{}", local_method);
-        JSValue val = JS_Eval(
-          ctx, code.c_str(), code.size(), path.c_str(), JS_EVAL_TYPE_GLOBAL);
-
-        auto status = true;
+        JSValue val = context.run(*script);
 
         if (JS_IsException(val))
         {
           js_dump_error(ctx);
-          int err_code = jsonrpc::CCFErrorCodes::SCRIPT_ERROR;
-          std::string msg = "";
-          args.rpc_ctx->set_response_error(err_code, msg);
+          args.rpc_ctx->set_response_error(
+            jsonrpc::CCFErrorCodes::SCRIPT_ERROR, "");
           return;
         }
 
-        if (JS_IsBool(val) && !JS_VALUE_GET_BOOL(val))
-          status = false;
-
         JSValue rval = JS_JSONStringify(ctx, val, JS_NULL, JS_NULL);
         auto cstr = JS_ToCString(ctx, rval);
         auto response = nlohmann::json::parse(cstr);
 
         JS_FreeCString(ctx, cstr);
+        JS_FreeValue(ctx, rval);
         JS_FreeValue(ctx, val);
 
-        JS_FreeContext(ctx);
-        JS_FreeRuntime(rt);
-
         args.rpc_ctx->set_response_result(std::move(response));
         return;
       };
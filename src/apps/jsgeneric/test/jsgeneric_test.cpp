@@ -0,0 +1,116 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "doctest/doctest.h"
+#include "enclave/appinterface.h"
+#include "http/http_rpc_context.h"
+#include "node/encryptor.h"
+#include "node/genesisgen.h"
+#include "node/rpc/jsonrpc.h"
+#include "node/rpc/test/node_stub.h"
+#include "tls/keypair.h"
+
+#include <string>
+
+using namespace ccfapp;
+using namespace ccf;
+using namespace std;
+using namespace jsonrpc;
+using namespace nlohmann;
+
+auto kp = tls::make_key_pair();
+
+constexpr auto default_format = jsonrpc::Pack::MsgPack;
+
+nlohmann::json parse_response(const vector<uint8_t>& v)
+{
+  http::SimpleMsgProcessor processor;
+  http::Parser parser(HTTP_RESPONSE, processor);
+
+  const auto parsed_count = parser.execute(v.data(), v.size());
+  REQUIRE(parsed_count == v.size());
+  REQUIRE(processor.received.size() == 1);
+
+  return jsonrpc::unpack(processor.received.front().body, default_format);
+}
+
+auto user_caller = kp -> self_sign("CN=name");
+auto user_caller_der = tls::make_verifier(user_caller) -> der_cert_data();
+
+void set_handler(NetworkTables& network, const string& method, const Script& h)
+{
+  Store::Tx tx;
+  tx.get_view(network.app_scripts)->put(method, h);
+  REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+}
+
+std::vector<uint8_t> make_pc(const string& method)
+{
+  auto request = http::Request(method);
+  request.set_header(
+    http::headers::CONTENT_TYPE, http::headervalues::contenttype::MSGPACK);
+  return request.build_request();
+}
+
+TEST_CASE("JS requests are isolated from each other")
+{
+  NetworkTables network;
+  auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
+  network.tables->set_encryptor(encryptor);
+  Store::Tx gen_tx;
+  GenesisGenerator gen(network, gen_tx);
+  gen.init_values();
+  gen.add_user(user_caller);
+  gen.finalize();
+
+  StubNotifier notifier;
+  auto frontend = get_rpc_handler(network, notifier);
+  const enclave::SessionContext user_session(
+    enclave::InvalidSessionId, user_caller_der);
+
+  auto call = [&](const string& method) {
+    auto rpc_ctx = enclave::make_rpc_context(user_session, make_pc(method));
+    const auto response = parse_response(frontend->process(rpc_ctx).value());
+    REQUIRE(response.find(ERR) == response.end());
+    return response[RESULT];
+  };
+
+  SUBCASE("globals and built-ins")
+  {
+    constexpr auto pollute = R"xxx(
+      var leaked = "global";
+      Array.prototype.leaked = "prototype";
+      let declared = "let";
+      [leaked, [].leaked, declared]
+    )xxx";
+    set_handler(network, "pollute", {pollute});
+
+    constexpr auto inspect = R"xxx(
+      [typeof leaked, typeof [].leaked, typeof declared]
+    )xxx";
+    set_handler(network, "inspect", {inspect});
+
+    const json polluted = {"global", "prototype", "let"};
+    CHECK(call("pollute") == polluted);
+
+    const json clean = {"undefined", "undefined", "undefined"};
+    CHECK(call("inspect") == clean);
+
+    // Top-level let declarations can be evaluated again
+    CHECK(call("pollute") == polluted);
+    CHECK(call("inspect") == clean);
+  }
+
+  SUBCASE("compiled scripts follow the app table")
+  {
+    set_handler(network, "version", {"1"});
+    CHECK(call("version") == 1);
+    CHECK(call("version") == 1);
+
+    set_handler(network, "version", {"2"});
+    CHECK(call("version") == 2);
+
+    set_handler(network, "version", {"1"});
+    CHECK(call("version") == 1);
+  }
+}
@@ -303,6 +303,48 @@ TEST_CASE("simple lua apps")
     check_error(
       frontend->process(put_ctx).value(), CCFErrorCodes::SCRIPT_ERROR);
   }
+
+  SUBCASE("interpreters are reset between calls")
+  {
+    constexpr auto set_global = R"xxx(
+      tables, gov_tables, args = ...
+      leaked = args.params.v
+      env.leaked = args.params.v
+      string.upper = nil
+      math.pi = 3
+      env = nil
+      return {result = true}
+    )xxx";
+    set_handler(network, "set_global", {set_global});
+
+    constexpr auto get_global = R"xxx(
+      return env.succ(
+        leaked == nil and env.leaked == nil and ("a"):upper() == "A" and
+        math.pi > 3.14)
+    )xxx";
+    set_handler(network, "get_global", {get_global});
+
+    const auto set_packed = make_pc("set_global", {{"v", 42}});
+    const auto get_packed = make_pc("get_global", {});
+    for (size_t i = 0; i < 3; ++i)
+    {
+      auto set_ctx = enclave::make_rpc_context(user_session, set_packed);
+      check_success(frontend->process(set_ctx).value(), true);
+
+      // globals assigned by the previous call, env and the tables reachable
+      // from them have been restored
+      auto get_ctx = enclave::make_rpc_context(user_session, get_packed);
+      check_success(frontend->process(get_ctx).value(), true);
+    }
+
+    // the cached compiled script is not used once the handler changes
+    constexpr auto changed = R"xxx(
+      return env.succ(leaked == 42)
+    )xxx";
+    set_handler(network, "get_global", {changed});
+    auto get_ctx = enclave::make_rpc_context(user_session, get_packed);
+    check_success(frontend->process(get_ctx).value(), false);
+  }
 }
 
 TEST_CASE("simple bank")
@@ -568,7 +610,8 @@ TEST_CASE("pre-populated environment")
           env.error_codes.CODE_ID_NOT_FOUND,
           env.error_codes.CODE_ID_RETIRED,
           env.error_codes.RPC_NOT_FORWARDED,
-          env.error_codes.QUOTE_NOT_VERIFIED
+          env.error_codes.QUOTE_NOT_VERIFIED,
+          env.error_codes.TX_CONFLICT
         }
       )
     )xxx";
@@ -603,6 +646,7 @@ TEST_CASE("pre-populated environment")
       expected.push_back(EBT(CCFEC::CODE_ID_RETIRED));
       expected.push_back(EBT(CCFEC::RPC_NOT_FORWARDED));
       expected.push_back(EBT(CCFEC::QUOTE_NOT_VERIFIED));
+      expected.push_back(EBT(CCFEC::TX_CONFLICT));
 
       CHECK(r.result == expected);
     }
@@ -19,6 +19,10 @@ namespace consensus
   private:
     ringbuffer::WriterPtr to_host;
 
+    // Number of truncations sent to the host, which the host echoes when it
+    // reports durable entries
+    size_t truncations = 0;
+
   public:
     LedgerEnclave(ringbuffer::AbstractWriterFactory& writer_factory_) :
       to_host(writer_factory_.create_writer_to_outside())
@@ -101,7 +105,27 @@ namespace consensus
      */
     void truncate(Index idx)
     {
+      truncations++;
       RINGBUFFER_WRITE_MESSAGE(consensus::ledger_truncate, to_host, idx);
     }
+
+    /**
+     * Number of truncations of the ledger so far, used to detect stale
+     * ledger_durable notifications.
+     */
+    size_t truncation_count() const
+    {
+      return truncations;
+    }
+
+    /**
+     * Mark the ledger as committed up to a given index.
+     *
+     * @param idx Index of the last committed entry
+     */
+    void commit(Index idx)
+    {
+      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_commit, to_host, idx);
+    }
   };
 }
\ No newline at end of file
@@ -10,12 +10,14 @@ namespace consensus
   /// Consensus-related ringbuffer messages
   enum : ringbuffer::Message
   {
-    /// Request individual log entries. Enclave -> Host
-    DEFINE_RINGBUFFER_MSG_TYPE(ledger_get),
+    /// Request a range of log entries. Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_get_range),
 
     ///@{
-    /// Respond to log_get. Host -> Enclave
-    DEFINE_RINGBUFFER_MSG_TYPE(ledger_entry),
+    /// Respond to ledger_get_range, with the framed entries of a prefix of the
+    /// range, or no entry if the range starts after the end of the log.
+    /// Host -> Enclave
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_entries),
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_no_entry),
     ///@}
 
@@ -24,14 +26,40 @@ namespace consensus
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_append),
     DEFINE_RINGBUFFER_MSG_TYPE(ledger_truncate),
     ///@}
+
+    /// Entries up to an index are committed and will not be truncated.
+    /// Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_commit),
+
+    /// Entries up to an index have been synced to disk, after a number of
+    /// truncations. Host -> Enclave
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_durable),
+
+    /// Persist a snapshot of the kv store at an index. The snapshot, of the
+    /// given total size, is sent in ledger_snapshot_chunk messages and is
+    /// complete once ledger_snapshot_commit is received. Enclave -> Host
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_snapshot_begin),
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_snapshot_chunk),
+    DEFINE_RINGBUFFER_MSG_TYPE(ledger_snapshot_commit),
   };
 }
 
-DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_get, consensus::Index);
 DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
-  consensus::ledger_entry, std::vector<uint8_t>);
-DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_no_entry);
+  consensus::ledger_get_range, consensus::Index, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_entries, consensus::Index, std::vector<uint8_t>);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_no_entry, consensus::Index);
 DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
   consensus::ledger_append, std::vector<uint8_t>);
 DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
   consensus::ledger_truncate, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(consensus::ledger_commit, consensus::Index);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_durable, consensus::Index, size_t);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_snapshot_begin, consensus::Index, size_t);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_snapshot_chunk, consensus::Index, std::vector<uint8_t>);
+DECLARE_RINGBUFFER_MESSAGE_PAYLOAD(
+  consensus::ledger_snapshot_commit, consensus::Index);
@@ -119,6 +119,7 @@ void Node::add_principal(const PrincipalInfo& principal_info)
     if (principal->get_cert().empty())
     {
       principal->set_certificate(principal_info.cert);
+      config_counter++;
     }
     return;
   }
@@ -138,6 +139,7 @@ void Node::add_principal(const PrincipalInfo& principal_info)
        principal_info.id, a, principal_info.is_replica, principal_info.cert)});
 
   std::atomic_store(&atomic_principals, new_principals);
+  config_counter++;
 
   LOG_INFO << "Added principal with id:" << principal_info.id << std::endl;
 
@@ -306,4 +308,5 @@ void Node::set_f(ccf::NodeId f)
   send_only_to_self = (f == 0);
   threshold = f * 2 + 1;
   num_replicas = 3 * f + 1;
+  config_counter++;
 }
\ No newline at end of file
@@ -66,6 +66,11 @@ public:
   bool is_replica(int id) const;
   // Effects: Returns true iff id() is the identifier of a valid replica.
 
+  uint64_t config_version() const;
+  // Effects: Returns a counter which changes whenever a principal is added
+  // or updated, or f changes. The checks made when verifying messages
+  // depend on these.
+
   int primary(View vi) const;
   // Effects: Returns the identifier of the primary for view v.
 
@@ -135,6 +140,11 @@ protected:
 
   size_t replica_count;
   NodeInfo node_info;
+
+  // Incremented whenever principals or f change. Principals may be added
+  // while verifying messages on worker threads.
+  std::atomic<uint64_t> config_counter = 0;
+
   RequestIdGenerator request_id_generator;
 
   View v; //  Last view known to this node.
@@ -197,6 +207,11 @@ inline std::shared_ptr<Principal> Node::principal() const
   return get_principal(id());
 }
 
+inline uint64_t Node::config_version() const
+{
+  return config_counter.load();
+}
+
 inline bool Node::is_replica(int id) const
 {
   auto principal = get_principal(id);
@@ -223,6 +223,45 @@ static void pre_verify_cb(std::unique_ptr<enclave::Tmsg<PreVerifyCbMsg>> req)
     0, std::move(resp));
 }
 
+struct VerifyCbMsg
+{
+  Message* m;
+  Replica* self;
+  uint64_t verify_seqno;
+  uint64_t config_version;
+  bool result;
+};
+
+static void verified_cb(std::unique_ptr<enclave::Tmsg<VerifyCbMsg>> req)
+{
+  req->data.self->process_verified(
+    req->data.verify_seqno,
+    req->data.m,
+    req->data.result,
+    req->data.config_version);
+}
+
+static void verify_cb(std::unique_ptr<enclave::Tmsg<VerifyCbMsg>> req)
+{
+  Message* m = req->data.m;
+  Replica* self = req->data.self;
+  uint64_t verify_seqno = req->data.verify_seqno;
+  uint64_t config_version = req->data.config_version;
+
+  auto resp =
+    enclave::ThreadMessaging::ConvertMessage<VerifyCbMsg, VerifyCbMsg>(
+      std::move(req), verified_cb);
+
+  resp->data.m = m;
+  resp->data.self = self;
+  resp->data.verify_seqno = verify_seqno;
+  resp->data.config_version = config_version;
+  resp->data.result = Replica::pre_verify(m);
+
+  enclave::ThreadMessaging::thread_messaging.add_task<VerifyCbMsg>(
+    enclave::ThreadMessaging::main_thread, std::move(resp));
+}
+
 static uint64_t verification_thread = 0;
 
 Message* Replica::create_message(const uint8_t* data, uint32_t size)
@@ -329,10 +368,43 @@ void Replica::receive_message(const uint8_t* data, uint32_t size)
     LOG_FAIL << "Received message size exceeds message: " << size << std::endl;
   }
   Message* m = create_message(data, size);
+  if (m == nullptr)
+  {
+    LOG_FAIL << "Received message with unknown tag" << std::endl;
+    return;
+  }
+
   uint32_t target_thread = 0;
 
-  if (enclave::ThreadMessaging::thread_count > 1 && m->tag() == Request_tag)
+  if (enclave::ThreadMessaging::thread_count > 1 && m->tag() != Request_tag)
   {
+    // Protocol messages are verified on worker threads in turn, and handled
+    // in the order they were received once verified
+    uint32_t num_worker_thread = enclave::ThreadMessaging::thread_count - 1;
+    const auto verify_seqno = next_verify_seqno++;
+    const auto config_version = Node::config_version();
+
+    if (f() == 0)
+    {
+      process_verified(verify_seqno, m, pre_verify(m), config_version);
+      return;
+    }
+
+    auto msg = std::make_unique<enclave::Tmsg<VerifyCbMsg>>(&verify_cb);
+    msg->data.m = m;
+    msg->data.self = this;
+    msg->data.verify_seqno = verify_seqno;
+    msg->data.config_version = config_version;
+
+    enclave::ThreadMessaging::thread_messaging.add_task<VerifyCbMsg>(
+      (verify_seqno % num_worker_thread) + 1, std::move(msg));
+    return;
+  }
+
+  if (enclave::ThreadMessaging::thread_count > 1)
+  {
+    // Requests from the same user are verified by the same thread, and are
+    // not ordered with respect to other messages
     uint32_t num_worker_thread = enclave::ThreadMessaging::thread_count - 1;
     target_thread = (((Request*)m)->user_id() % num_worker_thread) + 1;
   }
@@ -361,6 +433,53 @@ void Replica::receive_message(const uint8_t* data, uint32_t size)
   }
 }
 
+void Replica::process_verified(
+  uint64_t verify_seqno, Message* m, bool verified, uint64_t config_version)
+{
+  if (verify_seqno != next_verified_seqno)
+  {
+    verified_out_of_order.emplace(
+      verify_seqno, Verified{m, verified, config_version});
+    return;
+  }
+
+  while (true)
+  {
+    ++next_verified_seqno;
+
+    if (config_version != Node::config_version())
+    {
+      // Principals or f have changed since m was verified, for instance
+      // because a New_principal received just before it has been handled.
+      // Verify it again now that every earlier message has been handled.
+      verified = pre_verify(m);
+    }
+
+    if (verified)
+    {
+      recv_process_one_msg(m);
+    }
+    else
+    {
+      LOG_INFO_FMT("did not verify - m:{}", m->tag());
+      ++unverified_count;
+      delete m;
+    }
+
+    auto it = verified_out_of_order.begin();
+    if (
+      it == verified_out_of_order.end() || it->first != next_verified_seqno)
+    {
+      break;
+    }
+
+    m = it->second.m;
+    verified = it->second.verified;
+    config_version = it->second.config_version;
+    verified_out_of_order.erase(it);
+  }
+}
+
 bool Replica::compare_execution_results(
   const ByzInfo& info, Pre_prepare* pre_prepare)
 {
@@ -30,6 +30,8 @@
 #  include "Rep_info.h"
 #endif
 
+#include <map>
+
 class Request;
 class Reply;
 class Pre_prepare;
@@ -190,6 +192,18 @@ public:
   // Effects: Use when messages are passed to Replica rather than replica
   // polling
 
+  void process_verified(
+    uint64_t verify_seqno, Message* m, bool verified, uint64_t config_version);
+  // Effects: Handles "m" once it and every message received before it have
+  // been verified. Messages are verified in parallel on worker threads, but
+  // are handled in the order they were received. "config_version" is the
+  // node's config_version() when "m" was received. If it has changed by the
+  // time "m" is handled, "m" is verified again.
+
+  uint64_t unverified_messages() const;
+  // Effects: Returns the number of protocol messages dropped by
+  // process_verified because they did not verify
+
   static Message* create_message(const uint8_t* data, uint32_t size);
   // Effects: Creates a new message from a buffer
 
@@ -543,6 +557,22 @@ private:
   //
   ExecCommand exec_command;
 
+  //
+  // Parallel verification of received messages
+  //
+  uint64_t next_verify_seqno = 0; // Assigned to the next message received
+  uint64_t next_verified_seqno = 0; // Next message to be handled
+  // Messages verified before some message received earlier, and whether they
+  // were valid
+  struct Verified
+  {
+    Message* m;
+    bool verified;
+    uint64_t config_version;
+  };
+  std::map<uint64_t, Verified> verified_out_of_order;
+  uint64_t unverified_count = 0;
+
   //
   // Statistics to set pre_prepare batch info
   //
@@ -584,6 +614,11 @@ inline void Replica::gen_handle(Message* m)
   }
 }
 
+inline uint64_t Replica::unverified_messages() const
+{
+  return unverified_count;
+}
+
 inline Big_req_table* Replica::big_reqs()
 {
   return &brt;
@@ -0,0 +1,122 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+
+#include "Commit.h"
+#include "Message.h"
+#include "New_principal.h"
+#include "Node.h"
+#include "Replica.h"
+#include "consensus/pbft/pbftpreprepares.h"
+#include "consensus/pbft/pbftrequests.h"
+#include "consensus/pbft/pbfttables.h"
+#include "consensus/pbft/pbfttypes.h"
+#include "kv/test/stub_consensus.h"
+#include "network_mock.h"
+#include "tls/keypair.h"
+
+#include <doctest/doctest.h>
+
+enclave::ThreadMessaging enclave::ThreadMessaging::thread_messaging;
+std::atomic<uint16_t> enclave::ThreadMessaging::thread_count = 0;
+
+NodeInfo get_node_info()
+{
+  auto kp = tls::make_key_pair();
+  std::vector<PrincipalInfo> principal_info;
+
+  auto node_cert = kp->self_sign("CN=CCF node");
+
+  PrincipalInfo pi = {0, (short)(3000), "ip", node_cert, "name-1", true};
+  principal_info.emplace_back(pi);
+
+  GeneralInfo gi = {
+    2, 0, 0, "generic", 1800000, 5000, 100, 9999250000, 50, principal_info};
+
+  NodeInfo node_info = {gi.principal_info[0], kp->private_key_pem().str(), gi};
+
+  return node_info;
+}
+
+New_principal* create_new_principal(NodeId id)
+{
+  auto kp = tls::make_key_pair();
+  auto cert = kp->self_sign("CN=CCF node");
+  return new New_principal(
+    id,
+    (short)(3000 + id),
+    "ip",
+    std::string(cert.begin(), cert.end()),
+    "name-" + std::to_string(id),
+    true);
+}
+
+Commit* create_commit(int from)
+{
+  // Far beyond the replica's window, so that it is discarded once handled
+  auto c = new Commit(0, 1000000);
+  reinterpret_cast<Commit_rep*>(c->contents())->id = from;
+  return c;
+}
+
+TEST_CASE("Verified messages are handled in the order they were received")
+{
+  auto store = std::make_shared<ccf::Store>(
+    pbft::replicate_type_pbft, pbft::replicated_tables_pbft);
+  store->set_consensus(std::make_shared<kv::StubConsensus>());
+  auto& pbft_requests_map = store->create<pbft::RequestsMap>(
+    pbft::Tables::PBFT_REQUESTS, kv::SecurityDomain::PUBLIC);
+  auto& pbft_pre_prepares_map = store->create<pbft::PrePreparesMap>(
+    pbft::Tables::PBFT_PRE_PREPARES, kv::SecurityDomain::PUBLIC);
+  auto pbft_store =
+    std::make_unique<pbft::Adaptor<ccf::Store, kv::DeserialiseSuccess>>(
+      store);
+
+  std::vector<char> service_mem(256, 0);
+  Log_allocator::should_use_malloc(true);
+  pbft::GlobalState::set_replica(std::make_unique<Replica>(
+    get_node_info(),
+    service_mem.data(),
+    service_mem.size(),
+    Create_Mock_Network(),
+    pbft_requests_map,
+    pbft_pre_prepares_map,
+    *pbft_store));
+  auto& replica = pbft::GlobalState::get_replica();
+  replica.init_state();
+
+  INFO("Messages verified early wait for the messages received before them");
+  {
+    const auto config_version = replica.config_version();
+    replica.process_verified(1, create_new_principal(2), true, config_version);
+    REQUIRE(replica.get_principal(2) == nullptr);
+
+    replica.process_verified(0, create_new_principal(1), true, config_version);
+    REQUIRE(replica.get_principal(1) != nullptr);
+    REQUIRE(replica.get_principal(2) != nullptr);
+    REQUIRE(replica.unverified_messages() == 0);
+  }
+
+  replica.set_f(1);
+
+  INFO("Messages from principals added just before them are re-verified");
+  {
+    // Both were verified before the principal for 7 was added
+    const auto config_version = replica.config_version();
+    replica.process_verified(3, create_commit(7), false, config_version);
+    REQUIRE(replica.get_principal(7) == nullptr);
+
+    replica.process_verified(2, create_new_principal(7), true, config_version);
+    REQUIRE(replica.get_principal(7) != nullptr);
+    REQUIRE(replica.config_version() != config_version);
+    REQUIRE(replica.unverified_messages() == 0);
+  }
+
+  INFO("Messages from unknown principals are dropped");
+  {
+    replica.process_verified(
+      4, create_commit(9), false, replica.config_version());
+    REQUIRE(replica.unverified_messages() == 1);
+  }
+}
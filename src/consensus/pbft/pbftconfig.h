@@ -3,10 +3,17 @@
 #pragma once
 #include "consensus/pbft/libbyz/libbyz.h"
 #include "consensus/pbft/libbyz/pbft_assert.h"
+#include "ds/thread_messaging.h"
 #include "enclave/rpchandler.h"
 #include "enclave/rpcmap.h"
 #include "pbftdeps.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
 namespace pbft
 {
   class AbstractPbftConfig
@@ -47,82 +54,253 @@ namespace pbft
 
     IMessageReceiveBase* message_receive_base;
 
+    struct Speculation
+    {
+      std::shared_ptr<enclave::RpcContext> ctx;
+      std::shared_ptr<enclave::RpcHandler> frontend;
+      ccf::Store::Tx tx;
+      //! set by the first thread to start executing the command
+      std::atomic<bool> claimed{false};
+      bool ready = false;
+    };
+
+    // Shared with the worker tasks, which may only run after the batch has
+    // been committed if their worker was busy
+    struct SpeculationBatch
+    {
+      std::vector<Speculation> speculations;
+      std::mutex lock;
+      std::condition_variable done;
+      size_t pending;
+
+      SpeculationBatch(size_t size) : speculations(size), pending(size) {}
+    };
+
+    struct SpeculateMsg
+    {
+      std::shared_ptr<SpeculationBatch> batch;
+      size_t index;
+    };
+
+    static void speculate(SpeculationBatch& batch, size_t index)
+    {
+      auto& s = batch.speculations[index];
+      if (s.claimed.exchange(true))
+        return;
+
+      // Any failure leaves the command to be executed again when the batch is
+      // committed, and the batch must always be told the command is done
+      try
+      {
+        s.ready = s.frontend->execute_pbft(s.ctx, s.tx);
+      }
+      catch (...)
+      {
+        s.ready = false;
+      }
+
+      {
+        std::lock_guard<std::mutex> guard(batch.lock);
+        --batch.pending;
+      }
+      batch.done.notify_one();
+    }
+
+    static void speculate_cb(std::unique_ptr<enclave::Tmsg<SpeculateMsg>> msg)
+    {
+      speculate(*msg->data.batch, msg->data.index);
+    }
+
+    std::shared_ptr<enclave::RpcContext> create_context(ExecCommandMsg& msg)
+    {
+      Byz_req* inb = &msg.inb;
+
+      pbft::Request request;
+      request.deserialise({inb->contents, inb->contents + inb->size});
+
+      const enclave::SessionContext session(
+        enclave::InvalidSessionId, request.caller_id, request.caller_cert);
+      return enclave::make_rpc_context(
+        session, request.raw, {msg.req_start, msg.req_start + msg.req_size});
+    }
+
+    std::shared_ptr<enclave::RpcHandler> get_frontend(
+      enclave::RpcContext& ctx)
+    {
+      const auto actor_opt = http::extract_actor(ctx);
+      if (!actor_opt.has_value())
+      {
+        throw std::logic_error(fmt::format(
+          "Failed to extract actor from PBFT request. Method is '{}'",
+          ctx.get_method()));
+      }
+
+      const auto& actor_s = actor_opt.value();
+      const auto actor = this->rpc_map->resolve(actor_s);
+      auto handler = this->rpc_map->find(actor);
+      if (!handler.has_value())
+        throw std::logic_error(
+          fmt::format("No frontend associated with actor {}", actor_s));
+
+      LOG_DEBUG_FMT("PBFT exec_command() for frontend {}", actor_s);
+
+      return handler.value();
+    }
+
+    void complete(
+      ExecCommandMsg& msg,
+      ByzInfo& info,
+      const enclave::RpcHandler::ProcessPbftResp& rep)
+    {
+      Byz_rep& outb = msg.outb;
+
+      static_assert(
+        sizeof(info.replicated_state_merkle_root) ==
+        sizeof(crypto::Sha256Hash));
+      if (msg.include_merkle_roots)
+      {
+        std::copy(
+          std::begin(rep.replicated_state_merkle_root.h),
+          std::end(rep.replicated_state_merkle_root.h),
+          std::begin(info.replicated_state_merkle_root));
+      }
+      info.ctx = rep.version;
+
+      outb.contents = message_receive_base->create_response_message(
+        msg.client, msg.rid, rep.result.size());
+
+      outb.size = rep.result.size();
+      auto outb_ptr = (uint8_t*)outb.contents;
+      size_t outb_size = (size_t)outb.size;
+
+      serialized::write(
+        outb_ptr, outb_size, rep.result.data(), rep.result.size());
+
+      msg.cb(msg, info);
+    }
+
+    void execute_sequentially(
+      std::vector<std::unique_ptr<ExecCommandMsg>>& msgs, ByzInfo& info)
+    {
+      for (auto& msg : msgs)
+      {
+        auto ctx = create_context(*msg);
+        auto frontend = get_frontend(*ctx);
+
+        enclave::RpcHandler::ProcessPbftResp rep;
+        if (msg->tx != nullptr)
+        {
+          rep = frontend->process_pbft(
+            ctx, *msg->tx, true, msg->include_merkle_roots);
+        }
+        else
+        {
+          rep = frontend->process_pbft(ctx, msg->include_merkle_roots);
+        }
+
+        complete(*msg, info, rep);
+      }
+    }
+
+    // The commands in the batch are first executed concurrently on worker
+    // threads, against the same state, without being committed. They are then
+    // committed in batch order. A command which read state written by an
+    // earlier command in the batch conflicts, and is executed again at that
+    // point, as is any command whose speculative execution failed. Commit
+    // versions, and so merkle roots, are the same as if the batch had been
+    // executed sequentially.
+    void execute_speculatively(
+      std::vector<std::unique_ptr<ExecCommandMsg>>& msgs, ByzInfo& info)
+    {
+      const size_t workers = enclave::ThreadMessaging::thread_count - 1;
+
+      auto batch = std::make_shared<SpeculationBatch>(msgs.size());
+      auto& speculations = batch->speculations;
+
+      for (size_t i = 0; i < msgs.size(); ++i)
+      {
+        auto& s = speculations[i];
+        s.ctx = create_context(*msgs[i]);
+        s.frontend = get_frontend(*s.ctx);
+
+        // Reads of maps the command does not write must be validated too,
+        // since an earlier command in the batch may have written them
+        s.tx.set_validate_all_reads();
+      }
+
+      for (size_t i = 0; i < msgs.size(); ++i)
+      {
+        auto task =
+          std::make_unique<enclave::Tmsg<SpeculateMsg>>(&speculate_cb);
+        task->data.batch = batch;
+        task->data.index = i;
+        enclave::ThreadMessaging::thread_messaging.add_task<SpeculateMsg>(
+          (i % workers) + 1, std::move(task));
+      }
+
+      // Rather than waiting for workers which may be busy with other tasks,
+      // this thread executes the commands that no worker has started, from
+      // the end of the batch. It then only waits for those being executed.
+      for (size_t i = msgs.size(); i-- > 0;)
+      {
+        speculate(*batch, i);
+      }
+
+      {
+        std::unique_lock<std::mutex> guard(batch->lock);
+        batch->done.wait(guard, [&batch]() { return batch->pending == 0; });
+      }
+
+      size_t reexecuted = 0;
+
+      for (size_t i = 0; i < msgs.size(); ++i)
+      {
+        auto& msg = msgs[i];
+        auto& s = speculations[i];
+
+        std::optional<enclave::RpcHandler::ProcessPbftResp> rep;
+        if (s.ready)
+        {
+          rep = s.frontend->commit_pbft(s.ctx, s.tx, msg->include_merkle_roots);
+        }
+
+        if (!rep.has_value())
+        {
+          ++reexecuted;
+          auto ctx = create_context(*msg);
+          rep = s.frontend->process_pbft(ctx, msg->include_merkle_roots);
+        }
+
+        complete(*msg, info, rep.value());
+      }
+
+      LOG_DEBUG_FMT(
+        "Executed batch of {} commands speculatively, {} executed again",
+        msgs.size(),
+        reexecuted);
+    }
+
     ExecCommand exec_command =
       [this](
         std::vector<std::unique_ptr<ExecCommandMsg>>& msgs, ByzInfo& info) {
-        for (auto& msg : msgs)
+        // Commands being played back are executed in transactions provided
+        // by the caller, and must be executed sequentially
+        const bool playback = std::any_of(
+          msgs.begin(), msgs.end(), [](const auto& msg) {
+            return msg->tx != nullptr;
+          });
+
+        if (
+          !playback && msgs.size() > 1 &&
+          enclave::ThreadMessaging::thread_count > 1)
+        {
+          execute_speculatively(msgs, info);
+        }
+        else
         {
-          Byz_req* inb = &msg->inb;
-          Byz_rep& outb = msg->outb;
-          int client = msg->client;
-          Request_id rid = msg->rid;
-          uint8_t* req_start = msg->req_start;
-          size_t req_size = msg->req_size;
-          Seqno total_requests_executed = msg->total_requests_executed;
-          ccf::Store::Tx* tx = msg->tx;
-
-          pbft::Request request;
-          request.deserialise({inb->contents, inb->contents + inb->size});
-
-          const enclave::SessionContext session(
-            enclave::InvalidSessionId, request.caller_id, request.caller_cert);
-          auto ctx = enclave::make_rpc_context(
-            session, request.raw, {req_start, req_start + req_size});
-
-          const auto actor_opt = http::extract_actor(*ctx);
-          if (!actor_opt.has_value())
-          {
-            throw std::logic_error(fmt::format(
-              "Failed to extract actor from PBFT request. Method is '{}'",
-              ctx->get_method()));
-          }
-
-          const auto& actor_s = actor_opt.value();
-          const auto actor = this->rpc_map->resolve(actor_s);
-          auto handler = this->rpc_map->find(actor);
-          if (!handler.has_value())
-            throw std::logic_error(
-              fmt::format("No frontend associated with actor {}", actor_s));
-
-          auto frontend = handler.value();
-
-          LOG_DEBUG_FMT("PBFT exec_command() for frontend {}", actor_s);
-
-          enclave::RpcHandler::ProcessPbftResp rep;
-          if (tx != nullptr)
-          {
-            rep =
-              frontend->process_pbft(ctx, *tx, true, msg->include_merkle_roots);
-          }
-          else
-          {
-            rep = frontend->process_pbft(ctx, msg->include_merkle_roots);
-          }
-
-          static_assert(
-            sizeof(info.replicated_state_merkle_root) ==
-            sizeof(crypto::Sha256Hash));
-          if (msg->include_merkle_roots)
-          {
-            std::copy(
-              std::begin(rep.replicated_state_merkle_root.h),
-              std::end(rep.replicated_state_merkle_root.h),
-              std::begin(info.replicated_state_merkle_root));
-          }
-          info.ctx = rep.version;
-
-          outb.contents = message_receive_base->create_response_message(
-            client, rid, rep.result.size());
-
-          outb.size = rep.result.size();
-          auto outb_ptr = (uint8_t*)outb.contents;
-          size_t outb_size = (size_t)outb.size;
-
-          serialized::write(
-            outb_ptr, outb_size, rep.result.data(), rep.result.size());
-
-          msg->cb(*msg.get(), info);
+          execute_sequentially(msgs, info);
         }
+
         return 0;
       };
   };
@@ -11,7 +11,10 @@
 
 #include <algorithm>
 #include <deque>
+#include <functional>
 #include <list>
+#include <map>
+#include <optional>
 #include <random>
 #include <unordered_map>
 #include <vector>
@@ -43,11 +46,94 @@ namespace raft
       auto it = upper_bound(terms.begin(), terms.end(), idx);
       return (it - terms.begin()) - 1;
     }
+
+    // First index in term, or 0 if term is unknown
+    Index start_of(Term term)
+    {
+      if (term >= terms.size())
+        return 0;
+
+      return terms[term];
+    }
+
+    // Highest index whose term is at most term
+    Index last_idx_up_to(Term term)
+    {
+      if (term + 1 >= terms.size())
+        return std::numeric_limits<Index>::max();
+
+      return terms[term + 1] - 1;
+    }
+  };
+
+  // Sizes of recent log entries, used to size append entries batches in
+  // bytes. Sizes are recorded as entries are written to the ledger, on leaders
+  // and followers. Entries whose size was never recorded (e.g. entries
+  // written before this node started) are assumed to be of average size.
+  class EntrySizes
+  {
+    Index first = 1;
+    std::deque<uint32_t> sizes;
+    size_t total = 0;
+
+  public:
+    static constexpr size_t max_entries = 1 << 20;
+    static constexpr size_t unknown_entry_size = 1 << 10;
+
+    void append(Index idx, size_t size)
+    {
+      if (idx != first + sizes.size())
+      {
+        sizes.clear();
+        total = 0;
+        first = idx;
+      }
+
+      sizes.push_back(size);
+      total += size;
+
+      if (sizes.size() > max_entries)
+        trim(first);
+    }
+
+    // Forget entries after idx
+    void truncate(Index idx)
+    {
+      while (!sizes.empty() && first + sizes.size() - 1 > idx)
+      {
+        total -= sizes.back();
+        sizes.pop_back();
+      }
+    }
+
+    // Forget entries up to and including idx
+    void trim(Index idx)
+    {
+      while (!sizes.empty() && first <= idx)
+      {
+        total -= sizes.front();
+        sizes.pop_front();
+        first++;
+      }
+    }
+
+    size_t size_of(Index idx)
+    {
+      if (idx >= first && idx < first + sizes.size())
+        return sizes[idx - first];
+
+      return sizes.empty() ? unknown_entry_size : total / sizes.size();
+    }
   };
 
   template <class LedgerProxy, class ChannelProxy>
   class Raft
   {
+  public:
+    // Called with the index that a linearisable read must observe, or nullopt
+    // if it could not be confirmed. Called with the Raft lock held.
+    using ReadIndexCallback = std::function<void(std::optional<Index>)>;
+
   private:
     enum State
     {
@@ -56,12 +142,41 @@ namespace raft
       Candidate
     };
 
+    struct Inflight
+    {
+      // last index in the batch
+      Index end_idx;
+      size_t bytes;
+    };
+
     struct NodeState
     {
       // the highest matching index with the node that was confirmed
-      Index match_idx;
+      Index match_idx = 0;
       // the highest index sent to the node
-      Index sent_idx;
+      Index sent_idx = 0;
+      // batches sent to the node that have not been acknowledged yet
+      std::deque<Inflight> inflight;
+      size_t inflight_bytes = 0;
+      // incremented whenever entries are resent from an earlier index.
+      // Rejections of entries sent before then are ignored.
+      uint64_t probe_epoch = 0;
+      // the latest confirmation round the node has acknowledged
+      uint64_t acked_round = 0;
+    };
+
+    struct PendingRead
+    {
+      uint64_t round;
+      Index read_idx;
+      ReadIndexCallback cb;
+    };
+
+    struct ForwardedRead
+    {
+      // clock when the read index was requested from the leader
+      std::chrono::milliseconds sent;
+      ReadIndexCallback cb;
     };
 
     struct Configuration
@@ -82,6 +197,39 @@ namespace raft
     Index commit_idx;
     TermHistory term_history;
 
+    // When set, entries are only acknowledged (as a follower) and counted
+    // towards commit (as a leader) once the host has synced them to disk,
+    // as reported by ledger_durable()
+    bool wait_for_ledger_sync;
+    Index durable_idx;
+
+    // Linearisable reads. The leader starts a confirmation round every
+    // request timeout, and whenever a read index must be confirmed. Append
+    // entries carry the current round, and followers echo the latest round
+    // they received. Once a quorum has acknowledged a round, the leader knows
+    // it was still leader when the round started, and holds a lease for
+    // lease_duration from then: when read_lease is set, followers which have
+    // heard from their leader within the election timeout do not vote for
+    // anyone else, so no other leader can be elected before it expires.
+    bool read_lease;
+    std::chrono::milliseconds clock;
+    std::chrono::milliseconds lease_expiry;
+    uint64_t round = 0;
+    uint64_t confirmed_round = 0;
+    // Rounds which a quorum has not acknowledged yet, and when they started
+    std::deque<std::pair<uint64_t, std::chrono::milliseconds>> round_starts;
+    std::deque<PendingRead> pending_reads;
+    // As a follower
+    std::chrono::milliseconds since_leader;
+    uint64_t leader_round = 0;
+    uint64_t leader_probe_epoch = 0;
+    uint64_t next_read_id = 0;
+    // By read id, so the oldest come first. They are failed if the leader
+    // has not answered within the election timeout, in case the request or
+    // the response was lost.
+    std::map<uint64_t, ForwardedRead> reads_awaiting_leader;
+    std::multimap<Index, ReadIndexCallback> reads_awaiting_commit;
+
     // Volatile
     NodeId leader_id;
     std::unordered_set<NodeId> votes_for_me;
@@ -97,11 +245,9 @@ namespace raft
     std::list<Configuration> configurations;
     std::unordered_map<NodeId, NodeState> nodes;
 
-    size_t entry_size_not_limited = 0;
-    size_t entry_count = 0;
-    Index entries_batch_size = 1;
-    static constexpr int batch_window_size = 100;
-    int batch_window_sum = 0;
+    EntrySizes entry_sizes;
+    // Bytes replicated since append entries were last sent to all nodes
+    size_t unsent_bytes = 0;
 
     // Indices that are eligible for global commit, from a Node's perspective
     std::deque<Index> committable_indices;
@@ -121,6 +267,10 @@ namespace raft
 
   public:
     static constexpr size_t append_entries_size_limit = 20000;
+    // Per-node flow control: no more entries are sent to a node once this
+    // many bytes or entries are in flight to it, until it acknowledges some
+    static constexpr size_t max_inflight_bytes = 8 * append_entries_size_limit;
+    static constexpr Index max_inflight_entries = 1 << 16;
     std::unique_ptr<LedgerProxy> ledger;
     std::shared_ptr<ChannelProxy> channels;
 
@@ -132,7 +282,9 @@ namespace raft
       NodeId id,
       std::chrono::milliseconds request_timeout_,
       std::chrono::milliseconds election_timeout_,
-      bool public_only_ = false) :
+      bool public_only_ = false,
+      bool wait_for_ledger_sync_ = false,
+      bool read_lease_ = false) :
       store(std::move(store)),
 
       current_term(0),
@@ -140,6 +292,12 @@ namespace raft
       voted_for(NoNode),
       last_idx(0),
       commit_idx(0),
+      wait_for_ledger_sync(wait_for_ledger_sync_),
+      durable_idx(0),
+      read_lease(read_lease_),
+      clock(0),
+      lease_expiry(0),
+      since_leader(0),
 
       leader_id(NoNode),
 
@@ -228,6 +386,7 @@ namespace raft
       std::lock_guard<SpinLock> guard(lock);
       current_term = term;
       last_idx = index;
+      durable_idx = index;
       commit_idx = commit_idx_;
       term_history.update(index, term);
       current_term += 2;
@@ -248,6 +407,7 @@ namespace raft
       std::lock_guard<SpinLock> guard(lock);
       current_term = term;
       last_idx = index;
+      durable_idx = index;
       commit_idx = commit_idx_;
       term_history.initialise(terms);
       term_history.update(index, term);
@@ -255,17 +415,106 @@ namespace raft
       become_leader();
     }
 
+    void init_as_follower(Index index, Term term)
+    {
+      // This should only be called when the node resumes from state that was
+      // installed out of band (e.g. a snapshot), before any append entries are
+      // received. The entries up to index are treated as committed.
+      std::lock_guard<SpinLock> guard(lock);
+      current_term = term;
+      last_idx = index;
+      durable_idx = index;
+      commit_idx = index;
+      term_history.update(index, term);
+      LOG_INFO_FMT(
+        "Initialised follower {} at index {} in term {}",
+        local_id,
+        index,
+        term);
+    }
+
     Index get_last_idx()
     {
       return last_idx;
     }
 
+    Index get_durable_idx()
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      return durable_idx;
+    }
+
+    void ledger_durable(Index idx, size_t truncations)
+    {
+      // The host has synced its ledger up to idx. If the ledger has been
+      // truncated since, the notification may cover entries that have since
+      // been replaced, and is ignored: the host syncs again after the entries
+      // that follow the truncation are written.
+      std::lock_guard<SpinLock> guard(lock);
+
+      if (!wait_for_ledger_sync || truncations != ledger->truncation_count())
+        return;
+
+      idx = std::min(idx, last_idx);
+      if (idx <= durable_idx)
+        return;
+
+      durable_idx = idx;
+      LOG_DEBUG_FMT("Ledger durable on {}: {}", local_id, durable_idx);
+
+      if (state == Leader)
+        update_commit();
+      else if (state == Follower && leader_id != NoNode)
+        send_append_entries_response(leader_id, true);
+    }
+
     Index get_commit_idx()
     {
       std::lock_guard<SpinLock> guard(lock);
       return commit_idx;
     }
 
+    bool read_lease_enabled()
+    {
+      return read_lease;
+    }
+
+    // True if this node is leader and holds a lease, so that its local state
+    // reflects every entry committed so far
+    bool has_lease()
+    {
+      std::lock_guard<SpinLock> guard(lock);
+      return has_lease_internal();
+    }
+
+    // Finds the index up to which a linearisable read must observe the log,
+    // ie the commit index of the leader at a point when it was known to still
+    // be leader. On a follower, the leader is asked for its read index, and cb
+    // is only called once this node has committed up to it.
+    void read_index(ReadIndexCallback cb)
+    {
+      std::lock_guard<SpinLock> guard(lock);
+
+      if (state == Leader)
+      {
+        read_index_as_leader(std::move(cb));
+      }
+      else if (state == Follower && leader_id != NoNode)
+      {
+        const auto read_id = next_read_id++;
+        reads_awaiting_leader.emplace(
+          read_id, ForwardedRead{clock, std::move(cb)});
+
+        ReadIndex ri = {raft_read_index, local_id, current_term, read_id};
+        channels->send_authenticated(
+          ccf::NodeMsgType::consensus_msg, leader_id, ri);
+      }
+      else
+      {
+        cb(std::nullopt);
+      }
+    }
+
     Term get_term()
     {
       std::lock_guard<SpinLock> guard(lock);
@@ -331,19 +580,17 @@ namespace raft
 
         last_idx = index;
         auto s = write_to_ledger(data);
-        entry_size_not_limited += s;
-        entry_count++;
+        entry_sizes.append(index, s);
+        unsent_bytes += s;
 
         term_history.update(index, current_term);
-        if (entry_size_not_limited >= append_entries_size_limit)
+        if (unsent_bytes >= append_entries_size_limit)
         {
-          update_batch_size();
-          entry_count = 0;
-          entry_size_not_limited = 0;
+          unsent_bytes = 0;
           for (const auto& it : nodes)
           {
             LOG_DEBUG_FMT("Sending updates to follower {}", it.first);
-            send_append_entries(it.first, it.second.sent_idx + 1);
+            send_append_entries(it.first);
           }
         }
       }
@@ -383,6 +630,14 @@ namespace raft
           recv_request_vote_response(data, size);
           break;
 
+        case raft_read_index:
+          recv_read_index(data, size);
+          break;
+
+        case raft_read_index_response:
+          recv_read_index_response(data, size);
+          break;
+
         default:
         {}
       }
@@ -392,6 +647,8 @@ namespace raft
     {
       std::lock_guard<SpinLock> guard(lock);
       timeout_elapsed += elapsed;
+      clock += elapsed;
+      since_leader += elapsed;
 
       if (state == Leader)
       {
@@ -399,17 +656,24 @@ namespace raft
         {
           using namespace std::chrono_literals;
           timeout_elapsed = 0ms;
+          unsent_bytes = 0;
+
+          // The heartbeats renew the lease
+          start_round();
 
-          update_batch_size();
           // Send newly available entries to all nodes.
           for (const auto& it : nodes)
           {
-            send_append_entries(it.first, it.second.sent_idx + 1);
+            send_append_entries(it.first, true);
           }
+
+          update_confirmed_round();
         }
       }
       else
       {
+        expire_forwarded_reads();
+
         if (timeout_elapsed >= election_timeout)
         {
           // Start an election.
@@ -419,20 +683,227 @@ namespace raft
     }
 
   private:
-    inline void update_batch_size()
+    // The lease is a fraction of the election timeout, to allow for the
+    // granularity of periodic() and for clocks running at different rates
+    std::chrono::milliseconds lease_duration()
     {
-      auto avg_entry_size = (entry_count == 0) ?
-        append_entries_size_limit :
-        entry_size_not_limited / entry_count;
+      return election_timeout / 2;
+    }
 
-      auto batch_size = (avg_entry_size == 0) ?
-        append_entries_size_limit / 2 :
-        append_entries_size_limit / avg_entry_size;
+    // A new leader does not know which entries were committed by its
+    // predecessors until it has committed one of its own
+    bool knows_commit_idx()
+    {
+      return get_term_internal(commit_idx) == current_term;
+    }
 
-      auto batch_avg = batch_window_sum / batch_window_size;
-      // balance out total batch size across batch window
-      batch_window_sum += (batch_size - batch_avg);
-      entries_batch_size = std::max((batch_window_sum / batch_window_size), 1);
+    bool has_lease_internal()
+    {
+      return state == Leader && read_lease && knows_commit_idx() &&
+        clock < lease_expiry;
+    }
+
+    void start_round()
+    {
+      round++;
+      round_starts.emplace_back(round, clock);
+    }
+
+    void read_index_as_leader(ReadIndexCallback cb)
+    {
+      if (!knows_commit_idx())
+      {
+        cb(std::nullopt);
+        return;
+      }
+
+      if (has_lease_internal())
+      {
+        cb(commit_idx);
+        return;
+      }
+
+      // Confirm that we are still leader with a round of heartbeats
+      start_round();
+      pending_reads.push_back({round, commit_idx, std::move(cb)});
+
+      for (const auto& it : nodes)
+      {
+        send_append_entries(it.first, true);
+      }
+
+      update_confirmed_round();
+    }
+
+    void update_confirmed_round()
+    {
+      // The highest round acknowledged by a quorum of each active
+      // configuration
+      auto new_confirmed = round;
+
+      for (auto& c : configurations)
+      {
+        std::vector<uint64_t> acked;
+        acked.reserve(c.nodes.size() + 1);
+
+        for (auto node : c.nodes)
+        {
+          if (node == local_id)
+            acked.push_back(round);
+          else
+            acked.push_back(nodes.at(node).acked_round);
+        }
+
+        sort(acked.begin(), acked.end());
+        new_confirmed =
+          std::min(new_confirmed, acked.at((acked.size() - 1) / 2));
+      }
+
+      if (new_confirmed <= confirmed_round)
+        return;
+
+      confirmed_round = new_confirmed;
+
+      while (!round_starts.empty() &&
+             round_starts.front().first <= confirmed_round)
+      {
+        if (round_starts.front().first == confirmed_round && read_lease)
+          lease_expiry = round_starts.front().second + lease_duration();
+        round_starts.pop_front();
+      }
+
+      while (!pending_reads.empty() &&
+             pending_reads.front().round <= confirmed_round)
+      {
+        auto read = std::move(pending_reads.front());
+        pending_reads.pop_front();
+        read.cb(read.read_idx);
+      }
+    }
+
+    void ack_round(NodeState& node, uint64_t acked_round)
+    {
+      if (acked_round > node.acked_round)
+      {
+        node.acked_round = acked_round;
+        update_confirmed_round();
+      }
+    }
+
+    void expire_forwarded_reads()
+    {
+      while (!reads_awaiting_leader.empty())
+      {
+        auto it = reads_awaiting_leader.begin();
+        if (clock < it->second.sent + election_timeout)
+          break;
+
+        LOG_DEBUG_FMT(
+          "Read index {} on {} expired waiting for the leader",
+          it->first,
+          local_id);
+        auto cb = std::move(it->second.cb);
+        reads_awaiting_leader.erase(it);
+        cb(std::nullopt);
+      }
+    }
+
+    void fail_pending_reads()
+    {
+      for (auto& read : pending_reads)
+        read.cb(std::nullopt);
+      pending_reads.clear();
+
+      for (auto& [id, read] : reads_awaiting_leader)
+        read.cb(std::nullopt);
+      reads_awaiting_leader.clear();
+
+      round_starts.clear();
+      lease_expiry = std::chrono::milliseconds(0);
+    }
+
+    void recv_read_index(const uint8_t* data, size_t size)
+    {
+      ReadIndex r;
+
+      try
+      {
+        r = channels->template recv_authenticated<ReadIndex>(data, size);
+      }
+      catch (const std::logic_error& err)
+      {
+        LOG_FAIL_FMT(err.what());
+        return;
+      }
+
+      const auto from = r.from_node;
+      const auto read_id = r.read_id;
+      auto reply = [this, from, read_id](std::optional<Index> idx) {
+        ReadIndexResponse response = {raft_read_index_response,
+                                      local_id,
+                                      current_term,
+                                      read_id,
+                                      idx.value_or(0),
+                                      idx.has_value()};
+        channels->send_authenticated(
+          ccf::NodeMsgType::consensus_msg, from, response);
+      };
+
+      if (state != Leader || r.term != current_term)
+      {
+        LOG_DEBUG_FMT(
+          "Recv read index to {} from {}: not leader in term {}",
+          local_id,
+          from,
+          r.term);
+        reply(std::nullopt);
+        return;
+      }
+
+      read_index_as_leader(std::move(reply));
+    }
+
+    void recv_read_index_response(const uint8_t* data, size_t size)
+    {
+      ReadIndexResponse r;
+
+      try
+      {
+        r = channels->template recv_authenticated<ReadIndexResponse>(
+          data, size);
+      }
+      catch (const std::logic_error& err)
+      {
+        LOG_FAIL_FMT(err.what());
+        return;
+      }
+
+      auto it = reads_awaiting_leader.find(r.read_id);
+      if (it == reads_awaiting_leader.end())
+        return;
+
+      auto cb = std::move(it->second.cb);
+      reads_awaiting_leader.erase(it);
+
+      if (!r.success || r.term != current_term)
+      {
+        cb(std::nullopt);
+      }
+      else if (r.read_idx <= commit_idx)
+      {
+        cb(r.read_idx);
+      }
+      else
+      {
+        reads_awaiting_commit.emplace(r.read_idx, std::move(cb));
+      }
+    }
+
+    Index ackable_idx()
+    {
+      // Last index that this node has persisted, as far as replication is
+      // concerned
+      return wait_for_ledger_sync ? durable_idx : last_idx;
     }
 
     Term get_term_internal(Index idx)
@@ -443,21 +914,68 @@ namespace raft
       return term_history.term_at(idx);
     }
 
-    void send_append_entries(NodeId to, Index start_idx)
+    void reset_node_state(NodeState& node, Index sent_idx)
     {
-      Index end_idx = (last_idx == 0) ?
-        0 :
-        std::min(start_idx + entries_batch_size, last_idx);
+      node.match_idx = std::min(node.match_idx, sent_idx);
+      node.sent_idx = sent_idx;
+      node.inflight.clear();
+      node.inflight_bytes = 0;
+      node.probe_epoch++;
+    }
 
-      for (Index i = end_idx; i < last_idx; i += entries_batch_size)
+    // Sends the entries following the last index sent to the node, in batches
+    // of at most append_entries_size_limit bytes (or a single larger entry),
+    // for as long as the node's inflight window allows. If heartbeat is set
+    // and no entries are sent, an empty append entries is sent instead.
+    void send_append_entries(NodeId to, bool heartbeat = false)
+    {
+      auto& node = nodes.at(to);
+      bool sent = false;
+
+      while (node.sent_idx < last_idx)
       {
-        send_append_entries_range(to, start_idx, i);
-        start_idx = std::min(i + 1, last_idx);
+        if (
+          node.inflight_bytes >= max_inflight_bytes ||
+          node.sent_idx - node.match_idx >= max_inflight_entries)
+        {
+          LOG_DEBUG_FMT(
+            "Inflight window to {} is full: {} to {} ({} bytes)",
+            to,
+            node.match_idx,
+            node.sent_idx,
+            node.inflight_bytes);
+          break;
+        }
+
+        const auto start_idx = node.sent_idx + 1;
+        auto end_idx = start_idx;
+        auto bytes = entry_sizes.size_of(start_idx);
+        while (end_idx < last_idx)
+        {
+          const auto next_bytes = entry_sizes.size_of(end_idx + 1);
+          if (bytes + next_bytes > append_entries_size_limit)
+            break;
+
+          bytes += next_bytes;
+          end_idx++;
+        }
+
+        send_append_entries_range(to, start_idx, end_idx);
+
+        // Record the most recent index we have sent to this node.
+        node.sent_idx = end_idx;
+        node.inflight.push_back({end_idx, bytes});
+        node.inflight_bytes += bytes;
+        sent = true;
       }
 
-      if (last_idx == 0 || end_idx <= last_idx)
+      if (heartbeat && !sent)
       {
-        send_append_entries_range(to, start_idx, last_idx);
+        // Messages to a node are delivered in order, so by the time the node
+        // receives this it has received all batches in flight, unless they
+        // were lost. It then rejects this, and entries are resent from the
+        // end of its log.
+        send_append_entries_range(to, node.sent_idx + 1, node.sent_idx);
       }
     }
 
@@ -482,12 +1000,9 @@ namespace raft
                           current_term,
                           prev_term,
                           commit_idx,
-                          term_of_idx};
-
-      auto& node = nodes.at(to);
-
-      // Record the most recent index we have sent to this node.
-      node.sent_idx = end_idx;
+                          term_of_idx,
+                          round,
+                          nodes.at(to).probe_epoch};
 
       // The host will append log entries to this message when it is
       // sent to the destination node.
@@ -518,6 +1033,9 @@ namespace raft
       const auto prev_term = get_term_internal(r.prev_idx);
       LOG_DEBUG_FMT("Previous term for {} should be {}", r.prev_idx, prev_term);
 
+      // Any response to this is tagged with its probe epoch
+      leader_probe_epoch = r.probe_epoch;
+
       // Don't check that the sender node ID is valid. Accept anything that
       // passes the integrity check. This way, entries containing dynamic
       // topology changes that include adding this new leader can be accepted.
@@ -580,7 +1098,21 @@ namespace raft
             prev_term,
             r.prev_term);
         }
-        send_append_entries_response(r.from_node, false);
+
+        // Our entries from the conflicting term can't match the leader's
+        // entry at r.prev_idx, whose term differs. Point the leader to the
+        // last entry before them, so that a follower which is far behind
+        // converges in one round trip per term rather than per batch.
+        auto hint_idx = std::min(r.prev_idx - 1, last_idx);
+        if (prev_term != 0)
+        {
+          const auto start = term_history.start_of(prev_term);
+          if (start > 0)
+            hint_idx = std::min(hint_idx, start - 1);
+        }
+        hint_idx = std::max(hint_idx, commit_idx);
+
+        send_append_entries_response(r.from_node, false, hint_idx);
         return;
       }
 
@@ -632,6 +1164,7 @@ namespace raft
         last_idx = i;
         is_first_entry = false;
         auto ret = ledger->record_entry(data, size);
+        entry_sizes.append(i, ret.first.size());
 
         if (!ret.second)
         {
@@ -645,6 +1178,7 @@ namespace raft
 
           last_idx = r.prev_idx;
           ledger->truncate(r.prev_idx);
+          entry_sizes.truncate(r.prev_idx);
           send_append_entries_response(r.from_node, false);
           return;
         }
@@ -682,6 +1216,10 @@ namespace raft
         LOG_DEBUG_FMT("Node {} thinks leader is {}", local_id, leader_id);
       }
 
+      using namespace std::chrono_literals;
+      since_leader = 0ms;
+      leader_round = std::max(leader_round, r.round);
+
       send_append_entries_response(r.from_node, true);
       commit_if_possible(r.leader_commit_idx);
 
@@ -689,16 +1227,30 @@ namespace raft
     }
 
     void send_append_entries_response(NodeId to, bool answer)
+    {
+      // Success acknowledges the entries persisted so far. Failure points the
+      // leader to the end of our log.
+      send_append_entries_response(
+        to, answer, answer ? ackable_idx() : last_idx);
+    }
+
+    void send_append_entries_response(NodeId to, bool answer, Index idx)
     {
       LOG_DEBUG_FMT(
         "Send append entries response from {} to {} for index {}: {}",
         local_id,
         to,
-        last_idx,
+        idx,
         answer);
 
-      AppendEntriesResponse response = {
-        raft_append_entries_response, local_id, current_term, last_idx, answer};
+      AppendEntriesResponse response = {raft_append_entries_response,
+                                        local_id,
+                                        current_term,
+                                        idx,
+                                        get_term_internal(idx),
+                                        answer,
+                                        leader_round,
+                                        leader_probe_epoch};
 
       channels->send_authenticated(
         ccf::NodeMsgType::consensus_msg, to, response);
@@ -763,28 +1315,71 @@ namespace raft
           local_id,
           r.from_node);
         if (r.success)
+        {
+          ack_round(node->second, r.round);
           return;
+        }
       }
 
-      // Update next and match for the responding node.
-      node->second.match_idx = std::min(r.last_log_idx, last_idx);
+      auto& node_state = node->second;
 
       if (!r.success)
       {
-        // Failed due to log inconsistency. Reset sent_idx and try again.
+        // Failed due to log inconsistency. Our entries up to the highest index
+        // whose term is no later than the follower's term at the hinted index
+        // may match. Restart from there. The follower reports term 0 if it
+        // does not know its term at that index.
+        auto probe_idx = std::min(r.last_log_idx, last_idx);
+        if (r.last_log_term != 0)
+        {
+          probe_idx =
+            std::min(probe_idx, term_history.last_idx_up_to(r.last_log_term));
+        }
+
+        if (r.probe_epoch < node_state.probe_epoch)
+        {
+          // Rejection of entries that were in flight when we last resent
+          // entries from an earlier index. Only rejections of the entries
+          // sent since, which may have been lost too, restart again.
+          LOG_DEBUG_FMT(
+            "Recv append entries response to {} from {}: failed, stale",
+            local_id,
+            r.from_node);
+          return;
+        }
+
         LOG_DEBUG_FMT(
-          "Recv append entries response to {} from {}: failed",
+          "Recv append entries response to {} from {}: failed, retrying "
+          "from {}",
           local_id,
-          r.from_node);
-        send_append_entries(r.from_node, node->second.match_idx + 1);
+          r.from_node,
+          probe_idx);
+        reset_node_state(node_state, probe_idx);
+        send_append_entries(r.from_node, true);
         return;
       }
 
+      ack_round(node_state, r.round);
+
+      // Update next and match for the responding node.
+      node_state.match_idx = std::min(r.last_log_idx, last_idx);
+      node_state.sent_idx = std::max(node_state.sent_idx, node_state.match_idx);
+
+      while (!node_state.inflight.empty() &&
+             node_state.inflight.front().end_idx <= node_state.match_idx)
+      {
+        node_state.inflight_bytes -= node_state.inflight.front().bytes;
+        node_state.inflight.pop_front();
+      }
+
       LOG_DEBUG_FMT(
         "Recv append entries response to {} from {} for index {}: success",
         local_id,
         r.from_node,
         r.last_log_idx);
+
+      // Acknowledged batches open the window for more
+      send_append_entries(r.from_node);
       update_commit();
     }
 
@@ -826,6 +1421,20 @@ namespace raft
         return;
       }
 
+      if (
+        read_lease && state == Follower && leader_id != NoNode &&
+        since_leader < election_timeout)
+      {
+        // Our leader may hold a lease based on our acknowledgements. Ignore,
+        // since we have heard from it too recently for it to have failed.
+        LOG_DEBUG_FMT(
+          "Recv request vote to {} from {}: leader {} is active",
+          local_id,
+          r.from_node,
+          leader_id);
+        return;
+      }
+
       if (current_term > r.term)
       {
         // Reply false, since our term is later than the received term.
@@ -981,6 +1590,7 @@ namespace raft
       voted_for = local_id;
       votes_for_me.clear();
       current_term++;
+      fail_pending_reads();
 
       restart_election_timeout();
       add_vote_for_me(local_id);
@@ -1006,6 +1616,9 @@ namespace raft
       using namespace std::chrono_literals;
       timeout_elapsed = 0ms;
 
+      fail_pending_reads();
+      start_round();
+
       LOG_INFO_FMT("Becoming leader {}: {}", local_id, current_term);
 
       // Immediately commit if there are no other nodes.
@@ -1016,15 +1629,14 @@ namespace raft
       }
 
       // Reset next, match, and sent indices for all nodes.
-      auto next = last_idx + 1;
-
       for (auto it = nodes.begin(); it != nodes.end(); ++it)
       {
         it->second.match_idx = 0;
-        it->second.sent_idx = next - 1;
+        it->second.acked_round = 0;
+        reset_node_state(it->second, last_idx);
 
         // Send an empty append_entries to all nodes.
-        send_append_entries(it->first, next);
+        send_append_entries(it->first, true);
       }
     }
 
@@ -1037,6 +1649,8 @@ namespace raft
       current_term = term;
       voted_for = NoNode;
       votes_for_me.clear();
+      leader_round = 0;
+      fail_pending_reads();
 
       // Rollback unreplicated commits.
       rollback(commit_idx);
@@ -1071,7 +1685,7 @@ namespace raft
         for (auto node : c.nodes)
         {
           if (node == local_id)
-            match.push_back(last_idx);
+            match.push_back(ackable_idx());
           else
             match.push_back(nodes.at(node).match_idx);
         }
@@ -1132,8 +1746,28 @@ namespace raft
 
       commit_idx = idx;
 
+      while (!reads_awaiting_commit.empty() &&
+             reads_awaiting_commit.begin()->first <= idx)
+      {
+        auto cb = std::move(reads_awaiting_commit.begin()->second);
+        reads_awaiting_commit.erase(reads_awaiting_commit.begin());
+        cb(idx);
+      }
+
+      // Once all nodes have acknowledged entries (or, on a follower, once they
+      // are committed), their sizes only matter for batching entries to nodes
+      // which fall behind, for which the average size is a good estimate
+      auto trim_idx = idx;
+      if (state == Leader)
+      {
+        for (const auto& node : nodes)
+          trim_idx = std::min(trim_idx, node.second.match_idx);
+      }
+      entry_sizes.trim(trim_idx);
+
       LOG_DEBUG_FMT("Compacting...");
       store->compact(idx);
+      ledger->commit(idx);
       LOG_DEBUG_FMT("Commit on {}: {}", local_id, idx);
 
       // Examine all configurations that are followed by a globally committed
@@ -1165,7 +1799,9 @@ namespace raft
     {
       store->rollback(idx);
       ledger->truncate(idx);
+      entry_sizes.truncate(idx);
       last_idx = idx;
+      durable_idx = std::min(durable_idx, idx);
       LOG_DEBUG_FMT("Rolled back at {}", idx);
 
       while (!committable_indices.empty() && (committable_indices.back() > idx))
@@ -1222,11 +1858,11 @@ namespace raft
         {
           // A new node is sent only future entries initially. If it does not
           // have prior data, it will communicate that back to the leader.
-          auto index = last_idx + 1;
-          nodes[node_id] = {0, index};
+          auto& node = nodes[node_id];
+          node.sent_idx = last_idx;
 
           if (state == Leader)
-            send_append_entries(node_id, index);
+            send_append_entries(node_id, true);
 
           LOG_INFO_FMT("Added node {}", node_id);
         }
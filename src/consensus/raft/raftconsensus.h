@@ -49,6 +49,16 @@ namespace raft
       raft->force_become_leader(seqno, view, terms, commit_seqno);
     }
 
+    void init_as_backup(SeqNo seqno, View view) override
+    {
+      raft->init_as_follower(seqno, view);
+    }
+
+    void ledger_durable(SeqNo seqno, size_t truncations) override
+    {
+      raft->ledger_durable(seqno, truncations);
+    }
+
     bool replicate(const kv::BatchVector& entries) override
     {
       return raft->replicate(entries);
@@ -69,6 +79,21 @@ namespace raft
       return raft->get_commit_idx();
     }
 
+    bool linearisable_reads() override
+    {
+      return raft->read_lease_enabled();
+    }
+
+    bool has_read_lease() override
+    {
+      return raft->has_lease();
+    }
+
+    void read_index(ReadIndexCallback cb) override
+    {
+      raft->read_index(std::move(cb));
+    }
+
     NodeId primary() override
     {
       return raft->leader();
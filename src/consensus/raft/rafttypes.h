@@ -23,7 +23,13 @@ namespace raft
   {
     size_t request_timeout;
     size_t election_timeout;
-    MSGPACK_DEFINE(request_timeout, election_timeout);
+    // Only acknowledge and commit entries once the host has synced them
+    bool wait_for_ledger_sync;
+    // Serve linearisable reads: on the leader from local state while it holds
+    // a lease, elsewhere once the leader has confirmed a read index
+    bool read_lease;
+    MSGPACK_DEFINE(
+      request_timeout, election_timeout, wait_for_ledger_sync, read_lease);
   };
 
   template <typename S>
@@ -81,6 +87,8 @@ namespace raft
     raft_append_entries_response,
     raft_request_vote,
     raft_request_vote_response,
+    raft_read_index,
+    raft_read_index_response,
   };
 
 #pragma pack(push, 1)
@@ -97,13 +105,26 @@ namespace raft
     Term prev_term;
     Index leader_commit_idx;
     Term term_of_idx;
+    // Leader's confirmation round when this was sent, echoed in the response
+    uint64_t round;
+    // Leader's probe epoch for the recipient when this was sent, echoed in
+    // the response
+    uint64_t probe_epoch;
   };
 
   struct AppendEntriesResponse : RaftHeader
   {
     Term term;
+    // On failure, the highest index at which the follower's log may still
+    // match the leader's, and the follower's term at that index. The leader
+    // uses these to skip back over whole terms of conflicting entries.
     Index last_log_idx;
+    Term last_log_term;
     bool success;
+    // Latest round received from the leader
+    uint64_t round;
+    // Probe epoch of the latest append entries received from the leader
+    uint64_t probe_epoch;
   };
 
   struct RequestVote : RaftHeader
@@ -122,5 +143,19 @@ namespace raft
     Term term;
     bool vote_granted;
   };
+
+  struct ReadIndex : RaftHeader
+  {
+    Term term;
+    uint64_t read_id;
+  };
+
+  struct ReadIndexResponse : RaftHeader
+  {
+    Term term;
+    uint64_t read_id;
+    Index read_idx;
+    bool success;
+  };
 #pragma pack(pop)
 }
\ No newline at end of file
@@ -18,6 +18,7 @@ namespace raft
   public:
     std::vector<std::shared_ptr<std::vector<uint8_t>>> ledger;
     uint64_t skip_count = 0;
+    size_t truncations = 0;
 
     LedgerStubProxy(NodeId id) : _id(id) {}
 
@@ -57,6 +58,7 @@ namespace raft
 
     void truncate(Index idx)
     {
+      truncations++;
       ledger.resize(idx);
 #ifdef STUB_LOG
       std::cout << "  KV" << _id << "->>Node" << _id << ": truncate i: " << idx
@@ -64,6 +66,13 @@ namespace raft
 #endif
     }
 
+    void commit(Index idx) {}
+
+    size_t truncation_count() const
+    {
+      return truncations;
+    }
+
     void reset_skip_count()
     {
       skip_count = 0;
@@ -80,6 +89,8 @@ namespace raft
       sent_request_vote_response;
     std::list<std::pair<NodeId, AppendEntriesResponse>>
       sent_append_entries_response;
+    std::list<std::pair<NodeId, ReadIndex>> sent_read_index;
+    std::list<std::pair<NodeId, ReadIndexResponse>> sent_read_index_response;
 
     ChannelStubProxy() {}
 
@@ -111,10 +122,25 @@ namespace raft
       sent_append_entries_response.push_back(std::make_pair(to, data));
     }
 
+    void send_authenticated(
+      const ccf::NodeMsgType& msg_type, NodeId to, const ReadIndex& data)
+    {
+      sent_read_index.push_back(std::make_pair(to, data));
+    }
+
+    void send_authenticated(
+      const ccf::NodeMsgType& msg_type,
+      NodeId to,
+      const ReadIndexResponse& data)
+    {
+      sent_read_index_response.push_back(std::make_pair(to, data));
+    }
+
     size_t sent_msg_count() const
     {
       return sent_request_vote.size() + sent_request_vote_response.size() +
-        sent_append_entries.size() + sent_append_entries_response.size();
+        sent_append_entries.size() + sent_append_entries_response.size() +
+        sent_read_index.size() + sent_read_index_response.size();
     }
 
     template <class T>
@@ -598,6 +598,7 @@ DOCTEST_TEST_CASE("Recv append entries logic" * doctest::test_suite("multiple"))
     DOCTEST_REQUIRE(r0.ledger->ledger.size() == 5);
     r0.periodic(ms(10));
     DOCTEST_REQUIRE(r0.channels->sent_append_entries.size() == 1);
+    const auto lost_ae = r0.channels->sent_append_entries.front().second;
     r0.channels->sent_append_entries.pop_front();
 
     // Simulate that the append entries was not deserialised successfully
@@ -605,6 +606,7 @@ DOCTEST_TEST_CASE("Recv append entries logic" * doctest::test_suite("multiple"))
     auto aer = r1.channels->sent_append_entries_response.front().second;
     r1.channels->sent_append_entries_response.pop_front();
     aer.success = false;
+    aer.probe_epoch = lost_ae.probe_epoch;
     r0.recv_message(reinterpret_cast<uint8_t*>(&aer), sizeof(aer));
     DOCTEST_REQUIRE(r0.channels->sent_append_entries.size() == 1);
 
@@ -745,17 +747,180 @@ DOCTEST_TEST_CASE("Exceed append entries limit")
   r2.channels->sent_append_entries_response.pop_front();
   r0.recv_message(reinterpret_cast<uint8_t*>(&aer), sizeof(aer));
 
-  DOCTEST_REQUIRE(
-    (r0.channels->sent_append_entries.size() > num_small_entries_sent &&
-     r0.channels->sent_append_entries.size() <=
-       num_small_entries_sent + num_big_entries));
-  auto sent_entries = dispatch_all(nodes, r0.channels->sent_append_entries);
+  DOCTEST_INFO("Node 0 sends what fits in Node 2's inflight window, then more "
+               "as Node 2 acknowledges it");
+  size_t sent_entries = 0;
+  while (!r0.channels->sent_append_entries.empty())
+  {
+    DOCTEST_REQUIRE(
+      r0.channels->sent_append_entries.size() <=
+      r0.max_inflight_bytes / (r0.append_entries_size_limit / 2));
+    sent_entries += dispatch_all(nodes, r0.channels->sent_append_entries);
+    dispatch_all(nodes, r2.channels->sent_append_entries_response);
+  }
   DOCTEST_REQUIRE(
     (sent_entries > num_small_entries_sent &&
      sent_entries <= num_small_entries_sent + num_big_entries));
   DOCTEST_REQUIRE(r2.ledger->ledger.size() == individual_entries);
 }
 
+DOCTEST_TEST_CASE("Inflight window")
+{
+  logger::config::level() = logger::INFO;
+
+  auto kv_store0 = std::make_shared<Store>(0);
+  auto kv_store1 = std::make_shared<Store>(1);
+
+  raft::NodeId node_id0(0);
+  raft::NodeId node_id1(1);
+
+  ms request_timeout(10);
+
+  TRaft r0(
+    std::make_unique<Adaptor>(kv_store0),
+    std::make_unique<raft::LedgerStubProxy>(node_id0),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id0,
+    request_timeout,
+    ms(20));
+  TRaft r1(
+    std::make_unique<Adaptor>(kv_store1),
+    std::make_unique<raft::LedgerStubProxy>(node_id1),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id1,
+    request_timeout,
+    ms(100));
+
+  std::unordered_set<raft::NodeId> config0 = {node_id0, node_id1};
+  r0.add_configuration(0, config0);
+  r1.add_configuration(0, config0);
+
+  map<raft::NodeId, TRaft*> nodes;
+  nodes[node_id0] = &r0;
+  nodes[node_id1] = &r1;
+
+  r0.periodic(std::chrono::milliseconds(200));
+
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_request_vote));
+  DOCTEST_REQUIRE(
+    1 == dispatch_all(nodes, r1.channels->sent_request_vote_response));
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  DOCTEST_REQUIRE(
+    1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+
+  // Each entry fills a batch, and is sent as soon as it is replicated
+  const size_t window = r0.max_inflight_bytes / r0.append_entries_size_limit;
+  const size_t num_entries = 3 * window;
+  std::vector<uint8_t> data(r0.append_entries_size_limit, 1);
+
+  DOCTEST_INFO("Entries beyond the window are not sent until acknowledged");
+  for (size_t i = 1; i <= num_entries; ++i)
+  {
+    DOCTEST_REQUIRE(r0.replicate(kv::BatchVector{{i, data, true}}));
+  }
+  DOCTEST_REQUIRE(r0.channels->sent_append_entries.size() == window);
+
+  DOCTEST_INFO("Acknowledgements open the window for more");
+  size_t rounds = 0;
+  while (!r0.channels->sent_append_entries.empty())
+  {
+    DOCTEST_REQUIRE(r0.channels->sent_append_entries.size() <= window);
+    dispatch_all(nodes, r0.channels->sent_append_entries);
+    dispatch_all(nodes, r1.channels->sent_append_entries_response);
+    rounds++;
+  }
+  DOCTEST_REQUIRE(rounds == 3);
+  DOCTEST_REQUIRE(r1.ledger->ledger.size() == num_entries);
+  DOCTEST_REQUIRE(r0.get_commit_idx() == num_entries);
+
+  DOCTEST_INFO("Lost batches are resent after one round trip");
+  {
+    // The batches carrying the next entries are lost
+    for (size_t i = num_entries + 1; i <= num_entries + window; ++i)
+    {
+      DOCTEST_REQUIRE(r0.replicate(kv::BatchVector{{i, data, true}}));
+    }
+    r0.channels->sent_append_entries.clear();
+
+    // Node 1 rejects the next heartbeat, and points Node 0 to the end of its
+    // log
+    std::vector<uint8_t> last_entry = {1, 2, 3};
+    DOCTEST_REQUIRE(r0.replicate(
+      kv::BatchVector{{num_entries + window + 1, last_entry, true}}));
+    r0.periodic(request_timeout);
+    DOCTEST_REQUIRE(
+      1 ==
+      dispatch_all_and_DOCTEST_CHECK(
+        nodes, r0.channels->sent_append_entries, [&](const auto& msg) {
+          DOCTEST_REQUIRE(msg.prev_idx == num_entries + window);
+        }));
+    DOCTEST_REQUIRE(
+      1 ==
+      dispatch_all_and_DOCTEST_CHECK(
+        nodes,
+        r1.channels->sent_append_entries_response,
+        [&](const auto& msg) {
+          DOCTEST_REQUIRE(!msg.success);
+          DOCTEST_REQUIRE(msg.last_log_idx == num_entries);
+        }));
+
+    // Node 0 resends the entries Node 1 is missing straight away, as far as
+    // the window allows
+    DOCTEST_REQUIRE(
+      window == dispatch_all(nodes, r0.channels->sent_append_entries));
+    DOCTEST_REQUIRE(r1.ledger->ledger.size() == num_entries + window);
+    DOCTEST_REQUIRE(
+      window ==
+      dispatch_all(nodes, r1.channels->sent_append_entries_response));
+    DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+    DOCTEST_REQUIRE(r1.ledger->ledger.size() == num_entries + window + 1);
+    DOCTEST_REQUIRE(
+      1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+  }
+
+  DOCTEST_INFO("Lost resent batches are resent again");
+  {
+    const size_t start = r1.ledger->ledger.size();
+
+    // The batches carrying the next entries are lost
+    for (size_t i = start + 1; i <= start + window; ++i)
+    {
+      DOCTEST_REQUIRE(r0.replicate(kv::BatchVector{{i, data, true}}));
+    }
+    r0.channels->sent_append_entries.clear();
+
+    // Node 1 rejects the next heartbeat, and Node 0 resends the entries, but
+    // these are lost as well
+    r0.periodic(request_timeout);
+    DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+    DOCTEST_REQUIRE(
+      1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+    DOCTEST_REQUIRE(r0.channels->sent_append_entries.size() == window);
+    r0.channels->sent_append_entries.clear();
+
+    // Node 1 rejects the following heartbeat in the same way. Since the
+    // entries resent since were lost, Node 0 resends them again.
+    r0.periodic(request_timeout);
+    DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+    DOCTEST_REQUIRE(
+      1 ==
+      dispatch_all_and_DOCTEST_CHECK(
+        nodes,
+        r1.channels->sent_append_entries_response,
+        [&](const auto& msg) {
+          DOCTEST_REQUIRE(!msg.success);
+          DOCTEST_REQUIRE(msg.last_log_idx == start);
+        }));
+    DOCTEST_REQUIRE(
+      window == dispatch_all(nodes, r0.channels->sent_append_entries));
+    DOCTEST_REQUIRE(r1.ledger->ledger.size() == start + window);
+    DOCTEST_REQUIRE(
+      window ==
+      dispatch_all(nodes, r1.channels->sent_append_entries_response));
+    DOCTEST_REQUIRE(r0.get_commit_idx() == start + window);
+  }
+}
+
 // Reproduces issue described here: https://github.com/microsoft/CCF/issues/521
 // Once this is fixed test will need to be modified since right now it
 // DOCTEST_CHECKs that the issue stands
@@ -983,4 +1148,235 @@ DOCTEST_TEST_CASE(
     DOCTEST_CHECK(r2.get_commit_idx() == 2);
     DOCTEST_CHECK(r2.get_last_idx() == 3);
   }
-}
\ No newline at end of file
+}
+DOCTEST_TEST_CASE(
+  "Entries are only acknowledged once durable" *
+  doctest::test_suite("multiple"))
+{
+  auto kv_store0 = std::make_shared<Store>(0);
+  auto kv_store1 = std::make_shared<Store>(1);
+
+  raft::NodeId node_id0(0);
+  raft::NodeId node_id1(1);
+
+  ms request_timeout(10);
+  const bool wait_for_ledger_sync = true;
+
+  TRaft r0(
+    std::make_unique<Adaptor>(kv_store0),
+    std::make_unique<raft::LedgerStubProxy>(node_id0),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id0,
+    request_timeout,
+    ms(20),
+    false,
+    wait_for_ledger_sync);
+  TRaft r1(
+    std::make_unique<Adaptor>(kv_store1),
+    std::make_unique<raft::LedgerStubProxy>(node_id1),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id1,
+    request_timeout,
+    ms(100),
+    false,
+    wait_for_ledger_sync);
+
+  std::unordered_set<raft::NodeId> config = {node_id0, node_id1};
+  r0.add_configuration(0, config);
+  r1.add_configuration(0, config);
+
+  map<raft::NodeId, TRaft*> nodes;
+  nodes[node_id0] = &r0;
+  nodes[node_id1] = &r1;
+
+  r0.periodic(std::chrono::milliseconds(200));
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_request_vote));
+  DOCTEST_REQUIRE(
+    1 == dispatch_all(nodes, r1.channels->sent_request_vote_response));
+  DOCTEST_REQUIRE(r0.is_leader());
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  DOCTEST_REQUIRE(
+    1 == dispatch_all(nodes, r1.channels->sent_append_entries_response));
+
+  DOCTEST_INFO("The follower does not acknowledge entries it has not synced");
+  std::vector<uint8_t> entry = {1, 2, 3};
+  DOCTEST_REQUIRE(r0.replicate(kv::BatchVector{{1, entry, true}}));
+  r0.periodic(request_timeout);
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  DOCTEST_REQUIRE(r1.get_last_idx() == 1);
+  DOCTEST_REQUIRE(
+    1 ==
+    dispatch_all_and_DOCTEST_CHECK(
+      nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+        DOCTEST_REQUIRE(msg.last_log_idx == 0);
+        DOCTEST_REQUIRE(msg.success);
+      }));
+
+  DOCTEST_INFO("Once synced, the follower acknowledges the entries");
+  r1.ledger_durable(1, r1.ledger->truncation_count());
+  DOCTEST_REQUIRE(r1.get_durable_idx() == 1);
+  DOCTEST_REQUIRE(
+    1 ==
+    dispatch_all_and_DOCTEST_CHECK(
+      nodes, r1.channels->sent_append_entries_response, [](const auto& msg) {
+        DOCTEST_REQUIRE(msg.last_log_idx == 1);
+        DOCTEST_REQUIRE(msg.success);
+      }));
+
+  DOCTEST_INFO("The leader only commits entries it has synced itself");
+  DOCTEST_REQUIRE(r0.get_commit_idx() == 0);
+
+  DOCTEST_INFO("Notifications from before a truncation are ignored");
+  r0.ledger_durable(1, r0.ledger->truncation_count() + 1);
+  DOCTEST_REQUIRE(r0.get_durable_idx() == 0);
+  DOCTEST_REQUIRE(r0.get_commit_idx() == 0);
+
+  r0.ledger_durable(1, r0.ledger->truncation_count());
+  DOCTEST_REQUIRE(r0.get_durable_idx() == 1);
+  DOCTEST_REQUIRE(r0.get_commit_idx() == 1);
+}
+
+DOCTEST_TEST_CASE(
+  "Linearisable reads from leases and read indices" *
+  doctest::test_suite("multiple"))
+{
+  auto kv_store0 = std::make_shared<StoreSig>(0);
+  auto kv_store1 = std::make_shared<StoreSig>(1);
+  auto kv_store2 = std::make_shared<StoreSig>(2);
+
+  raft::NodeId node_id0(0);
+  raft::NodeId node_id1(1);
+  raft::NodeId node_id2(2);
+
+  ms request_timeout(10);
+  const bool read_lease = true;
+
+  TRaft r0(
+    std::make_unique<Adaptor>(kv_store0),
+    std::make_unique<raft::LedgerStubProxy>(node_id0),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id0,
+    request_timeout,
+    ms(20),
+    false,
+    false,
+    read_lease);
+  TRaft r1(
+    std::make_unique<Adaptor>(kv_store1),
+    std::make_unique<raft::LedgerStubProxy>(node_id1),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id1,
+    request_timeout,
+    ms(100),
+    false,
+    false,
+    read_lease);
+  TRaft r2(
+    std::make_unique<Adaptor>(kv_store2),
+    std::make_unique<raft::LedgerStubProxy>(node_id2),
+    std::make_shared<raft::ChannelStubProxy>(),
+    node_id2,
+    request_timeout,
+    ms(50),
+    false,
+    false,
+    read_lease);
+
+  std::unordered_set<raft::NodeId> config = {node_id0, node_id1, node_id2};
+  r0.add_configuration(0, config);
+  r1.add_configuration(0, config);
+  r2.add_configuration(0, config);
+
+  map<raft::NodeId, TRaft*> nodes;
+  nodes[node_id0] = &r0;
+  nodes[node_id1] = &r1;
+  nodes[node_id2] = &r2;
+
+  std::vector<std::optional<raft::Index>> reads;
+  auto read = [&reads](std::optional<raft::Index> idx) {
+    reads.push_back(idx);
+  };
+
+  r0.periodic(std::chrono::milliseconds(200));
+  DOCTEST_REQUIRE(2 == dispatch_all(nodes, r0.channels->sent_request_vote));
+  dispatch_all(nodes, r1.channels->sent_request_vote_response);
+  dispatch_all(nodes, r2.channels->sent_request_vote_response);
+  DOCTEST_REQUIRE(r0.is_leader());
+  DOCTEST_REQUIRE(2 == dispatch_all(nodes, r0.channels->sent_append_entries));
+  dispatch_all(nodes, r1.channels->sent_append_entries_response);
+  dispatch_all(nodes, r2.channels->sent_append_entries_response);
+
+  DOCTEST_INFO("A leader serves no reads until it commits in its own term");
+  DOCTEST_REQUIRE(!r0.has_lease());
+  r0.read_index(read);
+  DOCTEST_REQUIRE(reads.size() == 1);
+  DOCTEST_REQUIRE(!reads.back().has_value());
+
+  std::vector<uint8_t> entry = {1, 2, 3};
+  DOCTEST_REQUIRE(r0.replicate(kv::BatchVector{{1, entry, true}}));
+  r0.periodic(request_timeout);
+  DOCTEST_REQUIRE(dispatch_all(nodes, r0.channels->sent_append_entries) > 0);
+  dispatch_all(nodes, r1.channels->sent_append_entries_response);
+  dispatch_all(nodes, r2.channels->sent_append_entries_response);
+  DOCTEST_REQUIRE(r0.get_commit_idx() == 1);
+
+  DOCTEST_INFO("Once a quorum acknowledges a round, the leader has a lease");
+  DOCTEST_REQUIRE(r0.has_lease());
+  r0.read_index(read);
+  DOCTEST_REQUIRE(reads.size() == 2);
+  DOCTEST_REQUIRE(reads.back() == 1);
+
+  DOCTEST_INFO("Without acknowledgements, the lease expires");
+  r0.periodic(request_timeout);
+  DOCTEST_REQUIRE(!r0.has_lease());
+
+  DOCTEST_INFO("A read then waits for a round of heartbeats");
+  r0.read_index(read);
+  DOCTEST_REQUIRE(reads.size() == 2);
+  DOCTEST_REQUIRE(dispatch_all(nodes, r0.channels->sent_append_entries) > 0);
+  dispatch_all(nodes, r1.channels->sent_append_entries_response);
+  DOCTEST_REQUIRE(reads.size() == 3);
+  DOCTEST_REQUIRE(reads.back() == 1);
+  DOCTEST_REQUIRE(r0.has_lease());
+  dispatch_all(nodes, r2.channels->sent_append_entries_response);
+
+  DOCTEST_INFO("A follower obtains a read index from the leader");
+  DOCTEST_REQUIRE(r1.get_commit_idx() == 1);
+  r1.read_index(read);
+  DOCTEST_REQUIRE(1 == dispatch_all(nodes, r1.channels->sent_read_index));
+  DOCTEST_REQUIRE(
+    1 == dispatch_all(nodes, r0.channels->sent_read_index_response));
+  DOCTEST_REQUIRE(reads.size() == 4);
+  DOCTEST_REQUIRE(reads.back() == 1);
+
+  DOCTEST_INFO("A follower's read fails if the leader does not answer");
+  r1.read_index(read);
+  r1.channels->sent_read_index.clear();
+  r1.periodic(std::chrono::milliseconds(60));
+  DOCTEST_REQUIRE(reads.size() == 4);
+  r0.periodic(request_timeout);
+  DOCTEST_REQUIRE(dispatch_all(nodes, r0.channels->sent_append_entries) > 0);
+  dispatch_all(nodes, r1.channels->sent_append_entries_response);
+  dispatch_all(nodes, r2.channels->sent_append_entries_response);
+  r1.periodic(std::chrono::milliseconds(60));
+  DOCTEST_REQUIRE(reads.size() == 5);
+  DOCTEST_REQUIRE(!reads.back().has_value());
+  DOCTEST_REQUIRE(r1.channels->sent_request_vote.empty());
+
+  DOCTEST_INFO("Followers which recently heard from the leader ignore votes");
+  r2.periodic(std::chrono::milliseconds(100));
+  DOCTEST_REQUIRE(r2.channels->sent_request_vote.size() == 2);
+  while (!r2.channels->sent_request_vote.empty())
+  {
+    auto rv = r2.channels->sent_request_vote.front();
+    r2.channels->sent_request_vote.pop_front();
+    auto contents = get<1>(rv);
+    if (get<0>(rv) == node_id1)
+    {
+      r1.recv_message(
+        reinterpret_cast<uint8_t*>(&contents), sizeof(contents));
+    }
+  }
+  DOCTEST_REQUIRE(r1.channels->sent_request_vote_response.empty());
+  DOCTEST_REQUIRE(r1.get_term() == 1);
+}
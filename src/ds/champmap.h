@@ -2,10 +2,15 @@
 // Licensed under the Apache 2.0 License.
 #pragma once
 
-#include <array>
-#include <memory>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
 #include <optional>
-#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 namespace champ
 {
@@ -13,6 +18,9 @@ namespace champ
   // from 'Fast and Lean Immutable Multi-Maps on the JVM based on Heterogeneous
   // Hash-Array Mapped Tries' by Michael J. Steindorfer and Jurgen J. Vinju
   // (https://arxiv.org/pdf/1608.01036.pdf).
+  //
+  // Each node is a single allocation holding its bitmaps, its entries and
+  // pointers to its children, and is reference counted intrusively.
 
   static constexpr size_t index_mask_bits = 5;
   static constexpr size_t index_mask = (1 << index_mask_bits) - 1;
@@ -24,16 +32,32 @@ namespace champ
   static constexpr size_t small_index_bits = sizeof(SmallIndex) * 8;
   static_assert(small_index_bits > index_mask_bits);
 
-  static constexpr size_t collision_node_bits = hash_bits % index_mask_bits;
-  static_assert(collision_node_bits > 0);
-  static constexpr SmallIndex collision_depth = hash_bits / index_mask_bits;
-  static constexpr size_t collision_bins = 1 << collision_node_bits;
+  // Nodes above collision_depth are indexed by successive bits of the hash
+  // (the deepest of them by the remaining hash_bits % index_mask_bits bits).
+  // Keys with equal hashes are kept together in a node at collision_depth.
+  static constexpr SmallIndex collision_depth =
+    (hash_bits + index_mask_bits - 1) / index_mask_bits;
+
+  // Entries no larger than this, which can be copied as bytes, are stored in
+  // their node. Others are stored in their own allocation, shared by copies
+  // of the node.
+  static constexpr size_t max_inline_entry_size = 32;
 
   static constexpr SmallIndex mask(Hash hash, SmallIndex depth)
   {
     return (hash >> ((Hash)depth * index_mask_bits)) & index_mask;
   }
 
+  // Nodes created by a TransientMap are tagged with its edit, and it may then
+  // mutate them in place. Nodes tagged with edit 0 are never mutated.
+  using Edit = uint64_t;
+
+  inline Edit new_edit()
+  {
+    static std::atomic<Edit> next_edit = 1;
+    return next_edit++;
+  }
+
   class Bitmap
   {
     uint32_t _bits;
@@ -67,10 +91,124 @@ namespace champ
     {
       return (_bits & ((uint32_t)1 << idx)) != 0;
     }
+
+    // Number of bits set below idx
+    constexpr SmallIndex pop_below(SmallIndex idx) const
+    {
+      return (*this & Bitmap(~((uint32_t)-1 << idx))).pop();
+    }
   };
 
-  template <class K, class V, class H>
-  struct SubNodes;
+  // Nodes are shared between threads once their map is published, so counts
+  // are atomic. However, the owner of the only reference knows that no other
+  // thread can race with it, and releases it without a read-modify-write.
+  class RefCount
+  {
+    std::atomic<uint32_t> count = 1;
+
+  public:
+    void acquire()
+    {
+      count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Returns true if the last reference was released
+    bool release()
+    {
+      if (count.load(std::memory_order_acquire) == 1)
+        return true;
+
+      return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+  };
+
+  // Allocates nodes from per-thread free lists, one for each size class of
+  // granularity bytes. A block is returned to the free list of the thread
+  // which frees it, whichever thread allocated it. Each free list holds at
+  // most max_free_bytes, beyond which blocks are returned to the allocator.
+  class NodeAllocator
+  {
+  private:
+    static constexpr size_t granularity = 16;
+    static constexpr size_t size_classes = 48;
+    static constexpr size_t max_free_bytes = 1 << 16;
+
+    struct FreeBlock
+    {
+      FreeBlock* next;
+    };
+
+    // Trivially destructible, so that nodes released while thread-locals (or
+    // statics, on the main thread) are destroyed can still be freed
+    struct FreeLists
+    {
+      FreeBlock* heads[size_classes];
+      uint32_t counts[size_classes];
+      bool drained;
+    };
+
+    struct Drain
+    {
+      FreeLists& lists;
+
+      ~Drain()
+      {
+        for (auto& head : lists.heads)
+        {
+          while (head != nullptr)
+          {
+            auto block = head;
+            head = block->next;
+            ::operator delete(block);
+          }
+        }
+        lists.drained = true;
+      }
+    };
+
+    static FreeLists& local()
+    {
+      static thread_local FreeLists lists = {};
+      static thread_local Drain drain{lists};
+      return lists;
+    }
+
+  public:
+    static void* allocate(size_t size)
+    {
+      const auto c = (size - 1) / granularity;
+      if (c >= size_classes)
+        return ::operator new(size);
+
+      auto& lists = local();
+      auto block = lists.heads[c];
+      if (block == nullptr)
+        return ::operator new((c + 1) * granularity);
+
+      lists.heads[c] = block->next;
+      lists.counts[c]--;
+      return block;
+    }
+
+    static void deallocate(void* p, size_t size)
+    {
+      const auto c = (size - 1) / granularity;
+      if (c < size_classes)
+      {
+        auto& lists = local();
+        const auto max_free = max_free_bytes / ((c + 1) * granularity);
+        if (!lists.drained && lists.counts[c] < max_free)
+        {
+          auto block = static_cast<FreeBlock*>(p);
+          block->next = lists.heads[c];
+          lists.heads[c] = block;
+          lists.counts[c]++;
+          return;
+        }
+      }
+      ::operator delete(p);
+    }
+  };
 
   template <class K, class V>
   struct Entry
@@ -78,246 +216,625 @@ namespace champ
     K key;
     V value;
 
-    Entry(K k, V v) : key(k), value(v) {}
+    Entry(const K& k, const V& v) : key(k), value(v) {}
 
-    const V* getp(const K& k) const
+    const Entry& get() const
     {
-      if (k == key)
-        return &value;
-      else
-        return nullptr;
+      return *this;
     }
   };
 
-  template <class K, class V, class H>
-  using Node = std::shared_ptr<void>;
-
-  template <class K, class V, class H>
-  struct Collisions
+  template <class K, class V>
+  class BoxedEntry
   {
-    std::array<std::vector<std::shared_ptr<Entry<K, V>>>, collision_bins> bins;
+  private:
+    struct Box
+    {
+      RefCount rc;
+      Entry<K, V> entry;
+
+      Box(const K& k, const V& v) : entry(k, v) {}
+    };
+
+    Box* box;
 
-    const V* getp(Hash hash, const K& k) const
+  public:
+    BoxedEntry(const K& k, const V& v)
     {
-      const auto idx = mask(hash, collision_depth);
-      const auto& bin = bins[idx];
-      for (const auto& node : bin)
+      auto p = NodeAllocator::allocate(sizeof(Box));
+      try
       {
-        if (k == node->key)
-          return &node->value;
+        box = new (p) Box(k, v);
+      }
+      catch (...)
+      {
+        NodeAllocator::deallocate(p, sizeof(Box));
+        throw;
       }
-      return nullptr;
     }
 
-    bool put_mut(Hash hash, const K& k, const V& v)
+    BoxedEntry(const BoxedEntry& that) : box(that.box)
     {
-      const auto idx = mask(hash, collision_depth);
-      auto& bin = bins[idx];
-      for (size_t i = 0; i < bin.size(); ++i)
-      {
-        const auto& entry = bin[i];
-        if (k == entry->key)
-        {
-          bin[i] = std::make_shared<Entry<K, V>>(k, v);
-          return false;
-        }
-      }
-      bin.push_back(std::make_shared<Entry<K, V>>(k, v));
-      return true;
+      box->rc.acquire();
     }
 
-    template <class F>
-    bool foreach(F&& f) const
+    BoxedEntry(BoxedEntry&& that) noexcept : box(that.box)
     {
-      for (const auto& bin : bins)
+      that.box = nullptr;
+    }
+
+    BoxedEntry& operator=(BoxedEntry that) noexcept
+    {
+      std::swap(box, that.box);
+      return *this;
+    }
+
+    ~BoxedEntry()
+    {
+      if (box != nullptr && box->rc.release())
       {
-        for (const auto& entry : bin)
-          if (!f(entry->key, entry->value))
-            return false;
+        box->~Box();
+        NodeAllocator::deallocate(box, sizeof(Box));
       }
-      return true;
+    }
+
+    const Entry<K, V>& get() const
+    {
+      return box->entry;
     }
   };
 
+  template <class K, class V>
+  using Slot = std::conditional_t<
+    std::is_trivially_copyable_v<Entry<K, V>> &&
+      sizeof(Entry<K, V>) <= max_inline_entry_size,
+    Entry<K, V>,
+    BoxedEntry<K, V>>;
+
   template <class K, class V, class H>
-  struct SubNodes
+  struct Node;
+
+  template <class K, class V, class H>
+  class NodeRef
   {
-    std::vector<Node<K, V, H>> nodes;
+  private:
+    Node<K, V, H>* node = nullptr;
+
+  public:
+    NodeRef() = default;
+
+    // Takes ownership of a newly allocated node
+    explicit NodeRef(Node<K, V, H>* node_) : node(node_) {}
+
+    NodeRef(const NodeRef& that) : node(that.node)
+    {
+      if (node != nullptr)
+        node->rc.acquire();
+    }
+
+    NodeRef(NodeRef&& that) noexcept : node(that.node)
+    {
+      that.node = nullptr;
+    }
+
+    NodeRef& operator=(NodeRef that) noexcept
+    {
+      std::swap(node, that.node);
+      return *this;
+    }
+
+    ~NodeRef()
+    {
+      if (node != nullptr && node->rc.release())
+        Node<K, V, H>::destroy(node);
+    }
+
+    Node<K, V, H>* get() const
+    {
+      return node;
+    }
+
+    Node<K, V, H>* operator->() const
+    {
+      return node;
+    }
+
+    bool operator==(const NodeRef& that) const
+    {
+      return node == that.node;
+    }
+  };
+
+  // A node is laid out as this header, followed by n_entries entries and
+  // n_children references to the nodes one level deeper. Nodes at
+  // collision_depth hold entries only, and do not use their bitmaps.
+  template <class K, class V, class H>
+  struct Node
+  {
+    using S = Slot<K, V>;
+    using Ref = NodeRef<K, V, H>;
+
+    static_assert(alignof(S) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+    static constexpr uint32_t none = (uint32_t)-1;
+
+    RefCount rc;
+    uint32_t n_entries;
+    Edit edit;
     Bitmap node_map;
     Bitmap data_map;
+    uint32_t n_children;
+
+    static constexpr size_t align_up(size_t n, size_t a)
+    {
+      return (n + a - 1) / a * a;
+    }
+
+    static constexpr size_t entries_offset()
+    {
+      return align_up(sizeof(Node), alignof(S));
+    }
 
-    SubNodes() {}
+    static constexpr size_t children_offset(uint32_t n_entries_)
+    {
+      return align_up(
+        entries_offset() + n_entries_ * sizeof(S), alignof(Ref));
+    }
 
-    SubNodes(std::vector<Node<K, V, H>> ns) : nodes(ns) {}
+    static constexpr size_t alloc_size(
+      uint32_t n_entries_, uint32_t n_children_)
+    {
+      return children_offset(n_entries_) + n_children_ * sizeof(Ref);
+    }
 
-    SubNodes(std::vector<Node<K, V, H>> ns, Bitmap nm, Bitmap dm) :
-      nodes(ns),
-      node_map(nm),
-      data_map(dm)
+    Node(
+      uint32_t n_entries_,
+      uint32_t n_children_,
+      Bitmap node_map_,
+      Bitmap data_map_,
+      Edit edit_) :
+      n_entries(n_entries_),
+      edit(edit_),
+      node_map(node_map_),
+      data_map(data_map_),
+      n_children(n_children_)
     {}
 
-    SmallIndex compressed_idx(SmallIndex idx) const
+    S* entries()
     {
-      if (!node_map.check(idx) && !data_map.check(idx))
-        return (SmallIndex)-1;
+      return reinterpret_cast<S*>(
+        reinterpret_cast<uint8_t*>(this) + entries_offset());
+    }
 
-      const auto mask = Bitmap(~((uint32_t)-1 << idx));
-      if (data_map.check(idx))
-        return (data_map & mask).pop();
+    const S* entries() const
+    {
+      return reinterpret_cast<const S*>(
+        reinterpret_cast<const uint8_t*>(this) + entries_offset());
+    }
 
-      return data_map.pop() + (node_map & mask).pop();
+    Ref* children()
+    {
+      return reinterpret_cast<Ref*>(
+        reinterpret_cast<uint8_t*>(this) + children_offset(n_entries));
     }
 
-    const V* getp(SmallIndex depth, Hash hash, const K& k) const
+    const Ref* children() const
     {
-      const auto idx = mask(hash, depth);
-      const auto c_idx = compressed_idx(idx);
+      return reinterpret_cast<const Ref*>(
+        reinterpret_cast<const uint8_t*>(this) + children_offset(n_entries));
+    }
 
-      if (c_idx == (SmallIndex)-1)
-        return nullptr;
+    bool owned_by(Edit edit_) const
+    {
+      return edit_ != 0 && edit == edit_;
+    }
 
-      if (data_map.check(idx))
-        return node_as<Entry<K, V>>(c_idx)->getp(k);
+    // Allocates a node whose entries and children must then be constructed
+    // by the caller, without throwing
+    static Node* allocate(
+      uint32_t n_entries_,
+      uint32_t n_children_,
+      Bitmap node_map_,
+      Bitmap data_map_,
+      Edit edit_)
+    {
+      auto p = NodeAllocator::allocate(alloc_size(n_entries_, n_children_));
+      return new (p) Node(n_entries_, n_children_, node_map_, data_map_, edit_);
+    }
 
-      if (depth == (collision_depth - 1))
-        return node_as<Collisions<K, V, H>>(c_idx)->getp(hash, k);
+    static void destroy(Node* node)
+    {
+      const auto size = alloc_size(node->n_entries, node->n_children);
+      auto entries_ = node->entries();
+      for (uint32_t i = 0; i < node->n_entries; ++i)
+        entries_[i].~S();
+      auto children_ = node->children();
+      for (uint32_t i = 0; i < node->n_children; ++i)
+        children_[i].~Ref();
+      node->~Node();
+      NodeAllocator::deallocate(node, size);
+    }
 
-      return node_as<SubNodes<K, V, H>>(c_idx)->getp(depth + 1, hash, k);
+    static Ref empty()
+    {
+      return Ref(allocate(0, 0, Bitmap(0), Bitmap(0), 0));
     }
 
-    bool put_mut(SmallIndex depth, Hash hash, const K& k, const V& v)
+    // Constructs dst_n elements at dst from the src_n elements at src, with
+    // the element at src index erase left out, and inserted constructed at
+    // dst index insert. Either may be none.
+    template <class T>
+    static void transfer(
+      T* dst,
+      uint32_t dst_n,
+      T* src,
+      uint32_t erase,
+      uint32_t insert,
+      T* inserted,
+      bool steal)
     {
-      const auto idx = mask(hash, depth);
-      auto c_idx = compressed_idx(idx);
+      uint32_t s = 0;
+      for (uint32_t d = 0; d < dst_n; ++d)
+      {
+        if (d == insert)
+        {
+          new (dst + d) T(std::move(*inserted));
+          continue;
+        }
+
+        if (s == erase)
+          ++s;
+
+        if (steal)
+          new (dst + d) T(std::move(src[s]));
+        else
+          new (dst + d) T(src[s]);
+        ++s;
+      }
+    }
+
+    // Creates a node from src, with an entry and a child erased or inserted.
+    // If steal is set, src is owned by the caller's edit and about to be
+    // released, so its entries and children are moved rather than copied.
+    static Ref rebuild(
+      Node* src,
+      bool steal,
+      Bitmap node_map_,
+      Bitmap data_map_,
+      Edit edit_,
+      uint32_t entry_erase,
+      uint32_t entry_insert,
+      S* entry,
+      uint32_t child_erase,
+      uint32_t child_insert,
+      Ref* child)
+    {
+      const uint32_t n_entries_ = src->n_entries - (entry_erase != none) +
+        (entry_insert != none);
+      const uint32_t n_children_ = src->n_children - (child_erase != none) +
+        (child_insert != none);
+
+      auto node =
+        allocate(n_entries_, n_children_, node_map_, data_map_, edit_);
+      transfer(
+        node->entries(),
+        n_entries_,
+        src->entries(),
+        entry_erase,
+        entry_insert,
+        entry,
+        steal);
+      transfer(
+        node->children(),
+        n_children_,
+        src->children(),
+        child_erase,
+        child_insert,
+        child,
+        steal);
+      return Ref(node);
+    }
 
-      if (c_idx == (SmallIndex)-1)
+    static Ref clone(Node* src, Edit edit_)
+    {
+      return rebuild(
+        src,
+        false,
+        src->node_map,
+        src->data_map,
+        edit_,
+        none,
+        none,
+        nullptr,
+        none,
+        none,
+        nullptr);
+    }
+
+    // Creates a node at depth holding the entries a and b, whose hashes
+    // first differ at or below depth
+    static Ref pair(
+      SmallIndex depth, S& a, Hash hash_a, S& b, Hash hash_b, Edit edit_)
+    {
+      if (depth == collision_depth)
       {
-        data_map = data_map.set(idx);
-        c_idx = compressed_idx(idx);
-        nodes.insert(
-          nodes.begin() + c_idx, std::make_shared<Entry<K, V>>(k, v));
-        return true;
+        auto node = allocate(2, 0, Bitmap(0), Bitmap(0), edit_);
+        new (node->entries()) S(std::move(a));
+        new (node->entries() + 1) S(std::move(b));
+        return Ref(node);
       }
 
-      if (node_map.check(idx))
+      const auto idx_a = mask(hash_a, depth);
+      const auto idx_b = mask(hash_b, depth);
+      if (idx_a == idx_b)
       {
-        bool insert;
-        if (depth < (collision_depth - 1))
+        auto child = pair(depth + 1, a, hash_a, b, hash_b, edit_);
+        auto node = allocate(0, 1, Bitmap(0).set(idx_a), Bitmap(0), edit_);
+        new (node->children()) Ref(std::move(child));
+        return Ref(node);
+      }
+
+      auto node =
+        allocate(2, 0, Bitmap(0), Bitmap(0).set(idx_a).set(idx_b), edit_);
+      new (node->entries() + (idx_a < idx_b ? 0 : 1)) S(std::move(a));
+      new (node->entries() + (idx_a < idx_b ? 1 : 0)) S(std::move(b));
+      return Ref(node);
+    }
+
+    const V* getp(SmallIndex depth, Hash hash, const K& k) const
+    {
+      auto node = this;
+      for (; depth < collision_depth; ++depth)
+      {
+        const auto idx = mask(hash, depth);
+        if (node->data_map.check(idx))
         {
-          auto sn = *node_as<SubNodes<K, V, H>>(c_idx);
-          insert = sn.put_mut(depth + 1, hash, k, v);
-          nodes[c_idx] = std::make_shared<SubNodes<K, V, H>>(std::move(sn));
+          const auto& entry =
+            node->entries()[node->data_map.pop_below(idx)].get();
+          if (k == entry.key)
+            return &entry.value;
+          else
+            return nullptr;
         }
-        else
+
+        if (!node->node_map.check(idx))
+          return nullptr;
+
+        node = node->children()[node->node_map.pop_below(idx)].get();
+      }
+
+      for (uint32_t i = 0; i < node->n_entries; ++i)
+      {
+        const auto& entry = node->entries()[i].get();
+        if (k == entry.key)
+          return &entry.value;
+      }
+      return nullptr;
+    }
+
+    // Inserts or replaces the entry for k in the node referenced by n. A node
+    // that is not owned by edit_ is not modified. Instead, n is replaced by a
+    // modified copy owned by edit_. Returns true if an entry was inserted.
+    static bool put(
+      Ref& n, SmallIndex depth, Hash hash, const K& k, const V& v, Edit edit_)
+    {
+      auto node = n.get();
+
+      if (depth == collision_depth)
+      {
+        for (uint32_t i = 0; i < node->n_entries; ++i)
         {
-          auto sn = *node_as<Collisions<K, V, H>>(c_idx);
-          insert = sn.put_mut(hash, k, v);
-          nodes[c_idx] = std::make_shared<Collisions<K, V, H>>(std::move(sn));
+          if (k == node->entries()[i].get().key)
+          {
+            S entry(k, v);
+            if (!node->owned_by(edit_))
+            {
+              n = clone(node, edit_);
+              node = n.get();
+            }
+            node->entries()[i] = std::move(entry);
+            return false;
+          }
         }
-        return insert;
+
+        S entry(k, v);
+        n = rebuild(
+          node,
+          node->owned_by(edit_),
+          Bitmap(0),
+          Bitmap(0),
+          edit_,
+          none,
+          node->n_entries,
+          &entry,
+          none,
+          none,
+          nullptr);
+        return true;
       }
 
-      const auto& entry0 = node_as<Entry<K, V>>(c_idx);
-      if (k == entry0->key)
+      const auto idx = mask(hash, depth);
+
+      if (node->node_map.check(idx))
       {
-        nodes[c_idx] = std::make_shared<Entry<K, V>>(k, v);
-        return false;
+        if (!node->owned_by(edit_))
+        {
+          n = clone(node, edit_);
+          node = n.get();
+        }
+        auto& child = node->children()[node->node_map.pop_below(idx)];
+        return put(child, depth + 1, hash, k, v, edit_);
       }
 
-      if (depth < (collision_depth - 1))
+      const auto e_idx = node->data_map.pop_below(idx);
+
+      if (!node->data_map.check(idx))
       {
-        const auto hash0 = H()(entry0->key);
-        const auto idx0 = mask(hash0, depth + 1);
-        auto sub_node =
-          SubNodes<K, V, H>({entry0}, Bitmap(0), Bitmap(0).set(idx0));
-        sub_node.put_mut(depth + 1, hash, k, v);
-
-        nodes.erase(nodes.begin() + c_idx);
-        data_map = data_map.clear(idx);
-        node_map = node_map.set(idx);
-        c_idx = compressed_idx(idx);
-        nodes.insert(
-          nodes.begin() + c_idx,
-          std::make_shared<SubNodes<K, V, H>>(std::move(sub_node)));
+        S entry(k, v);
+        n = rebuild(
+          node,
+          node->owned_by(edit_),
+          node->node_map,
+          node->data_map.set(idx),
+          edit_,
+          none,
+          e_idx,
+          &entry,
+          none,
+          none,
+          nullptr);
+        return true;
       }
-      else
+
+      auto& entry0 = node->entries()[e_idx];
+      if (k == entry0.get().key)
       {
-        auto sub_node = Collisions<K, V, H>();
-        const auto hash0 = H()(entry0->key);
-        const auto idx0 = mask(hash0, collision_depth);
-        sub_node.bins[idx0].push_back(entry0);
-        const auto idx1 = mask(hash, collision_depth);
-        sub_node.bins[idx1].push_back(std::make_shared<Entry<K, V>>(k, v));
-
-        nodes.erase(nodes.begin() + c_idx);
-        data_map = data_map.clear(idx);
-        node_map = node_map.set(idx);
-        c_idx = compressed_idx(idx);
-        nodes.insert(
-          nodes.begin() + c_idx,
-          std::make_shared<Collisions<K, V, H>>(std::move(sub_node)));
+        S entry(k, v);
+        if (!node->owned_by(edit_))
+        {
+          n = clone(node, edit_);
+          node = n.get();
+        }
+        node->entries()[e_idx] = std::move(entry);
+        return false;
       }
+
+      // The existing entry and the new one are pushed down to a new child
+      S entry(k, v);
+      S moved0(entry0);
+      auto child =
+        pair(depth + 1, moved0, H()(entry0.get().key), entry, hash, edit_);
+      n = rebuild(
+        node,
+        node->owned_by(edit_),
+        node->node_map.set(idx),
+        node->data_map.clear(idx),
+        edit_,
+        e_idx,
+        none,
+        nullptr,
+        none,
+        node->node_map.pop_below(idx),
+        &child);
       return true;
     }
 
-    std::pair<std::shared_ptr<SubNodes<K, V, H>>, bool> put(
-      SmallIndex depth, Hash hash, const K& k, const V& v) const
+    // Removes the entry for k, which must be present, from the node
+    // referenced by n, in the same way as put. A child left with a single
+    // entry is replaced by that entry, so that the trie stays as shallow as
+    // if the removed entry had never been inserted.
+    static void remove(
+      Ref& n, SmallIndex depth, Hash hash, const K& k, Edit edit_)
     {
-      auto node = *this;
-      auto r = node.put_mut(depth, hash, k, v);
-      return std::make_pair(
-        std::make_shared<SubNodes<K, V, H>>(std::move(node)), r);
+      auto node = n.get();
+      const auto owned = node->owned_by(edit_);
+
+      if (depth == collision_depth)
+      {
+        uint32_t i = 0;
+        while (!(k == node->entries()[i].get().key))
+          ++i;
+
+        n = rebuild(
+          node,
+          owned,
+          Bitmap(0),
+          Bitmap(0),
+          edit_,
+          i,
+          none,
+          nullptr,
+          none,
+          none,
+          nullptr);
+        return;
+      }
+
+      const auto idx = mask(hash, depth);
+
+      if (node->data_map.check(idx))
+      {
+        n = rebuild(
+          node,
+          owned,
+          node->node_map,
+          node->data_map.clear(idx),
+          edit_,
+          node->data_map.pop_below(idx),
+          none,
+          nullptr,
+          none,
+          none,
+          nullptr);
+        return;
+      }
+
+      if (!owned)
+      {
+        n = clone(node, edit_);
+        node = n.get();
+      }
+      const auto c_idx = node->node_map.pop_below(idx);
+      auto& child = node->children()[c_idx];
+      remove(child, depth + 1, hash, k, edit_);
+
+      const auto c = child.get();
+      if (c->n_children == 0 && c->n_entries == 1)
+      {
+        // node is owned by the caller now, whatever edit_ is
+        S entry(c->entries()[0]);
+        n = rebuild(
+          node,
+          true,
+          node->node_map.clear(idx),
+          node->data_map.set(idx),
+          edit_,
+          none,
+          node->data_map.pop_below(idx),
+          &entry,
+          c_idx,
+          none,
+          nullptr);
+      }
     }
 
     template <class F>
-    bool foreach(SmallIndex depth, F&& f) const
+    bool foreach(F&& f) const
     {
-      const auto entries = data_map.pop();
-      for (SmallIndex i = 0; i < entries; ++i)
+      for (uint32_t i = 0; i < n_entries; ++i)
       {
-        const auto& entry = node_as<Entry<K, V>>(i);
-        if (!f(entry->key, entry->value))
+        const auto& entry = entries()[i].get();
+        if (!f(entry.key, entry.value))
           return false;
       }
-      for (size_t i = entries; i < nodes.size(); ++i)
+      for (uint32_t i = 0; i < n_children; ++i)
       {
-        if (depth == (collision_depth - 1))
-        {
-          if (!node_as<Collisions<K, V, H>>(i)->foreach(std::forward<F>(f)))
-            return false;
-        }
-        else
-        {
-          if (!node_as<SubNodes<K, V, H>>(i)->foreach(
-                depth + 1, std::forward<F>(f)))
-            return false;
-        }
+        if (!children()[i]->foreach(std::forward<F>(f)))
+          return false;
       }
       return true;
     }
-
-  private:
-    template <class A>
-    const std::shared_ptr<A>& node_as(SmallIndex c_idx) const
-    {
-      return reinterpret_cast<const std::shared_ptr<A>&>(nodes[c_idx]);
-    }
   };
 
+  template <class K, class V, class H>
+  class TransientMap;
+
   template <class K, class V, class H = std::hash<K>>
   class Map
   {
   private:
-    std::shared_ptr<SubNodes<K, V, H>> root;
+    friend class TransientMap<K, V, H>;
+
+    NodeRef<K, V, H> root;
     size_t _size = 0;
 
-    Map(std::shared_ptr<SubNodes<K, V, H>> root_, size_t size_) :
-      root(root_),
+    Map(NodeRef<K, V, H> root_, size_t size_) :
+      root(std::move(root_)),
       _size(size_)
     {}
 
   public:
-    Map() : root(std::make_shared<SubNodes<K, V, H>>()) {}
+    Map() : root(Node<K, V, H>::empty()) {}
 
     size_t size() const
     {
@@ -329,6 +846,14 @@ namespace champ
       return _size == 0;
     }
 
+    // Maps that share their root have the same contents. This is cheaper
+    // than comparing their contents, but maps created separately never
+    // share their root, even if their contents are the same.
+    bool same_root(const Map<K, V, H>& other) const
+    {
+      return root == other.root;
+    }
+
     std::optional<V> get(const K& key) const
     {
       auto v = root->getp(0, H()(key), key);
@@ -346,18 +871,115 @@ namespace champ
 
     const Map<K, V, H> put(const K& key, const V& value) const
     {
-      auto r = root->put(0, H()(key), key, value);
+      auto root_ = root;
       auto size_ = _size;
-      if (r.second)
+      if (Node<K, V, H>::put(root_, 0, H()(key), key, value, 0))
         size_++;
 
-      return Map(std::move(r.first), size_);
+      return Map(std::move(root_), size_);
+    }
+
+    const Map<K, V, H> remove(const K& key) const
+    {
+      const auto hash = H()(key);
+      if (root->getp(0, hash, key) == nullptr)
+        return *this;
+
+      auto root_ = root;
+      Node<K, V, H>::remove(root_, 0, hash, key, 0);
+      return Map(std::move(root_), _size - 1);
+    }
+
+    // Returns a builder which applies a batch of changes to this map without
+    // copying the nodes it has already copied during the batch. This map is
+    // not modified.
+    TransientMap<K, V, H> transient() const
+    {
+      return TransientMap<K, V, H>(root, _size);
     }
 
     template <class F>
     bool foreach(F&& f) const
     {
-      return root->foreach(0, std::forward<F>(f));
+      return root->foreach(std::forward<F>(f));
+    }
+  };
+
+  // A map under construction. Each put or remove copies only the nodes on its
+  // path that were not already created by this builder, and mutates the rest
+  // in place.
+  // persistent() returns the result as a Map, after which the builder can no
+  // longer be used.
+  template <class K, class V, class H = std::hash<K>>
+  class TransientMap
+  {
+  private:
+    friend class Map<K, V, H>;
+
+    NodeRef<K, V, H> root;
+    size_t _size;
+    Edit edit;
+
+    TransientMap(NodeRef<K, V, H> root_, size_t size_) :
+      root(std::move(root_)),
+      _size(size_),
+      edit(new_edit())
+    {}
+
+    void check_editable() const
+    {
+      if (edit == 0)
+        throw std::logic_error("Transient map used after persistent()");
+    }
+
+  public:
+    size_t size() const
+    {
+      check_editable();
+      return _size;
+    }
+
+    std::optional<V> get(const K& key) const
+    {
+      auto v = getp(key);
+
+      if (v)
+        return *v;
+      else
+        return {};
+    }
+
+    const V* getp(const K& key) const
+    {
+      check_editable();
+      return root->getp(0, H()(key), key);
+    }
+
+    void put(const K& key, const V& value)
+    {
+      check_editable();
+      if (Node<K, V, H>::put(root, 0, H()(key), key, value, edit))
+        _size++;
+    }
+
+    // Returns true if the key was present
+    bool remove(const K& key)
+    {
+      check_editable();
+      const auto hash = H()(key);
+      if (root->getp(0, hash, key) == nullptr)
+        return false;
+
+      Node<K, V, H>::remove(root, 0, hash, key, edit);
+      _size--;
+      return true;
+    }
+
+    Map<K, V, H> persistent()
+    {
+      check_editable();
+      edit = 0;
+      return Map<K, V, H>(std::move(root), _size);
     }
   };
 }
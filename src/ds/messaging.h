@@ -7,10 +7,15 @@
 #include "spinlock.h"
 #include "thread_messaging.h"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <map>
+#include <memory>
 #include <stdexcept>
+#include <vector>
 
 namespace messaging
 {
@@ -26,15 +31,162 @@ namespace messaging
     using logic_error::logic_error;
   };
 
+  /** Counters kept by a Dispatcher for each message type it handles
+   */
+  struct MessageStats
+  {
+    static constexpr size_t latency_buckets = 32;
+
+    // Number of messages dispatched to the handler
+    size_t count = 0;
+    // Total size of the bodies of those messages
+    size_t bytes = 0;
+    // Time spent in the handler. Bucket i counts calls which took from 2^i to
+    // 2^(i+1) - 1 ns, and the last bucket also counts anything slower. Only
+    // recorded by Dispatchers which measure latency.
+    std::array<size_t, latency_buckets> latency_ns = {};
+
+    void record_latency(uint64_t ns)
+    {
+      size_t bucket = 0;
+      if (ns > 1)
+      {
+        bucket = 63 - __builtin_clzll(ns);
+      }
+      ++latency_ns[std::min(bucket, latency_buckets - 1)];
+    }
+
+    /** Upper bound of the bucket containing the given quantile (0.0 to 1.0)
+     * of recorded latencies, or 0 if none have been recorded
+     */
+    uint64_t latency_quantile_ns(double q) const
+    {
+      size_t recorded = 0;
+      for (auto n : latency_ns)
+      {
+        recorded += n;
+      }
+
+      if (recorded == 0)
+      {
+        return 0;
+      }
+
+      const auto target = std::max<size_t>(1, q * recorded);
+      size_t seen = 0;
+      size_t bucket = 0;
+      for (; bucket < latency_buckets - 1; ++bucket)
+      {
+        seen += latency_ns[bucket];
+        if (seen >= target)
+        {
+          break;
+        }
+      }
+
+      return (uint64_t(1) << (bucket + 1)) - 1;
+    }
+  };
+
   template <typename MessageType>
   class Dispatcher
   {
+    struct Entry
+    {
+      Handler handler;
+      char const* label;
+      MessageStats stats;
+    };
+
+    // Handlers live in a flat, open-addressed table with linear probing. Its
+    // capacity is a power of two, and at least twice the number of handlers,
+    // so a lookup is a mask and usually a single probe. Message types are
+    // small integers or fnv_1a hashes, so their low bits are used directly as
+    // the index. Entries are allocated separately so that they do not move
+    // when the table grows, since handlers may register further handlers.
+    struct Slot
+    {
+      MessageType m;
+      std::unique_ptr<Entry> entry;
+    };
+
+    static constexpr size_t initial_capacity = 128;
+
     // Store a name to distinguish error messages
     char const* const name;
 
-    std::map<MessageType, Handler> handlers;
+    // If set, the time spent in each handler is recorded in its stats
+    const bool measure_latency;
+
+    std::vector<Slot> slots;
+    size_t handler_count = 0;
+
+    // Labels are kept after a handler is removed, for error messages
     std::map<MessageType, char const*> message_labels;
 
+    size_t home_index(MessageType m) const
+    {
+      return static_cast<size_t>(m) & (slots.size() - 1);
+    }
+
+    // Returns the index of the slot holding m, or of the empty slot where m
+    // would be inserted
+    size_t find_index(MessageType m) const
+    {
+      const auto mask = slots.size() - 1;
+      auto i = home_index(m);
+      while (slots[i].entry != nullptr && slots[i].m != m)
+      {
+        i = (i + 1) & mask;
+      }
+      return i;
+    }
+
+    Entry* find(MessageType m) const
+    {
+      return slots[find_index(m)].entry.get();
+    }
+
+    void grow()
+    {
+      std::vector<Slot> old(slots.size() * 2);
+      std::swap(old, slots);
+
+      for (auto& slot : old)
+      {
+        if (slot.entry != nullptr)
+        {
+          slots[find_index(slot.m)] = std::move(slot);
+        }
+      }
+    }
+
+    // Removes the entry at index i, shifting back any entries further along
+    // its probe sequence so that no tombstone is needed
+    std::unique_ptr<Entry> erase_index(size_t i)
+    {
+      const auto mask = slots.size() - 1;
+      auto removed = std::move(slots[i].entry);
+
+      auto hole = i;
+      auto j = (i + 1) & mask;
+      while (slots[j].entry != nullptr)
+      {
+        const auto home = home_index(slots[j].m);
+        // Move j into the hole unless its home lies cyclically in (hole, j]
+        const auto dist_home = (j - home) & mask;
+        const auto dist_hole = (j - hole) & mask;
+        if (dist_home >= dist_hole)
+        {
+          slots[hole] = std::move(slots[j]);
+          hole = j;
+        }
+        j = (j + 1) & mask;
+      }
+
+      return removed;
+    }
+
     std::string get_error_prefix()
     {
       return std::string("[") + std::string(name) + std::string("] ");
@@ -59,7 +211,11 @@ namespace messaging
     }
 
   public:
-    Dispatcher(char const* name) : name(name), handlers() {}
+    Dispatcher(char const* name, bool measure_latency = false) :
+      name(name),
+      measure_latency(measure_latency),
+      slots(initial_capacity)
+    {}
 
     /** Set a callback for this message type
      *
@@ -76,9 +232,7 @@ namespace messaging
     void set_message_handler(
       MessageType m, char const* message_label, Handler h)
     {
-      // Check for presence first, so we only copy if we're actually inserting
-      auto it = handlers.find(m);
-      if (it != handlers.end())
+      if (find(m) != nullptr)
       {
         throw already_handled(
           get_error_prefix() + "MessageType " + std::to_string(m) +
@@ -87,7 +241,16 @@ namespace messaging
       }
 
       LOG_DEBUG_FMT("Setting handler for {} ({})", message_label, m);
-      handlers.insert(it, {m, h});
+
+      if ((handler_count + 1) * 2 > slots.size())
+      {
+        grow();
+      }
+
+      auto& slot = slots[find_index(m)];
+      slot.m = m;
+      slot.entry.reset(new Entry{std::move(h), message_label, {}});
+      ++handler_count;
 
       if (message_label != nullptr)
       {
@@ -104,8 +267,8 @@ namespace messaging
      */
     void remove_message_handler(MessageType m)
     {
-      auto it = handlers.find(m);
-      if (it == handlers.end())
+      const auto i = find_index(m);
+      if (slots[i].entry == nullptr)
       {
         throw no_handler(
           get_error_prefix() +
@@ -113,7 +276,8 @@ namespace messaging
           get_message_name(m));
       }
 
-      handlers.erase(it);
+      erase_index(i);
+      --handler_count;
     }
 
     /** Is handler already registered for this message type
@@ -123,7 +287,7 @@ namespace messaging
      */
     bool has_handler(MessageType m)
     {
-      return handlers.find(m) != handlers.end();
+      return find(m) != nullptr;
     }
 
     /** Dispatch a single message
@@ -135,16 +299,53 @@ namespace messaging
      */
     void dispatch(MessageType m, const uint8_t* data, size_t size)
     {
-      auto it = handlers.find(m);
-      if (it == handlers.end())
+      auto entry = find(m);
+      if (entry == nullptr)
       {
         throw no_handler(
           get_error_prefix() +
           "No handler for this message: " + get_message_name(m));
       }
 
-      // Handlers may register or remove handlers, so iterator is invalidated
-      it->second(data, size);
+      auto& stats = entry->stats;
+      ++stats.count;
+      stats.bytes += size;
+
+      if (!measure_latency)
+      {
+        entry->handler(data, size);
+        return;
+      }
+
+      // Handlers may remove their own handler, so the entry must not be
+      // touched after the call
+      const auto start = std::chrono::steady_clock::now();
+      entry->handler(data, size);
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+
+      if (auto current = find(m); current != nullptr)
+      {
+        current->stats.record_latency(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+            .count());
+      }
+    }
+
+    /** Visit the stats of every registered handler
+     *
+     * f is called with the label and type of each handled message, and the
+     * stats for that message type, in no particular order.
+     */
+    template <typename F>
+    void foreach_message_stats(F&& f) const
+    {
+      for (const auto& slot : slots)
+      {
+        if (slot.entry != nullptr)
+        {
+          f(slot.entry->label, slot.m, slot.entry->stats);
+        }
+      }
     }
   };
 
@@ -156,7 +357,9 @@ namespace messaging
     std::atomic<bool> finished;
 
   public:
-    BufferProcessor(char const* name = "") : dispatcher(name), finished(false)
+    BufferProcessor(char const* name = "", bool measure_latency = false) :
+      dispatcher(name, measure_latency),
+      finished(false)
     {}
 
     RingbufferDispatcher& get_dispatcher()
@@ -181,13 +384,15 @@ namespace messaging
 
       while (!finished.load() && total_read < max_messages)
       {
-        // Read one at a time so we don't process any after being told to stop
+        // Read as many as are available in one pass over the buffer, but stop
+        // as soon as we are told to, so we don't process any after that
         auto read = r.read(
-          1,
+          max_messages - total_read,
           [& d = dispatcher](
             ringbuffer::Message m, const uint8_t* data, size_t size) {
             d.dispatch(m, data, size);
-          });
+          },
+          [this]() { return finished.load(std::memory_order_relaxed); });
 
         total_read += read;
 
@@ -205,22 +410,46 @@ namespace messaging
       size_t total_read = 0;
 
       uint16_t tid = thread_ids[std::this_thread::get_id()];
+      auto& thread_messaging = enclave::ThreadMessaging::thread_messaging;
 
-      while (!finished.load())
-      {
-        auto num_read = read_n(-1, r);
-        if (num_read != 0)
-        {
-          total_read += num_read;
-        }
+      // Ringbuffer writers and thread messages both wake this thread through
+      // the reader's spot
+      auto& spot = r.get_spot();
+      auto previous_spot = thread_messaging.set_parking_spot(tid, &spot);
+      parking::Idler idler;
 
-        bool task_run = enclave::ThreadMessaging::thread_messaging.run_one(tid);
-
-        if (num_read == 0 && !task_run)
+      try
+      {
+        while (!finished.load())
         {
-          CCF_PAUSE();
+          auto num_read = read_n(-1, r);
+          if (num_read != 0)
+          {
+            total_read += num_read;
+          }
+
+          bool task_run = thread_messaging.run_one(tid);
+
+          if (num_read == 0 && !task_run)
+          {
+            idler.idle(spot, [&]() {
+              return !r.is_empty() || thread_messaging.has_tasks(tid) ||
+                finished.load();
+            });
+          }
+          else
+          {
+            idler.reset();
+          }
         }
       }
+      catch (...)
+      {
+        thread_messaging.set_parking_spot(tid, previous_spot);
+        throw;
+      }
+
+      thread_messaging.set_parking_spot(tid, previous_spot);
 
       return total_read;
     }
@@ -0,0 +1,142 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#if !defined(INSIDE_ENCLAVE) || defined(VIRTUAL_ENCLAVE)
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+// Ideally this would be _mm_pause or similar, but finding cross-platform
+// headers that expose this neatly through OE (ie - non-standard std libs) is
+// awkward. Instead we resort to copying OE, and implementing this directly
+// ourselves.
+#define CCF_PAUSE() asm volatile("pause")
+
+// Threads which poll for work (ringbuffer readers, thread messaging queues)
+// spin for a bounded number of empty polls, then park until a producer
+// notifies them. Parking is a futex wait performed by the host, so a Spot must
+// live in host memory: inside an SGX enclave, waits and wakes are ocalls.
+// A consumer on the host's uv loop cannot block on the futex, and instead
+// sets the spot's event_fd, which wakes also signal.
+
+namespace parking
+{
+  struct Spot
+  {
+    // Incremented by every notification which may have to wake a thread
+    std::atomic<uint32_t> epoch = 0;
+    // Number of threads which are parked, or are about to park, on this spot
+    std::atomic<uint32_t> waiters = 0;
+    // If not -1, an eventfd to signal on every wake, for a consumer which
+    // waits for it to be readable (see asynchost::EveryIO)
+    std::atomic<int> event_fd = -1;
+  };
+
+  // Maximum time a thread stays parked without being notified. Wake-ups are
+  // not expected to be lost, but this bounds the cost if one ever is.
+  static constexpr uint32_t park_timeout_ms = 10;
+
+#if defined(INSIDE_ENCLAVE) && !defined(VIRTUAL_ENCLAVE)
+  // Implemented in enclave/main.cpp, as ocalls to the host
+  void wait(Spot& spot, uint32_t epoch, uint32_t timeout_ms);
+  void wake(Spot& spot);
+#else
+  inline void wait(Spot& spot, uint32_t epoch, uint32_t timeout_ms)
+  {
+    timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000;
+    syscall(
+      SYS_futex,
+      reinterpret_cast<uint32_t*>(&spot.epoch),
+      FUTEX_WAIT_PRIVATE,
+      epoch,
+      &timeout,
+      nullptr,
+      0);
+  }
+
+  inline void wake(Spot& spot)
+  {
+    syscall(
+      SYS_futex,
+      reinterpret_cast<uint32_t*>(&spot.epoch),
+      FUTEX_WAKE_PRIVATE,
+      INT32_MAX,
+      nullptr,
+      nullptr,
+      0);
+
+    const auto fd = spot.event_fd.load();
+    if (fd >= 0)
+    {
+      const uint64_t one = 1;
+      [[maybe_unused]] auto rc = write(fd, &one, sizeof(one));
+    }
+  }
+#endif
+
+  /** Called by a producer after publishing work. This is a fence and a load
+   * unless a consumer is parked, or about to park, on the spot.
+   */
+  inline void notify(Spot& spot)
+  {
+    // Orders the publication of the work before the check for waiters. Pairs
+    // with the increment of waiters in Idler::idle.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (spot.waiters.load(std::memory_order_relaxed) != 0)
+    {
+      spot.epoch.fetch_add(1);
+      wake(spot);
+    }
+  }
+
+  /** Wait strategy for a consumer which found no work. It spins for a bounded
+   * number of consecutive empty polls, so that bursts of work are picked up
+   * without a wake-up, then parks until notified.
+   */
+  class Idler
+  {
+  private:
+    size_t empty_polls = 0;
+
+  public:
+    static constexpr size_t spin_polls = 1 << 12;
+
+    //! Called when a poll found work
+    void reset()
+    {
+      empty_polls = 0;
+    }
+
+    /** Called when a poll found no work. has_work is checked again after
+     * registering as a waiter, so that work published concurrently is not
+     * missed.
+     */
+    template <typename F>
+    void idle(Spot& spot, F&& has_work)
+    {
+      if (empty_polls < spin_polls)
+      {
+        ++empty_polls;
+        CCF_PAUSE();
+        return;
+      }
+
+      const auto epoch = spot.epoch.load();
+      spot.waiters.fetch_add(1);
+      if (!has_work())
+      {
+        wait(spot, epoch, park_timeout_ms);
+      }
+      spot.waiters.fetch_sub(1);
+    }
+  };
+}
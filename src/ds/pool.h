@@ -0,0 +1,93 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace ds
+{
+  struct PoolMetrics
+  {
+    // Objects handed out from the free list
+    size_t hits = 0;
+    // Objects that had to be allocated because the free list was empty
+    size_t misses = 0;
+    // Objects released while the free list was full, and deallocated
+    size_t discards = 0;
+  };
+
+  /**
+   * Pool of default-initialised objects of type T, recycled through a free
+   * list rather than returned to the allocator. At most max_free objects are
+   * kept in the free list, so that a burst does not pin memory forever.
+   *
+   * A pool is not thread-safe, and should only be used from a single thread
+   * (e.g. the thread running a uv loop).
+   */
+  template <typename T>
+  class Pool
+  {
+  public:
+    static constexpr size_t default_max_free = 1024;
+
+  private:
+    std::vector<std::unique_ptr<T>> free_list;
+    size_t max_free;
+    PoolMetrics metrics;
+
+  public:
+    Pool(size_t max_free_ = default_max_free) : max_free(max_free_)
+    {
+      free_list.reserve(max_free);
+    }
+
+    Pool(const Pool& that) = delete;
+
+    std::unique_ptr<T> acquire()
+    {
+      if (free_list.empty())
+      {
+        metrics.misses++;
+        // Default initialisation, so that buffers are not zeroed
+        return std::unique_ptr<T>(new T);
+      }
+
+      metrics.hits++;
+      auto obj = std::move(free_list.back());
+      free_list.pop_back();
+      return obj;
+    }
+
+    void release(std::unique_ptr<T> obj)
+    {
+      if (obj == nullptr)
+        return;
+
+      if (free_list.size() < max_free)
+        free_list.push_back(std::move(obj));
+      else
+        metrics.discards++;
+    }
+
+    // Objects already in the free list beyond the new limit are deallocated.
+    // A limit of 0 disables pooling.
+    void set_max_free(size_t max_free_)
+    {
+      max_free = max_free_;
+      if (free_list.size() > max_free)
+        free_list.resize(max_free);
+    }
+
+    size_t get_free_count() const
+    {
+      return free_list.size();
+    }
+
+    const PoolMetrics& get_metrics() const
+    {
+      return metrics;
+    }
+  };
+}
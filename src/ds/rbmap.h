@@ -5,6 +5,10 @@
 #include <cassert>
 #include <memory>
 #include <optional>
+#include <stdexcept>
+
+template <class K, class V>
+class TransientRBMap;
 
 template <class K, class V>
 class RBMap
@@ -40,9 +44,11 @@ private:
 
   explicit RBMap(std::shared_ptr<const Node> const& node) : _root(node) {}
 
+  // Nodes are not created const, so that the value of an entry that is not
+  // shared yet may be updated in place
   RBMap(
     Color c, const RBMap& lft, const K& key, const V& val, const RBMap& rgt) :
-    _root(std::make_shared<const Node>(c, lft._root, key, val, rgt._root))
+    _root(std::make_shared<Node>(c, lft._root, key, val, rgt._root))
   {
     assert(lft.empty() || lft.rootKey() < key);
     assert(rgt.empty() || key < rgt.rootKey());
@@ -56,6 +62,17 @@ public:
     return !_root;
   }
 
+  size_t size() const
+  {
+    return _size;
+  }
+
+  // Maps that share their root have the same contents
+  bool same_root(const RBMap& other) const
+  {
+    return _root == other._root;
+  }
+
   std::optional<V> get(const K& key) const
   {
     auto v = getp(key);
@@ -83,23 +100,63 @@ public:
 
   RBMap put(const K& key, const V& value) const
   {
-    RBMap t = insert(key, value);
-    return RBMap(B, t.left(), t.rootKey(), t.rootValue(), t.right());
+    bool inserted = false;
+    RBMap t = insert(key, value, inserted);
+    RBMap r(B, t.left(), t.rootKey(), t.rootValue(), t.right());
+    r._size = _size + (inserted ? 1 : 0);
+    return r;
+  }
+
+  RBMap remove(const K& key) const
+  {
+    if (getp(key) == nullptr)
+      return *this;
+
+    RBMap t = del(key);
+    RBMap r = t.empty() ? RBMap() : t.paint(B);
+    r._size = _size - 1;
+    return r;
+  }
+
+  TransientRBMap<K, V> transient() const
+  {
+    return TransientRBMap<K, V>(*this);
   }
 
   template <class F>
-  void foreach(F&& f) const
+  bool foreach(F&& f) const
   {
-    if (!empty())
-    {
-      left().foreach(std::forward<F>(f));
-      f(rootKey(), rootValue());
+    if (empty())
+      return true;
+
+    return left().foreach(std::forward<F>(f)) && f(rootKey(), rootValue()) &&
       right().foreach(std::forward<F>(f));
-    }
+  }
+
+  // Calls f in key order on the entries with keys from lo up to, but not
+  // including, hi. If hi is empty, the range is not bounded above.
+  template <class F>
+  bool foreach_range(const K& lo, const std::optional<K>& hi, F&& f) const
+  {
+    if (empty())
+      return true;
+
+    const K& k = rootKey();
+
+    if (k < lo)
+      return right().foreach_range(lo, hi, std::forward<F>(f));
+
+    if (hi.has_value() && !(k < hi.value()))
+      return left().foreach_range(lo, hi, std::forward<F>(f));
+
+    return left().foreach_range(lo, hi, std::forward<F>(f)) &&
+      f(k, rootValue()) && right().foreach_range(lo, hi, std::forward<F>(f));
   }
 
 private:
   std::shared_ptr<const Node> _root;
+  // Only maintained for whole maps, not for the subtrees used internally
+  size_t _size = 0;
 
   Color rootColor() const
   {
@@ -126,10 +183,13 @@ private:
     return RBMap(_root->_rgt);
   }
 
-  RBMap insert(const K& x, const V& v) const
+  RBMap insert(const K& x, const V& v, bool& inserted) const
   {
     if (empty())
+    {
+      inserted = true;
       return RBMap(R, RBMap(), x, v, RBMap());
+    }
 
     const K& y = rootKey();
     const V& yv = rootValue();
@@ -138,18 +198,18 @@ private:
     if (rootColor() == B)
     {
       if (x < y)
-        return balance(left().insert(x, v), y, yv, right());
+        return balance(left().insert(x, v, inserted), y, yv, right());
       else if (y < x)
-        return balance(left(), y, yv, right().insert(x, v));
+        return balance(left(), y, yv, right().insert(x, v, inserted));
       else
         return RBMap(c, left(), y, v, right());
     }
     else
     {
       if (x < y)
-        return RBMap(c, left().insert(x, v), y, yv, right());
+        return RBMap(c, left().insert(x, v, inserted), y, yv, right());
       else if (y < x)
-        return RBMap(c, left(), y, yv, right().insert(x, v));
+        return RBMap(c, left(), y, yv, right().insert(x, v, inserted));
       else
         return RBMap(c, left(), y, v, right());
     }
@@ -209,4 +269,233 @@ private:
   {
     return RBMap(c, left(), rootKey(), rootValue(), right());
   }
+
+  bool isRed() const
+  {
+    return !empty() && rootColor() == R;
+  }
+
+  bool isBlack() const
+  {
+    return !empty() && rootColor() == B;
+  }
+
+  // Deletion follows Kahrs, 'Red-black trees with types' (2001). x must be
+  // present. The root of the result may be red.
+  RBMap del(const K& x) const
+  {
+    const K& y = rootKey();
+    const V& yv = rootValue();
+
+    if (x < y)
+    {
+      if (left().isBlack())
+        return balanceLeft(left().del(x), y, yv, right());
+      else
+        return RBMap(R, left().del(x), y, yv, right());
+    }
+    else if (y < x)
+    {
+      if (right().isBlack())
+        return balanceRight(left(), y, yv, right().del(x));
+      else
+        return RBMap(R, left(), y, yv, right().del(x));
+    }
+    else
+      return fuse(left(), right());
+  }
+
+  // Balances a node whose left subtree is one black node shorter than its
+  // right subtree
+  static RBMap balanceLeft(
+    const RBMap& lft, const K& x, const V& v, const RBMap& rgt)
+  {
+    if (lft.isRed())
+      return RBMap(R, lft.paint(B), x, v, rgt);
+    else if (rgt.isBlack())
+      return rebalance(lft, x, v, rgt.paint(R));
+    else if (rgt.isRed() && rgt.left().isBlack())
+      return RBMap(
+        R,
+        RBMap(B, lft, x, v, rgt.left().left()),
+        rgt.left().rootKey(),
+        rgt.left().rootValue(),
+        rebalance(
+          rgt.left().right(),
+          rgt.rootKey(),
+          rgt.rootValue(),
+          redden(rgt.right())));
+    else
+      throw std::logic_error("Red-black tree invariant violated");
+  }
+
+  // Balances a node whose right subtree is one black node shorter than its
+  // left subtree
+  static RBMap balanceRight(
+    const RBMap& lft, const K& x, const V& v, const RBMap& rgt)
+  {
+    if (rgt.isRed())
+      return RBMap(R, lft, x, v, rgt.paint(B));
+    else if (lft.isBlack())
+      return rebalance(lft.paint(R), x, v, rgt);
+    else if (lft.isRed() && lft.right().isBlack())
+      return RBMap(
+        R,
+        rebalance(
+          redden(lft.left()),
+          lft.rootKey(),
+          lft.rootValue(),
+          lft.right().left()),
+        lft.right().rootKey(),
+        lft.right().rootValue(),
+        RBMap(B, lft.right().right(), x, v, rgt));
+    else
+      throw std::logic_error("Red-black tree invariant violated");
+  }
+
+  static RBMap redden(const RBMap& t)
+  {
+    if (!t.isBlack())
+      throw std::logic_error("Red-black tree invariant violated");
+    return t.paint(R);
+  }
+
+  // Like balance, but also resolves a node with two red children
+  static RBMap rebalance(
+    const RBMap& lft, const K& x, const V& v, const RBMap& rgt)
+  {
+    if (lft.isRed() && rgt.isRed())
+      return RBMap(R, lft.paint(B), x, v, rgt.paint(B));
+    else if (lft.doubledLeft())
+      return RBMap(
+        R,
+        lft.left().paint(B),
+        lft.rootKey(),
+        lft.rootValue(),
+        RBMap(B, lft.right(), x, v, rgt));
+    else if (lft.doubledRight())
+      return RBMap(
+        R,
+        RBMap(
+          B, lft.left(), lft.rootKey(), lft.rootValue(), lft.right().left()),
+        lft.right().rootKey(),
+        lft.right().rootValue(),
+        RBMap(B, lft.right().right(), x, v, rgt));
+    else if (rgt.doubledRight())
+      return RBMap(
+        R,
+        RBMap(B, lft, x, v, rgt.left()),
+        rgt.rootKey(),
+        rgt.rootValue(),
+        rgt.right().paint(B));
+    else if (rgt.doubledLeft())
+      return RBMap(
+        R,
+        RBMap(B, lft, x, v, rgt.left().left()),
+        rgt.left().rootKey(),
+        rgt.left().rootValue(),
+        RBMap(
+          B, rgt.left().right(), rgt.rootKey(), rgt.rootValue(), rgt.right()));
+    else
+      return RBMap(B, lft, x, v, rgt);
+  }
+
+  // Joins two subtrees of equal black height, all of whose keys in lft are
+  // smaller than those in rgt
+  static RBMap fuse(const RBMap& lft, const RBMap& rgt)
+  {
+    if (lft.empty())
+      return rgt;
+    if (rgt.empty())
+      return lft;
+
+    if (lft.isRed() && rgt.isRed())
+    {
+      auto m = fuse(lft.right(), rgt.left());
+      if (m.isRed())
+        return RBMap(
+          R,
+          RBMap(R, lft.left(), lft.rootKey(), lft.rootValue(), m.left()),
+          m.rootKey(),
+          m.rootValue(),
+          RBMap(R, m.right(), rgt.rootKey(), rgt.rootValue(), rgt.right()));
+      else
+        return RBMap(
+          R,
+          lft.left(),
+          lft.rootKey(),
+          lft.rootValue(),
+          RBMap(R, m, rgt.rootKey(), rgt.rootValue(), rgt.right()));
+    }
+    else if (lft.isBlack() && rgt.isBlack())
+    {
+      auto m = fuse(lft.right(), rgt.left());
+      if (m.isRed())
+        return RBMap(
+          R,
+          RBMap(B, lft.left(), lft.rootKey(), lft.rootValue(), m.left()),
+          m.rootKey(),
+          m.rootValue(),
+          RBMap(B, m.right(), rgt.rootKey(), rgt.rootValue(), rgt.right()));
+      else
+        return balanceLeft(
+          lft.left(),
+          lft.rootKey(),
+          lft.rootValue(),
+          RBMap(B, m, rgt.rootKey(), rgt.rootValue(), rgt.right()));
+    }
+    else if (rgt.isRed())
+      return RBMap(
+        R, fuse(lft, rgt.left()), rgt.rootKey(), rgt.rootValue(), rgt.right());
+    else
+      return RBMap(
+        R, lft.left(), lft.rootKey(), lft.rootValue(), fuse(lft.right(), rgt));
+  }
+};
+
+// Applies a batch of changes to an RBMap, with the same interface as
+// champ::TransientMap. Each change still copies its path.
+template <class K, class V>
+class TransientRBMap
+{
+private:
+  friend class RBMap<K, V>;
+
+  RBMap<K, V> map;
+
+  TransientRBMap(const RBMap<K, V>& map_) : map(map_) {}
+
+public:
+  size_t size() const
+  {
+    return map.size();
+  }
+
+  std::optional<V> get(const K& key) const
+  {
+    return map.get(key);
+  }
+
+  const V* getp(const K& key) const
+  {
+    return map.getp(key);
+  }
+
+  void put(const K& key, const V& value)
+  {
+    map = map.put(key, value);
+  }
+
+  // Returns true if the key was present
+  bool remove(const K& key)
+  {
+    const auto size = map.size();
+    map = map.remove(key);
+    return map.size() != size;
+  }
+
+  RBMap<K, V> persistent()
+  {
+    return std::move(map);
+  }
 };
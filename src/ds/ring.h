@@ -0,0 +1,163 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace ds
+{
+  /**
+   * Double-ended queue of T, stored contiguously in a circular buffer with a
+   * power-of-two number of slots. Elements are accessed by position in
+   * constant time, so that a queue ordered by some key can be binary searched.
+   *
+   * Slots are reused as elements are pushed and popped: a queue whose size is
+   * stable does not allocate. The buffer grows by doubling when full, and
+   * shrinks by half when less than a quarter full, so that its memory stays
+   * bounded by the size of the queue. Growing or shrinking moves all
+   * elements, which invalidates references to them.
+   *
+   * T must be default-constructible and move-assignable. Popped slots are
+   * reset to T(), so that the resources held by popped elements are released.
+   */
+  template <typename T>
+  class Ring
+  {
+  public:
+    static constexpr size_t min_capacity = 8;
+
+  private:
+    std::vector<T> slots;
+    size_t head = 0;
+    size_t count = 0;
+
+    size_t slot(size_t i) const
+    {
+      return (head + i) & (slots.size() - 1);
+    }
+
+    void resize(size_t capacity)
+    {
+      std::vector<T> resized(capacity);
+      for (size_t i = 0; i < count; ++i)
+        resized[i] = std::move(slots[slot(i)]);
+
+      slots.swap(resized);
+      head = 0;
+    }
+
+    void maybe_shrink()
+    {
+      if (slots.size() > min_capacity && count < slots.size() / 4)
+        resize(slots.size() / 2);
+    }
+
+  public:
+    Ring() : slots(min_capacity) {}
+
+    size_t size() const
+    {
+      return count;
+    }
+
+    bool empty() const
+    {
+      return count == 0;
+    }
+
+    size_t capacity() const
+    {
+      return slots.size();
+    }
+
+    T& operator[](size_t i)
+    {
+      return slots[slot(i)];
+    }
+
+    const T& operator[](size_t i) const
+    {
+      return slots[slot(i)];
+    }
+
+    T& front()
+    {
+      return slots[head];
+    }
+
+    const T& front() const
+    {
+      return slots[head];
+    }
+
+    T& back()
+    {
+      return slots[slot(count - 1)];
+    }
+
+    const T& back() const
+    {
+      return slots[slot(count - 1)];
+    }
+
+    void push_back(T&& t)
+    {
+      if (count == slots.size())
+        resize(2 * slots.size());
+
+      slots[slot(count)] = std::move(t);
+      count++;
+    }
+
+    void pop_front()
+    {
+      if (count == 0)
+        throw std::logic_error("Cannot pop from an empty ring");
+
+      slots[head] = T();
+      head = slot(1);
+      count--;
+      maybe_shrink();
+    }
+
+    void pop_back()
+    {
+      if (count == 0)
+        throw std::logic_error("Cannot pop from an empty ring");
+
+      count--;
+      slots[slot(count)] = T();
+      maybe_shrink();
+    }
+
+    void clear()
+    {
+      std::vector<T>(min_capacity).swap(slots);
+      head = 0;
+      count = 0;
+    }
+
+    /**
+     * Position of the first element for which less(value, element) is true,
+     * or size() if there is none, assuming elements are ordered by less.
+     */
+    template <typename V, typename Less>
+    size_t upper_bound(const V& value, Less&& less) const
+    {
+      size_t lo = 0;
+      size_t hi = count;
+      while (lo < hi)
+      {
+        const auto mid = lo + (hi - lo) / 2;
+        if (less(value, (*this)[mid]))
+          hi = mid;
+        else
+          lo = mid + 1;
+      }
+      return lo;
+    }
+  };
+}
@@ -2,18 +2,13 @@
 // Licensed under the Apache 2.0 License.
 #pragma once
 
+#include "parking.h"
 #include "ringbuffer_types.h"
 
 #include <atomic>
 #include <cstring>
 #include <functional>
 
-// Ideally this would be _mm_pause or similar, but finding cross-platform
-// headers that expose this neatly through OE (ie - non-standard std libs) is
-// awkward. Instead we resort to copying OE, and implementing this directly
-// ourselves.
-#define CCF_PAUSE() asm volatile("pause")
-
 // This file implements a Multiple-Producer Single-Consumer ringbuffer.
 
 // A single Reader instance owns an underlying memory buffer, and a single
@@ -41,6 +36,8 @@ namespace ringbuffer
     std::atomic<size_t> head_cache;
     std::atomic<size_t> tail;
     alignas(CACHELINE_SIZE) std::atomic<size_t> head;
+    // Where the reader parks when the buffer stays empty
+    alignas(CACHELINE_SIZE) parking::Spot spot;
   };
 
   struct Const
@@ -117,7 +114,32 @@ namespace ringbuffer
       v{{0}, {0}, {0}}
     {}
 
-    size_t read(size_t limit, Handler f)
+    parking::Spot& get_spot()
+    {
+      return v.spot;
+    }
+
+    /** Returns true if there is nothing at the head of the buffer, not even a
+     * pending write
+     */
+    bool is_empty()
+    {
+      auto mask = c.size - 1;
+      auto hd = v.head.load(std::memory_order_acquire);
+      return message(read64(hd & mask)) == Const::msg_none;
+    }
+
+    template <typename F>
+    size_t read(size_t limit, F&& f)
+    {
+      return read(limit, std::forward<F>(f), []() { return false; });
+    }
+
+    /** Reads up to limit messages, calling f on each. stop is checked before
+     * each message, and no further messages are read once it returns true.
+     */
+    template <typename F, typename Stop>
+    size_t read(size_t limit, F&& f, Stop&& stop)
     {
       auto mask = c.size - 1;
       auto hd = v.head.load(std::memory_order_acquire);
@@ -126,7 +148,7 @@ namespace ringbuffer
       size_t advance = 0;
       size_t count = 0;
 
-      while ((advance < block) && (count < limit))
+      while ((advance < block) && (count < limit) && !stop())
       {
         auto msg_index = hd_index + advance;
         auto header = read64(msg_index);
@@ -280,6 +302,9 @@ namespace ringbuffer
         const auto index = marker.value() - Const::header_size();
         auto size = read32(index);
         write32(index, size & length_mask);
+
+        // Wake the reader if it has parked
+        parking::notify(v->spot);
       }
     }
 
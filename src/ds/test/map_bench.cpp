@@ -1,9 +1,11 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the Apache 2.0 License.
-#define PICOBENCH_IMPLEMENT_WITH_MAIN
+#define PICOBENCH_IMPLEMENT
 #include "../champmap.h"
 #include "../rbmap.h"
 
+#include <iostream>
+#include <malloc.h>
 #include <picobench/picobench.hpp>
 
 using namespace std;
@@ -66,6 +68,43 @@ static void benchmark_put(picobench::state& s)
   s.stop_timer();
 }
 
+// Applies a batch of puts to a map of the given size, as a transaction
+// writing many keys does when it commits
+template <class M>
+static void benchmark_put_batch(picobench::state& s)
+{
+  size_t size = s.iterations();
+  auto v = gen_val(val_size);
+  auto map = gen_map<M>(size);
+  s.start_timer();
+  auto res = map;
+  for (auto _ : s)
+  {
+    res = res.put(size + _, v);
+    clobber_memory();
+  }
+  s.stop_timer();
+  do_not_optimize(res);
+}
+
+template <class M>
+static void benchmark_transient_put_batch(picobench::state& s)
+{
+  size_t size = s.iterations();
+  auto v = gen_val(val_size);
+  auto map = gen_map<M>(size);
+  s.start_timer();
+  auto batch = map.transient();
+  for (auto _ : s)
+  {
+    batch.put(size + _, v);
+    clobber_memory();
+  }
+  auto res = batch.persistent();
+  s.stop_timer();
+  do_not_optimize(res);
+}
+
 template <class M>
 static void benchmark_get(picobench::state& s)
 {
@@ -125,6 +164,13 @@ PICOBENCH(bench_rb_map_put).iterations(sizes).samples(10).baseline();
 auto bench_champ_map_put = benchmark_put<champ::Map<K, V>>;
 PICOBENCH(bench_champ_map_put).iterations(sizes).samples(10);
 
+PICOBENCH_SUITE("put batch");
+auto bench_champ_map_put_batch = benchmark_put_batch<champ::Map<K, V>>;
+PICOBENCH(bench_champ_map_put_batch).iterations(sizes).samples(10).baseline();
+auto bench_champ_map_transient_put_batch =
+  benchmark_transient_put_batch<champ::Map<K, V>>;
+PICOBENCH(bench_champ_map_transient_put_batch).iterations(sizes).samples(10);
+
 PICOBENCH_SUITE("get");
 auto bench_rb_map_get = benchmark_get<RBMap<K, V>>;
 PICOBENCH(bench_rb_map_get).iterations(sizes).samples(10).baseline();
@@ -142,3 +188,42 @@ auto bench_rb_map_foreach = benchmark_foreach<RBMap<K, V>>;
 PICOBENCH(bench_rb_map_foreach).iterations(for_sizes).samples(10).baseline();
 auto bench_champ_map_foreach = benchmark_foreach<champ::Map<K, V>>;
 PICOBENCH(bench_champ_map_foreach).iterations(for_sizes).samples(10);
+
+// Heap memory per key of a map from uint64_t to uint64_t with size entries.
+// The champ map is built with a transient, as the kv store does when it
+// installs a snapshot.
+template <class M>
+static double memory_per_key(size_t size)
+{
+  const auto before = (size_t)mallinfo().uordblks;
+  M map = M();
+  if constexpr (std::is_same_v<M, RBMap<K, uint64_t>>)
+  {
+    for (uint64_t i = 0; i < size; ++i)
+      map = map.put(i, i);
+  }
+  else
+  {
+    auto batch = map.transient();
+    for (uint64_t i = 0; i < size; ++i)
+      batch.put(i, i);
+    map = batch.persistent();
+  }
+  return (double)((size_t)mallinfo().uordblks - before) / size;
+}
+
+int main(int argc, char* argv[])
+{
+  picobench::runner runner;
+  runner.parse_cmd_line(argc, argv);
+  const auto ret = runner.run();
+
+  const size_t memory_size = 1 << 20;
+  std::cout << "Memory per key, " << memory_size << " keys:" << std::endl;
+  std::cout << "rb_map: " << memory_per_key<RBMap<K, uint64_t>>(memory_size)
+            << " bytes" << std::endl;
+  std::cout << "champ_map: "
+            << memory_per_key<champ::Map<K, uint64_t>>(memory_size) << " bytes"
+            << std::endl;
+  return ret;
+}
@@ -5,6 +5,8 @@
 #include "../rbmap.h"
 
 #include <doctest/doctest.h>
+#include <malloc.h>
+#include <map>
 #include <random>
 
 using namespace std;
@@ -136,3 +138,272 @@ TEST_CASE("persistent map operations")
     champ = champ_new;
   }
 }
+
+TEST_CASE("transient map operations")
+{
+  champ::Map<K, V, H> base;
+  for (K k = 0; k < 100; ++k)
+    base = base.put(k, k);
+
+  auto ops = gen_ops(500);
+
+  RBMap<K, V> rb;
+  champ::Map<K, V, H> expected = base;
+  base.foreach([&](const auto& k, const auto& v) {
+    rb = rb.put(k, v);
+    return true;
+  });
+
+  auto batch = base.transient();
+  for (auto& op : ops)
+  {
+    auto r = op->apply(rb, expected);
+    rb = r.first;
+    expected = r.second;
+
+    auto put = dynamic_cast<Put*>(op.get());
+    REQUIRE(put != nullptr);
+    batch.put(put->k, put->v);
+    REQUIRE(batch.size() == expected.size());
+    REQUIRE(batch.get(put->k) == put->v);
+  }
+
+  auto result = batch.persistent();
+  REQUIRE_THROWS_AS(batch.put(0, 0), std::logic_error);
+  REQUIRE_THROWS_AS(batch.getp(0), std::logic_error);
+
+  INFO("check the result of the batch matches the persistent puts");
+  {
+    size_t n = 0;
+    result.foreach([&](const auto& k, const auto& v) {
+      n++;
+      auto p = rb.get(k);
+      REQUIRE(p.has_value());
+      REQUIRE(p.value() == v);
+      return true;
+    });
+    REQUIRE(n == expected.size());
+    REQUIRE(result.size() == expected.size());
+  }
+
+  INFO("check the base of the batch is unchanged");
+  {
+    size_t n = 0;
+    base.foreach([&](const auto& k, const auto& v) {
+      n++;
+      REQUIRE(k == v);
+      return true;
+    });
+    REQUIRE(n == 100);
+    REQUIRE(base.size() == 100);
+  }
+
+  INFO("check a later batch does not modify the earlier result");
+  {
+    auto next = result.transient();
+    for (K k = 0; k < 100; ++k)
+      next.put(k, k + 1);
+    auto next_result = next.persistent();
+
+    for (K k = 0; k < 100; ++k)
+    {
+      REQUIRE(next_result.get(k) == k + 1);
+      REQUIRE(result.get(k) == rb.get(k));
+    }
+  }
+}
+
+TEST_CASE("maps of entries stored out of line")
+{
+  using BoxedMap = champ::Map<K, string, H>;
+  static_assert(
+    is_same_v<champ::Slot<K, string>, champ::BoxedEntry<K, string>>);
+
+  vector<BoxedMap> versions = {BoxedMap()};
+  for (K k = 0; k < 1000; ++k)
+    versions.push_back(versions.back().put(k % 300, to_string(k)));
+
+  auto batch = versions.back().transient();
+  for (K k = 0; k < 300; ++k)
+    batch.put(k, "batch");
+  auto result = batch.persistent();
+
+  INFO("every version keeps its own values");
+  for (K v = 0; v < versions.size(); ++v)
+  {
+    const auto& map = versions[v];
+    REQUIRE(map.size() == min<size_t>(v, 300));
+    for (K k = 0; k < min<K>(v, 300); ++k)
+    {
+      K last = k;
+      while (last + 300 < v)
+        last += 300;
+      REQUIRE(map.get(k) == to_string(last));
+    }
+  }
+
+  REQUIRE(result.size() == 300);
+  result.foreach([](const auto& k, const auto& v) {
+    REQUIRE(v == "batch");
+    return true;
+  });
+}
+
+TEST_CASE("persistent and transient removal")
+{
+  random_device rand_dev;
+  mt19937 gen(rand_dev());
+
+  map<K, V> model;
+  champ::Map<K, V, H> champ;
+
+  for (V v = 0; v < 2000; ++v)
+  {
+    auto prev_model = model;
+    auto prev_champ = champ;
+
+    if (model.empty() || gen() % 3 != 0)
+    {
+      const auto k = gen() % 1000;
+      model[k] = v;
+      champ = champ.put(k, v);
+    }
+    else
+    {
+      auto it = model.begin();
+      advance(it, gen() % model.size());
+      const auto k = it->first;
+      model.erase(it);
+      champ = champ.remove(k);
+      REQUIRE(!champ.get(k).has_value());
+    }
+
+    INFO("removing an absent key leaves the map unchanged");
+    REQUIRE(champ.remove(1000).same_root(champ));
+
+    REQUIRE(champ.size() == model.size());
+    REQUIRE(prev_champ.size() == prev_model.size());
+    for (const auto& [k, v] : prev_model)
+      REQUIRE(prev_champ.get(k) == v);
+  }
+
+  size_t n = 0;
+  champ.foreach([&](const auto& k, const auto& v) {
+    n++;
+    REQUIRE(model.at(k) == v);
+    return true;
+  });
+  REQUIRE(n == model.size());
+
+  INFO("remove every key in a batch");
+  auto batch = champ.transient();
+  for (const auto& [k, v] : model)
+  {
+    REQUIRE(batch.remove(k));
+    REQUIRE(!batch.remove(k));
+  }
+  auto emptied = batch.persistent();
+  REQUIRE(emptied.empty());
+  REQUIRE(emptied.foreach([](const auto&, const auto&) { return false; }));
+  REQUIRE(champ.size() == model.size());
+
+  INFO("the emptied map can be reused");
+  emptied = emptied.put(1, 1);
+  REQUIRE(emptied.get(1) == 1);
+  REQUIRE(emptied.size() == 1);
+}
+
+TEST_CASE("ordered map removal and ranges")
+{
+  random_device rand_dev;
+  mt19937 gen(rand_dev());
+
+  map<K, V> model;
+  RBMap<K, V> rb;
+
+  for (V v = 0; v < 2000; ++v)
+  {
+    auto prev_model = model;
+    auto prev_rb = rb;
+
+    const auto k = gen() % 1000;
+    if (gen() % 3 != 0)
+    {
+      model[k] = v;
+      rb = rb.put(k, v);
+    }
+    else
+    {
+      model.erase(k);
+      rb = rb.remove(k);
+      REQUIRE(!rb.get(k).has_value());
+    }
+
+    REQUIRE(rb.size() == model.size());
+    REQUIRE(prev_rb.size() == prev_model.size());
+    for (const auto& [k, v] : prev_model)
+      REQUIRE(prev_rb.get(k) == v);
+  }
+
+  INFO("ranges are visited in key order");
+  for (size_t i = 0; i < 100; ++i)
+  {
+    const K lo = gen() % 1100;
+    optional<K> hi;
+    if (i % 10 != 0)
+      hi = lo + gen() % 200;
+
+    auto it = model.lower_bound(lo);
+    REQUIRE(rb.foreach_range(lo, hi, [&](const auto& k, const auto& v) {
+      REQUIRE(it != model.end());
+      REQUIRE(it->first == k);
+      REQUIRE(it->second == v);
+      ++it;
+      return true;
+    }));
+    REQUIRE((it == model.end() || (hi.has_value() && it->first >= *hi)));
+  }
+
+  INFO("remove every key in a batch");
+  auto batch = rb.transient();
+  for (const auto& [k, v] : model)
+  {
+    REQUIRE(batch.remove(k));
+    REQUIRE(!batch.remove(k));
+  }
+  REQUIRE(batch.persistent().empty());
+  REQUIRE(rb.size() == model.size());
+}
+
+TEST_CASE("churn reaches a steady state")
+{
+  constexpr size_t live_keys = 10000;
+  champ::Map<K, V> map;
+  K next = 0;
+
+  auto churn = [&](size_t rounds) {
+    for (size_t r = 0; r < rounds; ++r)
+    {
+      auto batch = map.transient();
+      for (size_t i = 0; i < live_keys / 10; ++i)
+      {
+        batch.put(next + live_keys, next);
+        batch.remove(next);
+        ++next;
+      }
+      map = batch.persistent();
+    }
+  };
+
+  for (K k = 0; k < live_keys; ++k)
+    map = map.put(k, k);
+
+  churn(20);
+  const auto warm = (size_t)mallinfo().uordblks;
+  churn(200);
+  const auto steady = (size_t)mallinfo().uordblks;
+
+  REQUIRE(map.size() == live_keys);
+  INFO("memory does not grow with the number of keys ever inserted");
+  REQUIRE(steady <= warm + warm / 10);
+}
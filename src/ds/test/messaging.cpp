@@ -6,6 +6,7 @@
 #include "../ringbuffer.h"
 #include "../serialized.h"
 
+#include <algorithm>
 #include <array>
 #include <doctest/doctest.h>
 #include <iomanip>
@@ -149,6 +150,110 @@ TEST_CASE("Dispatch" * doctest::test_suite("messaging"))
   }
 }
 
+TEST_CASE("Dispatch table" * doctest::test_suite("messaging"))
+{
+  using MType = uint32_t;
+
+  // Enough handlers to grow the table, with types which collide in the low
+  // bits and so share probe sequences
+  constexpr size_t n = 300;
+  std::vector<MType> types;
+  for (size_t i = 0; i < n; ++i)
+  {
+    types.push_back(i % 2 == 0 ? i : (i << 16));
+  }
+
+  Dispatcher<MType> d("Test", true);
+  std::vector<size_t> calls(n, 0);
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    d.set_message_handler(
+      types[i], "type", [&calls, i](const uint8_t*, size_t) { ++calls[i]; });
+  }
+
+  INFO("Every handler is found");
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      REQUIRE(d.has_handler(types[i]));
+      d.dispatch(types[i], nullptr, i);
+      REQUIRE(calls[i] == 1);
+    }
+  }
+
+  INFO("Removing handlers does not lose the others");
+  {
+    for (size_t i = 0; i < n; i += 3)
+    {
+      d.remove_message_handler(types[i]);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+      if (i % 3 == 0)
+      {
+        REQUIRE_FALSE(d.has_handler(types[i]));
+        REQUIRE_THROWS_AS(d.dispatch(types[i], nullptr, 0), no_handler);
+      }
+      else
+      {
+        d.dispatch(types[i], nullptr, i);
+        REQUIRE(calls[i] == 2);
+      }
+    }
+  }
+
+  INFO("Stats are kept for each message type");
+  {
+    size_t visited = 0;
+    d.foreach_message_stats([&](char const*, MType m, const auto& stats) {
+      const auto it = std::find(types.begin(), types.end(), m);
+      REQUIRE(it != types.end());
+      const size_t i = it - types.begin();
+      REQUIRE(stats.count == 2);
+      REQUIRE(stats.bytes == 2 * i);
+      REQUIRE(stats.latency_quantile_ns(1.0) > 0);
+      ++visited;
+    });
+    REQUIRE(visited == n - (n + 2) / 3);
+  }
+}
+
+TEST_CASE("Batch reads stop when finished" * doctest::test_suite("messaging"))
+{
+  enum : Message
+  {
+    count = Const::msg_min,
+    finish
+  };
+
+  BufferProcessor bp;
+  size_t counted = 0;
+  DISPATCHER_SET_MESSAGE_HANDLER(
+    bp, count, [&](const uint8_t*, size_t) { ++counted; });
+  DISPATCHER_SET_MESSAGE_HANDLER(
+    bp, finish, [&](const uint8_t*, size_t) { bp.set_finished(); });
+
+  Reader r(1 << 10);
+  Writer w(r);
+  w.write(count);
+  w.write(count);
+  w.write(finish);
+  w.write(count);
+
+  REQUIRE(bp.read_n(2, r) == 2);
+  REQUIRE(counted == 2);
+
+  REQUIRE(bp.read_n(-1, r) == 1);
+  REQUIRE(counted == 2);
+
+  // The message after finish is left in the buffer
+  bp.set_finished(false);
+  REQUIRE(bp.read_n(-1, r) == 1);
+  REQUIRE(counted == 3);
+}
+
 TEST_CASE("Basic message loop" * doctest::test_suite("messaging"))
 {
   enum : Message
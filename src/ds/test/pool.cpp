@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#include "../pool.h"
+
+#include <doctest/doctest.h>
+
+struct Block
+{
+  uint8_t data[1024];
+};
+
+TEST_CASE("Pool reuses released objects" * doctest::test_suite("pool"))
+{
+  ds::Pool<Block> pool(2);
+
+  auto a = pool.acquire();
+  auto b = pool.acquire();
+  auto c = pool.acquire();
+  REQUIRE(pool.get_metrics().misses == 3);
+  REQUIRE(pool.get_metrics().hits == 0);
+
+  auto a_ptr = a.get();
+  pool.release(std::move(a));
+  pool.release(std::move(b));
+
+  INFO("The free list is bounded");
+  pool.release(std::move(c));
+  REQUIRE(pool.get_free_count() == 2);
+  REQUIRE(pool.get_metrics().discards == 1);
+
+  INFO("Released objects are handed out again");
+  auto d = pool.acquire();
+  auto e = pool.acquire();
+  REQUIRE(pool.get_metrics().hits == 2);
+  REQUIRE((d.get() == a_ptr || e.get() == a_ptr));
+  REQUIRE(pool.get_free_count() == 0);
+
+  auto f = pool.acquire();
+  REQUIRE(pool.get_metrics().misses == 4);
+
+  pool.release(nullptr);
+  REQUIRE(pool.get_free_count() == 0);
+
+  INFO("Lowering the limit trims the free list");
+  pool.release(std::move(d));
+  pool.release(std::move(e));
+  pool.set_max_free(1);
+  REQUIRE(pool.get_free_count() == 1);
+
+  INFO("Pooling can be disabled");
+  pool.set_max_free(0);
+  REQUIRE(pool.get_free_count() == 0);
+  pool.release(std::move(f));
+  REQUIRE(pool.get_free_count() == 0);
+  REQUIRE(pool.get_metrics().discards == 2);
+}
@@ -0,0 +1,97 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#include "../ring.h"
+
+#include <doctest/doctest.h>
+#include <memory>
+
+TEST_CASE("Ring is a double-ended queue" * doctest::test_suite("ring"))
+{
+  ds::Ring<size_t> ring;
+  REQUIRE(ring.empty());
+
+  for (size_t i = 0; i < 100; ++i)
+    ring.push_back(size_t(i));
+  REQUIRE(ring.size() == 100);
+  REQUIRE(ring.front() == 0);
+  REQUIRE(ring.back() == 99);
+  for (size_t i = 0; i < ring.size(); ++i)
+    REQUIRE(ring[i] == i);
+
+  ring.pop_front();
+  ring.pop_back();
+  REQUIRE(ring.size() == 98);
+  REQUIRE(ring.front() == 1);
+  REQUIRE(ring.back() == 98);
+  REQUIRE(ring[10] == 11);
+
+  ring.clear();
+  REQUIRE(ring.empty());
+  REQUIRE_THROWS(ring.pop_front());
+  REQUIRE_THROWS(ring.pop_back());
+}
+
+TEST_CASE("Ring reuses its slots" * doctest::test_suite("ring"))
+{
+  ds::Ring<size_t> ring;
+
+  INFO("A queue of stable size wraps around without growing");
+  for (size_t i = 0; i < 4; ++i)
+    ring.push_back(size_t(i));
+  for (size_t i = 4; i < 1000; ++i)
+  {
+    ring.push_back(size_t(i));
+    ring.pop_front();
+    REQUIRE(ring.front() == i - 3);
+    REQUIRE(ring.back() == i);
+  }
+  REQUIRE(ring.capacity() == ds::Ring<size_t>::min_capacity);
+
+  INFO("The ring grows when full, and shrinks when mostly empty");
+  for (size_t i = 1000; i < 2000; ++i)
+    ring.push_back(size_t(i));
+  REQUIRE(ring.capacity() == 1024);
+  for (size_t i = 0; i < ring.size(); ++i)
+    REQUIRE(ring[i] == i + 996);
+
+  while (ring.size() > 4)
+    ring.pop_front();
+  REQUIRE(ring.capacity() <= 16);
+  REQUIRE(ring.front() == 1996);
+  REQUIRE(ring.back() == 1999);
+}
+
+TEST_CASE("Ring releases popped elements" * doctest::test_suite("ring"))
+{
+  ds::Ring<std::shared_ptr<int>> ring;
+  auto p = std::make_shared<int>(42);
+
+  ring.push_back(std::shared_ptr<int>(p));
+  ring.push_back(std::shared_ptr<int>(p));
+  REQUIRE(p.use_count() == 3);
+
+  ring.pop_back();
+  REQUIRE(p.use_count() == 2);
+  ring.pop_front();
+  REQUIRE(p.use_count() == 1);
+}
+
+TEST_CASE("Ring binary search" * doctest::test_suite("ring"))
+{
+  ds::Ring<int> ring;
+  for (int i = 0; i < 20; ++i)
+  {
+    ring.push_back(i * 2);
+    if (i % 3 == 0)
+      ring.pop_front();
+  }
+
+  auto less = [](int v, int e) { return v < e; };
+  REQUIRE(ring.upper_bound(-1, less) == 0);
+  for (size_t i = 0; i < ring.size(); ++i)
+  {
+    REQUIRE(ring.upper_bound(ring[i], less) == i + 1);
+    REQUIRE(ring.upper_bound(ring[i] + 1, less) == i + 1);
+  }
+  REQUIRE(ring.upper_bound(1000, less) == ring.size());
+}
@@ -494,3 +494,49 @@ TEST_CASE("Multiple threads can wait" * doctest::test_suite("ringbuffer"))
     }
   }
 }
+
+TEST_CASE("Idle reader parks until written" * doctest::test_suite("ringbuffer"))
+{
+  Reader r(1 << 8);
+  auto& spot = r.get_spot();
+  std::atomic<size_t> reads = 0;
+
+  std::thread reader([&]() {
+    parking::Idler idler;
+    while (reads.load() < 2)
+    {
+      const auto n = r.read(-1, handle_message);
+      if (n > 0)
+      {
+        reads += n;
+        idler.reset();
+      }
+      else
+      {
+        idler.idle(spot, [&]() { return !r.is_empty(); });
+      }
+    }
+  });
+
+  Writer w(r);
+  for (size_t i = 0; i < 2; ++i)
+  {
+    // Wait for the reader to run out of spins and park
+    while (spot.waiters.load() == 0)
+    {
+      std::this_thread::yield();
+    }
+
+    REQUIRE(r.is_empty());
+    w.write(small_message, (uint8_t)i);
+
+    while (reads.load() <= i)
+    {
+      std::this_thread::yield();
+    }
+    REQUIRE(last_message_body == std::vector<uint8_t>{(uint8_t)i});
+  }
+
+  reader.join();
+  REQUIRE(spot.waiters.load() == 0);
+}
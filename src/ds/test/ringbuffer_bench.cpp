@@ -4,9 +4,15 @@
 #define PICOBENCH_DONT_BIND_TO_ONE_CORE
 #include "../ringbuffer.h"
 
+#include "../logger.h"
+#include "../serialized.h"
+#include "host/everyio.h"
+
 #include <picobench/picobench.hpp>
 #include <thread>
 
+::timespec logger::config::start{0, 0};
+
 using namespace ringbuffer;
 
 constexpr Message msg_type = Const::msg_min + 1;
@@ -88,6 +94,138 @@ static void write_impl(
   }
 }
 
+static int64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+
+// Measures the time from a message being written to the reader handling it.
+// The writer waits GapUs between messages, so with gaps beyond the reader's
+// spin budget this is the latency of waking a parked reader.
+template <size_t GapUs>
+static void wake_latency(picobench::state& s)
+{
+  Reader r(4096);
+
+  const size_t msg_count = s.iterations();
+  std::atomic<size_t> reads = 0;
+  int64_t total_latency_ns = 0;
+
+  std::thread reader_thread([&]() {
+    parking::Idler idler;
+    auto& spot = r.get_spot();
+
+    while (reads.load() < msg_count)
+    {
+      const auto n =
+        r.read(-1, [&](ringbuffer::Message, const uint8_t* data, size_t size) {
+          const auto sent = serialized::read<int64_t>(data, size);
+          total_latency_ns += now_ns() - sent;
+        });
+
+      if (n > 0)
+      {
+        reads += n;
+        idler.reset();
+      }
+      else
+      {
+        idler.idle(spot, [&]() { return !r.is_empty(); });
+      }
+    }
+  });
+
+  Writer w(r);
+  for (size_t i = 0; i < msg_count; ++i)
+  {
+    if (GapUs > 0)
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(GapUs));
+    }
+    w.write(msg_type, now_ns());
+  }
+
+  reader_thread.join();
+
+  s.add_custom_duration(total_latency_ns);
+}
+
+// Reads messages on the host's uv loop, as HandleRingbuffer does
+class HostReader
+{
+private:
+  Reader& r;
+  const size_t msg_count;
+  size_t reads = 0;
+  int64_t& total_latency_ns;
+
+public:
+  HostReader(Reader& r, size_t msg_count, int64_t& total_latency_ns) :
+    r(r),
+    msg_count(msg_count),
+    total_latency_ns(total_latency_ns)
+  {}
+
+  parking::Spot& get_spot()
+  {
+    return r.get_spot();
+  }
+
+  bool every()
+  {
+    const auto n =
+      r.read(-1, [&](ringbuffer::Message, const uint8_t* data, size_t size) {
+        const auto sent = serialized::read<int64_t>(data, size);
+        total_latency_ns += now_ns() - sent;
+      });
+
+    reads += n;
+    if (n > 0 && reads >= msg_count)
+    {
+      uv_stop(uv_default_loop());
+    }
+
+    return n > 0;
+  }
+};
+
+// As wake_latency, but the reader is an EveryIO on a uv loop, which waits for
+// the ringbuffer's eventfd once idle rather than parking
+template <size_t GapUs>
+static void host_wake_latency(picobench::state& s)
+{
+  Reader r(4096);
+
+  const size_t msg_count = s.iterations();
+  int64_t total_latency_ns = 0;
+
+  std::thread writer_thread([&]() {
+    Writer w(r);
+    for (size_t i = 0; i < msg_count; ++i)
+    {
+      if (GapUs > 0)
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(GapUs));
+      }
+      w.write(msg_type, now_ns());
+    }
+  });
+
+  {
+    asynchost::proxy_ptr<asynchost::EveryIO<HostReader>> reader(
+      r, msg_count, total_latency_ns);
+    uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+  }
+
+  // Let the reader's handles close
+  uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+  writer_thread.join();
+
+  s.add_custom_duration(total_latency_ns);
+}
+
 //
 // Defaults
 //
@@ -181,3 +319,24 @@ auto spin_200 = specialize<32, 1, 4, spin_pause_handler<200>>;
 FIXED_PICO(spin_200);
 auto spin_400 = specialize<32, 1, 4, spin_pause_handler<400>>;
 FIXED_PICO(spin_400);
+
+PICOBENCH_SUITE("wake latency (time from write to read)");
+const std::vector<int> wake_counts = {100};
+auto gap_0us = wake_latency<0>;
+PICOBENCH(gap_0us).iterations(wake_counts).samples(10).baseline();
+auto gap_10us = wake_latency<10>;
+PICOBENCH(gap_10us).iterations(wake_counts).samples(10);
+auto gap_1ms = wake_latency<1000>;
+PICOBENCH(gap_1ms).iterations(wake_counts).samples(10);
+auto gap_10ms = wake_latency<10000>;
+PICOBENCH(gap_10ms).iterations(wake_counts).samples(10);
+
+PICOBENCH_SUITE("host wake latency (time from write to read on uv loop)");
+auto host_gap_0us = host_wake_latency<0>;
+PICOBENCH(host_gap_0us).iterations(wake_counts).samples(10).baseline();
+auto host_gap_10us = host_wake_latency<10>;
+PICOBENCH(host_gap_10us).iterations(wake_counts).samples(10);
+auto host_gap_1ms = host_wake_latency<1000>;
+PICOBENCH(host_gap_1ms).iterations(wake_counts).samples(10);
+auto host_gap_10ms = host_wake_latency<10000>;
+PICOBENCH(host_gap_10ms).iterations(wake_counts).samples(10);
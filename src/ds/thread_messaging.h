@@ -5,6 +5,7 @@
 //#define USE_MPSCQ
 
 #include "ds/logger.h"
+#include "ds/parking.h"
 #ifdef USE_MPSCQ
 #  include "ds/mpscq.h"
 #endif
@@ -59,6 +60,9 @@ namespace enclave
     std::atomic<ThreadMsg*> item_head = nullptr;
     ThreadMsg* local_msg = nullptr;
 #endif
+    // Where the consuming thread parks, if any. Producers notify it when
+    // adding a task.
+    std::atomic<parking::Spot*> spot = nullptr;
 
   public:
     Task()
@@ -118,6 +122,35 @@ namespace enclave
         item->next = tmp_head;
       } while (!item_head.compare_exchange_strong(tmp_head, item));
 #endif
+      notify();
+    }
+
+    bool is_empty()
+    {
+#ifdef USE_MPSCQ
+      return queue.is_empty();
+#else
+      return local_msg == nullptr && item_head.load() == nullptr;
+#endif
+    }
+
+    parking::Spot* get_spot()
+    {
+      return spot.load();
+    }
+
+    parking::Spot* set_spot(parking::Spot* s)
+    {
+      return spot.exchange(s);
+    }
+
+    void notify()
+    {
+      auto s = spot.load();
+      if (s != nullptr)
+      {
+        parking::notify(*s);
+      }
     }
 
   private:
@@ -163,18 +196,52 @@ namespace enclave
     void set_finished(bool v = true)
     {
       finished.store(v);
+
+      // Wake any parked threads, so that they see they are finished
+      for (auto& task : tasks)
+      {
+        task.notify();
+      }
     }
 
     void run()
     {
       Task& task = tasks[thread_ids[std::this_thread::get_id()]];
+      parking::Idler idler;
 
       while (!is_finished())
       {
-        task.run_next_task();
+        if (task.run_next_task())
+        {
+          idler.reset();
+          continue;
+        }
+
+        auto spot = task.get_spot();
+        if (spot == nullptr)
+        {
+          CCF_PAUSE();
+          continue;
+        }
+
+        idler.idle(
+          *spot, [&]() { return !task.is_empty() || is_finished(); });
       }
     }
 
+    /** Sets where the thread consuming tid's tasks parks when it is idle, and
+     * returns the previous spot. With no spot, the thread spins.
+     */
+    parking::Spot* set_parking_spot(uint16_t tid, parking::Spot* spot)
+    {
+      return tasks[tid].set_spot(spot);
+    }
+
+    bool has_tasks(uint16_t tid)
+    {
+      return !tasks[tid].is_empty();
+    }
+
     bool run_one(uint16_t tid)
     {
       Task& task = tasks[tid];
@@ -23,6 +23,8 @@ namespace enclave
   {
   private:
     ringbuffer::Circuit* circuit;
+    parking::Spot* thread_spots;
+    size_t num_thread_spots;
     ringbuffer::WriterFactory basic_writer_factory;
     oversized::WriterFactory writer_factory;
     ccf::NetworkState network;
@@ -45,6 +47,8 @@ namespace enclave
       const ConsensusType& consensus_type_,
       const raft::Config& raft_config) :
       circuit(enclave_config->circuit),
+      thread_spots(enclave_config->thread_spots),
+      num_thread_spots(enclave_config->num_thread_spots),
       basic_writer_factory(*circuit),
       writer_factory(basic_writer_factory, enclave_config->writer_config),
       network(consensus_type_),
@@ -76,8 +80,13 @@ namespace enclave
         fe->set_sig_intervals(
           signature_intervals.sig_max_tx, signature_intervals.sig_max_ms);
         fe->set_cmd_forwarder(cmd_forwarder);
+        fe->set_rpc_responder(rpcsessions);
       }
 
+      // Commands forwarded to the primary, and their responses, are batched
+      // by a task on the main thread
+      cmd_forwarder->set_batching(true);
+
       node.initialize(raft_config, n2n_channels, rpc_map, cmd_forwarder);
     }
 
@@ -197,24 +206,29 @@ namespace enclave
 
         DISPATCHER_SET_MESSAGE_HANDLER(
           bp,
-          consensus::ledger_entry,
+          consensus::ledger_entries,
           [this](const uint8_t* data, size_t size) {
-            auto [body] =
-              ringbuffer::read_message<consensus::ledger_entry>(data, size);
-            if (node.is_reading_public_ledger())
-              node.recover_public_ledger_entry(body);
-            else if (node.is_reading_private_ledger())
-              node.recover_private_ledger_entry(body);
-            else
-              LOG_FAIL_FMT("Cannot recover ledger entry: Unexpected state");
+            auto [from, entries] =
+              ringbuffer::read_message<consensus::ledger_entries>(data, size);
+            node.recover_ledger_entries(from, entries);
+          });
+
+        DISPATCHER_SET_MESSAGE_HANDLER(
+          bp,
+          consensus::ledger_durable,
+          [this](const uint8_t* data, size_t size) {
+            auto [idx, truncations] =
+              ringbuffer::read_message<consensus::ledger_durable>(data, size);
+            node.ledger_durable(idx, truncations);
           });
 
         DISPATCHER_SET_MESSAGE_HANDLER(
           bp,
           consensus::ledger_no_entry,
           [this](const uint8_t* data, size_t size) {
-            ringbuffer::read_message<consensus::ledger_no_entry>(data, size);
-            node.recover_ledger_end();
+            auto [from] =
+              ringbuffer::read_message<consensus::ledger_no_entry>(data, size);
+            node.recover_ledger_end(from);
           });
 
         rpcsessions->register_message_handlers(bp.get_dispatcher());
@@ -258,8 +272,15 @@ namespace enclave
       try
 #endif
       {
+        const auto tid = thread_ids[std::this_thread::get_id()];
+        if (tid < num_thread_spots)
+        {
+          enclave::ThreadMessaging::thread_messaging.set_parking_spot(
+            tid, &thread_spots[tid]);
+        }
+
         auto msg = std::make_unique<enclave::Tmsg<Msg>>(&init_thread_cb);
-        msg->data.tid = thread_ids[std::this_thread::get_id()];
+        msg->data.tid = tid;
         enclave::ThreadMessaging::thread_messaging.add_task<Msg>(
           msg->data.tid, std::move(msg));
 
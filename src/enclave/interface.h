@@ -9,6 +9,7 @@
 #include "ds/buffer.h"
 #include "ds/logger.h"
 #include "ds/oversized.h"
+#include "ds/parking.h"
 #include "ds/ringbuffer_types.h"
 #include "kv/kvtypes.h"
 #include "node/members.h"
@@ -23,6 +24,11 @@ struct EnclaveConfig
   ringbuffer::Circuit* circuit = nullptr;
   oversized::WriterConfig writer_config = {};
 
+  // Where idle worker threads park, indexed by thread id. These are allocated
+  // by the host, since the host performs the wait.
+  parking::Spot* thread_spots = nullptr;
+  size_t num_thread_spots = 0;
+
 #ifdef DEBUG_CONFIG
   struct DebugConfig
   {
@@ -64,13 +70,26 @@ struct CCFConfig
   };
   Joining joining = {};
 
+  struct Snapshots
+  {
+    // Number of transactions between snapshots (0 disables snapshots)
+    size_t snapshot_tx_interval;
+    // Serialised snapshot to start from (empty to start from the ledger only)
+    kv::Version startup_snapshot_idx;
+    std::vector<uint8_t> startup_snapshot;
+    MSGPACK_DEFINE(
+      snapshot_tx_interval, startup_snapshot_idx, startup_snapshot);
+  };
+  Snapshots snapshots = {};
+
   MSGPACK_DEFINE(
     raft_config,
     node_info_network,
     domain,
     signature_intervals,
     genesis,
-    joining);
+    joining,
+    snapshots);
 };
 
 /// General administrative messages
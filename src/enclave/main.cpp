@@ -8,6 +8,10 @@
 #  include "../src/consensus/pbft/pbftglobals.h"
 #endif
 
+#ifndef VIRTUAL_ENCLAVE
+#  include <ccf_t.h>
+#endif
+
 #include <chrono>
 #include <msgpack.hpp>
 #include <thread>
@@ -23,6 +27,21 @@ std::atomic<uint16_t> num_pending_threads = 0;
 enclave::ThreadMessaging enclave::ThreadMessaging::thread_messaging;
 std::atomic<uint16_t> enclave::ThreadMessaging::thread_count = 0;
 
+#ifndef VIRTUAL_ENCLAVE
+namespace parking
+{
+  void wait(Spot& spot, uint32_t epoch, uint32_t timeout_ms)
+  {
+    ccf_park_thread(&spot, epoch, timeout_ms);
+  }
+
+  void wake(Spot& spot)
+  {
+    ccf_unpark_threads(&spot);
+  }
+}
+#endif
+
 extern "C"
 {
   bool enclave_create_node(
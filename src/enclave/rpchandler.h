@@ -21,6 +21,9 @@ namespace enclave
     virtual void set_cmd_forwarder(
       std::shared_ptr<AbstractForwarder> cmd_forwarder_) = 0;
     virtual void tick(std::chrono::milliseconds elapsed_ms_count) {}
+    virtual void set_rpc_responder(
+      std::shared_ptr<AbstractRPCResponder> rpc_responder_)
+    {}
     virtual void open() = 0;
     virtual bool is_open() = 0;
 
@@ -43,5 +46,14 @@ namespace enclave
       ccf::Store::Tx& tx,
       bool playback,
       bool include_merkle_roots) = 0;
+
+    // Used by PBFT to execute the commands in a batch concurrently. Commands
+    // are executed without being committed, and then committed in order.
+    virtual bool execute_pbft(
+      std::shared_ptr<enclave::RpcContext> ctx, ccf::Store::Tx& tx) = 0;
+    virtual std::optional<ProcessPbftResp> commit_pbft(
+      std::shared_ptr<enclave::RpcContext> ctx,
+      ccf::Store::Tx& tx,
+      bool include_merkle_roots) = 0;
   };
 }
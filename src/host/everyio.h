@@ -2,12 +2,26 @@
 // Licensed under the Apache 2.0 License.
 #pragma once
 
+#include "ds/parking.h"
 #include "proxy.h"
 
+#include <cerrno>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
 namespace asynchost
 {
   // This runs every loop. If any instance of this is active, the loop's poll
-  // timeout will be 0 (see uv_prepare_t vs uv_idle_t)
+  // timeout will be 0 (see uv_prepare_t vs uv_idle_t).
+  //
+  // Behaviour::every() returns whether it found any work. Once it has found
+  // none for idle_loops consecutive loops, this stops running every loop and
+  // waits on Behaviour::get_spot(), the parking spot its producers notify, so
+  // that an idle loop blocks in IO rather than spinning. A uv loop cannot
+  // block on the spot's futex, so notifications are delivered to it through
+  // an eventfd (see parking::wake). Like a parked thread, it also polls every
+  // parking::park_timeout_ms while waiting.
   template <typename Behaviour>
   class EveryIO : public with_uv_handle<uv_idle_t>
   {
@@ -15,6 +29,13 @@ namespace asynchost
     friend class close_ptr<EveryIO<Behaviour>>;
     Behaviour behaviour;
 
+    static constexpr size_t idle_loops = 1 << 12;
+
+    int event_fd = -1;
+    uv_poll_t event_poll;
+    uv_timer_t poll_timer;
+    size_t empty_loops = 0;
+
     template <typename... Args>
     EveryIO(Args&&... args) : behaviour(std::forward<Args>(args)...)
     {
@@ -28,6 +49,31 @@ namespace asynchost
 
       uv_handle.data = this;
 
+      event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (event_fd < 0)
+      {
+        LOG_FAIL_FMT("eventfd failed: {}", strerror(errno));
+        throw std::logic_error("eventfd failed");
+      }
+
+      if ((rc = uv_poll_init(uv_default_loop(), &event_poll, event_fd)) < 0)
+      {
+        LOG_FAIL_FMT("uv_poll_init failed: {}", uv_strerror(rc));
+        throw std::logic_error("uv_poll_init failed");
+      }
+
+      event_poll.data = this;
+
+      if ((rc = uv_timer_init(uv_default_loop(), &poll_timer)) < 0)
+      {
+        LOG_FAIL_FMT("uv_timer_init failed: {}", uv_strerror(rc));
+        throw std::logic_error("uv_timer_init failed");
+      }
+
+      poll_timer.data = this;
+
+      behaviour.get_spot().event_fd.store(event_fd);
+
       if ((rc = uv_idle_start(&uv_handle, on_every)) < 0)
       {
         LOG_FAIL_FMT("uv_idle_start failed: {}", uv_strerror(rc));
@@ -35,14 +81,99 @@ namespace asynchost
       }
     }
 
+    void close()
+    {
+      behaviour.get_spot().event_fd.store(-1);
+
+      // The timer and the poll handle must be closed before the idle handle,
+      // whose closure deletes this
+      uv_close((uv_handle_t*)&poll_timer, on_timer_close);
+    }
+
+    static void on_timer_close(uv_handle_t* handle)
+    {
+      auto self = static_cast<EveryIO*>(handle->data);
+      uv_close((uv_handle_t*)&self->event_poll, on_poll_close);
+    }
+
+    static void on_poll_close(uv_handle_t* handle)
+    {
+      auto self = static_cast<EveryIO*>(handle->data);
+      ::close(self->event_fd);
+      self->with_uv_handle::close();
+    }
+
     static void on_every(uv_idle_t* handle)
     {
       static_cast<EveryIO*>(handle->data)->on_every();
     }
 
+    static void on_event(uv_poll_t* handle, int, int)
+    {
+      static_cast<EveryIO*>(handle->data)->resume();
+    }
+
+    static void on_timeout(uv_timer_t* handle)
+    {
+      static_cast<EveryIO*>(handle->data)->on_timeout();
+    }
+
     void on_every()
     {
-      behaviour.every();
+      if (behaviour.every())
+      {
+        empty_loops = 0;
+      }
+      else if (++empty_loops >= idle_loops)
+      {
+        wait();
+      }
+    }
+
+    void wait()
+    {
+      // Work published after registering as a waiter notifies the spot, and
+      // work published before is found by checking again
+      auto& spot = behaviour.get_spot();
+      spot.waiters.fetch_add(1);
+      if (behaviour.every())
+      {
+        spot.waiters.fetch_sub(1);
+        empty_loops = 0;
+        return;
+      }
+
+      uv_idle_stop(&uv_handle);
+      uv_poll_start(&event_poll, UV_READABLE, on_event);
+      uv_timer_start(
+        &poll_timer,
+        on_timeout,
+        parking::park_timeout_ms,
+        parking::park_timeout_ms);
+    }
+
+    void on_timeout()
+    {
+      if (behaviour.every())
+      {
+        resume();
+      }
+    }
+
+    void resume()
+    {
+      behaviour.get_spot().waiters.fetch_sub(1);
+      uv_poll_stop(&event_poll);
+      uv_timer_stop(&poll_timer);
+
+      // Reset the eventfd's counter, so that it is only readable again once
+      // notified again
+      uint64_t notifications;
+      [[maybe_unused]] auto rc =
+        read(event_fd, &notifications, sizeof(notifications));
+
+      empty_loops = 0;
+      uv_idle_start(&uv_handle, on_every);
     }
   };
 }
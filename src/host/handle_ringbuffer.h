@@ -94,18 +94,28 @@ namespace asynchost
         });
     }
 
-    void every()
+    //! Notified by the enclave when it writes to an empty ringbuffer
+    parking::Spot& get_spot()
+    {
+      return r.get_spot();
+    }
+
+    bool every()
     {
       // On each uv loop iteration...
 
       // ...read (and process) all outbound ringbuffer messages...
-      while (bp.read_n(max_messages, r) > 0)
+      size_t total_read = 0;
+      size_t read;
+      while ((read = bp.read_n(max_messages, r)) > 0)
       {
-        continue;
+        total_read += read;
       }
 
       // ...flush any pending inbound messages...
-      nbwf.flush_all_inbound();
+      const auto all_flushed = nbwf.flush_all_inbound();
+
+      return total_read > 0 || !all_flushed;
     }
   };
 
@@ -0,0 +1,101 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "../ds/logger.h"
+#include "../ds/messaging.h"
+#include "tcp.h"
+#include "timer.h"
+
+#include <unordered_map>
+
+namespace asynchost
+{
+  /**
+   * Periodically logs the metrics of the host, so that they can be followed
+   * on a running node. Counters are reported as their change since the last
+   * report, and nothing is logged for a component that was idle.
+   */
+  class HostMetricsImpl
+  {
+  private:
+    const messaging::RingbufferDispatcher& dispatcher;
+    std::unordered_map<ringbuffer::Message, messaging::MessageStats>
+      last_messages;
+
+    ds::PoolMetrics last_read_pool;
+    ds::PoolMetrics last_write_pool;
+
+    void report_messages()
+    {
+      dispatcher.foreach_message_stats(
+        [this](char const* label, ringbuffer::Message m, const auto& stats) {
+          auto& last = last_messages[m];
+          messaging::MessageStats delta;
+          delta.count = stats.count - last.count;
+          delta.bytes = stats.bytes - last.bytes;
+          for (size_t i = 0; i < delta.latency_ns.size(); ++i)
+            delta.latency_ns[i] = stats.latency_ns[i] - last.latency_ns[i];
+          last = stats;
+
+          if (delta.count == 0)
+            return;
+
+          LOG_INFO_FMT(
+            "Ringbuffer {} ({}): {} messages, {} bytes, p50 < {}ns, "
+            "p99 < {}ns",
+            label == nullptr ? "unknown" : label,
+            m,
+            delta.count,
+            delta.bytes,
+            delta.latency_quantile_ns(0.5) + 1,
+            delta.latency_quantile_ns(0.99) + 1);
+        });
+    }
+
+    static void report_pool(
+      const char* name,
+      const ds::PoolMetrics& m,
+      ds::PoolMetrics& last,
+      size_t free_count)
+    {
+      const auto hits = m.hits - last.hits;
+      const auto misses = m.misses - last.misses;
+      const auto discards = m.discards - last.discards;
+      last = m;
+
+      if (hits == 0 && misses == 0 && discards == 0)
+        return;
+
+      LOG_INFO_FMT(
+        "TCP {} pool: {} hits, {} misses, {} discards, {} free",
+        name,
+        hits,
+        misses,
+        discards,
+        free_count);
+    }
+
+  public:
+    HostMetricsImpl(const messaging::RingbufferDispatcher& dispatcher) :
+      dispatcher(dispatcher)
+    {}
+
+    void on_timer()
+    {
+      report_messages();
+      report_pool(
+        "read buffer",
+        TCPImpl::get_read_pool_metrics(),
+        last_read_pool,
+        TCPImpl::get_read_pool_free_count());
+      report_pool(
+        "write request",
+        TCPImpl::get_write_pool_metrics(),
+        last_write_pool,
+        TCPImpl::get_write_pool_free_count());
+    }
+  };
+
+  using HostMetrics = proxy_ptr<Timer<HostMetricsImpl>>;
+}
@@ -6,188 +6,779 @@
 #include "ds/logger.h"
 #include "ds/messaging.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <memory>
+#include <optional>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <vector>
 
 namespace asynchost
 {
-  class Ledger
+  /**
+   * A contiguous range of ledger entries, stored in a single file.
+   *
+   * The file starts with the offset of the chunk's index (0 while the chunk is
+   * still being written to), followed by the framed entries. Once all its
+   * entries have been committed, the chunk is completed: the offsets of its
+   * entries are appended to the file, which is renamed to include its last
+   * index, and is from then on read through a read-only mapping.
+   */
+  class LedgerChunk
   {
-  private:
+  public:
+    using Offset = uint64_t;
+    using Owner = std::shared_ptr<const void>;
     static constexpr size_t frame_header_size = sizeof(uint32_t);
+    static constexpr auto file_prefix = "ledger_";
 
-    // This uses C stdio instead of fstream because an fstream
-    // cannot be truncated.
-    FILE* file;
-    std::vector<size_t> positions;
-    size_t total_len;
-    ringbuffer::WriterPtr to_enclave;
+  private:
+    const std::string dir;
+    const size_t start_idx;
+    int fd = -1;
+    bool complete = false;
+
+    // Offset of the first byte after the last entry
+    size_t total_len = sizeof(Offset);
+
+    // Positions of the entries, while the chunk is being written to
+    std::vector<Offset> positions;
+
+    // Read-only mapping of the file, once the chunk is complete. The
+    // positions of the entries are then read from the index in the mapping.
+    // The mapping is shared with readers of the chunk, so that it outlives
+    // the chunk until they release it (e.g. once a socket write completes).
+    std::shared_ptr<const uint8_t> map;
+    size_t map_size = 0;
+    size_t complete_count = 0;
+
+    [[noreturn]] void fail(const std::string& what) const
+    {
+      throw std::logic_error(
+        fmt::format("{} {}: {}", what, file_path(), strerror(errno)));
+    }
 
-  public:
-    Ledger(
-      const std::string& filename,
-      ringbuffer::AbstractWriterFactory& writer_factory) :
-      file(NULL),
-      to_enclave(writer_factory.create_writer_to_inside())
+    void write_at(const void* data, size_t size, size_t offset)
     {
-      file = fopen(filename.c_str(), "r+b");
+      if (pwrite(fd, data, size, offset) != (ssize_t)size)
+        fail("Failed to write to ledger chunk");
+    }
+
+    void read_at(void* data, size_t size, size_t offset) const
+    {
+      if (pread(fd, data, size, offset) != (ssize_t)size)
+        fail("Failed to read from ledger chunk");
+    }
 
-      if (!file)
-        file = fopen(filename.c_str(), "w+b");
+    Offset position(size_t i) const
+    {
+      if (!complete)
+        return positions.at(i);
+
+      // The index is not necessarily aligned in the mapping
+      Offset pos;
+      memcpy(
+        &pos, map.get() + total_len + i * sizeof(Offset), sizeof(Offset));
+      return pos;
+    }
 
-      if (!file)
-        throw std::logic_error("Unable to open or create ledger file");
+    void open_complete(size_t last_idx)
+    {
+      auto path = file_path(last_idx);
+      fd = ::open(path.c_str(), O_RDONLY);
+      if (fd == -1)
+        fail("Unable to open ledger chunk");
+
+      struct stat st;
+      if (fstat(fd, &st) != 0)
+        fail("Unable to stat ledger chunk");
+      map_size = st.st_size;
+
+      if (map_size < sizeof(Offset))
+        throw std::logic_error(fmt::format("Malformed ledger chunk {}", path));
+
+      auto p = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED)
+        fail("Unable to map ledger chunk");
+
+      map = std::shared_ptr<const uint8_t>(
+        (const uint8_t*)p,
+        [size = map_size](const uint8_t* p) { munmap((void*)p, size); });
+
+      complete = true;
+      complete_count = last_idx - start_idx + 1;
+
+      Offset index_offset;
+      memcpy(&index_offset, map.get(), sizeof(index_offset));
+      if (
+        index_offset < sizeof(Offset) ||
+        index_offset + complete_count * sizeof(Offset) != map_size)
+        throw std::logic_error(
+          fmt::format("Malformed ledger chunk index {}", path));
+
+      total_len = index_offset;
+    }
 
-      fseeko(file, 0, SEEK_END);
-      auto len = ftello(file);
-      if (len == 1)
+    void open_incomplete()
+    {
+      auto path = file_path();
+      fd = ::open(path.c_str(), O_RDWR);
+      if (fd == -1)
+        fail("Unable to open ledger chunk");
+
+      struct stat st;
+      if (fstat(fd, &st) != 0)
+        fail("Unable to stat ledger chunk");
+      size_t len = st.st_size;
+
+      if (len < sizeof(Offset))
+        throw std::logic_error(fmt::format("Malformed ledger chunk {}", path));
+
+      // If the index was written but the chunk was not renamed, discard the
+      // index. The chunk is completed again once committed.
+      Offset index_offset;
+      read_at(&index_offset, sizeof(index_offset), 0);
+      if (index_offset != 0)
       {
-        std::stringstream ss;
-        ss << "Failed to tell file size: " << strerror(errno);
-        throw std::logic_error(ss.str());
+        if (index_offset > len || ftruncate(fd, index_offset) != 0)
+          fail("Unable to discard index of ledger chunk");
+        len = index_offset;
+        index_offset = 0;
+        write_at(&index_offset, sizeof(index_offset), 0);
       }
-      fseeko(file, 0, SEEK_SET);
-      size_t pos = 0;
+
+      // Only the chunk(s) at the end of the ledger are not complete, so this
+      // scan is bounded by the chunk size
+      size_t pos = sizeof(Offset);
       uint32_t size = 0;
 
-      while (len >= frame_header_size)
+      while (len - pos >= frame_header_size)
       {
-        if (fread(&size, frame_header_size, 1, file) != 1)
-          throw std::logic_error("Failed to read from file");
-
-        len -= frame_header_size;
+        read_at(&size, frame_header_size, pos);
 
-        if (len < size)
-          throw std::logic_error("Malformed ledger file");
-
-        fseeko(file, size, SEEK_CUR);
-        len -= size;
+        if (len - pos - frame_header_size < size)
+          throw std::logic_error(
+            fmt::format("Malformed ledger chunk {}", path));
 
         positions.push_back(pos);
         pos += (size + frame_header_size);
       }
 
+      if (pos != len)
+        throw std::logic_error(fmt::format("Malformed ledger chunk {}", path));
+
       total_len = pos;
+    }
 
-      if (len != 0)
-        throw std::logic_error("Malformed ledger file");
+    void close_file()
+    {
+      map.reset();
+      map_size = 0;
+
+      if (fd != -1)
+      {
+        ::close(fd);
+        fd = -1;
+      }
     }
 
-    Ledger(const Ledger& that) = delete;
+  public:
+    /**
+     * Create a new, empty chunk.
+     *
+     * @param dir_ Ledger directory
+     * @param start_idx_ Index of the first entry of the chunk
+     */
+    LedgerChunk(const std::string& dir_, size_t start_idx_) :
+      dir(dir_),
+      start_idx(start_idx_)
+    {
+      auto path = file_path();
+      fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0664);
+      if (fd == -1)
+        fail("Unable to create ledger chunk");
+
+      Offset no_index = 0;
+      write_at(&no_index, sizeof(no_index), 0);
+    }
+
+    /**
+     * Open an existing chunk.
+     *
+     * @param dir_ Ledger directory
+     * @param start_idx_ Index of the first entry of the chunk
+     * @param last_idx Index of the last entry of the chunk, if it is complete
+     */
+    LedgerChunk(
+      const std::string& dir_,
+      size_t start_idx_,
+      std::optional<size_t> last_idx) :
+      dir(dir_),
+      start_idx(start_idx_)
+    {
+      if (last_idx.has_value())
+        open_complete(last_idx.value());
+      else
+        open_incomplete();
+    }
+
+    LedgerChunk(const LedgerChunk& that) = delete;
+
+    ~LedgerChunk()
+    {
+      close_file();
+    }
+
+    std::string file_path(std::optional<size_t> last_idx = std::nullopt) const
+    {
+      if (!last_idx.has_value() && complete)
+        last_idx = get_last_idx();
+
+      if (last_idx.has_value())
+        return fmt::format(
+          "{}/{}{}-{}", dir, file_prefix, start_idx, last_idx.value());
+
+      return fmt::format("{}/{}{}", dir, file_prefix, start_idx);
+    }
+
+    bool is_complete() const
+    {
+      return complete;
+    }
+
+    size_t get_start_idx() const
+    {
+      return start_idx;
+    }
+
+    size_t get_last_idx() const
+    {
+      return start_idx + get_count() - 1;
+    }
 
-    ~Ledger()
+    size_t get_count() const
     {
-      if (file)
+      return complete ? complete_count : positions.size();
+    }
+
+    size_t get_size() const
+    {
+      return total_len;
+    }
+
+    void write_entry(const uint8_t* data, size_t size)
+    {
+      if (complete)
+        throw std::logic_error(
+          fmt::format("Cannot write to complete ledger chunk {}", file_path()));
+
+      uint32_t frame = (uint32_t)size;
+      iovec iov[2] = {{&frame, frame_header_size}, {(void*)data, size}};
+      auto framed_size = frame_header_size + size;
+
+      if (pwritev(fd, iov, 2, total_len) != (ssize_t)framed_size)
+        fail("Failed to write to ledger chunk");
+
+      positions.push_back(total_len);
+      total_len += framed_size;
+    }
+
+    /**
+     * Offset and size of the framed entries [from, to] in the chunk file.
+     * Both indices must be in the chunk.
+     */
+    std::pair<size_t, size_t> framed_range(size_t from, size_t to) const
+    {
+      auto begin = position(from - start_idx);
+      auto end =
+        (to == get_last_idx()) ? total_len : position(to - start_idx + 1);
+      return {begin, end - begin};
+    }
+
+    /**
+     * Call f(data, size, owner) on the framed entries [from, to]. Entries of a
+     * complete chunk are passed directly from the mapping, without any copy.
+     * The data remains valid for as long as owner is held.
+     */
+    template <typename F>
+    void read_framed(size_t from, size_t to, F&& f) const
+    {
+      auto [offset, size] = framed_range(from, to);
+
+      if (complete)
+      {
+        f(map.get() + offset, size, Owner(map));
+      }
+      else
       {
-        fflush(file);
-        fclose(file);
+        auto framed = std::make_shared<std::vector<uint8_t>>(size);
+        read_at(framed->data(), size, offset);
+        f(framed->data(), size, Owner(framed));
       }
     }
 
-    size_t get_last_idx()
+    std::vector<uint8_t> read_entry(size_t idx) const
     {
-      return positions.size();
+      auto [offset, size] = framed_range(idx, idx);
+      offset += frame_header_size;
+      size -= frame_header_size;
+
+      if (complete)
+        return {map.get() + offset, map.get() + offset + size};
+
+      std::vector<uint8_t> entry(size);
+      read_at(entry.data(), size, offset);
+      return entry;
     }
 
-    const std::vector<uint8_t> read_entry(size_t idx)
+    void sync()
     {
-      if ((idx == 0) || (idx > positions.size()))
-        return {};
+      if (fdatasync(fd) != 0)
+        fail("Failed to sync ledger chunk");
+    }
 
-      auto len = entry_size(idx);
-      std::vector<uint8_t> entry(len);
-      fseeko(file, positions.at(idx - 1) + frame_header_size, SEEK_SET);
+    /**
+     * Complete the chunk: write its index and switch to a read-only mapping.
+     * This should only be called once all entries of the chunk are committed.
+     */
+    void complete_chunk()
+    {
+      if (complete || positions.empty())
+        return;
 
-      if (fread(entry.data(), len, 1, file) != 1)
-        throw std::logic_error("Failed to read from file");
+      Offset index_offset = total_len;
+      write_at(
+        positions.data(), positions.size() * sizeof(Offset), index_offset);
+      write_at(&index_offset, sizeof(index_offset), 0);
 
-      return entry;
+      if (fdatasync(fd) != 0)
+        fail("Failed to sync ledger chunk");
+
+      auto last_idx = get_last_idx();
+      auto from = file_path();
+      auto to = file_path(last_idx);
+      if (rename(from.c_str(), to.c_str()) != 0)
+        fail("Failed to rename ledger chunk");
+
+      close_file();
+      positions.clear();
+      open_complete(last_idx);
+
+      LOG_DEBUG_FMT("Completed ledger chunk {}", to);
     }
 
-    const std::vector<uint8_t> read_framed_entries(size_t from, size_t to)
+    /**
+     * Truncate the chunk so that idx is its last entry. A complete chunk is
+     * first turned back into a chunk that can be written to.
+     */
+    void truncate(size_t idx)
     {
-      auto framed_size = framed_entries_size(from, to);
+      if (idx >= get_last_idx())
+        return;
+
+      if (complete)
+      {
+        auto from = file_path();
+        for (size_t i = 0; i < complete_count; ++i)
+          positions.push_back(position(i));
 
-      std::vector<uint8_t> framed_entries(framed_size);
-      if (framed_size == 0)
-        return framed_entries;
+        close_file();
+        complete = false;
 
-      fseeko(file, positions.at(from - 1), SEEK_SET);
+        auto to = file_path();
+        if (rename(from.c_str(), to.c_str()) != 0)
+          fail("Failed to rename ledger chunk");
 
-      if (fread(framed_entries.data(), framed_size, 1, file) != 1)
-        throw std::logic_error("Failed to read from file");
+        fd = ::open(to.c_str(), O_RDWR);
+        if (fd == -1)
+          fail("Unable to open ledger chunk");
 
-      return framed_entries;
+        Offset no_index = 0;
+        write_at(&no_index, sizeof(no_index), 0);
+      }
+
+      auto count = idx + 1 - start_idx;
+      total_len = position(count);
+      positions.resize(count);
+
+      if (ftruncate(fd, total_len) != 0)
+        fail("Failed to truncate ledger chunk");
     }
 
-    size_t framed_entries_size(size_t from, size_t to)
+    void remove()
     {
-      if ((from == 0) || (to < from) || (to > positions.size()))
-        return 0;
+      auto path = file_path();
+      close_file();
+      if (unlink(path.c_str()) != 0)
+        fail("Failed to remove ledger chunk");
+    }
+
+    /**
+     * Parse the name of a chunk file.
+     *
+     * @return Start index, and last index if the chunk is complete, or nothing
+     * if the file is not a chunk
+     */
+    static std::optional<std::pair<size_t, std::optional<size_t>>>
+    parse_file_name(const std::string& name)
+    {
+      const std::string prefix(file_prefix);
+      if (name.compare(0, prefix.size(), prefix) != 0)
+        return std::nullopt;
+
+      auto range = name.substr(prefix.size());
+      auto sep = range.find('-');
+      auto start = range.substr(0, sep);
+      auto digits = "0123456789";
+
+      if (start.empty() || start.find_first_not_of(digits) != std::string::npos)
+        return std::nullopt;
 
-      if (to == positions.size())
+      if (sep == std::string::npos)
+        return std::make_pair(std::stoull(start), std::nullopt);
+
+      auto last = range.substr(sep + 1);
+      if (last.empty() || last.find_first_not_of(digits) != std::string::npos)
+        return std::nullopt;
+
+      return std::make_pair(
+        std::stoull(start), std::optional<size_t>(std::stoull(last)));
+    }
+  };
+
+  /**
+   * Ledger stored as a directory of chunks of entries. A new chunk is started
+   * once the current one exceeds the chunk threshold, and chunks are completed
+   * (indexed and mapped read-only) once all their entries are committed.
+   */
+  class Ledger
+  {
+  public:
+    static constexpr size_t default_chunk_threshold = 5 * 1024 * 1024;
+    // Maximum size of the framed entries sent in response to a range read,
+    // unless a single entry is larger
+    static constexpr size_t max_range_read_size = 1024 * 1024;
+
+  private:
+    const std::string ledger_dir;
+    const size_t chunk_threshold;
+
+    // Chunks, ordered by (contiguous) ranges of indices. Chunks are never
+    // empty.
+    std::vector<std::unique_ptr<LedgerChunk>> chunks;
+
+    // Index of the last entry that is not stored in this ledger, because the
+    // node started from a snapshot at that index
+    size_t start_idx = 0;
+
+    // Group commit: entries are synced to disk together, by sync(), either
+    // periodically or once sync_threshold bytes are pending (0 for no
+    // threshold). The enclave is then told which entries are durable,
+    // along with the number of truncations it requested so far.
+    size_t sync_threshold = 0;
+    size_t unsynced_bytes = 0;
+    bool sync_pending = false;
+    bool sync_dir_pending = false;
+    size_t truncations = 0;
+
+    ringbuffer::WriterPtr to_enclave;
+
+    LedgerChunk* find_chunk(size_t idx) const
+    {
+      auto it = std::upper_bound(
+        chunks.begin(),
+        chunks.end(),
+        idx,
+        [](size_t idx, const std::unique_ptr<LedgerChunk>& c) {
+          return idx < c->get_start_idx();
+        });
+
+      if (it == chunks.begin())
+        return nullptr;
+
+      return std::prev(it)->get();
+    }
+
+    template <typename F>
+    void foreach_chunk(size_t from, size_t to, F&& f) const
+    {
+      for (auto idx = from; idx <= to;)
       {
-        return total_len - positions.at(from - 1);
+        auto chunk = find_chunk(idx);
+        auto last = std::min(to, chunk->get_last_idx());
+        f(*chunk, idx, last);
+        idx = last + 1;
       }
-      else
+    }
+
+    bool valid_range(size_t from, size_t to) const
+    {
+      return (from > start_idx) && (from <= to) && (to <= get_last_idx());
+    }
+
+  public:
+    Ledger(
+      const std::string& ledger_dir_,
+      ringbuffer::AbstractWriterFactory& writer_factory,
+      size_t chunk_threshold_ = default_chunk_threshold) :
+      ledger_dir(ledger_dir_),
+      chunk_threshold(chunk_threshold_),
+      to_enclave(writer_factory.create_writer_to_inside())
+    {
+      if (mkdir(ledger_dir.c_str(), 0775) != 0 && errno != EEXIST)
+        throw std::logic_error(fmt::format(
+          "Unable to create ledger directory {}: {}",
+          ledger_dir,
+          strerror(errno)));
+
+      auto dir = opendir(ledger_dir.c_str());
+      if (dir == nullptr)
+        throw std::logic_error(fmt::format(
+          "Unable to open ledger directory {}: {}",
+          ledger_dir,
+          strerror(errno)));
+
+      // Only the names of the chunk files are read here. Complete chunks are
+      // mapped, and only incomplete chunks (at the end of the ledger) are
+      // scanned, so that startup does not depend on the size of the ledger.
+      std::vector<std::pair<size_t, std::optional<size_t>>> ranges;
+      while (auto entry = readdir(dir))
       {
-        return positions.at(to) - positions.at(from - 1);
+        auto range = LedgerChunk::parse_file_name(entry->d_name);
+        if (range.has_value())
+          ranges.push_back(range.value());
       }
+      closedir(dir);
+
+      std::sort(ranges.begin(), ranges.end());
+
+      for (auto& [chunk_start, chunk_last] : ranges)
+      {
+        if (!chunks.empty() && chunk_start != get_last_idx() + 1)
+          throw std::logic_error(fmt::format(
+            "Ledger chunk starting at {} does not follow last index {}",
+            chunk_start,
+            get_last_idx()));
+
+        auto chunk =
+          std::make_unique<LedgerChunk>(ledger_dir, chunk_start, chunk_last);
+
+        if (chunk->get_count() == 0)
+        {
+          chunk->remove();
+          continue;
+        }
+
+        if (chunks.empty())
+          start_idx = chunk_start - 1;
+
+        chunks.push_back(std::move(chunk));
+      }
+    }
+
+    Ledger(const Ledger& that) = delete;
+
+    void init(size_t idx)
+    {
+      // Entries up to idx are covered by a snapshot. This only applies to an
+      // empty ledger, since entries are always appended in order. The first
+      // chunk then starts at idx + 1, which records the start index.
+      if (!chunks.empty())
+        throw std::logic_error("Cannot set start index of non-empty ledger");
+
+      LOG_INFO_FMT("Ledger starts after index {}", idx);
+      start_idx = idx;
+    }
+
+    size_t get_start_idx() const
+    {
+      return start_idx;
+    }
+
+    size_t get_last_idx() const
+    {
+      return chunks.empty() ? start_idx : chunks.back()->get_last_idx();
+    }
+
+    size_t get_chunk_count() const
+    {
+      return chunks.size();
+    }
+
+    void set_sync_threshold(size_t sync_threshold_)
+    {
+      sync_threshold = sync_threshold_;
+    }
+
+    /**
+     * Sync all entries written since the last sync with a single fdatasync per
+     * open chunk, and report the last durable index to the enclave.
+     */
+    void sync()
+    {
+      if (!sync_pending)
+        return;
+
+      // Complete chunks were synced when they were completed
+      for (auto it = chunks.rbegin();
+           it != chunks.rend() && !(*it)->is_complete();
+           ++it)
+        (*it)->sync();
+
+      if (sync_dir_pending)
+      {
+        // New chunk files must also be durable in the directory
+        auto fd = ::open(ledger_dir.c_str(), O_RDONLY | O_DIRECTORY);
+        auto synced = fd != -1 && fsync(fd) == 0;
+        auto err = errno;
+        if (fd != -1)
+          ::close(fd);
+
+        if (!synced)
+          throw std::logic_error(fmt::format(
+            "Failed to sync ledger directory {}: {}",
+            ledger_dir,
+            strerror(err)));
+        sync_dir_pending = false;
+      }
+
+      unsynced_bytes = 0;
+      sync_pending = false;
+
+      RINGBUFFER_WRITE_MESSAGE(
+        consensus::ledger_durable,
+        to_enclave,
+        static_cast<consensus::Index>(get_last_idx()),
+        truncations);
+    }
+
+    const std::vector<uint8_t> read_entry(size_t idx)
+    {
+      if (!valid_range(idx, idx))
+        return {};
+
+      return find_chunk(idx)->read_entry(idx);
+    }
+
+    /**
+     * Call f(data, size, owner) on each contiguous region of the framed entries
+     * [from, to]. Regions in complete chunks are passed directly from their
+     * mapping. Each region remains valid for as long as its owner is held,
+     * even if the ledger is truncated in the meantime.
+     */
+    template <typename F>
+    void read_framed_entries(size_t from, size_t to, F&& f)
+    {
+      if (!valid_range(from, to))
+        return;
+
+      foreach_chunk(
+        from, to, [&f](const LedgerChunk& chunk, size_t first, size_t last) {
+          chunk.read_framed(first, last, f);
+        });
+    }
+
+    const std::vector<uint8_t> read_framed_entries(size_t from, size_t to)
+    {
+      std::vector<uint8_t> framed_entries;
+      framed_entries.reserve(framed_entries_size(from, to));
+
+      read_framed_entries(
+        from,
+        to,
+        [&](const uint8_t* data, size_t size, const LedgerChunk::Owner&) {
+          framed_entries.insert(framed_entries.end(), data, data + size);
+        });
+
+      return framed_entries;
+    }
+
+    size_t framed_entries_size(size_t from, size_t to)
+    {
+      if (!valid_range(from, to))
+        return 0;
+
+      size_t size = 0;
+      foreach_chunk(
+        from, to, [&size](const LedgerChunk& chunk, size_t first, size_t last) {
+          size += chunk.framed_range(first, last).second;
+        });
+      return size;
     }
 
     size_t entry_size(size_t idx)
     {
       auto framed_size = framed_entries_size(idx, idx);
 
-      return framed_size ? framed_size - frame_header_size : 0;
+      return framed_size ? framed_size - LedgerChunk::frame_header_size : 0;
     }
 
     void write_entry(const uint8_t* data, size_t size)
     {
-      fseeko(file, total_len, SEEK_SET);
-      positions.push_back(total_len);
-
-      LOG_DEBUG_FMT("Ledger write {}: {} bytes", positions.size(), size);
-
-      total_len += (size + frame_header_size);
+      if (
+        chunks.empty() || chunks.back()->is_complete() ||
+        chunks.back()->get_size() >= chunk_threshold)
+      {
+        chunks.push_back(
+          std::make_unique<LedgerChunk>(ledger_dir, get_last_idx() + 1));
+        sync_dir_pending = true;
+      }
 
-      uint32_t frame = (uint32_t)size;
+      LOG_DEBUG_FMT("Ledger write {}: {} bytes", get_last_idx() + 1, size);
 
-      if (fwrite(&frame, frame_header_size, 1, file) != 1)
-        throw std::logic_error("Failed to write to file");
+      chunks.back()->write_entry(data, size);
 
-      if (fwrite(data, size, 1, file) != 1)
-        throw std::logic_error("Failed to write to file");
+      sync_pending = true;
+      unsynced_bytes += size;
+      if (sync_threshold != 0 && unsynced_bytes >= sync_threshold)
+        sync();
     }
 
     void truncate(size_t last_idx)
     {
-      LOG_DEBUG_FMT("Ledger truncate: {}/{}", last_idx, positions.size());
+      LOG_DEBUG_FMT("Ledger truncate: {}/{}", last_idx, get_last_idx());
 
-      // positions[last_idx - 1] is the position of the specified
-      // final index. Truncate the ledger at position[last_idx].
-      if (last_idx >= positions.size())
+      // Entries covered by the snapshot cannot be truncated
+      last_idx = std::max(last_idx, start_idx);
+      if (last_idx >= get_last_idx())
         return;
 
-      total_len = positions.at(last_idx);
-      positions.resize(last_idx);
-
-      if (fflush(file) != 0)
+      while (!chunks.empty() && chunks.back()->get_start_idx() > last_idx)
       {
-        std::stringstream ss;
-        ss << "Failed to flush file: " << strerror(errno);
-        throw std::logic_error(ss.str());
+        chunks.back()->remove();
+        chunks.pop_back();
       }
 
-      if (ftruncate(fileno(file), total_len))
-        throw std::logic_error("Failed to truncate file");
+      if (!chunks.empty())
+        chunks.back()->truncate(last_idx);
+    }
 
-      fseeko(file, total_len, SEEK_SET);
+    void commit(size_t idx)
+    {
+      // Full chunks are completed once all their entries are committed. Only
+      // the chunks at the end of the ledger can be incomplete.
+      auto it = chunks.rbegin();
+      while (it != chunks.rend() && !(*it)->is_complete())
+        ++it;
+
+      for (auto c = it.base(); c != chunks.end(); ++c)
+      {
+        auto& chunk = *c;
+        if (chunk->get_size() < chunk_threshold || chunk->get_last_idx() > idx)
+          break;
+
+        chunk->complete_chunk();
+      }
     }
 
     void register_message_handlers(
@@ -203,27 +794,46 @@ namespace asynchost
         consensus::ledger_truncate,
         [this](const uint8_t* data, size_t size) {
           auto idx = serialized::read<consensus::Index>(data, size);
+          truncations++;
           truncate(idx);
         });
 
       DISPATCHER_SET_MESSAGE_HANDLER(
-        disp, consensus::ledger_get, [&](const uint8_t* data, size_t size) {
-          // The enclave has asked for a ledger entry.
-          auto [idx] =
-            ringbuffer::read_message<consensus::ledger_get>(data, size);
-
-          auto& entry = read_entry(idx);
+        disp,
+        consensus::ledger_commit,
+        [this](const uint8_t* data, size_t size) {
+          auto idx = serialized::read<consensus::Index>(data, size);
+          commit(idx);
+        });
 
-          if (entry.size() > 0)
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_get_range,
+        [&](const uint8_t* data, size_t size) {
+          // The enclave has asked for a range of ledger entries. Only a
+          // prefix of the range is returned if it is too large for a single
+          // message, and the enclave asks again for the rest.
+          auto [from, to] =
+            ringbuffer::read_message<consensus::ledger_get_range>(data, size);
+
+          to = std::min<consensus::Index>(to, get_last_idx());
+          if (!valid_range(from, to))
           {
             RINGBUFFER_WRITE_MESSAGE(
-              consensus::ledger_entry, to_enclave, entry);
-          }
-          else
-          {
-            RINGBUFFER_WRITE_MESSAGE(consensus::ledger_no_entry, to_enclave);
+              consensus::ledger_no_entry, to_enclave, from);
+            return;
           }
+
+          while (to > from &&
+                 framed_entries_size(from, to) > max_range_read_size)
+            to = from + (to - from) / 2;
+
+          RINGBUFFER_WRITE_MESSAGE(
+            consensus::ledger_entries,
+            to_enclave,
+            from,
+            read_framed_entries(from, to));
         });
     }
   };
-}
\ No newline at end of file
+}
@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "ledger.h"
+#include "timer.h"
+
+namespace asynchost
+{
+  class LedgerSyncImpl
+  {
+  private:
+    Ledger& ledger;
+
+  public:
+    LedgerSyncImpl(Ledger& ledger) : ledger(ledger) {}
+
+    void on_timer()
+    {
+      // Entries written since the last tick are synced together
+      ledger.sync();
+    }
+  };
+
+  using LedgerSync = proxy_ptr<Timer<LedgerSyncImpl>>;
+}
@@ -8,10 +8,13 @@
 #include "ds/oversized.h"
 #include "enclave.h"
 #include "handle_ringbuffer.h"
+#include "hostmetrics.h"
+#include "ledgersync.h"
 #include "nodeconnections.h"
 #include "notifyconnections.h"
 #include "rpcconnections.h"
 #include "sigterm.h"
+#include "snapshot.h"
 #include "ticker.h"
 
 #include <CLI11/CLI11.hpp>
@@ -27,6 +30,20 @@ using namespace std::chrono_literals;
 
 ::timespec logger::config::start{0, 0};
 
+#ifndef VIRTUAL_ENCLAVE
+// Called by idle enclave threads, which cannot wait on a futex themselves (see
+// ds/parking.h)
+extern "C" void ccf_park_thread(void* spot, uint32_t epoch, uint32_t timeout_ms)
+{
+  parking::wait(*static_cast<parking::Spot*>(spot), epoch, timeout_ms);
+}
+
+extern "C" void ccf_unpark_threads(void* spot)
+{
+  parking::wake(*static_cast<parking::Spot*>(spot));
+}
+#endif
+
 int main(int argc, char** argv)
 {
   // ignore SIGPIPE
@@ -86,8 +103,37 @@ int main(int argc, char** argv)
     "Address to advertise publicly to clients (defaults to same as "
     "--rpc-address)");
 
-  std::string ledger_file("ccf.ledger");
-  app.add_option("--ledger-file", ledger_file, "Ledger file", true);
+  std::string ledger_dir("ccf.ledger");
+  app.add_option(
+    "--ledger-dir",
+    ledger_dir,
+    "Ledger directory, in which the ledger is stored as chunk files",
+    true);
+
+  size_t ledger_chunk_bytes = asynchost::Ledger::default_chunk_threshold;
+  app.add_option(
+    "--ledger-chunk-bytes",
+    ledger_chunk_bytes,
+    "Size (bytes) after which a new ledger chunk file is started",
+    true);
+
+  size_t ledger_sync_window_ms = 0;
+  app.add_option(
+    "--ledger-sync-window-ms",
+    ledger_sync_window_ms,
+    "Interval (ms) at which ledger entries written since the last sync are "
+    "synced to disk together. Entries are then only acknowledged and "
+    "committed once synced (0 disables syncing)",
+    true);
+
+  size_t ledger_sync_bytes = 0;
+  app.add_option(
+    "--ledger-sync-bytes",
+    ledger_sync_bytes,
+    "Size (bytes) of ledger entries written since the last sync after which "
+    "the ledger is synced without waiting for the sync window (0 for no "
+    "limit). Only used if --ledger-sync-window-ms is set",
+    true);
 
   std::string host_log_level("info");
   app.add_set(
@@ -124,6 +170,14 @@ int main(int argc, char** argv)
     "Maximum milliseconds between signatures",
     true);
 
+  size_t snapshot_tx_interval = 0;
+  app.add_option(
+    "--snapshot-tx-interval",
+    snapshot_tx_interval,
+    "Number of committed transactions between snapshots of the key-value "
+    "store, written next to the ledger directory (0 disables snapshots)",
+    true);
+
   size_t circuit_size_shift = 22;
   app.add_option(
     "--circuit-size-shift",
@@ -156,6 +210,16 @@ int main(int argc, char** argv)
     "set to a significantly lower value than --raft-election-timeout-ms.",
     true);
 
+  bool raft_read_lease = false;
+  app.add_flag(
+    "--raft-read-lease",
+    raft_read_lease,
+    "Make reads linearisable. The Raft leader serves reads from its local "
+    "state while a quorum has acknowledged it within half an election "
+    "timeout, and other nodes serve reads once the leader has confirmed an "
+    "index that they have committed. Followers then do not vote while the "
+    "leader is active.");
+
   size_t max_msg_size = 24;
   app.add_option(
     "--max-msg-size",
@@ -183,6 +247,14 @@ int main(int argc, char** argv)
     "latency at a cost to throughput",
     true);
 
+  size_t host_metrics_period_ms = 60000;
+  app.add_option(
+    "--host-metrics-period-ms",
+    host_metrics_period_ms,
+    "Wait between reports of the host's metrics in its log (0 for no "
+    "reports)",
+    true);
+
   std::string domain;
   app.add_option(
     "--domain", domain, "DNS to use for TLS certificate validation", true);
@@ -305,7 +377,9 @@ int main(int argc, char** argv)
 
   // messaging ring buffers
   ringbuffer::Circuit circuit(1 << circuit_size_shift);
-  messaging::BufferProcessor bp("Host");
+
+  // Record how long the host spends on each type of message from the enclave
+  messaging::BufferProcessor bp("Host", true);
 
   // To prevent deadlock, all blocking writes from the host to the ringbuffer
   // will be queued if the ringbuffer is full
@@ -325,6 +399,12 @@ int main(int argc, char** argv)
     logger::config::set_start(s);
   });
 
+  // report host metrics
+  asynchost::HostMetrics host_metrics(nullptr);
+  if (host_metrics_period_ms != 0)
+    host_metrics =
+      asynchost::HostMetrics(host_metrics_period_ms, bp.get_dispatcher());
+
   // handle outbound messages from the enclave
   asynchost::HandleRingbuffer handle_ringbuffer(
     bp, circuit.read_from_inside(), non_blocking_factory);
@@ -340,15 +420,23 @@ int main(int argc, char** argv)
   StartType start_type;
   ConsensusType consensus_type;
 
+  // Where idle enclave worker threads park
+  std::vector<parking::Spot> thread_spots(num_worker_threads + 1);
+
   EnclaveConfig enclave_config;
   enclave_config.circuit = &circuit;
   enclave_config.writer_config = writer_config;
+  enclave_config.thread_spots = thread_spots.data();
+  enclave_config.num_thread_spots = thread_spots.size();
 #ifdef DEBUG_CONFIG
   enclave_config.debug_config = {memory_reserve_startup};
 #endif
 
   CCFConfig ccf_config;
-  ccf_config.raft_config = {raft_timeout, raft_election_timeout};
+  ccf_config.raft_config = {raft_timeout,
+                            raft_election_timeout,
+                            ledger_sync_window_ms != 0,
+                            raft_read_lease};
   ccf_config.signature_intervals = {sig_max_tx, sig_max_ms};
   ccf_config.node_info_network = {rpc_address.hostname,
                                   public_rpc_address.hostname,
@@ -356,6 +444,7 @@ int main(int argc, char** argv)
                                   node_address.port,
                                   rpc_address.port};
   ccf_config.domain = domain;
+  ccf_config.snapshots.snapshot_tx_interval = snapshot_tx_interval;
   if (consensus == "raft")
   {
     consensus_type = ConsensusType::Raft;
@@ -398,6 +487,49 @@ int main(int argc, char** argv)
     start_type = StartType::Recover;
   }
 
+  // ledger
+  asynchost::Ledger ledger(ledger_dir, writer_factory, ledger_chunk_bytes);
+  ledger.register_message_handlers(bp.get_dispatcher());
+
+  // group commit of ledger entries
+  asynchost::LedgerSync ledger_sync(nullptr);
+  if (ledger_sync_window_ms != 0)
+  {
+    ledger.set_sync_threshold(ledger_sync_bytes);
+    ledger_sync = asynchost::LedgerSync(ledger_sync_window_ms, ledger);
+  }
+
+  asynchost::SnapshotManager snapshots(ledger_dir);
+  snapshots.register_message_handlers(bp.get_dispatcher());
+
+  // Joining and recovering nodes start from the latest snapshot that the
+  // ledger can be resumed from. A joining node with an empty ledger can start
+  // from any snapshot.
+  if ((*join || *recover) && consensus_type == ConsensusType::Raft)
+  {
+    auto ledger_empty = ledger.get_last_idx() == 0;
+    auto snapshot = ledger_empty ?
+      snapshots.find_latest_snapshot(
+        1, std::numeric_limits<consensus::Index>::max()) :
+      snapshots.find_latest_snapshot(
+        ledger.get_start_idx(), ledger.get_last_idx());
+
+    if (snapshot.has_value() && !(*recover && ledger_empty))
+    {
+      LOG_INFO_FMT(
+        "Starting from snapshot at {}: {}", snapshot->idx, snapshot->path);
+
+      // Entries that follow the snapshot are replicated again once joined
+      if (ledger_empty)
+        ledger.init(snapshot->idx);
+      else if (*join)
+        ledger.truncate(snapshot->idx);
+
+      ccf_config.snapshots.startup_snapshot_idx = snapshot->idx;
+      ccf_config.snapshots.startup_snapshot = files::slurp(snapshot->path);
+    }
+  }
+
   enclave.create_node(
     enclave_config,
     ccf_config,
@@ -409,10 +541,6 @@ int main(int argc, char** argv)
 
   LOG_INFO_FMT("Created new node");
 
-  // ledger
-  asynchost::Ledger ledger(ledger_file, writer_factory);
-  ledger.register_message_handlers(bp.get_dispatcher());
-
   asynchost::NodeConnections node(
     ledger, writer_factory, node_address.hostname, node_address.port);
   node.register_message_handlers(bp.get_dispatcher());
@@ -243,13 +243,24 @@ namespace asynchost
             LOG_DEBUG_FMT(
               "send AE to {} [{}]: {}, {}", to, frame, ae.idx, ae.prev_idx);
 
-            node.value()->write(sizeof(uint32_t), (uint8_t*)&frame);
-            node.value()->write(size_to_send, data_to_send);
-
-            auto framed_entries =
-              ledger.read_framed_entries(ae.prev_idx + 1, ae.idx);
-            frame = (uint32_t)framed_entries.size();
-            node.value()->write(frame, framed_entries.data());
+            // Only the frame and header are copied out of the ringbuffer. The
+            // entries are written from the ledger in the same write: regions
+            // of committed chunks straight from their mapping, which is kept
+            // alive until the write completes.
+            std::vector<WriteBuffer> buffers;
+            buffers.push_back(framed_copy(frame, data_to_send, size_to_send));
+
+            ledger.read_framed_entries(
+              ae.prev_idx + 1,
+              ae.idx,
+              [&buffers](
+                const uint8_t* entries,
+                size_t entries_size,
+                const LedgerChunk::Owner& owner) {
+                buffers.push_back({entries, entries_size, owner});
+              });
+
+            node.value()->write(std::move(buffers));
           }
           else
           {
@@ -258,13 +269,22 @@ namespace asynchost
 
             LOG_DEBUG_FMT("node send to {} [{}]", to, frame);
 
-            node.value()->write(sizeof(uint32_t), (uint8_t*)&frame);
-            node.value()->write(size_to_send, data_to_send);
+            node.value()->write(
+              {framed_copy(frame, data_to_send, size_to_send)});
           }
         });
     }
 
   private:
+    static WriteBuffer framed_copy(
+      uint32_t frame, const uint8_t* data, size_t size)
+    {
+      auto copy = std::make_shared<std::vector<uint8_t>>(sizeof(frame) + size);
+      memcpy(copy->data(), &frame, sizeof(frame));
+      memcpy(copy->data() + sizeof(frame), data, size);
+      return {copy->data(), copy->size(), copy};
+    }
+
     bool add_node(
       ccf::NodeId node, const std::string& host, const std::string& service)
     {
@@ -21,6 +21,9 @@ namespace asynchost
     // To ensure we cleanup all open handles, keep track of them locally
     std::set<CURL*> easy_handles;
 
+    // Notified when a notification is queued, in case the loop is waiting
+    parking::Spot spot;
+
     void send_notification(const std::vector<uint8_t>& body)
     {
       if (multi_handle)
@@ -36,6 +39,7 @@ namespace asynchost
         curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
         curl_multi_add_handle(multi_handle, curl);
+        parking::notify(spot);
       }
     };
 
@@ -80,7 +84,12 @@ namespace asynchost
       easy_handles.clear();
     }
 
-    void every()
+    parking::Spot& get_spot()
+    {
+      return spot;
+    }
+
+    bool every()
     {
       int still_running = 0;
       curl_multi_perform(multi_handle, &still_running);
@@ -133,6 +142,8 @@ namespace asynchost
           }
         }
       }
+
+      return still_running > 0;
     }
 
     void register_message_handlers(
@@ -73,15 +73,15 @@ namespace asynchost
 
     virtual ~with_uv_handle() = default;
 
-  private:
-    template <typename T>
-    friend class close_ptr;
-
     void close()
     {
       uv_close((uv_handle_t*)&uv_handle, on_close);
     }
 
+  private:
+    template <typename T>
+    friend class close_ptr;
+
     static void on_close(uv_handle_t* handle)
     {
       static_cast<with_uv_handle<handle_type>*>(handle->data)->on_close();
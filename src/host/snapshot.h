@@ -0,0 +1,199 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "consensus/ledgerenclavetypes.h"
+#include "ds/logger.h"
+#include "ds/messaging.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <glob.h>
+#include <map>
+#include <optional>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace asynchost
+{
+  struct SnapshotFile
+  {
+    consensus::Index idx;
+    std::string path;
+  };
+
+  class SnapshotManager
+  {
+  private:
+    // Snapshots are stored next to the ledger directory, as
+    // <ledger_dir>.snapshot.<idx>
+    const std::string snapshot_prefix;
+
+    std::string snapshot_path(consensus::Index idx)
+    {
+      return fmt::format("{}{}", snapshot_prefix, idx);
+    }
+
+    // Snapshots being received from the enclave, written to a temporary file
+    // until they are committed
+    struct PendingSnapshot
+    {
+      FILE* f;
+      size_t size;
+      size_t written = 0;
+      bool ok = true;
+    };
+    std::map<consensus::Index, PendingSnapshot> pending;
+
+    void discard(consensus::Index idx, PendingSnapshot& p)
+    {
+      fclose(p.f);
+      remove((snapshot_path(idx) + ".tmp").c_str());
+    }
+
+  public:
+    SnapshotManager(const std::string& ledger_dir) :
+      snapshot_prefix(ledger_dir + ".snapshot.")
+    {}
+
+    ~SnapshotManager()
+    {
+      for (auto& [idx, p] : pending)
+        discard(idx, p);
+    }
+
+    void begin_snapshot(consensus::Index idx, size_t size)
+    {
+      // Write to a temporary file first so that a crash never leaves a
+      // truncated snapshot behind
+      auto search = pending.find(idx);
+      if (search != pending.end())
+      {
+        LOG_FAIL_FMT("Restarting snapshot at {}", idx);
+        discard(idx, search->second);
+        pending.erase(search);
+      }
+
+      auto tmp_path = snapshot_path(idx) + ".tmp";
+      auto f = fopen(tmp_path.c_str(), "wb");
+      if (!f)
+      {
+        LOG_FAIL_FMT("Unable to create snapshot file {}", tmp_path);
+        return;
+      }
+
+      pending.emplace(idx, PendingSnapshot{f, size});
+    }
+
+    void write_snapshot_chunk(
+      consensus::Index idx, const uint8_t* data, size_t size)
+    {
+      auto search = pending.find(idx);
+      if (search == pending.end())
+      {
+        LOG_FAIL_FMT("Received chunk of unknown snapshot at {}", idx);
+        return;
+      }
+
+      auto& p = search->second;
+      p.ok &= fwrite(data, size, 1, p.f) == 1;
+      p.written += size;
+    }
+
+    void commit_snapshot(consensus::Index idx)
+    {
+      auto search = pending.find(idx);
+      if (search == pending.end())
+      {
+        LOG_FAIL_FMT("Received commit of unknown snapshot at {}", idx);
+        return;
+      }
+
+      auto p = search->second;
+      pending.erase(search);
+
+      auto path = snapshot_path(idx);
+      auto tmp_path = path + ".tmp";
+
+      auto ok = p.ok && p.written == p.size;
+      ok &= fflush(p.f) == 0;
+      ok &= fdatasync(fileno(p.f)) == 0;
+      ok &= fclose(p.f) == 0;
+
+      if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+      {
+        LOG_FAIL_FMT("Failed to write snapshot file {}", path);
+        remove(tmp_path.c_str());
+        return;
+      }
+
+      LOG_INFO_FMT("Wrote snapshot at {} ({} bytes)", idx, p.size);
+    }
+
+    // Returns the most recent snapshot whose index is in [from, to]
+    std::optional<SnapshotFile> find_latest_snapshot(
+      consensus::Index from, consensus::Index to)
+    {
+      std::optional<SnapshotFile> latest = std::nullopt;
+
+      glob_t g;
+      auto pattern = snapshot_prefix + "*";
+      if (glob(pattern.c_str(), 0, nullptr, &g) != 0)
+        return latest;
+
+      for (size_t i = 0; i < g.gl_pathc; ++i)
+      {
+        std::string path(g.gl_pathv[i]);
+        auto suffix = path.substr(snapshot_prefix.size());
+
+        if (
+          suffix.empty() ||
+          suffix.find_first_not_of("0123456789") != std::string::npos)
+          continue;
+
+        consensus::Index idx = std::stoull(suffix);
+        if (idx < from || idx > to)
+          continue;
+
+        if (!latest.has_value() || idx > latest->idx)
+          latest = SnapshotFile{idx, path};
+      }
+
+      globfree(&g);
+      return latest;
+    }
+
+    void register_message_handlers(
+      messaging::Dispatcher<ringbuffer::Message>& disp)
+    {
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_snapshot_begin,
+        [this](const uint8_t* data, size_t size) {
+          auto [idx, snapshot_size] =
+            ringbuffer::read_message<consensus::ledger_snapshot_begin>(
+              data, size);
+          begin_snapshot(idx, snapshot_size);
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_snapshot_chunk,
+        [this](const uint8_t* data, size_t size) {
+          auto idx = serialized::read<consensus::Index>(data, size);
+          write_snapshot_chunk(idx, data, size);
+        });
+
+      DISPATCHER_SET_MESSAGE_HANDLER(
+        disp,
+        consensus::ledger_snapshot_commit,
+        [this](const uint8_t* data, size_t size) {
+          auto [idx] =
+            ringbuffer::read_message<consensus::ledger_snapshot_commit>(
+              data, size);
+          commit_snapshot(idx);
+        });
+    }
+  };
+}
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "../ds/logger.h"
+#include "../ds/pool.h"
 #include "dns.h"
 #include "proxy.h"
 
@@ -11,6 +12,18 @@ namespace asynchost
   class TCPImpl;
   using TCP = proxy_ptr<TCPImpl>;
 
+  /**
+   * Data to be written to a TCP connection, without copying it. The data
+   * remains valid for as long as owner is held, and the connection releases
+   * owner once the write has completed.
+   */
+  struct WriteBuffer
+  {
+    const uint8_t* data;
+    size_t len;
+    std::shared_ptr<const void> owner;
+  };
+
   class TCPBehaviour
   {
   public:
@@ -48,27 +61,54 @@ namespace asynchost
       RECONNECTING
     };
 
-    struct PendingWrite
-    {
-      uv_write_t* req;
-      size_t len;
+    // Payloads copied into pooled write requests keep their capacity, up to
+    // this size
+    static constexpr size_t max_pooled_payload = 65536;
 
-      PendingWrite(uv_write_t* req, size_t len) : req(req), len(len) {}
+    struct ReadBuffer
+    {
+      char data[max_read_size];
+    };
 
-      PendingWrite(PendingWrite&& that) : req(that.req), len(that.len)
-      {
-        that.req = nullptr;
-      }
+    struct WriteRequest
+    {
+      uv_write_t req;
+      std::vector<WriteBuffer> buffers;
+      size_t len = 0;
 
-      ~PendingWrite()
-      {
-        free_write(req);
-      }
+      // Storage for data copied by write(len, data)
+      std::vector<uint8_t> payload;
     };
 
+    // The host runs a single uv loop, on which all connections are read and
+    // written, so these pools are shared by all connections and are never
+    // accessed concurrently
+    static ds::Pool<ReadBuffer>& read_pool()
+    {
+      static ds::Pool<ReadBuffer> pool;
+      return pool;
+    }
+
+    static ds::Pool<WriteRequest>& write_pool()
+    {
+      static ds::Pool<WriteRequest> pool;
+      return pool;
+    }
+
+    static void release_write(std::unique_ptr<WriteRequest> req)
+    {
+      // Drop references to the written buffers, but keep the storage
+      req->buffers.clear();
+      req->len = 0;
+      if (req->payload.capacity() > max_pooled_payload)
+        std::vector<uint8_t>().swap(req->payload);
+
+      write_pool().release(std::move(req));
+    }
+
     Status status;
     std::unique_ptr<TCPBehaviour> behaviour;
-    std::vector<PendingWrite> pending_writes;
+    std::vector<std::unique_ptr<WriteRequest>> pending_writes;
 
     std::string host;
     std::string service;
@@ -90,6 +130,34 @@ namespace asynchost
     }
 
   public:
+    static const ds::PoolMetrics& get_read_pool_metrics()
+    {
+      return read_pool().get_metrics();
+    }
+
+    static const ds::PoolMetrics& get_write_pool_metrics()
+    {
+      return write_pool().get_metrics();
+    }
+
+    static size_t get_read_pool_free_count()
+    {
+      return read_pool().get_free_count();
+    }
+
+    static size_t get_write_pool_free_count()
+    {
+      return write_pool().get_free_count();
+    }
+
+    // Maximum number of free read buffers and write requests that are kept
+    // for reuse. 0 disables pooling, so that each is allocated and freed.
+    static void set_pool_limit(size_t max_free)
+    {
+      read_pool().set_max_free(max_free);
+      write_pool().set_max_free(max_free);
+    }
+
     void set_behaviour(std::unique_ptr<TCPBehaviour> b)
     {
       behaviour = std::move(b);
@@ -142,12 +210,37 @@ namespace asynchost
 
     bool write(size_t len, const uint8_t* data)
     {
-      auto req = new uv_write_t;
-      char* copy = new char[len];
+      auto req = write_pool().acquire();
+      req->payload.resize(len);
       if (data)
-        memcpy(copy, data, len);
-      req->data = copy;
+        memcpy(req->payload.data(), data, len);
+
+      req->buffers.push_back({req->payload.data(), len, nullptr});
+      req->len = len;
 
+      return write(std::move(req));
+    }
+
+    /**
+     * Write several buffers at once (scatter-gather), without copying them.
+     * Each buffer is kept alive through its owner until the write completes.
+     */
+    bool write(std::vector<WriteBuffer>&& buffers)
+    {
+      auto req = write_pool().acquire();
+      for (auto& b : buffers)
+        req->len += b.len;
+      req->buffers.insert(
+        req->buffers.end(),
+        std::make_move_iterator(buffers.begin()),
+        std::make_move_iterator(buffers.end()));
+
+      return write(std::move(req));
+    }
+
+  private:
+    bool write(std::unique_ptr<WriteRequest> req)
+    {
       switch (status)
       {
         case CONNECTING_RESOLVING:
@@ -155,16 +248,17 @@ namespace asynchost
         case RESOLVING_FAILED:
         case CONNECTING_FAILED:
         {
-          pending_writes.emplace_back(req, len);
+          pending_writes.push_back(std::move(req));
           break;
         }
 
         case CONNECTED:
-          return send_write(req, len);
+          return send_write(std::move(req));
 
         case DISCONNECTED:
         {
-          LOG_DEBUG_FMT("Disconnected: Ignoring write of size {}", len);
+          LOG_DEBUG_FMT("Disconnected: Ignoring write of size {}", req->len);
+          release_write(std::move(req));
           break;
         }
 
@@ -178,7 +272,6 @@ namespace asynchost
       return true;
     }
 
-  private:
     bool init()
     {
       assert_status(FRESH, FRESH);
@@ -200,19 +293,31 @@ namespace asynchost
       return true;
     }
 
-    bool send_write(uv_write_t* req, size_t len)
+    bool send_write(std::unique_ptr<WriteRequest> req)
     {
-      char* copy = (char*)req->data;
+      // libuv copies the uv_buf_t array, but not the data it points to, which
+      // is owned by the request until on_write
+      std::vector<uv_buf_t> bufs(req->buffers.size());
+      for (size_t i = 0; i < bufs.size(); ++i)
+      {
+        bufs[i].base = (char*)req->buffers[i].data;
+        bufs[i].len = req->buffers[i].len;
+      }
 
-      uv_buf_t buf;
-      buf.base = copy;
-      buf.len = len;
+      auto r = req.release();
+      r->req.data = r;
 
       int rc;
 
-      if ((rc = uv_write(req, (uv_stream_t*)&uv_handle, &buf, 1, on_write)) < 0)
+      if (
+        (rc = uv_write(
+           &r->req,
+           (uv_stream_t*)&uv_handle,
+           bufs.data(),
+           bufs.size(),
+           on_write)) < 0)
       {
-        free_write(req);
+        release_write(std::unique_ptr<WriteRequest>(r));
         LOG_FAIL_FMT("uv_write failed: {}", uv_strerror(rc));
         assert_status(CONNECTED, DISCONNECTED);
         behaviour->on_disconnect();
@@ -427,12 +532,9 @@ namespace asynchost
           return;
 
         for (auto& w : pending_writes)
-        {
-          send_write(w.req, w.len);
-          w.req = nullptr;
-        }
+          send_write(std::move(w));
 
-        std::vector<PendingWrite>().swap(pending_writes);
+        std::vector<std::unique_ptr<WriteRequest>>().swap(pending_writes);
         behaviour->on_connect();
       }
     }
@@ -464,14 +566,17 @@ namespace asynchost
     void on_alloc(size_t suggested_size, uv_buf_t* buf)
     {
       auto alloc_size = std::min(suggested_size, max_read_size);
-      buf->base = new char[alloc_size];
+      buf->base = read_pool().acquire().release()->data;
       buf->len = alloc_size;
     }
 
     void on_free(const uv_buf_t* buf)
     {
       if (buf->base != nullptr)
-        delete[] buf->base;
+      {
+        auto read_buffer = reinterpret_cast<ReadBuffer*>(buf->base);
+        read_pool().release(std::unique_ptr<ReadBuffer>(read_buffer));
+      }
     }
 
     static void on_read(uv_stream_t* handle, ssize_t sz, const uv_buf_t* buf)
@@ -508,17 +613,8 @@ namespace asynchost
     static void on_write(uv_write_t* req, int rc)
     {
       (void)rc;
-      free_write(req);
-    }
-
-    static void free_write(uv_write_t* req)
-    {
-      if (req == nullptr)
-        return;
-
-      char* copy = (char*)req->data;
-      delete[] copy;
-      delete req;
+      release_write(
+        std::unique_ptr<WriteRequest>(static_cast<WriteRequest*>(req->data)));
     }
 
     static void on_reconnect(uv_handle_t* handle)
@@ -2,10 +2,53 @@
 // Licensed under the Apache 2.0 License.
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "../ledger.h"
+#include "../snapshot.h"
+#include "ds/files.h"
 
 #include <doctest/doctest.h>
 #include <string>
 
+static void remove_ledger(const std::string& ledger_dir)
+{
+  auto dir = opendir(ledger_dir.c_str());
+  if (dir == nullptr)
+  {
+    unlink(ledger_dir.c_str());
+    return;
+  }
+
+  while (auto entry = readdir(dir))
+  {
+    std::string name(entry->d_name);
+    if (name != "." && name != "..")
+      unlink((ledger_dir + "/" + name).c_str());
+  }
+  closedir(dir);
+  rmdir(ledger_dir.c_str());
+}
+
+static size_t count_complete_chunks(const std::string& ledger_dir)
+{
+  size_t count = 0;
+  auto dir = opendir(ledger_dir.c_str());
+  while (auto entry = readdir(dir))
+  {
+    auto range = asynchost::LedgerChunk::parse_file_name(entry->d_name);
+    if (range.has_value() && range->second.has_value())
+      count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+static std::vector<uint8_t> make_entry(size_t idx, size_t size = 16)
+{
+  std::vector<uint8_t> e(size);
+  for (size_t i = 0; i < size; ++i)
+    e[i] = (uint8_t)(idx + i);
+  return e;
+}
+
 TEST_CASE("Read/Write test")
 {
   ringbuffer::Circuit eio(1024);
@@ -13,9 +56,9 @@ TEST_CASE("Read/Write test")
 
   const std::vector<uint8_t> e1 = {1, 2, 3};
   const std::vector<uint8_t> e2 = {5, 5, 6, 7};
+  remove_ledger("testlog");
   {
     asynchost::Ledger l("testlog", wf);
-    l.truncate(0);
     REQUIRE(l.get_last_idx() == 0);
     l.write_entry(e1.data(), e1.size());
     l.write_entry(e2.data(), e2.size());
@@ -37,8 +80,8 @@ TEST_CASE("Entry sizes")
   const std::vector<uint8_t> e1 = {1, 2, 3};
   const std::vector<uint8_t> e2 = {5, 5, 6, 7};
 
+  remove_ledger("testlog");
   asynchost::Ledger l("testlog", wf);
-  l.truncate(0);
   REQUIRE(l.get_last_idx() == 0);
   l.write_entry(e1.data(), e1.size());
   l.write_entry(e2.data(), e2.size());
@@ -53,9 +96,303 @@ TEST_CASE("Entry sizes")
     l.framed_entries_size(1, 2) ==
     (e1.size() + sizeof(uint32_t) + e2.size() + sizeof(uint32_t)));
 
-  /*
-    auto e = l.read_framed_entries(1, 1);
-    for (auto c : e)
-      std::cout << std::hex << (int)c;
-    std::cout << std::endl;*/
-}
\ No newline at end of file
+  auto framed = l.read_framed_entries(1, 2);
+  REQUIRE(framed.size() == l.framed_entries_size(1, 2));
+  REQUIRE(*(uint32_t*)framed.data() == e1.size());
+}
+
+TEST_CASE("Start index")
+{
+  ringbuffer::Circuit eio(2);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const std::vector<uint8_t> e1 = {1, 2, 3};
+  const std::vector<uint8_t> e2 = {5, 5, 6, 7};
+  const size_t start_idx = 10;
+
+  remove_ledger("testlog_start");
+  {
+    asynchost::Ledger l("testlog_start", wf);
+    REQUIRE(l.get_last_idx() == 0);
+    l.init(start_idx);
+    REQUIRE(l.get_last_idx() == start_idx);
+    l.write_entry(e1.data(), e1.size());
+    l.write_entry(e2.data(), e2.size());
+    REQUIRE_THROWS(l.init(start_idx));
+  }
+
+  asynchost::Ledger l("testlog_start", wf);
+  REQUIRE(l.get_start_idx() == start_idx);
+  REQUIRE(l.get_last_idx() == start_idx + 2);
+  REQUIRE(l.read_entry(start_idx).empty());
+  REQUIRE(l.read_entry(start_idx + 1) == e1);
+  REQUIRE(l.read_entry(start_idx + 2) == e2);
+  REQUIRE(l.entry_size(start_idx + 2) == e2.size());
+  REQUIRE(
+    l.framed_entries_size(start_idx + 1, start_idx + 2) ==
+    (e1.size() + sizeof(uint32_t) + e2.size() + sizeof(uint32_t)));
+
+  // Entries covered by the snapshot are never truncated
+  l.truncate(start_idx - 1);
+  REQUIRE(l.get_last_idx() == start_idx);
+  l.write_entry(e2.data(), e2.size());
+  REQUIRE(l.read_entry(start_idx + 1) == e2);
+}
+
+TEST_CASE("Chunks")
+{
+  ringbuffer::Circuit eio(2);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  // Each entry is 100 bytes framed, so that chunks hold 4 entries
+  const size_t entry_size = 100 - sizeof(uint32_t);
+  const size_t chunk_threshold = 4 * 100;
+  const size_t entries = 18;
+
+  remove_ledger("testlog_chunks");
+  {
+    asynchost::Ledger l("testlog_chunks", wf, chunk_threshold);
+    for (size_t i = 1; i <= entries; ++i)
+    {
+      auto e = make_entry(i, entry_size);
+      l.write_entry(e.data(), e.size());
+    }
+    REQUIRE(l.get_chunk_count() == 5);
+    REQUIRE(count_complete_chunks("testlog_chunks") == 0);
+
+    INFO("Only full and committed chunks are completed");
+    l.commit(10);
+    REQUIRE(count_complete_chunks("testlog_chunks") == 2);
+    l.commit(entries);
+    REQUIRE(count_complete_chunks("testlog_chunks") == 4);
+
+    INFO("Entries can be read across chunks");
+    for (size_t i = 1; i <= entries; ++i)
+      REQUIRE(l.read_entry(i) == make_entry(i, entry_size));
+
+    size_t regions = 0;
+    std::vector<uint8_t> framed;
+    l.read_framed_entries(
+      3,
+      14,
+      [&](
+        const uint8_t* data,
+        size_t size,
+        const asynchost::LedgerChunk::Owner& owner) {
+        REQUIRE(owner != nullptr);
+        regions++;
+        framed.insert(framed.end(), data, data + size);
+      });
+    REQUIRE(regions == 4);
+    REQUIRE(framed.size() == 12 * 100);
+    REQUIRE(framed == l.read_framed_entries(3, 14));
+    REQUIRE(l.framed_entries_size(3, 14) == framed.size());
+  }
+
+  INFO("Complete chunks are mapped on startup");
+  {
+    asynchost::Ledger l("testlog_chunks", wf, chunk_threshold);
+    REQUIRE(l.get_chunk_count() == 5);
+    REQUIRE(l.get_last_idx() == entries);
+    for (size_t i = 1; i <= entries; ++i)
+      REQUIRE(l.read_entry(i) == make_entry(i, entry_size));
+
+    INFO("Truncation removes and reopens chunks");
+    l.truncate(6);
+    REQUIRE(l.get_last_idx() == 6);
+    REQUIRE(l.get_chunk_count() == 2);
+    REQUIRE(count_complete_chunks("testlog_chunks") == 1);
+
+    auto e = make_entry(42, entry_size);
+    l.write_entry(e.data(), e.size());
+    REQUIRE(l.read_entry(7) == e);
+    REQUIRE(l.read_entry(6) == make_entry(6, entry_size));
+  }
+
+  {
+    asynchost::Ledger l("testlog_chunks", wf, chunk_threshold);
+    REQUIRE(l.get_last_idx() == 7);
+    REQUIRE(l.read_entry(7) == make_entry(42, entry_size));
+  }
+}
+
+TEST_CASE("Regions outlive their chunk")
+{
+  ringbuffer::Circuit eio(2);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const size_t entry_size = 100 - sizeof(uint32_t);
+  const size_t chunk_threshold = 2 * 100;
+
+  remove_ledger("testlog_regions");
+  asynchost::Ledger l("testlog_regions", wf, chunk_threshold);
+  for (size_t i = 1; i <= 4; ++i)
+  {
+    auto e = make_entry(i, entry_size);
+    l.write_entry(e.data(), e.size());
+  }
+  l.commit(4);
+  auto expected = l.read_framed_entries(3, 4);
+
+  const uint8_t* region = nullptr;
+  size_t region_size = 0;
+  asynchost::LedgerChunk::Owner region_owner;
+  l.read_framed_entries(
+    3,
+    4,
+    [&](
+      const uint8_t* data,
+      size_t size,
+      const asynchost::LedgerChunk::Owner& owner) {
+      region = data;
+      region_size = size;
+      region_owner = owner;
+    });
+
+  // The chunk holding entries 3 and 4 is removed, but its mapping is only
+  // released with the last owner
+  l.truncate(2);
+  REQUIRE(l.get_chunk_count() == 1);
+  REQUIRE(std::vector<uint8_t>(region, region + region_size) == expected);
+  region_owner.reset();
+}
+
+static std::vector<std::pair<consensus::Index, size_t>> read_durable(
+  ringbuffer::Circuit& eio)
+{
+  std::vector<std::pair<consensus::Index, size_t>> durable;
+  eio.read_from_outside().read(
+    -1, [&](ringbuffer::Message m, const uint8_t* data, size_t size) {
+      REQUIRE(m == consensus::ledger_durable);
+      auto [idx, truncations] =
+        ringbuffer::read_message<consensus::ledger_durable>(data, size);
+      durable.emplace_back(idx, truncations);
+    });
+  return durable;
+}
+
+TEST_CASE("Sync")
+{
+  ringbuffer::Circuit eio(1 << 12);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const size_t entry_size = 100 - sizeof(uint32_t);
+  const size_t chunk_threshold = 4 * 100;
+
+  remove_ledger("testlog_sync");
+  asynchost::Ledger l("testlog_sync", wf, chunk_threshold);
+
+  INFO("Nothing is reported until the ledger is synced");
+  for (size_t i = 1; i <= 3; ++i)
+  {
+    auto e = make_entry(i, entry_size);
+    l.write_entry(e.data(), e.size());
+  }
+  REQUIRE(read_durable(eio).empty());
+
+  l.sync();
+  auto durable = read_durable(eio);
+  REQUIRE(durable.size() == 1);
+  REQUIRE(durable[0].first == 3);
+  REQUIRE(durable[0].second == 0);
+
+  INFO("Syncing with nothing written is a no-op");
+  l.sync();
+  REQUIRE(read_durable(eio).empty());
+
+  INFO("Entries are synced together once the threshold is reached");
+  l.set_sync_threshold(3 * entry_size);
+  for (size_t i = 4; i <= 10; ++i)
+  {
+    auto e = make_entry(i, entry_size);
+    l.write_entry(e.data(), e.size());
+  }
+  durable = read_durable(eio);
+  REQUIRE(durable.size() == 2);
+  REQUIRE(durable[0].first == 6);
+  REQUIRE(durable[1].first == 9);
+
+  l.sync();
+  durable = read_durable(eio);
+  REQUIRE(durable.size() == 1);
+  REQUIRE(durable[0].first == 10);
+
+  INFO("Truncations requested by the enclave are reported");
+  messaging::BufferProcessor bp;
+  l.register_message_handlers(bp.get_dispatcher());
+  const consensus::Index truncate_at = 8;
+  bp.get_dispatcher().dispatch(
+    consensus::ledger_truncate,
+    reinterpret_cast<const uint8_t*>(&truncate_at),
+    sizeof(truncate_at));
+  REQUIRE(l.get_last_idx() == 8);
+
+  auto e = make_entry(42, entry_size);
+  l.write_entry(e.data(), e.size());
+  l.sync();
+  durable = read_durable(eio);
+  REQUIRE(durable.size() == 1);
+  REQUIRE(durable[0].first == 9);
+  REQUIRE(durable[0].second == 1);
+}
+
+TEST_CASE("Snapshots")
+{
+  const std::string ledger_dir = "snapshot_test_ledger";
+  const auto snapshot_path = ledger_dir + ".snapshot.10";
+  remove(snapshot_path.c_str());
+
+  asynchost::SnapshotManager snapshots(ledger_dir);
+  messaging::BufferProcessor bp;
+  snapshots.register_message_handlers(bp.get_dispatcher());
+  auto& disp = bp.get_dispatcher();
+
+  const consensus::Index idx = 10;
+  const std::vector<uint8_t> snapshot = {1, 2, 3, 4, 5};
+
+  auto begin = [&](size_t size) {
+    std::vector<uint8_t> msg(sizeof(idx) + sizeof(size));
+    auto data = msg.data();
+    auto size_ = msg.size();
+    serialized::write(data, size_, idx);
+    serialized::write(data, size_, size);
+    disp.dispatch(consensus::ledger_snapshot_begin, msg.data(), msg.size());
+  };
+
+  auto chunk = [&](size_t from, size_t to) {
+    std::vector<uint8_t> msg(sizeof(idx));
+    memcpy(msg.data(), &idx, sizeof(idx));
+    msg.insert(msg.end(), snapshot.begin() + from, snapshot.begin() + to);
+    disp.dispatch(consensus::ledger_snapshot_chunk, msg.data(), msg.size());
+  };
+
+  auto commit = [&]() {
+    disp.dispatch(
+      consensus::ledger_snapshot_commit,
+      reinterpret_cast<const uint8_t*>(&idx),
+      sizeof(idx));
+  };
+
+  INFO("A snapshot is only visible once all its chunks are committed");
+  {
+    begin(snapshot.size());
+    chunk(0, 2);
+    chunk(2, snapshot.size());
+    REQUIRE(!snapshots.find_latest_snapshot(0, idx).has_value());
+
+    commit();
+    auto latest = snapshots.find_latest_snapshot(0, idx);
+    REQUIRE(latest.has_value());
+    REQUIRE(latest->idx == idx);
+    REQUIRE(files::slurp(latest->path) == snapshot);
+    remove(snapshot_path.c_str());
+  }
+
+  INFO("A snapshot missing chunks is discarded");
+  {
+    begin(snapshot.size());
+    chunk(0, 2);
+    commit();
+    REQUIRE(!snapshots.find_latest_snapshot(0, idx).has_value());
+  }
+}
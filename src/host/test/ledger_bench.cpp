@@ -0,0 +1,204 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#define PICOBENCH_IMPLEMENT
+#include "../ledger.h"
+#include "../ledgersync.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <picobench/picobench.hpp>
+#include <string>
+
+// Measures the cost of making ledger entries durable, from a sync after every
+// entry (as if each append were followed by fdatasync) to a single sync after
+// the whole batch (as if all entries fell in the same group commit window).
+
+static constexpr size_t entry_size = 256;
+static const std::string ledger_dir = "ledger_bench_dir";
+
+static void remove_ledger()
+{
+  auto dir = opendir(ledger_dir.c_str());
+  if (dir == nullptr)
+    return;
+
+  while (auto entry = readdir(dir))
+  {
+    std::string name(entry->d_name);
+    if (name != "." && name != "..")
+      unlink((ledger_dir + "/" + name).c_str());
+  }
+  closedir(dir);
+  rmdir(ledger_dir.c_str());
+}
+
+template <size_t sync_threshold>
+static void write_entries(picobench::state& s)
+{
+  remove_ledger();
+  ringbuffer::Circuit eio(1 << 20);
+  auto wf = ringbuffer::WriterFactory(eio);
+  auto& from_host = eio.read_from_outside();
+
+  std::vector<uint8_t> entry(entry_size, 42);
+  {
+    asynchost::Ledger l(ledger_dir, wf);
+    l.set_sync_threshold(sync_threshold);
+
+    s.start_timer();
+    for (auto _ : s)
+    {
+      (void)_;
+      l.write_entry(entry.data(), entry.size());
+      // Drain durable notifications, as the enclave would
+      from_host.read(-1, [](ringbuffer::Message, const uint8_t*, size_t) {});
+    }
+    l.sync();
+    s.stop_timer();
+  }
+  remove_ledger();
+}
+
+const std::vector<int> iterations = {100, 1000};
+
+PICOBENCH_SUITE("sync");
+auto sync_every_entry = write_entries<1>;
+PICOBENCH(sync_every_entry).iterations(iterations).baseline();
+auto sync_4k = write_entries<4096>;
+PICOBENCH(sync_4k).iterations(iterations);
+auto sync_64k = write_entries<65536>;
+PICOBENCH(sync_64k).iterations(iterations);
+auto sync_1m = write_entries<1 << 20>;
+PICOBENCH(sync_1m).iterations(iterations);
+auto sync_once = write_entries<0>;
+PICOBENCH(sync_once).iterations(iterations);
+
+// Writes entries from the uv loop, as the host does when the enclave appends
+// them, while a LedgerSync timer syncs them every window_ms (or each entry is
+// synced as it is written, if window_ms is 0). Measures the throughput, and
+// the latency from writing each entry to being told that it is durable.
+class SyncWindowRun
+{
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t entries_per_loop = 8;
+
+  asynchost::Ledger& ledger;
+  ringbuffer::Reader& from_host;
+  const size_t total;
+  std::vector<uint8_t> entry;
+  std::vector<Clock::time_point> written;
+  size_t durable = 0;
+  uv_idle_t idle;
+
+public:
+  std::vector<double> latencies_us;
+  Clock::time_point start;
+  Clock::time_point end;
+
+  SyncWindowRun(
+    asynchost::Ledger& ledger, ringbuffer::Reader& from_host, size_t total) :
+    ledger(ledger),
+    from_host(from_host),
+    total(total),
+    entry(entry_size, 42)
+  {
+    written.reserve(total);
+    latencies_us.reserve(total);
+    uv_idle_init(uv_default_loop(), &idle);
+    idle.data = this;
+  }
+
+  void run()
+  {
+    start = Clock::now();
+    uv_idle_start(&idle, on_idle);
+    uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+    uv_close((uv_handle_t*)&idle, nullptr);
+  }
+
+private:
+  static void on_idle(uv_idle_t* handle)
+  {
+    static_cast<SyncWindowRun*>(handle->data)->on_idle();
+  }
+
+  void on_idle()
+  {
+    for (size_t i = 0; i < entries_per_loop && written.size() < total; ++i)
+    {
+      written.push_back(Clock::now());
+      ledger.write_entry(entry.data(), entry.size());
+    }
+
+    from_host.read(
+      -1, [this](ringbuffer::Message m, const uint8_t* data, size_t size) {
+        if (m != consensus::ledger_durable)
+          return;
+
+        auto [idx, truncations] =
+          ringbuffer::read_message<consensus::ledger_durable>(data, size);
+        (void)truncations;
+
+        const auto now = Clock::now();
+        for (; durable < idx; ++durable)
+          latencies_us.push_back(
+            std::chrono::duration<double, std::micro>(now - written[durable])
+              .count());
+      });
+
+    if (durable == total)
+    {
+      end = Clock::now();
+      uv_stop(uv_default_loop());
+    }
+  }
+};
+
+static void report_sync_window(size_t window_ms, size_t total)
+{
+  remove_ledger();
+  ringbuffer::Circuit eio(1 << 20);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  {
+    asynchost::Ledger l(ledger_dir, wf);
+    asynchost::LedgerSync ledger_sync(nullptr);
+    if (window_ms == 0)
+      l.set_sync_threshold(1);
+    else
+      ledger_sync = asynchost::LedgerSync(window_ms, l);
+
+    SyncWindowRun r(l, eio.read_from_outside(), total);
+    r.run();
+
+    auto& lat = r.latencies_us;
+    std::sort(lat.begin(), lat.end());
+    const auto seconds = std::chrono::duration<double>(r.end - r.start).count();
+    std::cout << "window " << window_ms << "ms: " << (size_t)(total / seconds)
+              << " entries/s, latency p50 " << (size_t)lat[lat.size() / 2]
+              << "us, p99 " << (size_t)lat[lat.size() * 99 / 100] << "us"
+              << std::endl;
+  }
+
+  // Let the closed handles be freed
+  uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+  remove_ledger();
+}
+
+int main(int argc, char* argv[])
+{
+  picobench::runner runner;
+  runner.parse_cmd_line(argc, argv);
+  const auto ret = runner.run();
+
+  const size_t total = 20000;
+  std::cout << "Group commit of " << total << " entries of " << entry_size
+            << " bytes:" << std::endl;
+  for (auto window_ms : {0, 1, 5, 20})
+    report_sync_window(window_ms, total);
+
+  return ret;
+}
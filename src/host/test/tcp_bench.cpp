@@ -0,0 +1,152 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#define PICOBENCH_IMPLEMENT
+#include "host/tcp.h"
+
+#include <iostream>
+#include <picobench/picobench.hpp>
+
+::timespec logger::config::start{0, 0};
+
+// Sends messages from one TCPImpl to another over a loopback connection,
+// through the uv loop. Each message is copied into a write request, and read
+// into a read buffer, either taken from the host's pools or, with pooling
+// disabled, allocated and freed each time.
+
+using namespace asynchost;
+
+class Receiver : public TCPBehaviour
+{
+public:
+  size_t& received;
+
+  Receiver(size_t& received) : received(received) {}
+
+  void on_read(size_t len, uint8_t*& data) override
+  {
+    received += len;
+  }
+};
+
+class Listener : public TCPBehaviour
+{
+public:
+  TCP& peer;
+  size_t& received;
+  bool& failed;
+
+  Listener(TCP& peer, size_t& received, bool& failed) :
+    peer(peer),
+    received(received),
+    failed(failed)
+  {}
+
+  void on_listen_failed() override
+  {
+    failed = true;
+  }
+
+  void on_accept(TCP& accepted) override
+  {
+    accepted->set_behaviour(std::make_unique<Receiver>(received));
+    peer = accepted;
+  }
+};
+
+class Connector : public TCPBehaviour
+{
+public:
+  bool& connected;
+
+  Connector(bool& connected) : connected(connected) {}
+
+  void on_connect() override
+  {
+    connected = true;
+  }
+};
+
+template <size_t N, bool Pooled>
+static void send(picobench::state& s)
+{
+  TCPImpl::set_pool_limit(Pooled ? ds::Pool<char>::default_max_free : 0);
+
+  {
+    size_t received = 0;
+    bool connected = false;
+    bool failed = true;
+
+    TCP peer(nullptr);
+    TCP server;
+    std::string port;
+    for (size_t p = 20000; failed && p < 20100; ++p)
+    {
+      failed = false;
+      port = std::to_string(p);
+      server = TCP();
+      server->set_behaviour(
+        std::make_unique<Listener>(peer, received, failed));
+      server->listen("127.0.0.1", port);
+    }
+    if (failed)
+      throw std::logic_error("Could not listen on a loopback port");
+
+    TCP client;
+    client->set_behaviour(std::make_unique<Connector>(connected));
+    client->connect("127.0.0.1", port);
+    while (!connected || peer.is_null())
+      uv_run(uv_default_loop(), UV_RUN_ONCE);
+
+    std::vector<uint8_t> msg(N, 42);
+    const size_t total = N * s.iterations();
+
+    s.start_timer();
+    for (auto _ : s)
+    {
+      (void)_;
+      client->write(N, msg.data());
+    }
+    while (received < total)
+      uv_run(uv_default_loop(), UV_RUN_ONCE);
+    s.stop_timer();
+  }
+
+  // Let the connections close
+  uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+}
+
+const std::vector<int> iterations = {1000, 10000};
+
+PICOBENCH_SUITE("send 64b");
+auto send_64_alloc = send<64, false>;
+PICOBENCH(send_64_alloc).iterations(iterations).baseline();
+auto send_64_pool = send<64, true>;
+PICOBENCH(send_64_pool).iterations(iterations);
+
+PICOBENCH_SUITE("send 1k");
+auto send_1k_alloc = send<1024, false>;
+PICOBENCH(send_1k_alloc).iterations(iterations).baseline();
+auto send_1k_pool = send<1024, true>;
+PICOBENCH(send_1k_pool).iterations(iterations);
+
+PICOBENCH_SUITE("send 16k");
+auto send_16k_alloc = send<16384, false>;
+PICOBENCH(send_16k_alloc).iterations(iterations).baseline();
+auto send_16k_pool = send<16384, true>;
+PICOBENCH(send_16k_pool).iterations(iterations);
+
+int main(int argc, char* argv[])
+{
+  picobench::runner runner;
+  runner.parse_cmd_line(argc, argv);
+  const auto ret = runner.run();
+
+  auto print = [](const char* name, const ds::PoolMetrics& m) {
+    std::cout << name << " pool: " << m.hits << " hits, " << m.misses
+              << " misses, " << m.discards << " discards" << std::endl;
+  };
+  print("Read buffer", TCPImpl::get_read_pool_metrics());
+  print("Write request", TCPImpl::get_write_pool_metrics());
+
+  return ret;
+}
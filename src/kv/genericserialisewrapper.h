@@ -169,6 +169,11 @@ namespace kv
       serialise_internal(k);
     }
 
+    void serialise_raw(const std::vector<uint8_t>& raw)
+    {
+      serialise_internal(raw);
+    }
+
     std::vector<uint8_t> get_raw_data()
     {
       // make sure the private buffer is empty when we return
@@ -415,6 +420,11 @@ namespace kv
       return current_reader->template read_next<K>();
     }
 
+    std::vector<uint8_t> deserialise_raw()
+    {
+      return current_reader->template read_next<std::vector<uint8_t>>();
+    }
+
     template <class K, class V, class Version>
     std::optional<KeyValVersion<K, V, Version>> deserialise_write_version()
     {
@@ -4,13 +4,16 @@
 
 #include "ds/champmap.h"
 #include "ds/logger.h"
+#include "ds/rbmap.h"
+#include "ds/ring.h"
 #include "ds/spinlock.h"
 #include "kvtypes.h"
 
+#include <algorithm>
+#include <climits>
 #include <functional>
 #include <iostream>
 #include <limits>
-#include <list>
 #include <map>
 #include <mutex>
 #include <optional>
@@ -57,7 +60,15 @@ namespace kv
   template <class S, class D>
   class Store;
 
-  template <class K, class V, class H, class S, class D>
+  // Ordered maps keep their entries sorted by key, so that transactions can
+  // read ranges of keys, and only conflict with writes to those ranges.
+  template <
+    class K,
+    class V,
+    class H,
+    class S,
+    class D,
+    bool Ordered = false>
   class Map : public AbstractMap<S, D>
   {
   public:
@@ -75,14 +86,17 @@ namespace kv
       VersionV(Version ver, V val) : version(ver), value(val) {}
     };
 
-    using State = champ::Map<K, VersionV, H>;
+    using State = std::conditional_t<
+      Ordered,
+      RBMap<K, VersionV>,
+      champ::Map<K, VersionV, H>>;
     using Read = std::unordered_map<K, Version, H>;
     using Write = std::unordered_map<K, VersionV, H>;
     /// Signature for transaction commit handlers
     using CommitHook = std::function<void(Version, const State&, const Write&)>;
 
   private:
-    using This = Map<K, V, H, S, D>;
+    using This = Map<K, V, H, S, D, Ordered>;
 
     struct LocalCommit
     {
@@ -90,15 +104,28 @@ namespace kv
       State state;
       Write writes;
     };
-    using LocalCommits = std::list<LocalCommit>;
+    // Local commits that may still be rolled back, in increasing version
+    // order, so that the state at a version is found by binary search. Slots
+    // are reused once compacted, so that committing does not allocate.
+    using LocalCommits = ds::Ring<LocalCommit>;
+
+    struct Tombstone
+    {
+      Version version;
+      K key;
+    };
+    // Keys removed by local commits, in increasing version order. Once their
+    // removal is globally committed, they are dropped from the state.
+    using Tombstones = ds::Ring<Tombstone>;
 
     Store<S, D>* store;
     std::string name;
     size_t rollback_counter;
     std::unique_ptr<LocalCommits> roll;
+    Tombstones tombstones;
     CommitHook local_hook;
     CommitHook global_hook;
-    LocalCommits commit_deltas;
+    std::vector<LocalCommit> commit_deltas;
     SpinLock sl;
     const SecurityDomain security_domain;
     const bool replicated;
@@ -124,6 +151,15 @@ namespace kv
 
     Map(const Map& that) = delete;
 
+    // Position in the roll of the last entry committed at or before version
+    // v, or of the first entry if there is none
+    size_t roll_position(Version v) const
+    {
+      auto pos = roll->upper_bound(
+        v, [](Version v, const LocalCommit& c) { return v < c.version; });
+      return pos == 0 ? 0 : pos - 1;
+    }
+
   public:
     virtual AbstractMap<S, D>* clone(AbstractStore* store) override
     {
@@ -207,15 +243,21 @@ namespace kv
       if (state1.version != state2.version)
         return false;
 
+      // Deleted entries are ignored, since they may already have been dropped
+      // from one of the states but not from the other
       size_t count = 0;
       state2.state.foreach([&count](const K& k, const VersionV& v) {
-        count++;
+        if (!deleted(v.version))
+          count++;
         return true;
       });
 
       size_t i = 0;
       bool ok =
         state1.state.foreach([&state2, &i](const K& k, const VersionV& v) {
+          if (deleted(v.version))
+            return true;
+
           auto search = state2.state.get(k);
 
           if (search.has_value())
@@ -260,6 +302,9 @@ namespace kv
       State state;
       State committed;
       Read reads;
+      // Ranges of keys that have been read, from the first key up to, but
+      // not including, the second, if any
+      std::vector<std::pair<K, std::optional<K>>> range_reads;
       Write writes;
       Version start_version;
       size_t rollback_counter;
@@ -269,6 +314,11 @@ namespace kv
       bool deserialised;
       bool committed_writes;
 
+      // The state of the map that this view's writes were applied to when it
+      // was staged, and the resulting state, which is committed.
+      State staged_base;
+      State staged;
+
       TxView(This& parent, State& s, Version v, size_t r) :
         map(parent),
         state(s),
@@ -475,6 +525,54 @@ namespace kv
         return true;
       }
 
+      /** Iterate in key order over the entries with keys from lo up to, but
+       * not including, hi
+       *
+       * Only the range is added to the read set, so the transaction conflicts
+       * with writes to keys in the range rather than with any write to the
+       * map. Only available on ordered maps.
+       *
+       * @param lo First key of the range
+       * @param hi Key after the range
+       * @param F functor, taking a key and a value, return value determines
+       * whether the iteration should continue (true) or stop (false)
+       */
+      template <class F>
+      bool range(const K& lo, const K& hi, F&& f)
+      {
+        return foreach_range(lo, hi, std::forward<F>(f));
+      }
+
+      /** Iterate in key order over the entries whose keys start with prefix
+       *
+       * Like range, this only adds the keys with the prefix to the read set.
+       * Only available on ordered maps with string keys.
+       *
+       * @param prefix Prefix of the keys
+       * @param F functor, taking a key and a value, return value determines
+       * whether the iteration should continue (true) or stop (false)
+       */
+      template <class F>
+      bool prefix(const K& prefix, F&& f)
+      {
+        static_assert(
+          std::is_same_v<K, std::string>, "Prefix reads require string keys");
+
+        // The range ends at the first key that is greater than every key with
+        // the prefix. There is none if the prefix is only made of maximal
+        // characters.
+        std::optional<K> hi = prefix;
+        while (!hi->empty() && (unsigned char)hi->back() == UCHAR_MAX)
+          hi->pop_back();
+
+        if (hi->empty())
+          hi.reset();
+        else
+          hi->back() = (char)((unsigned char)hi->back() + 1);
+
+        return foreach_range(prefix, hi, std::forward<F>(f));
+      }
+
       Version start_order()
       {
         return start_version;
@@ -494,6 +592,93 @@ namespace kv
       }
 
     private:
+      template <class F>
+      bool foreach_range(const K& lo, const std::optional<K>& hi, F&& f)
+      {
+        static_assert(Ordered, "Range reads require an ordered map");
+
+        if (commit_version != NoVersion)
+          return false;
+
+        // Record a read dependency on the range only.
+        range_reads.emplace_back(lo, hi);
+
+        // Entries written by this transaction are merged in key order with
+        // those in the state.
+        std::vector<const typename Write::value_type*> local;
+        for (const auto& write : writes)
+        {
+          const auto& k = write.first;
+          if (!(k < lo) && (!hi.has_value() || k < hi.value()))
+            local.push_back(&write);
+        }
+        std::sort(local.begin(), local.end(), [](auto a, auto b) {
+          return a->first < b->first;
+        });
+
+        auto next = local.begin();
+        auto visit_local = [&f](const typename Write::value_type* write) {
+          return deleted(write->second.version) ||
+            f(write->first, write->second.value);
+        };
+
+        auto visit = [&](const K& k, const VersionV& v) {
+          for (; next != local.end() && (*next)->first < k; ++next)
+          {
+            if (!visit_local(*next))
+              return false;
+          }
+
+          // This transaction's write replaces the entry.
+          if (next != local.end() && !(k < (*next)->first))
+            return visit_local(*next++);
+
+          return deleted(v.version) || f(k, v.value);
+        };
+
+        if (!state.foreach_range(lo, hi, visit))
+          return false;
+
+        for (; next != local.end(); ++next)
+        {
+          if (!visit_local(*next))
+            return false;
+        }
+        return true;
+      }
+
+      // Check that the entries in a range that are not deleted, and their
+      // versions, are the same in both states.
+      static bool same_range(
+        const State& a,
+        const State& b,
+        const K& lo,
+        const std::optional<K>& hi)
+      {
+        std::vector<std::pair<const K*, Version>> entries;
+        a.foreach_range(lo, hi, [&entries](const K& k, const VersionV& v) {
+          if (!deleted(v.version))
+            entries.emplace_back(&k, v.version);
+          return true;
+        });
+
+        size_t i = 0;
+        bool same = b.foreach_range(lo, hi, [&](const K& k, const VersionV& v) {
+          if (deleted(v.version))
+            return true;
+
+          if (
+            i == entries.size() || !(*entries[i].first == k) ||
+            entries[i].second != v.version)
+            return false;
+
+          i++;
+          return true;
+        });
+
+        return same && i == entries.size();
+      }
+
       virtual bool has_writes()
       {
         return committed_writes || !writes.empty();
@@ -504,20 +689,11 @@ namespace kv
         return changes;
       }
 
-      virtual bool prepare()
+      // Check the read set against a state of the map at a given version.
+      bool validate(Version version, const State& current)
       {
-        if (writes.empty())
-          return true;
-
-        // If the parent map has rolled back since this transaction began, this
-        // transaction must fail.
-        if (rollback_counter != map.rollback_counter)
-          return false;
-
         // If we have iterated over the map, check for a global version match.
-        auto& current = map.roll->back();
-
-        if ((read_version != NoVersion) && (read_version != current.version))
+        if ((read_version != NoVersion) && (read_version != version))
         {
           LOG_DEBUG_FMT("Read version {} is invalid", read_version);
           return false;
@@ -527,32 +703,142 @@ namespace kv
         for (auto it = reads.begin(); it != reads.end(); ++it)
         {
           // Get the value from the current state.
-          auto search = current.state.get(it->first);
+          auto search = current.getp(it->first);
 
           if (it->second == NoVersion)
           {
             // If we depend on the key not existing, it must be absent.
-            if (search.has_value())
+            if (search != nullptr)
             {
               LOG_DEBUG_FMT("Read depends on non-existing entry");
               return false;
             }
           }
-          else
+          else if (search == nullptr)
           {
-            // If we depend on the key existing, it must be present and have the
-            // version that we expect.
-            if (!search.has_value() || (it->second != search.value().version))
+            // If we read the key as removed, its removal may have been
+            // globally committed and dropped since, which leaves it just as
+            // absent. Otherwise, we depend on the key existing.
+            if (!deleted(it->second))
             {
               LOG_DEBUG_FMT("Read depends on invalid version of entry");
               return false;
             }
           }
+          else if (it->second != search->version)
+          {
+            // The key must have the version that we expect.
+            LOG_DEBUG_FMT("Read depends on invalid version of entry");
+            return false;
+          }
+        }
+
+        // Check each range in our read set, unless the map is unchanged.
+        if constexpr (Ordered)
+        {
+          if (!range_reads.empty() && !current.same_root(state))
+          {
+            for (const auto& [lo, hi] : range_reads)
+            {
+              if (!same_range(state, current, lo, hi))
+              {
+                LOG_DEBUG_FMT("Read depends on invalid range of entries");
+                return false;
+              }
+            }
+          }
         }
 
         return true;
       }
 
+      // Apply the write set to base, into staged. Written entries are given
+      // version 0 until the commit version is known. The writes are applied
+      // as a single batch, so that nodes are copied at most once.
+      void apply_writes(const State& base)
+      {
+        staged_base = base;
+        changes = false;
+
+        auto batch = base.transient();
+        for (auto it = writes.begin(); it != writes.end(); ++it)
+        {
+          if (it->second.version >= 0)
+          {
+            changes = true;
+            batch.put(it->first, VersionV{0, it->second.value});
+          }
+          else if (batch.getp(it->first) != nullptr)
+          {
+            // Write an empty value only if the key exists.
+            changes = true;
+            batch.put(it->first, VersionV{0, V()});
+          }
+        }
+        staged = batch.persistent();
+      }
+
+      virtual bool stage()
+      {
+        if (writes.empty())
+          return true;
+
+        // Capturing the latest state is cheap, since it is persistent. The
+        // reads are validated and the writes applied to that capture without
+        // holding the map lock.
+        map.lock();
+        const auto& current = map.roll->back();
+        const auto version = current.version;
+        auto state = current.state;
+        const auto map_rollback_counter = map.rollback_counter;
+        map.unlock();
+
+        if (rollback_counter != map_rollback_counter)
+          return false;
+
+        if (!validate(version, state))
+          return false;
+
+        apply_writes(state);
+        return true;
+      }
+
+      virtual bool prepare()
+      {
+        if (writes.empty())
+          return true;
+
+        // If the parent map has rolled back since this transaction began, this
+        // transaction must fail.
+        if (rollback_counter != map.rollback_counter)
+          return false;
+
+        // If the map has not changed since this view was staged, the reads
+        // are still valid and the staged state can be committed as it is.
+        auto& current = map.roll->back();
+        if (current.state.same_root(staged_base))
+          return true;
+
+        // Otherwise, another transaction committed to the map in the meantime,
+        // and this view is staged again on the latest state.
+        if (!validate(current.version, current.state))
+          return false;
+
+        apply_writes(current.state);
+        return true;
+      }
+
+      // Check the reads of a view against the latest state of its map, even
+      // if the view has no writes. The map must be locked.
+      virtual bool validate_reads()
+      {
+        if (rollback_counter != map.rollback_counter)
+          return false;
+
+        auto& current = map.roll->back();
+        return validate(current.version, current.state);
+      }
+
       virtual void commit(Version v)
       {
         if (writes.empty())
@@ -565,33 +851,29 @@ namespace kv
         commit_version = v;
         committed_writes = true;
 
-        if (!writes.empty())
+        if (changes)
         {
-          auto state = map.roll->back().state;
-
+          // The written entries were created when staging, and are not shared
+          // with any other state yet, so they can be given their version in
+          // place.
           for (auto it = writes.begin(); it != writes.end(); ++it)
           {
+            auto entry = const_cast<VersionV*>(staged.getp(it->first));
+            if (entry == nullptr)
+              continue;
+
             if (it->second.version >= 0)
             {
-              // Write the new value with the global version.
-              changes = true;
-              state = state.put(it->first, VersionV{v, it->second.value});
+              entry->version = v;
             }
             else
             {
-              // Write an empty value with the deleted global version only if
-              // the key exists.
-              auto search = state.get(it->first);
-              if (search.has_value())
-              {
-                changes = true;
-                state = state.put(it->first, VersionV{-v, V()});
-              }
+              entry->version = -v;
+              map.tombstones.push_back({v, it->first});
             }
           }
 
-          if (changes)
-            map.roll->push_back({v, state, writes});
+          map.roll->push_back({v, staged, writes});
         }
       }
 
@@ -641,8 +923,7 @@ namespace kv
           }
           else
           {
-            auto search = map.roll->back().state.get(it->first);
-            if (search.has_value())
+            if (staged.getp(it->first) != nullptr)
               ++remove_ctr;
           }
         }
@@ -714,64 +995,96 @@ namespace kv
       lock();
 
       // Find the last entry committed at or before this version.
-      TxView* view = nullptr;
-
-      for (auto it = roll->rbegin(); it != roll->rend(); ++it)
-      {
-        if (it->version <= version)
-        {
-          view = new TxView(*this, it->state, it->version, rollback_counter);
-          break;
-        }
-      }
-
-      if (view == nullptr)
-      {
-        view = new TxView(
-          *this, roll->front().state, roll->front().version, rollback_counter);
-      }
+      auto& r = (*roll)[roll_position(version)];
+      TxView* view = new TxView(*this, r.state, r.version, rollback_counter);
 
       unlock();
       return view;
     }
 
     void compact(Version v) override
+    {
+      // The Map expects to be locked during compaction.
+      compact_roll(v);
+      drop_tombstones(v);
+    }
+
+    void compact_roll(Version v)
     {
       // This discards available rollback state before version v, and populates
       // the commit_deltas to be passed to the global commit hook, if there is
-      // one, up to version v. The Map expects to be locked during compaction.
+      // one, up to version v.
       while (roll->size() > 1)
       {
-        auto r = roll->begin();
+        auto& r = roll->front();
 
         // Globally committed but not discardable.
-        if (r->version == v)
+        if (r.version == v)
         {
           // We know that write set is not empty.
           if (global_hook)
             commit_deltas.emplace_back(
-              LocalCommit{r->version, r->state, move(r->writes)});
+              LocalCommit{r.version, r.state, move(r.writes)});
           return;
         }
 
-        // Discardable, so move to commit_deltas.
-        if (global_hook && !r->writes.empty())
-          std::move(r, std::next(r), std::back_inserter(commit_deltas));
+        // Discardable, so pass its writes to commit_deltas. The state is
+        // kept, since it is still the latest one if the next entry is after v.
+        if (global_hook && !r.writes.empty())
+          commit_deltas.emplace_back(
+            LocalCommit{r.version, r.state, move(r.writes)});
 
         // Stop if the next state may be rolled back or is the only state.
         // This ensures there is always a state present.
-        if (std::next(r)->version > v)
+        if ((*roll)[1].version > v)
           return;
 
         roll->pop_front();
       }
 
       // There is only one roll. We may need to call the commit hook.
-      auto r = roll->begin();
+      auto& r = roll->front();
 
-      if (global_hook && !r->writes.empty())
+      if (global_hook && !r.writes.empty())
         commit_deltas.emplace_back(
-          LocalCommit{r->version, r->state, move(r->writes)});
+          LocalCommit{r.version, r.state, move(r.writes)});
+    }
+
+    void drop_tombstones(Version v)
+    {
+      // Keys removed at or before version v can no longer be rolled back, so
+      // they are removed from the remaining states rather than kept as
+      // deleted entries. A transaction that read one of these keys as
+      // deleted now conflicts, and sees the key as absent when it is retried.
+      if (tombstones.empty() || tombstones.front().version > v)
+        return;
+
+      for (size_t i = 0; i < roll->size(); ++i)
+      {
+        auto& r = (*roll)[i];
+        auto batch = r.state.transient();
+        bool removed = false;
+
+        for (size_t t = 0; t < tombstones.size(); ++t)
+        {
+          const auto& tombstone = tombstones[t];
+          if (tombstone.version > v)
+            break;
+
+          // The key may have been written again since it was removed.
+          auto entry = batch.getp(tombstone.key);
+          if (
+            entry != nullptr && deleted(entry->version) &&
+            -entry->version <= v)
+            removed |= batch.remove(tombstone.key);
+        }
+
+        if (removed)
+          r.state = batch.persistent();
+      }
+
+      while (!tombstones.empty() && tombstones.front().version <= v)
+        tombstones.pop_front();
     }
 
     void post_compact() override
@@ -804,6 +1117,9 @@ namespace kv
         roll->pop_back();
       }
 
+      while (!tombstones.empty() && tombstones.back().version > v)
+        tombstones.pop_back();
+
       if (advance)
         rollback_counter++;
     }
@@ -814,6 +1130,7 @@ namespace kv
       // and rollback counter. The Map expects to be locked before clearing it.
       roll->clear();
       roll->push_back({0, State(), Write()});
+      tombstones.clear();
       rollback_counter = 0;
     }
 
@@ -836,6 +1153,92 @@ namespace kv
 
       std::swap(rollback_counter, map->rollback_counter);
       std::swap(roll, map->roll);
+      std::swap(tombstones, map->tombstones);
+    }
+
+    class Snapshot : public AbstractMapSnapshot<S>
+    {
+    private:
+      const std::string name;
+      const SecurityDomain security_domain;
+      State state;
+
+    public:
+      Snapshot(
+        const std::string& name_,
+        SecurityDomain security_domain_,
+        const State& state_) :
+        name(name_),
+        security_domain(security_domain_),
+        state(state_)
+      {}
+
+      void serialise(S& s) override
+      {
+        s.start_map(name, security_domain);
+
+        // Deleted entries are kept, with their (negative) deletion version, so
+        // that the installed state is identical to the one that was captured
+        state.foreach([&s](const K& k, const VersionV& v) {
+          s.serialise_write_version(k, v.value, v.version);
+          return true;
+        });
+      }
+    };
+
+    std::unique_ptr<AbstractMapSnapshot<S>> snapshot(Version v) override
+    {
+      // The state is persistent, so capturing it is cheap and it can be
+      // serialised later without holding the map lock. The Map expects to be
+      // locked while the snapshot is taken.
+      return std::make_unique<Snapshot>(
+        name, security_domain, (*roll)[roll_position(v)].state);
+    }
+
+    void deserialise_snapshot(D& d, Version v) override
+    {
+      // This replaces the entire content of the map with the snapshotted
+      // state at version v. The Map expects to be locked while the snapshot is
+      // installed.
+      auto batch = State().transient();
+      Write writes;
+      tombstones.clear();
+
+      for (auto r = d.template deserialise_write_version<K, V, Version>();
+           r.has_value();
+           r = d.template deserialise_write_version<K, V, Version>())
+      {
+        auto& kvv = r.value();
+        batch.put(kvv.key, VersionV{kvv.version, kvv.value});
+        if (!deleted(kvv.version))
+          writes[kvv.key] = VersionV{kvv.version, kvv.value};
+        else
+          tombstones.push_back({v, kvv.key});
+      }
+
+      roll->clear();
+      roll->push_back({v, batch.persistent(), std::move(writes)});
+      rollback_counter++;
+    }
+
+    void post_snapshot() override
+    {
+      // Hooks are presented with the entire snapshotted state as their write
+      // set, as if it had been committed in a single transaction. The writes
+      // are then discarded, so that they are not passed again to the global
+      // hook on the next compaction.
+      auto& r = roll->back();
+
+      if (!r.writes.empty())
+      {
+        if (local_hook)
+          local_hook(r.version, r.state, r.writes);
+
+        if (global_hook)
+          global_hook(r.version, r.state, r.writes);
+      }
+
+      r.writes.clear();
     }
   };
 
@@ -879,6 +1282,7 @@ namespace kv
     Version read_version;
     Version version;
     bool read_globally_committed = false;
+    bool validate_all_reads = false;
 
     kv::TxHistory::RequestID req_id;
 
@@ -1015,7 +1419,10 @@ namespace kv
       }
 
       auto store = view_list.begin()->second.map->get_store();
-      auto c = commit(view_list, [store]() { return store->next_version(); });
+      auto c = commit(
+        view_list,
+        [store]() { return store->next_version(); },
+        validate_all_reads);
       success = c.has_value();
 
       if (!success)
@@ -1052,8 +1459,17 @@ namespace kv
             return CommitSuccess::OK;
           }
 
+          // The history's hash of the transaction is computed here, so that
+          // transactions committed concurrently are hashed in parallel rather
+          // than by the store while it orders commits
+          std::optional<crypto::Sha256Hash> hash;
+          if (store->get_history() != nullptr)
+            hash = crypto::Sha256Hash({data});
+
           return store->commit(
-            version, MovePendingTx(std::move(data), std::move(req_id)), false);
+            version,
+            MovePendingTx(std::move(data), std::move(req_id), std::move(hash)),
+            false);
         }
         catch (const std::exception& e)
         {
@@ -1084,12 +1500,25 @@ namespace kv
     }
 
     static std::optional<Version> commit(
-      OrderedViews<S, D>& views, std::function<Version()> f)
-    {
-      // All maps with pending writes are locked, transactions are prepared
-      // and possibly committed, and then all maps with pending writes are
-      // unlocked. This is to prevent transactions from being committed in an
-      // interleaved fashion.
+      OrderedViews<S, D>& views,
+      std::function<Version()> f,
+      bool validate_all_reads = false)
+    {
+      // Views with pending writes are first staged without holding any lock:
+      // their reads are validated and their writes applied to the latest
+      // state of each map. Then all maps with pending writes are locked,
+      // transactions are prepared and possibly committed, and then all maps
+      // with pending writes are unlocked. This is to prevent transactions from
+      // being committed in an interleaved fashion. Preparing a view is cheap
+      // if its map has not changed since it was staged. If all reads are
+      // validated, maps which were only read are locked as well, and the
+      // reads of their views are validated while they are locked.
+      for (auto it = views.begin(); it != views.end(); ++it)
+      {
+        if (!it->second.view->stage())
+          return {};
+      }
+
       Version version = 0;
       bool has_writes = false;
 
@@ -1100,13 +1529,21 @@ namespace kv
           it->second.map->lock();
           has_writes = true;
         }
+        else if (validate_all_reads)
+        {
+          it->second.map->lock();
+        }
       }
 
       bool ok = true;
 
       for (auto it = views.begin(); it != views.end(); ++it)
       {
-        if (!it->second.view->prepare())
+        auto view = it->second.view.get();
+        if (
+          !view->prepare() ||
+          (validate_all_reads && !view->has_writes() &&
+           !view->validate_reads()))
         {
           ok = false;
           break;
@@ -1127,7 +1564,7 @@ namespace kv
 
       for (auto it = views.begin(); it != views.end(); ++it)
       {
-        if (it->second.view->has_writes())
+        if (validate_all_reads || it->second.view->has_writes())
           it->second.map->unlock();
       }
 
@@ -1214,6 +1651,15 @@ namespace kv
       return {CommitSuccess::OK, {0, 0, 0}, std::move(serialise())};
     }
 
+    // Validate the reads of every view when committing, including views which
+    // only read, so that the transaction conflicts if anything it read has
+    // been written since. By default, the reads of views without writes are
+    // not validated.
+    void set_validate_all_reads()
+    {
+      validate_all_reads = true;
+    }
+
     // Set all reads on transaction to read at the global commit version,
     // rather than the local commit.
     void set_read_committed()
@@ -1236,7 +1682,11 @@ namespace kv
   public:
     template <class K, class V, class H = std::hash<K>>
     using Map = Map<K, V, H, S, D>;
+
+    template <class K, class V, class H = std::hash<K>>
+    using OrderedMap = kv::Map<K, V, H, S, D, true>;
     using Tx = Tx<S, D>;
+    using Deserialiser = D;
 
   private:
     // All collections of Map must be ordered so that we lock their contained
@@ -1247,6 +1697,7 @@ namespace kv
     std::shared_ptr<Consensus> consensus = nullptr;
     std::shared_ptr<TxHistory> history = nullptr;
     std::shared_ptr<AbstractTxEncryptor> encryptor = nullptr;
+    std::shared_ptr<AbstractSnapshotter> snapshotter = nullptr;
     Version version = 0;
     Version compacted = 0;
 
@@ -1293,6 +1744,48 @@ namespace kv
     }
 
   public:
+    /** Consistent capture of all replicated maps at a given version
+     *
+     * Capturing is cheap since map states are persistent. All the work of
+     * serialising (and encrypting) the captured state is done in `serialise`,
+     * without holding any of the store's locks.
+     */
+    class Snapshot
+    {
+    private:
+      Version version;
+      std::vector<uint8_t> tree;
+      std::vector<std::unique_ptr<AbstractMapSnapshot<S>>> snapshots;
+
+    public:
+      Snapshot(Version version_, std::vector<uint8_t>&& tree_) :
+        version(version_),
+        tree(std::move(tree_))
+      {}
+
+      Version get_version() const
+      {
+        return version;
+      }
+
+      void add_map_snapshot(std::unique_ptr<AbstractMapSnapshot<S>> snapshot)
+      {
+        snapshots.push_back(std::move(snapshot));
+      }
+
+      std::vector<uint8_t> serialise(
+        std::shared_ptr<AbstractTxEncryptor> encryptor)
+      {
+        S serialiser(encryptor, version);
+        serialiser.serialise_raw(tree);
+
+        for (auto& s : snapshots)
+          s->serialise(serialiser);
+
+        return serialiser.get_raw_data();
+      }
+    };
+
     void clone_schema(Store& target)
     {
       std::lock_guard<SpinLock> mguard(maps_lock);
@@ -1349,6 +1842,11 @@ namespace kv
       return encryptor;
     }
 
+    void set_snapshotter(std::shared_ptr<AbstractSnapshotter> snapshotter_)
+    {
+      snapshotter = snapshotter_;
+    }
+
     template <class K, class V, class H = std::hash<K>>
     Map<K, V, H>* get(std::string name)
     {
@@ -1447,35 +1945,197 @@ namespace kv
       // This is called when the store will never be rolled back to any
       // state before the specified version.
       // No transactions can be prepared or committed during compaction.
+      {
+        std::lock_guard<SpinLock> mguard(maps_lock);
+
+        if (v > current_version())
+          return;
+
+        for (auto& map : maps)
+          map.second->lock();
+
+        for (auto& map : maps)
+          map.second->compact(v);
+
+        for (auto& map : maps)
+          map.second->unlock();
+
+        {
+          std::lock_guard<SpinLock> vguard(version_lock);
+          compacted = v;
+
+          auto h = get_history();
+          if (h)
+            h->compact(v);
+
+          auto e = get_encryptor();
+          if (e)
+            e->compact(v);
+        }
+
+        for (auto& map : maps)
+          map.second->post_compact();
+      }
+
+      // The snapshotter takes its own snapshot of the store, so must be
+      // called once the maps have been released
+      if (snapshotter)
+        snapshotter->compact(v);
+    }
+
+    /** Capture the state of all replicated maps at version v
+     *
+     * The version must not have been compacted away, nor be later than the
+     * current version. The returned snapshot also holds the Merkle tree of the
+     * transaction history at that version, if there is one.
+     *
+     * @param v Version at which to snapshot
+     *
+     * @return Snapshot of the store
+     */
+    std::unique_ptr<Snapshot> snapshot(Version v)
+    {
       std::lock_guard<SpinLock> mguard(maps_lock);
 
-      if (v > current_version())
-        return;
+      std::vector<uint8_t> tree;
+      {
+        std::lock_guard<SpinLock> vguard(version_lock);
+        if (v < compacted || v > version)
+        {
+          throw std::logic_error(fmt::format(
+            "Cannot snapshot at version {} (compacted: {}, current: {})",
+            v,
+            compacted,
+            version));
+        }
+
+        auto h = get_history();
+        if (h)
+          tree = h->serialise_tree(v);
+      }
+
+      auto snapshot = std::make_unique<Snapshot>(v, std::move(tree));
 
       for (auto& map : maps)
         map.second->lock();
 
       for (auto& map : maps)
-        map.second->compact(v);
+      {
+        if (map.second->is_replicated())
+          snapshot->add_map_snapshot(map.second->snapshot(v));
+      }
 
       for (auto& map : maps)
         map.second->unlock();
 
+      return snapshot;
+    }
+
+    /** Install a serialised snapshot in an empty store
+     *
+     * All maps present in the snapshot have their content replaced, the
+     * store is set (and compacted) at the snapshot version and the history
+     * resumes from the snapshotted Merkle tree. Commit hooks are then called
+     * with the entire content of each map as their write set.
+     *
+     * @param data Serialised snapshot
+     * @param public_only Only install the public maps of the snapshot
+     *
+     * @return PASS if the snapshot was installed, FAILED otherwise
+     */
+    DeserialiseSuccess deserialise_snapshot(
+      const std::vector<uint8_t>& data, bool public_only = false)
+    {
+      auto e = get_encryptor();
+      auto d = std::make_unique<D>(
+        e,
+        public_only ? kv::SecurityDomain::PUBLIC :
+                      std::optional<kv::SecurityDomain>());
+
+      if (!d->init(data.data(), data.size()))
       {
-        std::lock_guard<SpinLock> vguard(version_lock);
-        compacted = v;
+        LOG_FAIL_FMT("Initialisation of snapshot deserialiser failed");
+        return DeserialiseSuccess::FAILED;
+      }
 
-        auto h = get_history();
-        if (h)
-          h->compact(v);
+      Version v = d->template deserialise_version<Version>();
+      auto tree = d->deserialise_raw();
+
+      {
+        std::lock_guard<SpinLock> mguard(maps_lock);
+
+        if (current_version() != 0)
+        {
+          LOG_FAIL_FMT(
+            "Cannot install snapshot at {} on a non-empty store ({})",
+            v,
+            current_version());
+          return DeserialiseSuccess::FAILED;
+        }
+
+        for (auto& map : maps)
+          map.second->lock();
+
+        bool ok = true;
+        std::unordered_set<std::string> seen;
+
+        for (auto r = d->start_map(); r.has_value(); r = d->start_map())
+        {
+          const auto map_name = r.value();
+
+          auto search = maps.find(map_name);
+          if (search == maps.end())
+          {
+            LOG_FAIL_FMT("No such map {} in snapshot at {}", map_name, v);
+            ok = false;
+            break;
+          }
+
+          if (!seen.insert(map_name).second)
+          {
+            LOG_FAIL_FMT("Map {} appears twice in snapshot at {}", map_name, v);
+            ok = false;
+            break;
+          }
+
+          search->second->deserialise_snapshot(*d, v);
+        }
 
-        auto e = get_encryptor();
-        if (e)
-          e->compact(v);
+        if (ok && !d->end())
+        {
+          LOG_FAIL_FMT("Unexpected content in snapshot at {}", v);
+          ok = false;
+        }
+
+        if (!ok)
+        {
+          for (auto& map : maps)
+            map.second->clear();
+        }
+
+        for (auto& map : maps)
+          map.second->unlock();
+
+        if (!ok)
+          return DeserialiseSuccess::FAILED;
+
+        {
+          std::lock_guard<SpinLock> vguard(version_lock);
+          version = v;
+          compacted = v;
+          last_replicated = v;
+          last_committable = v;
+
+          auto h = get_history();
+          if (h && !tree.empty())
+            h->deserialise_tree(tree);
+        }
+
+        for (auto& map : maps)
+          map.second->post_snapshot();
       }
 
-      for (auto& map : maps)
-        map.second->post_compact();
+      return DeserialiseSuccess::PASS;
     }
 
     void rollback(Version v) override
@@ -1519,6 +2179,39 @@ namespace kv
       bool public_only = false,
       Term* term = nullptr,
       Tx* tx = nullptr)
+    {
+      return deserialise_prepared_views(
+        data, prepare_deserialise(data, public_only), term, tx);
+    }
+
+    /**
+     * Create a deserialiser for a serialised transaction, decrypting its
+     * private domain unless public_only is set. The store itself is not
+     * accessed, so that transactions can be prepared concurrently, e.g. on
+     * worker threads, before being applied in order with
+     * deserialise_prepared().
+     *
+     * @return nullptr if the transaction could not be decrypted
+     */
+    std::unique_ptr<D> prepare_deserialise(
+      const std::vector<uint8_t>& data, bool public_only = false)
+    {
+      auto d = std::make_unique<D>(
+        get_encryptor(),
+        public_only ? kv::SecurityDomain::PUBLIC :
+                      std::optional<kv::SecurityDomain>());
+
+      if (!d->init(data.data(), data.size()))
+        return nullptr;
+
+      return d;
+    }
+
+    DeserialiseSuccess deserialise_prepared_views(
+      const std::vector<uint8_t>& data,
+      std::unique_ptr<D> d,
+      Term* term = nullptr,
+      Tx* tx = nullptr)
     {
       // If we pass in a transaction we don't want to commit, just deserialise
       // and put the views into that transaction.
@@ -1532,15 +2225,7 @@ namespace kv
       // Processing transactions locally and also deserialising to the
       // same store will result in a store version mismatch and
       // deserialisation will then fail.
-      auto e = get_encryptor();
-
-      // create the first deserialiser
-      auto d = std::make_unique<D>(
-        e,
-        public_only ? kv::SecurityDomain::PUBLIC :
-                      std::optional<kv::SecurityDomain>());
-
-      if (!d->init(data.data(), data.size()))
+      if (d == nullptr)
       {
         LOG_FAIL_FMT("Initialisation of deserialise object failed");
         return DeserialiseSuccess::FAILED;
@@ -1687,6 +2372,18 @@ namespace kv
       return deserialise_views(data, public_only, term);
     }
 
+    /**
+     * Apply a transaction prepared with prepare_deserialise(). data must be
+     * the serialised transaction the deserialiser was prepared from.
+     */
+    DeserialiseSuccess deserialise_prepared(
+      const std::vector<uint8_t>& data,
+      std::unique_ptr<D> d,
+      Term* term = nullptr)
+    {
+      return deserialise_prepared_views(data, std::move(d), term);
+    }
+
     bool operator==(const Store<S, D>& that) const
     {
       // Only used for debugging, not thread safe.
@@ -1765,7 +2462,7 @@ namespace kv
             break;
 
           auto& [pending_tx_, committable_] = search->second;
-          auto [success_, reqid, data_] = pending_tx_();
+          auto [success_, reqid, data_, hash_] = pending_tx_();
 
           // NB: this cannot happen currently. Regular Tx only make it here if
           // they did succeed, and signatures cannot conflict because they
@@ -1776,7 +2473,10 @@ namespace kv
 
           if (h)
           {
-            h->add_result(reqid, version, data_.data(), data_.size());
+            if (hash_.has_value())
+              h->add_result(reqid, version, hash_.value());
+            else
+              h->add_result(reqid, version, data_.data(), data_.size());
           }
 
           LOG_DEBUG_FMT(
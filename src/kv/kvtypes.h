@@ -11,6 +11,7 @@
 #include <functional>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <unordered_set>
 #include <vector>
 
@@ -135,6 +136,10 @@ namespace kv
       kv::Version version,
       const uint8_t* replicated,
       size_t replicated_size) = 0;
+    virtual void add_result(
+      RequestID id,
+      kv::Version version,
+      crypto::Sha256Hash replicated_hash) = 0;
     virtual void add_result(RequestID id, kv::Version version) = 0;
     virtual void add_response(
       RequestID id, const std::vector<uint8_t>& response) = 0;
@@ -145,6 +150,8 @@ namespace kv
     virtual crypto::Sha256Hash get_replicated_state_root() = 0;
     virtual std::vector<uint8_t> get_receipt(Version v) = 0;
     virtual bool verify_receipt(const std::vector<uint8_t>& receipt) = 0;
+    virtual std::vector<uint8_t> serialise_tree(Version v) = 0;
+    virtual void deserialise_tree(const std::vector<uint8_t>& tree) = 0;
   };
 
   class Consensus
@@ -234,6 +241,37 @@ namespace kv
     virtual void set_f(ccf::NodeId f) = 0;
     virtual void emit_signature() = 0;
     virtual ConsensusType type() = 0;
+
+    // Resume as a backup from state installed out of band (e.g. a snapshot),
+    // rather than from an empty log
+    virtual void init_as_backup(SeqNo seqno, View view) {}
+
+    // The host has synced the ledger up to seqno, after the given number of
+    // ledger truncations
+    virtual void ledger_durable(SeqNo seqno, size_t truncations) {}
+
+    // Linearisable reads. If enabled, a read served from local state must
+    // observe every transaction committed before it started: either this node
+    // holds a read lease, or the read waits for read_index(). The callback is
+    // given the seqno up to which local state must be committed, or nullopt
+    // if it could not be confirmed, and may be called with consensus locks
+    // held.
+    using ReadIndexCallback = std::function<void(std::optional<SeqNo>)>;
+
+    virtual bool linearisable_reads()
+    {
+      return false;
+    }
+
+    virtual bool has_read_lease()
+    {
+      return false;
+    }
+
+    virtual void read_index(ReadIndexCallback cb)
+    {
+      cb(std::nullopt);
+    }
   };
 
   struct PendingTxInfo
@@ -241,14 +279,20 @@ namespace kv
     CommitSuccess success;
     TxHistory::RequestID reqid;
     std::vector<uint8_t> data;
+    // Hash of data, if it was computed before the transaction was passed to
+    // the store, so that the store does not compute it while it orders
+    // commits
+    std::optional<crypto::Sha256Hash> hash;
 
     PendingTxInfo(
       CommitSuccess success_,
       TxHistory::RequestID reqid_,
-      std::vector<uint8_t>&& data_) :
+      std::vector<uint8_t>&& data_,
+      std::optional<crypto::Sha256Hash> hash_ = std::nullopt) :
       success(success_),
       reqid(std::move(reqid_)),
-      data(std::move(data_))
+      data(std::move(data_)),
+      hash(std::move(hash_))
     {}
   };
 
@@ -259,12 +303,16 @@ namespace kv
   private:
     std::vector<uint8_t> data;
     kv::TxHistory::RequestID req_id;
+    std::optional<crypto::Sha256Hash> hash;
 
   public:
     MovePendingTx(
-      std::vector<uint8_t>&& data_, kv::TxHistory::RequestID req_id_) :
+      std::vector<uint8_t>&& data_,
+      kv::TxHistory::RequestID req_id_,
+      std::optional<crypto::Sha256Hash> hash_ = std::nullopt) :
       data(std::move(data_)),
-      req_id(std::move(req_id_))
+      req_id(std::move(req_id_)),
+      hash(std::move(hash_))
     {}
 
     MovePendingTx(MovePendingTx&& other) = default;
@@ -285,7 +333,7 @@ namespace kv
     PendingTxInfo operator()()
     {
       return PendingTxInfo(
-        CommitSuccess::OK, std::move(req_id), std::move(data));
+        CommitSuccess::OK, std::move(req_id), std::move(data), hash);
     }
   };
 
@@ -310,6 +358,13 @@ namespace kv
       Version version, const std::vector<uint8_t>& raw_ledger_key) = 0;
   };
 
+  class AbstractSnapshotter
+  {
+  public:
+    virtual ~AbstractSnapshotter() {}
+    virtual void compact(Version v) = 0;
+  };
+
   class AbstractStore
   {
   public:
@@ -338,7 +393,9 @@ namespace kv
     virtual ~AbstractTxView() {}
     virtual bool has_writes() = 0;
     virtual bool has_changes() = 0;
+    virtual bool stage() = 0;
     virtual bool prepare() = 0;
+    virtual bool validate_reads() = 0;
     virtual void commit(Version v) = 0;
     virtual void post_commit() = 0;
     virtual void serialise(S& s, bool include_reads) = 0;
@@ -348,6 +405,14 @@ namespace kv
     virtual bool is_replicated() = 0;
   };
 
+  template <class S>
+  class AbstractMapSnapshot
+  {
+  public:
+    virtual ~AbstractMapSnapshot() {}
+    virtual void serialise(S& s) = 0;
+  };
+
   template <class S, class D>
   class AbstractMap
   {
@@ -369,5 +434,9 @@ namespace kv
 
     virtual AbstractMap<S, D>* clone(AbstractStore* store) = 0;
     virtual void swap(AbstractMap<S, D>* map) = 0;
+
+    virtual std::unique_ptr<AbstractMapSnapshot<S>> snapshot(Version v) = 0;
+    virtual void deserialise_snapshot(D& d, Version v) = 0;
+    virtual void post_snapshot() = 0;
   };
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 
 #include <picobench/picobench.hpp>
 #include <string>
+#include <thread>
 
 using namespace ccfapp;
 using namespace ccf;
@@ -91,6 +92,149 @@ static void deserialise(picobench::state& s)
   s.stop_timer();
 }
 
+// Creates views on a map with many uncommitted versions, either at the latest
+// version or at the oldest (committed) one
+template <bool ReadCommitted>
+static void create_view(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  Store kv_store;
+  kv_store.set_encryptor(std::make_shared<NullTxEncryptor>());
+  auto& map0 = kv_store.create<std::string, std::string>("map0");
+
+  const int uncommitted_versions = 10000;
+  for (int i = 0; i < uncommitted_versions; i++)
+  {
+    Store::Tx tx;
+    tx.get_view(map0)->put("key" + std::to_string(i), "value");
+    tx.commit();
+  }
+
+  s.start_timer();
+  for (auto _ : s)
+  {
+    (void)_;
+    Store::Tx tx;
+    if constexpr (ReadCommitted)
+      tx.set_read_committed();
+    auto view = tx.get_view(map0);
+    if (view == nullptr)
+      throw std::logic_error("Could not create view");
+  }
+  s.stop_timer();
+}
+
+// Commits transactions from several threads, each reading and writing its own
+// keys of a single map. The transactions never conflict, but all update the
+// same map.
+template <size_t Threads>
+static void commit_concurrent(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  Store kv_store;
+  kv_store.set_encryptor(std::make_shared<NullTxEncryptor>());
+  auto& map0 = kv_store.create<std::string, std::string>(
+    "map0", kv::SecurityDomain::PUBLIC);
+
+  const size_t keys_per_tx = 4;
+  const size_t initial_keys = 10000;
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map0);
+    for (size_t i = 0; i < initial_keys; i++)
+      view->put("key" + std::to_string(i), "value");
+    tx.commit();
+  }
+
+  const size_t txs_per_thread = s.iterations() / Threads;
+  auto worker = [&](size_t t) {
+    for (size_t i = 0; i < txs_per_thread; i++)
+    {
+      Store::Tx tx;
+      auto view = tx.get_view(map0);
+      auto prefix = std::to_string(t) + "-" + std::to_string(i % 100) + "-";
+      view->get(prefix + "0");
+      for (size_t k = 0; k < keys_per_tx; k++)
+        view->put(prefix + std::to_string(k), "value");
+
+      auto rc = tx.commit();
+      if (rc != kv::CommitSuccess::OK)
+        throw std::logic_error(
+          "Transaction commit failed: " + std::to_string(rc));
+    }
+  };
+
+  s.start_timer();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < Threads; t++)
+    threads.emplace_back(worker, t);
+  for (auto& thread : threads)
+    thread.join();
+  s.stop_timer();
+}
+
+// Reads the entries in a range of 100 keys, from maps of increasing size,
+// either as a range of an ordered map or by filtering a scan of a hash map
+template <bool Ordered>
+static void range_read(picobench::state& s)
+{
+  logger::config::level() = logger::INFO;
+
+  using M = std::conditional_t<
+    Ordered,
+    Store::OrderedMap<std::string, std::string>,
+    Store::Map<std::string, std::string>>;
+
+  Store kv_store;
+  kv_store.set_encryptor(std::make_shared<NullTxEncryptor>());
+  auto& map0 = kv_store.create<M>("map0", kv::SecurityDomain::PUBLIC);
+
+  // Keys are padded, so that their order is that of their index
+  auto key = [](size_t i) {
+    auto n = std::to_string(i);
+    return "key" + std::string(10 - n.size(), '0') + n;
+  };
+
+  const size_t keys = s.iterations();
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map0);
+    for (size_t i = 0; i < keys; i++)
+      view->put(key(i), "value");
+    tx.commit();
+  }
+
+  const size_t range_size = 100;
+  const auto lo = key(keys / 2);
+  const auto hi = key(keys / 2 + range_size);
+  const size_t reads = 100;
+
+  s.start_timer();
+  for (size_t i = 0; i < reads; i++)
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map0);
+    size_t n = 0;
+    auto count = [&n](const auto&, const auto&) {
+      n++;
+      return true;
+    };
+
+    if constexpr (Ordered)
+      view->range(lo, hi, count);
+    else
+      view->foreach([&](const auto& k, const auto& v) {
+        return k < lo || !(k < hi) || count(k, v);
+      });
+
+    if (n != range_size)
+      throw std::logic_error("Range read " + std::to_string(n) + " entries");
+  }
+  s.stop_timer();
+}
+
 const std::vector<int> tx_count = {10, 100, 200};
 const uint32_t sample_size = 100;
 
@@ -109,3 +253,23 @@ PICOBENCH(deserialise<SD::PUBLIC>)
   .samples(sample_size)
   .baseline();
 PICOBENCH(deserialise<SD::PRIVATE>).iterations(tx_count).samples(sample_size);
+
+const std::vector<int> view_count = {1000, 10000};
+
+PICOBENCH_SUITE("create_view");
+PICOBENCH(create_view<false>).iterations(view_count).baseline();
+PICOBENCH(create_view<true>).iterations(view_count);
+
+const std::vector<int> concurrent_tx_count = {12000, 120000};
+
+PICOBENCH_SUITE("commit_concurrent");
+PICOBENCH(commit_concurrent<1>).iterations(concurrent_tx_count).baseline();
+PICOBENCH(commit_concurrent<2>).iterations(concurrent_tx_count);
+PICOBENCH(commit_concurrent<4>).iterations(concurrent_tx_count);
+PICOBENCH(commit_concurrent<6>).iterations(concurrent_tx_count);
+
+const std::vector<int> range_map_size = {1000, 10000, 100000};
+
+PICOBENCH_SUITE("range_read");
+PICOBENCH(range_read<false>).iterations(range_map_size).baseline();
+PICOBENCH(range_read<true>).iterations(range_map_size);
@@ -475,6 +475,129 @@ TEST_CASE("replicated and derived table serialisation")
   }
 }
 
+TEST_CASE(
+  "Snapshot and install snapshot" * doctest::test_suite("serialisation"))
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
+
+  Store store(consensus);
+  store.set_encryptor(encryptor);
+
+  auto& pub_map = store.create<std::string, std::string>(
+    "pub_map", kv::SecurityDomain::PUBLIC);
+  auto& priv_map = store.create<std::string, std::string>("priv_map");
+
+  {
+    Store::Tx tx;
+    auto [view_pub, view_priv] = tx.get_view(pub_map, priv_map);
+    view_pub->put("pubk1", "pubv1");
+    view_pub->put("pubk2", "pubv2");
+    view_priv->put("privk1", "privv1");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  {
+    Store::Tx tx;
+    auto view_pub = tx.get_view(pub_map);
+    view_pub->remove("pubk2");
+    view_pub->put("pubk3", "pubv3");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  auto snapshot_version = store.current_version();
+  auto snapshot = store.snapshot(snapshot_version);
+  REQUIRE(snapshot->get_version() == snapshot_version);
+
+  // Transactions that follow the snapshot are not part of it
+  {
+    Store::Tx tx;
+    auto view_pub = tx.get_view(pub_map);
+    view_pub->put("pubk1", "pubv4");
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+  auto next_tx = consensus->get_latest_data().first;
+
+  auto serialised_snapshot = snapshot->serialise(encryptor);
+
+  INFO("Install snapshot in empty store");
+  {
+    Store target_store;
+    target_store.set_encryptor(encryptor);
+    target_store.clone_schema(store);
+    auto& target_pub_map =
+      *target_store.get<std::string, std::string>("pub_map");
+    auto& target_priv_map =
+      *target_store.get<std::string, std::string>("priv_map");
+
+    size_t hook_writes = 0;
+    target_pub_map.set_local_hook(
+      [&hook_writes](
+        kv::Version v,
+        const Store::Map<std::string, std::string>::State& s,
+        const Store::Map<std::string, std::string>::Write& w) {
+        hook_writes += w.size();
+      });
+
+    REQUIRE(
+      target_store.deserialise_snapshot(serialised_snapshot) ==
+      kv::DeserialiseSuccess::PASS);
+    REQUIRE(target_store.current_version() == snapshot_version);
+    REQUIRE(target_store.commit_version() == snapshot_version);
+    REQUIRE(hook_writes == 2);
+
+    {
+      Store::Tx tx;
+      auto [view_pub, view_priv] = tx.get_view(target_pub_map, target_priv_map);
+      REQUIRE(view_pub->get("pubk1") == "pubv1");
+      REQUIRE(!view_pub->get("pubk2").has_value());
+      REQUIRE(view_pub->get("pubk3") == "pubv3");
+      REQUIRE(view_priv->get("privk1") == "privv1");
+    }
+
+    INFO("Transactions that follow the snapshot can be deserialised");
+    {
+      REQUIRE(
+        target_store.deserialise(next_tx) == kv::DeserialiseSuccess::PASS);
+      Store::Tx tx;
+      auto view_pub = tx.get_view(target_pub_map);
+      REQUIRE(view_pub->get("pubk1") == "pubv4");
+    }
+
+    INFO("Snapshot cannot be installed in a non-empty store");
+    {
+      REQUIRE(
+        target_store.deserialise_snapshot(serialised_snapshot) ==
+        kv::DeserialiseSuccess::FAILED);
+    }
+  }
+
+  INFO("Install public domain of snapshot only");
+  {
+    Store target_store;
+    target_store.set_encryptor(encryptor);
+    target_store.clone_schema(store);
+
+    REQUIRE(
+      target_store.deserialise_snapshot(serialised_snapshot, true) ==
+      kv::DeserialiseSuccess::PASS);
+    REQUIRE(target_store.current_version() == snapshot_version);
+
+    Store::Tx tx;
+    auto [view_pub, view_priv] = tx.get_view(
+      *target_store.get<std::string, std::string>("pub_map"),
+      *target_store.get<std::string, std::string>("priv_map"));
+    REQUIRE(view_pub->get("pubk3") == "pubv3");
+    REQUIRE(!view_priv->get("privk1").has_value());
+  }
+
+  INFO("Snapshot must not precede compacted version");
+  {
+    store.compact(store.current_version());
+    REQUIRE_THROWS_AS(store.snapshot(snapshot_version), std::logic_error);
+  }
+}
+
 struct NonSerialisable
 {};
 
@@ -203,6 +203,183 @@ TEST_CASE("Rollback and compact")
   }
 }
 
+TEST_CASE("Views at past versions")
+{
+  Store kv_store;
+  auto& map =
+    kv_store.create<size_t, size_t>("map", kv::SecurityDomain::PUBLIC);
+  auto& other =
+    kv_store.create<size_t, size_t>("other", kv::SecurityDomain::PUBLIC);
+
+  // Only some versions write to map, so that views are created at versions
+  // that are not in its roll
+  constexpr size_t versions = 1000;
+  for (size_t i = 1; i <= versions; ++i)
+  {
+    Store::Tx tx;
+    if (i % 3 == 0)
+      tx.get_view(map)->put(0, i);
+    else
+      tx.get_view(other)->put(0, i);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Views read the state at their read version");
+  for (kv::Version v : {0, 1, 2, 3, 500, 501})
+  {
+    kv_store.compact(v);
+
+    Store::Tx tx;
+    tx.set_read_committed();
+    auto view = tx.get_view(map);
+    auto expected = v - v % 3;
+    if (expected == 0)
+      REQUIRE(!view->get(0).has_value());
+    else
+      REQUIRE(view->get(0) == expected);
+  }
+
+  INFO("Rolled back versions are not read");
+  {
+    kv_store.rollback(versions - 2);
+    Store::Tx tx;
+    REQUIRE(tx.get_view(map)->get(0) == 996);
+
+    Store::Tx tx2;
+    tx2.set_read_committed();
+    REQUIRE(tx2.get_view(map)->get(0) == 501);
+  }
+}
+
+TEST_CASE("Removed keys are dropped once globally committed")
+{
+  using State = Store::Map<size_t, size_t>::State;
+  using Write = Store::Map<size_t, size_t>::Write;
+
+  // Number of entries in the latest state, including removed keys which have
+  // not been dropped yet
+  size_t state_size = 0;
+  auto local_hook = [&](kv::Version v, const State& s, const Write& w) {
+    state_size = s.size();
+  };
+
+  Store kv_store;
+  auto& map = kv_store.create<size_t, size_t>(
+    "map", kv::SecurityDomain::PUBLIC, local_hook);
+
+  auto touch = [&]() {
+    Store::Tx tx;
+    tx.get_view(map)->put(0, 0);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  };
+
+  INFO("Removed keys are kept until their removal is globally committed");
+  {
+    Store::Tx tx;
+    tx.get_view(map)->put(1, 1);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    Store::Tx tx2;
+    REQUIRE(tx2.get_view(map)->remove(1));
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+
+    kv_store.compact(tx2.commit_version() - 1);
+    touch();
+    REQUIRE(state_size == 2);
+
+    kv_store.compact(tx2.commit_version());
+    touch();
+    REQUIRE(state_size == 1);
+  }
+
+  INFO("Removals that are rolled back are not dropped");
+  {
+    Store::Tx tx;
+    tx.get_view(map)->put(2, 2);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    Store::Tx tx2;
+    REQUIRE(tx2.get_view(map)->remove(2));
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+
+    kv_store.rollback(tx.commit_version());
+    kv_store.compact(kv_store.current_version());
+
+    Store::Tx tx3;
+    REQUIRE(tx3.get_view(map)->get(2) == 2);
+  }
+
+  INFO("Transactions which read a dropped key as removed do not conflict");
+  {
+    Store::Tx tx;
+    REQUIRE(tx.get_view(map)->remove(2));
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    Store::Tx tx2;
+    auto view = tx2.get_view(map);
+    REQUIRE(!view->get(2).has_value());
+    view->put(3, 3);
+
+    kv_store.compact(kv_store.current_version());
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+
+    Store::Tx tx3;
+    auto view3 = tx3.get_view(map);
+    REQUIRE(!view3->get(2).has_value());
+    REQUIRE(view3->get(3) == 3);
+  }
+
+  INFO("Transactions which read a key as removed conflict if it is added");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(view->remove(3));
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+
+    Store::Tx tx2;
+    auto view2 = tx2.get_view(map);
+    REQUIRE(!view2->get(3).has_value());
+    view2->put(4, 4);
+
+    kv_store.compact(kv_store.current_version());
+    Store::Tx tx3;
+    tx3.get_view(map)->put(3, 3);
+    REQUIRE(tx3.commit() == kv::CommitSuccess::OK);
+
+    REQUIRE(tx2.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("A workload which keeps replacing its keys reaches a steady state");
+  {
+    constexpr size_t live_keys = 100;
+    constexpr size_t churn = 10;
+    size_t next = 1000;
+    for (size_t i = 0; i < live_keys; ++i)
+    {
+      Store::Tx tx;
+      tx.get_view(map)->put(next + i, i);
+      REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    }
+
+    const auto start_size = state_size;
+    for (size_t round = 0; round < 100; ++round)
+    {
+      Store::Tx tx;
+      auto view = tx.get_view(map);
+      for (size_t i = 0; i < churn; ++i)
+      {
+        view->put(next + live_keys, next);
+        REQUIRE(view->remove(next));
+        ++next;
+      }
+      REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+      REQUIRE(state_size == start_size + churn);
+
+      kv_store.compact(kv_store.current_version());
+    }
+  }
+}
+
 TEST_CASE("Clear entire store")
 {
   Store kv_store;
@@ -811,4 +988,222 @@ TEST_CASE("Conflict resolution")
   // Re-running a _committed_ transaction is exceptionally bad
   REQUIRE_THROWS(tx1.commit());
   REQUIRE_THROWS(tx2.commit());
-}
\ No newline at end of file
+}
+
+TEST_CASE("Disjoint writes")
+{
+  Store kv_store;
+  auto& map = kv_store.create<std::string, std::string>(
+    "map", kv::SecurityDomain::PUBLIC);
+
+  INFO("Transactions writing different keys of a map do not conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+    REQUIRE(!view1->get("foo").has_value());
+    view1->put("foo", "foo");
+    REQUIRE(!view2->get("bar").has_value());
+    view2->put("bar", "bar");
+    view2->remove("baz");
+
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit_version() == tx2.commit_version() + 1);
+  }
+
+  INFO("Committed entries have the version of their transaction");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+    REQUIRE(view1->get("foo") == "foo");
+    view1->put("bar", "foo");
+    REQUIRE(view2->get("foo") == "foo");
+    view2->put("foo", "bar");
+
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  Store::Tx tx;
+  auto view = tx.get_view(map);
+  REQUIRE(view->get("foo") == "bar");
+  REQUIRE(view->get("bar") == "bar");
+  REQUIRE(!view->get("baz").has_value());
+}
+
+TEST_CASE("Validating reads of read-only views")
+{
+  Store kv_store;
+  auto& map1 = kv_store.create<std::string, std::string>(
+    "map1", kv::SecurityDomain::PUBLIC);
+  auto& map2 = kv_store.create<std::string, std::string>(
+    "map2", kv::SecurityDomain::PUBLIC);
+
+  INFO("By default, reads of a map which is not written are not validated");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    auto view1 = tx1.get_view(map1);
+    REQUIRE(!view1->get("foo").has_value());
+    tx1.get_view(map2)->put("foo", "foo");
+    tx2.get_view(map1)->put("foo", "bar");
+
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Reads of all maps can be validated");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    tx1.set_validate_all_reads();
+    auto view1 = tx1.get_view(map1);
+    REQUIRE(view1->get("foo") == "bar");
+    tx1.get_view(map2)->put("bar", "bar");
+    tx2.get_view(map1)->put("foo", "baz");
+
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Valid reads of read-only views do not conflict");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    tx1.set_validate_all_reads();
+    tx2.set_validate_all_reads();
+    REQUIRE(tx1.get_view(map1)->get("foo") == "baz");
+    tx1.get_view(map2)->put("bar", "baz");
+    REQUIRE(tx2.get_view(map1)->get("foo") == "baz");
+
+    REQUIRE(tx2.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+  }
+
+  Store::Tx tx;
+  REQUIRE(tx.get_view(map2)->get("foo") == "foo");
+  REQUIRE(tx.get_view(map2)->get("bar") == "baz");
+}
+
+TEST_CASE("Ordered map range reads")
+{
+  Store kv_store;
+  using StringString = Store::OrderedMap<std::string, std::string>;
+  auto& map =
+    kv_store.create<StringString>("map", kv::SecurityDomain::PUBLIC);
+
+  auto read_range = [](StringString::TxView* view, const std::string& lo,
+                       const std::string& hi) {
+    std::vector<std::string> keys;
+    view->range(lo, hi, [&keys](const auto& k, const auto& v) {
+      REQUIRE(k == v);
+      keys.push_back(k);
+      return true;
+    });
+    return keys;
+  };
+
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    for (const auto& k : {"b", "ab", "d", "aa", "ca", "a", "c", "e"})
+      view->put(k, k);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  INFO("Entries are iterated in key order");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    std::vector<std::string> keys;
+    view->foreach([&keys](const auto& k, const auto&) {
+      keys.push_back(k);
+      return true;
+    });
+    REQUIRE(keys == std::vector<std::string>{"a", "aa", "ab", "b", "c", "ca",
+                                             "d", "e"});
+  }
+
+  INFO("Ranges and prefixes include the transaction's own writes");
+  {
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(read_range(view, "aa", "c") == std::vector<std::string>{"aa", "ab",
+                                                                    "b"});
+
+    view->put("bb", "bb");
+    view->remove("ab");
+    view->put("aa", "aa");
+    REQUIRE(read_range(view, "aa", "c") == std::vector<std::string>{"aa", "b",
+                                                                    "bb"});
+    REQUIRE(read_range(view, "c", "a").empty());
+
+    std::vector<std::string> keys;
+    view->prefix("a", [&keys](const auto& k, const auto&) {
+      keys.push_back(k);
+      return true;
+    });
+    REQUIRE(keys == std::vector<std::string>{"a", "aa"});
+
+    size_t n = 0;
+    REQUIRE(!view->prefix("", [&n](const auto&, const auto&) {
+      return ++n < 3;
+    }));
+    REQUIRE(n == 3);
+  }
+
+  INFO("Range reads only conflict with writes to the range");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    Store::Tx tx3;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+    auto view3 = tx3.get_view(map);
+    REQUIRE(read_range(view1, "b", "d").size() == 3);
+    view1->put("x", "x");
+    view2->foreach([](const auto&, const auto&) { return true; });
+    view2->put("y", "y");
+
+    view3->put("a", "a");
+    view3->put("d", "d");
+    REQUIRE(tx3.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx2.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Inserting or removing a key in a range conflicts");
+  {
+    Store::Tx tx1;
+    Store::Tx tx2;
+    Store::Tx tx3;
+    auto view1 = tx1.get_view(map);
+    auto view2 = tx2.get_view(map);
+    auto view3 = tx3.get_view(map);
+    REQUIRE(read_range(view1, "b", "d").size() == 3);
+    view1->put("x", "x");
+    view2->prefix("d", [](const auto&, const auto&) { return true; });
+    view2->put("y", "y");
+
+    view3->put("bb", "bb");
+    view3->remove("d");
+    REQUIRE(tx3.commit() == kv::CommitSuccess::OK);
+    REQUIRE(tx1.commit() == kv::CommitSuccess::CONFLICT);
+    REQUIRE(tx2.commit() == kv::CommitSuccess::CONFLICT);
+  }
+
+  INFO("Removed keys are dropped from ordered maps");
+  {
+    kv_store.compact(kv_store.current_version());
+
+    Store::Tx tx;
+    auto view = tx.get_view(map);
+    REQUIRE(!view->get("d").has_value());
+    REQUIRE(read_range(view, "c", "z") == std::vector<std::string>{"c", "ca",
+                                                                    "e", "x"});
+  }
+}
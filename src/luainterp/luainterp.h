@@ -126,12 +126,10 @@ namespace ccf
           lua_pop(l, 1); /* remove lib */
         }
 
-        // lua's garbage collector is left in its default state. As long as
-        // instances of this Interpreter remain reasonably short-lived their
-        // memory use is unlikely to be a problem - either they are destroyed
-        // before the garbage collector ever runs, or they kept in check by
-        // occasional
-        //  mark-and-sweep passes.
+        // lua's garbage collector is left in its default state. Short-lived
+        // instances of this Interpreter are likely destroyed before the
+        // garbage collector ever runs, while long-lived (eg, pooled) instances
+        // are kept in check by occasional mark-and-sweep passes.
         // If we trust that all scripts will avoid long-term growth and want to
         // remove the GC interruptions we could disable GC entirely:
         // lua_gc(l, LUA_GCSTOP);
@@ -1,12 +1,16 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 // Licensed under the Apache 2.0 License.
 #pragma once
+#include "ds/spinlock.h"
 #include "luainterp/luainterp.h"
 #include "luainterp/luakv.h"
 #include "node/networktables.h"
 #include "node/rpc/rpcexception.h"
 
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string_view>
 #include <type_traits>
 #include <unordered_map>
 #include <vector>
@@ -128,16 +132,260 @@ namespace ccf
 
       const NetworkTables& network_tables;
 
-      static void load(lua::Interpreter& li, Script s)
+      /** An interpreter whose environment has already been set up, kept
+       * between runs along with the scripts it has loaded.
+       */
+      struct PooledInterpreter
+      {
+        lua::Interpreter li;
+        //! text or bytecode of the environment script it was set up with
+        std::string env_code;
+        //! registry reference to shallow copies, keyed by table, of the
+        //! globals and every table reachable from them after set up
+        int baseline = LUA_NOREF;
+        //! registry reference to the metatables of those tables after set up
+        int baseline_metatables = LUA_NOREF;
+        //! loaded scripts, by hash of their code: (code, registry reference)
+        std::unordered_map<size_t, std::pair<std::string, int>> loaded;
+      };
+
+      static constexpr size_t max_idle_interpreters = 16;
+      static constexpr size_t max_loaded_scripts = 64;
+
+      mutable SpinLock pool_lock;
+      //! code of the environment script the idle interpreters were set up with
+      mutable std::string pool_env_code;
+      mutable std::vector<std::unique_ptr<PooledInterpreter>> idle;
+
+      static std::string_view get_code(const Script& s)
       {
         if (s.bytecode)
-          li.push_code(*s.bytecode);
+          return {reinterpret_cast<const char*>(s.bytecode->data()),
+                  s.bytecode->size()};
         else if (s.text)
-          li.push_code(*s.text);
+          return *s.text;
         else
           throw std::logic_error("no bytecode or string to load as script");
       }
 
+      static void load(lua::Interpreter& li, Script s)
+      {
+        const auto code = get_code(s);
+        li.push_code(code.data(), code.size());
+      }
+
+      /** Pushes the compiled function for a script, only compiling it the
+       * first time the interpreter sees its code
+       */
+      static void load(PooledInterpreter& pi, const Script& s)
+      {
+        auto l = pi.li.get_state();
+        const auto code = get_code(s);
+        const auto h = std::hash<std::string_view>()(code);
+
+        auto it = pi.loaded.find(h);
+        if (it != pi.loaded.end())
+        {
+          if (it->second.first == code)
+          {
+            lua_rawgeti(l, LUA_REGISTRYINDEX, it->second.second);
+            return;
+          }
+          luaL_unref(l, LUA_REGISTRYINDEX, it->second.second);
+          pi.loaded.erase(it);
+        }
+
+        // Scripts are arbitrary governance-controlled code, so bound the
+        // cache rather than holding on to every script ever run
+        if (pi.loaded.size() >= max_loaded_scripts)
+        {
+          for (const auto& entry : pi.loaded)
+            luaL_unref(l, LUA_REGISTRYINDEX, entry.second.second);
+          pi.loaded.clear();
+        }
+
+        pi.li.push_code(code.data(), code.size());
+        lua_pushvalue(l, -1);
+        const auto ref = luaL_ref(l, LUA_REGISTRYINDEX);
+        pi.loaded.emplace(h, std::make_pair(std::string(code), ref));
+      }
+
+      /** Records a shallow copy and the metatable of the table at the top of
+       * the stack, then of every table reachable from it through its keys,
+       * values and metatable. Leaves the stack as it was.
+       */
+      static void snapshot_table(lua_State* l, int copies, int metatables)
+      {
+        const auto t = lua_gettop(l);
+        lua_pushvalue(l, t);
+        const auto seen = lua_rawget(l, copies) != LUA_TNIL;
+        lua_pop(l, 1);
+        if (seen)
+          return;
+
+        luaL_checkstack(l, 6, "tables nested too deeply");
+        lua_newtable(l);
+        const auto copy = t + 1;
+        lua_pushvalue(l, t);
+        lua_pushvalue(l, copy);
+        lua_rawset(l, copies);
+
+        if (lua_getmetatable(l, t))
+        {
+          lua_pushvalue(l, t);
+          lua_pushvalue(l, -2);
+          lua_rawset(l, metatables);
+          snapshot_table(l, copies, metatables);
+          lua_pop(l, 1);
+        }
+
+        lua_pushnil(l);
+        while (lua_next(l, t))
+        {
+          lua_pushvalue(l, -2);
+          lua_pushvalue(l, -2);
+          lua_rawset(l, copy);
+          if (lua_type(l, -1) == LUA_TTABLE)
+            snapshot_table(l, copies, metatables);
+          if (lua_type(l, -2) == LUA_TTABLE)
+          {
+            lua_pushvalue(l, -2);
+            snapshot_table(l, copies, metatables);
+            lua_pop(l, 1);
+          }
+          lua_pop(l, 1);
+        }
+        lua_settop(l, t);
+      }
+
+      //! Restores the fields of table t to those of its copy
+      static void restore_table(lua_State* l, int t, int copy)
+      {
+        lua_pushnil(l);
+        while (lua_next(l, t))
+        {
+          lua_pushvalue(l, -2);
+          lua_rawget(l, copy);
+          if (!lua_rawequal(l, -1, -2))
+          {
+            // clearing or modifying existing fields is allowed during
+            // traversal
+            lua_pushvalue(l, -3);
+            lua_pushvalue(l, -2);
+            lua_rawset(l, t);
+          }
+          lua_pop(l, 2);
+        }
+
+        lua_pushnil(l);
+        while (lua_next(l, copy))
+        {
+          lua_pushvalue(l, -2);
+          if (lua_rawget(l, t) == LUA_TNIL)
+          {
+            lua_pushvalue(l, -3);
+            lua_pushvalue(l, -3);
+            lua_rawset(l, t);
+          }
+          lua_pop(l, 2);
+        }
+      }
+
+      /** Restores the globals, and the tables reachable from them after set
+       * up (such as env, string, table and math), to their state after set
+       * up. Fields a script created are removed, fields it replaced are
+       * reverted and metatables it changed are put back.
+       */
+      static void reset_globals(PooledInterpreter& pi)
+      {
+        auto l = pi.li.get_state();
+        lua_settop(l, 0);
+        lua_rawgeti(l, LUA_REGISTRYINDEX, pi.baseline);
+        lua_rawgeti(l, LUA_REGISTRYINDEX, pi.baseline_metatables);
+
+        constexpr auto copies = 1;
+        constexpr auto metatables = 2;
+        constexpr auto table = 3;
+        constexpr auto copy = 4;
+
+        lua_pushnil(l);
+        while (lua_next(l, copies))
+        {
+          restore_table(l, table, copy);
+          lua_pushvalue(l, table);
+          lua_rawget(l, metatables);
+          lua_setmetatable(l, table);
+          lua_pop(l, 1);
+        }
+
+        lua_settop(l, 0);
+      }
+
+      std::unique_ptr<PooledInterpreter> acquire(
+        const std::optional<Script>& env_script) const
+      {
+        const auto env_code =
+          env_script ? get_code(*env_script) : std::string_view();
+
+        {
+          std::lock_guard<SpinLock> guard(pool_lock);
+          if (env_code != pool_env_code)
+          {
+            // The environment script has changed, so interpreters set up with
+            // the previous one can no longer be used
+            idle.clear();
+            pool_env_code = env_code;
+          }
+          else if (!idle.empty())
+          {
+            auto pi = std::move(idle.back());
+            idle.pop_back();
+            return pi;
+          }
+        }
+
+        auto pi = std::make_unique<PooledInterpreter>();
+        pi->env_code = env_code;
+        setup_environment(pi->li, env_script);
+
+        // take copies of the globals and of the tables reachable from them,
+        // including through the metatable shared by all strings, to restore
+        // them to after each run
+        auto l = pi->li.get_state();
+        lua_settop(l, 0);
+        lua_newtable(l);
+        lua_newtable(l);
+
+        constexpr auto copies = 1;
+        constexpr auto metatables = 2;
+
+        lua_pushglobaltable(l);
+        snapshot_table(l, copies, metatables);
+        lua_pop(l, 1);
+        lua_pushliteral(l, "");
+        if (lua_getmetatable(l, -1))
+        {
+          snapshot_table(l, copies, metatables);
+          lua_pop(l, 1);
+        }
+        lua_pop(l, 1);
+
+        pi->baseline_metatables = luaL_ref(l, LUA_REGISTRYINDEX);
+        pi->baseline = luaL_ref(l, LUA_REGISTRYINDEX);
+
+        return pi;
+      }
+
+      void release(std::unique_ptr<PooledInterpreter> pi) const
+      {
+        reset_globals(*pi);
+
+        std::lock_guard<SpinLock> guard(pool_lock);
+        if (
+          pi->env_code == pool_env_code && idle.size() < max_idle_interpreters)
+          idle.push_back(std::move(pi));
+      }
+
       Whitelist get_whitelist(Store::Tx& tx, WlId id) const
       {
         const auto wl = tx.get_view(network_tables.whitelists)->get(id);
@@ -234,6 +482,11 @@ namespace ccf
        * Further, subclasses of this class may add custom tables by overriding
        * the add_custom_tables() method.
        *
+       * Interpreters are pooled and reused: the environment is set up once per
+       * interpreter, each script is compiled once per interpreter, and the
+       * globals and the tables reachable from them are restored before the
+       * next run.
+       *
        * @tparam T the return type of the script
        * @tparam Args the types of the arguments to the script
        * @param tx the transaction to run the script in
@@ -245,12 +498,12 @@ namespace ccf
       template <typename T, typename... Args>
       T run(Store::Tx& tx, const TxScript& txs, Args&&... args) const
       {
-        lua::Interpreter li;
+        // take an interpreter which has already run the optional environment
+        // script. It is only returned to the pool if the script succeeds.
+        auto pi = acquire(txs.env_script);
+        auto& li = pi->li;
 
-        // run an optional environment script
-        setup_environment(li, txs.env_script);
-
-        load(li, txs.script);
+        load(*pi, txs.script);
 
         // register writable and read-only tables with respect to the given
         // whitelists the table of writable tables will be pushed on the stack
@@ -279,10 +532,17 @@ namespace ccf
         {
           // no return if T == void
           if constexpr (std::is_same_v<T, void>)
+          {
             li.invoke_raw(n_registered_tables, std::forward<Args>(args)...);
+            release(std::move(pi));
+          }
           else
-            return li.template invoke_raw<T>(
+          {
+            auto r = li.template invoke_raw<T>(
               n_registered_tables, std::forward<Args>(args)...);
+            release(std::move(pi));
+            return r;
+          }
         }
         catch (const lua::ex& e)
         {
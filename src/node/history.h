@@ -155,6 +155,12 @@ namespace ccf
       size_t replicated_size) override
     {}
 
+    void add_result(
+      RequestID id,
+      kv::Version version,
+      crypto::Sha256Hash replicated_hash) override
+    {}
+
     void add_result(RequestID id, kv::Version version) override {}
 
     void add_response(
@@ -184,6 +190,13 @@ namespace ccf
     {
       return true;
     }
+
+    std::vector<uint8_t> serialise_tree(kv::Version v) override
+    {
+      return {};
+    }
+
+    void deserialise_tree(const std::vector<uint8_t>& tree) override {}
   };
 
   class Receipt
@@ -337,6 +350,78 @@ namespace ccf
       mt_serialize(tree, output.data(), output.capacity());
       return output;
     }
+
+    std::vector<uint8_t> serialise(uint64_t index)
+    {
+      // Serialise the tree as it was when index was its last leaf, without
+      // modifying this tree
+      MerkleTreeHistory t(serialise());
+      t.retract(index);
+      return t.serialise();
+    }
+
+    void deserialise(const std::vector<uint8_t>& serialised)
+    {
+      auto t = mt_deserialize(serialised.data(), serialised.size());
+      if (t == nullptr)
+        throw std::logic_error("Failed to deserialise merkle tree");
+
+      mt_free(tree);
+      tree = t;
+    }
+
+    // The frontier holds, for each level at which the number of leaves has a
+    // bit set, the root of the last complete subtree at that level. This is
+    // enough to compute the root and to append further leaves, and its size
+    // only grows with the log of the number of leaves.
+    std::vector<uint8_t> serialise_frontier() const
+    {
+      const auto& mt = *tree;
+      size_t s = sizeof(mt.offset) + sizeof(mt.j) +
+        crypto::Sha256Hash::SIZE * __builtin_popcount(mt.j);
+      std::vector<uint8_t> output(s);
+      uint8_t* buf = output.data();
+      serialized::write(buf, s, mt.offset);
+      serialized::write(buf, s, mt.j);
+
+      for (uint32_t lv = 0; (mt.j >> lv) != 0; ++lv)
+      {
+        const uint32_t j = mt.j >> lv;
+        if (j % 2 == 0)
+          continue;
+
+        // Hashes at each level are retained from the even index at or below
+        // the first retained leaf, so the last complete subtree always is
+        const uint32_t first = (mt.i >> lv) & ~1u;
+        serialized::write(
+          buf, s, mt.hs.vs[lv].vs[j - 1 - first], crypto::Sha256Hash::SIZE);
+      }
+
+      return output;
+    }
+
+    // Computes the root of the tree from its frontier, as mt_get_root does
+    // from the retained hashes
+    static crypto::Sha256Hash get_frontier_root(
+      const std::vector<uint8_t>& frontier)
+    {
+      const uint8_t* data = frontier.data();
+      size_t size = frontier.size();
+      serialized::skip(data, size, sizeof(merkle_tree::offset));
+      const auto j = serialized::read<decltype(merkle_tree::j)>(data, size);
+      if (j == 0 || size != crypto::Sha256Hash::SIZE * __builtin_popcount(j))
+        throw std::logic_error("Invalid merkle tree frontier");
+
+      crypto::Sha256Hash root;
+      std::copy(data, data + root.SIZE, root.h);
+      serialized::skip(data, size, root.SIZE);
+      while (size > 0)
+      {
+        hash_2(const_cast<uint8_t*>(data), root.h, root.h);
+        serialized::skip(data, size, root.SIZE);
+      }
+      return root;
+    }
   };
 
   template <class T>
@@ -486,7 +571,7 @@ namespace ccf
             view,
             commit,
             kp.sign_hash(root.h, root.SIZE),
-            replicated_state_tree.serialise());
+            replicated_state_tree.serialise_frontier());
           sig_view->put(0, sig_value);
           return sig.commit_reserved();
         },
@@ -524,7 +609,17 @@ namespace ccf
       const uint8_t* replicated,
       size_t replicated_size) override
     {
-      append(replicated, replicated_size);
+      add_result(
+        id, version, crypto::Sha256Hash({{replicated, replicated_size}}));
+    }
+
+    void add_result(
+      RequestID id,
+      kv::Version version,
+      crypto::Sha256Hash replicated_hash) override
+    {
+      log_hash(replicated_hash, APPEND);
+      replicated_state_tree.append(replicated_hash);
 #ifdef PBFT
       if (on_result.has_value())
       {
@@ -567,6 +662,17 @@ namespace ccf
       auto r = Receipt::from_v(v);
       return replicated_state_tree.verify(r);
     }
+
+    std::vector<uint8_t> serialise_tree(kv::Version v) override
+    {
+      return replicated_state_tree.serialise(v);
+    }
+
+    void deserialise_tree(const std::vector<uint8_t>& tree) override
+    {
+      replicated_state_tree.deserialise(tree);
+      log_hash(replicated_state_tree.get_root(), APPEND);
+    }
   };
 
   using MerkleTxHistory = HashedTxHistory<MerkleTreeHistory>;
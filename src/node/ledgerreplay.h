@@ -0,0 +1,341 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "consensus/ledgerenclavetypes.h"
+#include "ds/logger.h"
+#include "ds/serialized.h"
+#include "ds/thread_messaging.h"
+#include "entities.h"
+
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace ccf
+{
+  /**
+   * Replays the ledger stored by the host into a store, during recovery.
+   *
+   * Ranges of entries are read from the host ahead of being applied. Each
+   * range is split between the worker threads, which prepare (i.e. decrypt)
+   * their entries in parallel. Prepared entries are then applied to the store
+   * in ledger order, on the main thread. Without worker threads, entries are
+   * prepared on the main thread as they are received.
+   */
+  class LedgerReplay
+  {
+  public:
+    using Deserialiser = Store::Deserialiser;
+
+    // Called on each entry, in ledger order, on the main thread. Returns
+    // false if the replay should stop.
+    using ApplyEntry = std::function<bool(
+      consensus::Index idx,
+      const std::vector<uint8_t>& entry,
+      std::unique_ptr<Deserialiser> d)>;
+
+    // Called on the main thread once all the entries up to the end of the
+    // ledger have been applied
+    using EndReplay = std::function<void()>;
+
+    // Number of entries requested from the host at once
+    static constexpr consensus::Index range_size = 1000;
+    // Maximum number of entries read from the host but not yet applied
+    static constexpr size_t max_pending = 4 * range_size;
+
+  private:
+    struct PreparedEntry
+    {
+      std::vector<uint8_t> entry;
+      std::unique_ptr<Deserialiser> d;
+    };
+
+    struct StartMsg
+    {
+      LedgerReplay* self;
+      std::shared_ptr<Store> store;
+      bool public_only;
+      consensus::Index from;
+      ApplyEntry apply;
+      EndReplay end;
+    };
+
+    struct PrepareMsg
+    {
+      LedgerReplay* self;
+      size_t generation;
+      std::shared_ptr<Store> store;
+      bool public_only;
+      consensus::Index from;
+      std::vector<PreparedEntry> entries;
+    };
+
+    ringbuffer::WriterPtr to_host;
+
+    std::shared_ptr<Store> store;
+    bool public_only = false;
+    ApplyEntry apply;
+    EndReplay end;
+
+    bool active = false;
+    // Incremented whenever a replay starts or stops, so that entries prepared
+    // for an earlier replay are discarded
+    size_t generation = 0;
+
+    // First index of the next range to request from the host
+    consensus::Index next_request = 0;
+    bool request_pending = false;
+    bool end_of_ledger = false;
+
+    // Index of the next entry to apply, and entries received from the host
+    // but not applied yet
+    consensus::Index next_apply = 0;
+    size_t pending = 0;
+    std::map<consensus::Index, PreparedEntry> prepared;
+
+    static void start_cb(std::unique_ptr<enclave::Tmsg<StartMsg>> msg)
+    {
+      auto& d = msg->data;
+      d.self->start_(
+        std::move(d.store),
+        d.public_only,
+        d.from,
+        std::move(d.apply),
+        std::move(d.end));
+    }
+
+    static void prepare_cb(std::unique_ptr<enclave::Tmsg<PrepareMsg>> msg)
+    {
+      auto& d = msg->data;
+      for (auto& e : d.entries)
+        e.d = d.store->prepare_deserialise(e.entry, d.public_only);
+
+      auto result = std::make_unique<enclave::Tmsg<PrepareMsg>>(&prepared_cb);
+      result->data = std::move(msg->data);
+      enclave::ThreadMessaging::thread_messaging.add_task<PrepareMsg>(
+        enclave::ThreadMessaging::main_thread, std::move(result));
+    }
+
+    static void prepared_cb(std::unique_ptr<enclave::Tmsg<PrepareMsg>> msg)
+    {
+      auto& d = msg->data;
+      d.self->add_prepared(d.generation, d.from, std::move(d.entries));
+    }
+
+    void start_(
+      std::shared_ptr<Store> store_,
+      bool public_only_,
+      consensus::Index from,
+      ApplyEntry apply_,
+      EndReplay end_)
+    {
+      store = std::move(store_);
+      public_only = public_only_;
+      apply = std::move(apply_);
+      end = std::move(end_);
+
+      active = true;
+      generation++;
+      next_request = from;
+      request_pending = false;
+      end_of_ledger = false;
+      next_apply = from;
+      pending = 0;
+      prepared.clear();
+
+      LOG_INFO_FMT("Replaying ledger from {}", from);
+      request_next();
+    }
+
+    void stop()
+    {
+      active = false;
+      generation++;
+      pending = 0;
+      prepared.clear();
+      store.reset();
+    }
+
+    void request_next()
+    {
+      if (!active || request_pending || end_of_ledger || pending >= max_pending)
+        return;
+
+      RINGBUFFER_WRITE_MESSAGE(
+        consensus::ledger_get_range,
+        to_host,
+        next_request,
+        next_request + range_size - 1);
+      request_pending = true;
+    }
+
+    void prepare(consensus::Index from, std::vector<PreparedEntry>&& entries)
+    {
+      const size_t workers = enclave::ThreadMessaging::thread_count > 1 ?
+        enclave::ThreadMessaging::thread_count - 1 :
+        0;
+
+      if (workers == 0)
+      {
+        for (auto& e : entries)
+          e.d = store->prepare_deserialise(e.entry, public_only);
+        add_prepared(generation, from, std::move(entries));
+        return;
+      }
+
+      // Each worker prepares a contiguous slice of the range
+      const auto slice_size = (entries.size() + workers - 1) / workers;
+      for (size_t w = 0; w < workers; ++w)
+      {
+        const auto begin = w * slice_size;
+        if (begin >= entries.size())
+          break;
+        const auto end = std::min(begin + slice_size, entries.size());
+
+        auto msg = std::make_unique<enclave::Tmsg<PrepareMsg>>(&prepare_cb);
+        msg->data.self = this;
+        msg->data.generation = generation;
+        msg->data.store = store;
+        msg->data.public_only = public_only;
+        msg->data.from = from + begin;
+        msg->data.entries.assign(
+          std::make_move_iterator(entries.begin() + begin),
+          std::make_move_iterator(entries.begin() + end));
+
+        enclave::ThreadMessaging::thread_messaging.add_task<PrepareMsg>(
+          w + 1, std::move(msg));
+      }
+    }
+
+    void add_prepared(
+      size_t generation_,
+      consensus::Index from,
+      std::vector<PreparedEntry>&& entries)
+    {
+      if (generation_ != generation)
+        return;
+
+      for (auto& e : entries)
+        prepared.emplace(from++, std::move(e));
+
+      apply_prepared();
+    }
+
+    void apply_prepared()
+    {
+      while (active)
+      {
+        auto it = prepared.find(next_apply);
+        if (it == prepared.end())
+          break;
+
+        auto e = std::move(it->second);
+        prepared.erase(it);
+        pending--;
+
+        if (!apply(next_apply++, e.entry, std::move(e.d)))
+        {
+          stop();
+          return;
+        }
+      }
+
+      if (!active)
+        return;
+
+      if (end_of_ledger && pending == 0)
+      {
+        LOG_INFO_FMT("Replayed ledger up to {}", next_apply - 1);
+        auto end_ = std::move(end);
+        stop();
+        end_();
+        return;
+      }
+
+      request_next();
+    }
+
+  public:
+    LedgerReplay(ringbuffer::AbstractWriterFactory& writer_factory) :
+      to_host(writer_factory.create_writer_to_outside())
+    {}
+
+    /**
+     * Start replaying the ledger into store, from index from. If there are
+     * worker threads, the replay starts on the main thread, so that this can
+     * be called from any thread.
+     */
+    void start(
+      std::shared_ptr<Store> store_,
+      bool public_only_,
+      consensus::Index from,
+      ApplyEntry apply_,
+      EndReplay end_)
+    {
+      auto msg = std::make_unique<enclave::Tmsg<StartMsg>>(&start_cb);
+      msg->data.self = this;
+      msg->data.store = std::move(store_);
+      msg->data.public_only = public_only_;
+      msg->data.from = from;
+      msg->data.apply = std::move(apply_);
+      msg->data.end = std::move(end_);
+
+      if (enclave::ThreadMessaging::thread_count > 1)
+      {
+        enclave::ThreadMessaging::thread_messaging.add_task<StartMsg>(
+          enclave::ThreadMessaging::main_thread, std::move(msg));
+      }
+      else
+      {
+        start_cb(std::move(msg));
+      }
+    }
+
+    bool is_active() const
+    {
+      return active;
+    }
+
+    /// Framed entries read from the host, starting at from
+    void recv_entries(consensus::Index from, const std::vector<uint8_t>& framed)
+    {
+      // Responses to requests made by an earlier replay are ignored
+      if (!active || !request_pending || from != next_request)
+        return;
+      request_pending = false;
+
+      std::vector<PreparedEntry> entries;
+      auto data = framed.data();
+      auto size = framed.size();
+      while (size > 0)
+      {
+        auto entry_size = serialized::read<uint32_t>(data, size);
+        if (entry_size > size)
+          throw std::logic_error(fmt::format(
+            "Truncated ledger entry at {}", from + entries.size()));
+
+        entries.push_back({{data, data + entry_size}, nullptr});
+        serialized::skip(data, size, entry_size);
+      }
+
+      next_request += entries.size();
+      pending += entries.size();
+
+      // Keep reading from the host while these entries are prepared
+      request_next();
+      prepare(from, std::move(entries));
+    }
+
+    /// The host has no entry at from, which is the end of the ledger
+    void recv_no_entry(consensus::Index from)
+    {
+      if (!active || !request_pending || from != next_request)
+        return;
+      request_pending = false;
+
+      end_of_ledger = true;
+      apply_prepared();
+    }
+  };
+}
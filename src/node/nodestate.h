@@ -12,6 +12,7 @@
 #include "entities.h"
 #include "genesisgen.h"
 #include "history.h"
+#include "ledgerreplay.h"
 #include "networkstate.h"
 #include "nodetonode.h"
 #include "notifier.h"
@@ -21,6 +22,7 @@
 #include "rpc/serialization.h"
 #include "seal.h"
 #include "secretshare.h"
+#include "snapshotter.h"
 #include "timer.h"
 #include "tls/25519.h"
 #include "tls/client.h"
@@ -172,6 +174,12 @@ namespace ccf
     ringbuffer::WriterPtr to_host;
     raft::Config raft_config;
 
+    // The node's writer to the host ledger, handed over to consensus once it
+    // is set up. Truncations requested before then (e.g. at the end of
+    // recovery) must go through it, so that it counts every truncation that
+    // the host counts.
+    std::unique_ptr<consensus::LedgerEnclave> ledger;
+
     NetworkState& network;
 
     std::shared_ptr<kv::Consensus> consensus;
@@ -205,6 +213,13 @@ namespace ccf
     kv::Version last_recovered_commit_idx = 1;
 
     consensus::Index ledger_idx = 0;
+    LedgerReplay ledger_replay;
+
+    //
+    // snapshots
+    //
+    CCFConfig::Snapshots snapshot_config;
+    std::shared_ptr<Snapshotter> snapshotter;
 
   public:
     NodeState(
@@ -219,11 +234,13 @@ namespace ccf
       node_encrypt_kp(tls::make_key_pair()),
       writer_factory(writer_factory),
       to_host(writer_factory.create_writer_to_outside()),
+      ledger(std::make_unique<consensus::LedgerEnclave>(writer_factory)),
       network(network),
       rpcsessions(rpcsessions),
       notifier(notifier),
       timers(timers),
-      seal(std::make_shared<Seal>(writer_factory))
+      seal(std::make_shared<Seal>(writer_factory)),
+      ledger_replay(writer_factory)
     {
       ::EverCrypt_AutoConfig2_init();
     }
@@ -256,6 +273,8 @@ namespace ccf
       std::lock_guard<SpinLock> guard(lock);
       sm.expect(State::initialized);
 
+      snapshot_config = args.config.snapshots;
+
       create_node_cert(args.config);
       open_node_frontend();
 
@@ -282,6 +301,7 @@ namespace ccf
           setup_pbft(args.config);
 #else
           setup_raft();
+          setup_snapshotter();
 #endif
           setup_history();
           setup_encryptor();
@@ -399,10 +419,29 @@ namespace ccf
             setup_pbft(args.config);
 #else
             setup_raft(resp->public_only);
+            setup_snapshotter();
 #endif
             setup_history();
             setup_encryptor();
 
+#ifndef PBFT
+            // The joining node resumes from its startup snapshot, if any, and
+            // only replicates the entries that follow it
+            if (install_startup_snapshot(*network.tables, resp->public_only))
+            {
+              Store::Tx tx;
+              GenesisGenerator g(network, tx);
+              auto last_sig = g.get_last_signature();
+              if (!last_sig.has_value())
+                throw std::logic_error("No signature in startup snapshot");
+
+              consensus->init_as_backup(
+                network.tables->current_version(), last_sig->term);
+              snapshotter->set_last_snapshot_idx(
+                network.tables->current_version());
+            }
+#endif
+
             open_member_frontend();
 
             accept_network_tls_connections(args.config);
@@ -486,25 +525,63 @@ namespace ccf
       std::lock_guard<SpinLock> guard(lock);
       sm.expect(State::readingPublicLedger);
       LOG_INFO_FMT("Start public recovery");
-      read_ledger_idx(++ledger_idx);
+
+      // Public recovery starts from the public maps of the startup snapshot,
+      // if any, and then reads the ledger entries that follow it
+      if (install_startup_snapshot(*network.tables, true))
+      {
+        ledger_idx = network.tables->current_version();
+
+        Store::Tx tx;
+        GenesisGenerator g(network, tx);
+        auto last_sig = g.get_last_signature();
+        if (!last_sig.has_value())
+          throw std::logic_error("No signature in startup snapshot");
+
+        // Terms that precede the snapshot are all assumed to start at the
+        // snapshot index, since the ledger before it is not read
+        for (auto i = term_history.size(); i <= last_sig->term; ++i)
+          term_history.push_back(ledger_idx);
+        last_recovered_commit_idx = ledger_idx;
+      }
+
+      // When reading the public ledger, deserialise in the real store
+      ledger_replay.start(
+        network.tables,
+        true,
+        ledger_idx + 1,
+        [this](
+          consensus::Index idx,
+          const std::vector<uint8_t>& entry,
+          std::unique_ptr<Store::Deserialiser> d) {
+          std::lock_guard<SpinLock> guard(lock);
+          return recover_public_ledger_entry_unsafe(idx, entry, std::move(d));
+        },
+        [this]() {
+          std::lock_guard<SpinLock> guard(lock);
+          recover_public_ledger_end_unsafe();
+        });
     }
 
-    void recover_public_ledger_entry(const std::vector<uint8_t>& ledger_entry)
+    bool recover_public_ledger_entry_unsafe(
+      consensus::Index idx,
+      const std::vector<uint8_t>& ledger_entry,
+      std::unique_ptr<Store::Deserialiser> d)
     {
-      std::lock_guard<SpinLock> guard(lock);
       sm.expect(State::readingPublicLedger);
+      ledger_idx = idx;
 
       LOG_DEBUG_FMT(
         "Deserialising public ledger entry ({})", ledger_entry.size());
 
-      // When reading the public ledger, deserialise in the real store
-      auto result = network.tables->deserialise(ledger_entry, true);
+      auto result =
+        network.tables->deserialise_prepared(ledger_entry, std::move(d));
       if (result == kv::DeserialiseSuccess::FAILED)
       {
         LOG_FAIL_FMT("Failed to deserialise entry in public ledger");
         network.tables->rollback(ledger_idx - 1);
         recover_public_ledger_end_unsafe();
-        return;
+        return false;
       }
 
       // If the ledger entry is a signature, it is safe to compact the store
@@ -530,7 +607,7 @@ namespace ccf
         }
       }
 
-      read_ledger_idx(++ledger_idx);
+      return true;
     }
 
     void recover_public_ledger_end_unsafe()
@@ -583,6 +660,7 @@ namespace ccf
         h->set_node_id(self);
 
       setup_raft(true);
+      setup_snapshotter();
 
       LOG_DEBUG_FMT(
         "Restarting Raft at index: {} term: {} commit_idx {}",
@@ -611,22 +689,25 @@ namespace ccf
     //
     // funcs in state "readingPrivateLedger"
     //
-    void recover_private_ledger_entry(const std::vector<uint8_t>& ledger_entry)
+    bool recover_private_ledger_entry_unsafe(
+      consensus::Index idx,
+      const std::vector<uint8_t>& ledger_entry,
+      std::unique_ptr<Store::Deserialiser> d)
     {
-      std::lock_guard<SpinLock> guard(lock);
       sm.expect(State::readingPrivateLedger);
+      ledger_idx = idx;
 
       LOG_INFO_FMT(
         "Deserialising private ledger entry ({})", ledger_entry.size());
 
-      // When reading the private ledger, deserialise in the recovery store
-      auto result = recovery_store->deserialise(ledger_entry);
+      auto result =
+        recovery_store->deserialise_prepared(ledger_entry, std::move(d));
       if (result == kv::DeserialiseSuccess::FAILED)
       {
         LOG_FAIL_FMT("Failed to deserialise entry in private ledger");
         recovery_store->rollback(ledger_idx - 1);
         recover_private_ledger_end_unsafe();
-        return;
+        return false;
       }
 
       if (result == kv::DeserialiseSuccess::PASS_SIGNATURE)
@@ -636,11 +717,10 @@ namespace ccf
       {
         LOG_INFO_FMT("Reached recovery final version at {}", recovery_v);
         recover_private_ledger_end_unsafe();
+        return false;
       }
-      else
-      {
-        read_ledger_idx(++ledger_idx);
-      }
+
+      return true;
     }
 
     void recover_private_ledger_end_unsafe()
@@ -695,24 +775,18 @@ namespace ccf
     //
     // funcs in state "readingPublicLedger" or "readingPrivateLedger"
     //
-    void recover_ledger_end()
+    void recover_ledger_entries(
+      consensus::Index from, const std::vector<uint8_t>& entries)
     {
-      std::lock_guard<SpinLock> guard(lock);
+      // Not locked: the replay is only driven from the main thread, and takes
+      // the lock to apply each entry. Responses to ranges requested by a
+      // replay that has since stopped are ignored.
+      ledger_replay.recv_entries(from, entries);
+    }
 
-      if (is_reading_public_ledger())
-      {
-        recover_public_ledger_end_unsafe();
-      }
-      else if (is_reading_private_ledger())
-      {
-        recover_private_ledger_end_unsafe();
-      }
-      else
-      {
-        throw std::logic_error(
-          "Cannot end ledger recovery if not reading public or private "
-          "ledger");
-      }
+    void recover_ledger_end(consensus::Index from)
+    {
+      ledger_replay.recv_no_entry(from);
     }
 
     //
@@ -790,8 +864,7 @@ namespace ccf
       setup_private_recovery_store();
 
       // Start reading private security domain of ledger
-      ledger_idx = 0;
-      read_ledger_idx(++ledger_idx);
+      start_private_ledger_recovery_unsafe();
 
       sm.advance(State::readingPrivateLedger);
       return true;
@@ -810,6 +883,14 @@ namespace ccf
       consensus->periodic(elapsed);
     }
 
+    void ledger_durable(kv::Consensus::SeqNo seqno, size_t truncations)
+    {
+      // Durability notifications received before consensus is set up are
+      // dropped, since consensus then starts from entries already on disk
+      if (consensus != nullptr)
+        consensus->ledger_durable(seqno, truncations);
+    }
+
     void node_msg(const std::vector<uint8_t>& data)
     {
       // Only process messages once part of network
@@ -1267,12 +1348,80 @@ namespace ccf
       consensus->suspend_replication(recovery_v + 1);
 
       // Start reading private security domain of ledger
-      ledger_idx = 0;
-      read_ledger_idx(++ledger_idx);
+      start_private_ledger_recovery_unsafe();
 
       sm.advance(State::readingPrivateLedger);
     }
 
+    void start_private_ledger_recovery_unsafe()
+    {
+      // The private recovery store starts from the startup snapshot, if any.
+      // Since the public network has committed transactions since, the
+      // snapshot is always older than recovery_v.
+      ledger_idx = 0;
+      if (install_startup_snapshot(*recovery_store, false))
+        ledger_idx = recovery_store->current_version();
+
+      // When reading the private ledger, deserialise in the recovery store
+      ledger_replay.start(
+        recovery_store,
+        false,
+        ledger_idx + 1,
+        [this](
+          consensus::Index idx,
+          const std::vector<uint8_t>& entry,
+          std::unique_ptr<Store::Deserialiser> d) {
+          std::lock_guard<SpinLock> guard(lock);
+          return recover_private_ledger_entry_unsafe(
+            idx, entry, std::move(d));
+        },
+        [this]() {
+          std::lock_guard<SpinLock> guard(lock);
+          recover_private_ledger_end_unsafe();
+        });
+    }
+
+    bool install_startup_snapshot(Store& store, bool public_only)
+    {
+      if (snapshot_config.startup_snapshot.empty())
+        return false;
+
+      LOG_INFO_FMT(
+        "Installing startup snapshot at {} ({})",
+        snapshot_config.startup_snapshot_idx,
+        (public_only ? "public only" : "all domains"));
+
+      auto result = store.deserialise_snapshot(
+        snapshot_config.startup_snapshot, public_only);
+      if (result == kv::DeserialiseSuccess::FAILED)
+        throw std::logic_error("Failed to deserialise startup snapshot");
+
+      if (store.current_version() != snapshot_config.startup_snapshot_idx)
+      {
+        throw std::logic_error(fmt::format(
+          "Startup snapshot is at {}, expected {}",
+          store.current_version(),
+          snapshot_config.startup_snapshot_idx));
+      }
+
+      // If only the public domain was installed, the snapshot is kept for the
+      // private recovery of the ledger
+      if (!public_only)
+        snapshot_config.startup_snapshot.clear();
+
+      return true;
+    }
+
+    void setup_snapshotter()
+    {
+      snapshotter = std::make_shared<Snapshotter>(
+        writer_factory,
+        *network.tables,
+        snapshot_config.snapshot_tx_interval);
+
+      network.tables->set_snapshotter(snapshotter);
+    }
+
     void setup_basic_hooks()
     {
       // When a transaction that changes the configuration commits globally,
@@ -1390,12 +1539,14 @@ namespace ccf
       auto raft = std::make_unique<RaftType>(
         std::make_unique<raft::Adaptor<Store, kv::DeserialiseSuccess>>(
           network.tables),
-        std::make_unique<consensus::LedgerEnclave>(writer_factory),
+        take_ledger(),
         n2n_channels,
         self,
         std::chrono::milliseconds(raft_config.request_timeout),
         std::chrono::milliseconds(raft_config.election_timeout),
-        public_only);
+        public_only,
+        raft_config.wait_for_ledger_sync,
+        raft_config.read_lease);
 
       consensus = std::make_shared<RaftConsensusType>(std::move(raft));
 
@@ -1499,14 +1650,20 @@ namespace ccf
       }
     }
 
-    void read_ledger_idx(consensus::Index idx)
+    void ledger_truncate(consensus::Index idx)
     {
-      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_get, to_host, idx);
+      if (ledger == nullptr)
+        throw std::logic_error("Ledger is owned by consensus");
+
+      ledger->truncate(idx);
     }
 
-    void ledger_truncate(consensus::Index idx)
+    std::unique_ptr<consensus::LedgerEnclave> take_ledger()
     {
-      RINGBUFFER_WRITE_MESSAGE(consensus::ledger_truncate, to_host, idx);
+      if (ledger == nullptr)
+        throw std::logic_error("Ledger is already owned by consensus");
+
+      return std::move(ledger);
     }
 
 #ifdef PBFT
@@ -1520,7 +1677,7 @@ namespace ccf
         n2n_channels,
         self,
         config.signature_intervals.sig_max_tx,
-        std::make_unique<consensus::LedgerEnclave>(writer_factory),
+        take_ledger(),
         rpc_map,
         rpcsessions,
         *network.tables->get<pbft::RequestsMap>(pbft::Tables::PBFT_REQUESTS),
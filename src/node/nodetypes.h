@@ -34,7 +34,9 @@ namespace ccf
   enum ForwardedMsg : Node2NodeMsg
   {
     forwarded_cmd = 0,
-    forwarded_response
+    forwarded_response,
+    forwarded_cmd_batch,
+    forwarded_response_batch
   };
 
 #pragma pack(push, 1)
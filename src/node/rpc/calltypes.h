@@ -40,6 +40,7 @@ namespace ccf
     {
       HistogramResults histogram;
       nlohmann::json tx_rates;
+      nlohmann::json conflicts;
     };
   };
 
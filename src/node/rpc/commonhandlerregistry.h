@@ -280,5 +280,12 @@ namespace ccf
 
       HandlerRegistry::tick(elapsed, tx_count);
     }
+
+    void track_conflict(const std::string& method, bool retried) override
+    {
+      metrics.track_conflict(method, retried);
+
+      HandlerRegistry::track_conflict(method, retried);
+    }
   };
 }
\ No newline at end of file
@@ -2,11 +2,15 @@
 // Licensed under the Apache 2.0 License.
 #pragma once
 
+#include "ds/spinlock.h"
+#include "ds/thread_messaging.h"
 #include "enclave/forwardertypes.h"
 #include "enclave/rpcmap.h"
 #include "http/http_rpc_context.h"
 #include "node/nodetonode.h"
 
+#include <map>
+
 namespace ccf
 {
   class ForwardedRpcHandler
@@ -19,7 +23,9 @@ namespace ccf
   };
 
   template <typename ChannelProxy>
-  class Forwarder : public enclave::AbstractForwarder
+  class Forwarder
+    : public enclave::AbstractForwarder,
+      public std::enable_shared_from_this<Forwarder<ChannelProxy>>
   {
   private:
     std::shared_ptr<enclave::AbstractRPCResponder> rpcresponder;
@@ -29,29 +35,97 @@ namespace ccf
 
     using IsCallerCertForwarded = bool;
 
-  public:
-    Forwarder(
-      std::shared_ptr<enclave::AbstractRPCResponder> rpcresponder,
-      std::shared_ptr<ChannelProxy> n2n_channels,
-      std::shared_ptr<enclave::RPCMap> rpc_map_) :
-      rpcresponder(rpcresponder),
-      n2n_channels(n2n_channels),
-      rpc_map(rpc_map_)
-    {}
+    // When batching, commands and responses for the same node are queued
+    // rather than sent individually. The first one queued schedules a flush
+    // on the main thread, and everything queued by the time it runs is sent
+    // as a single encrypted message. Once a batch reaches max_batch_size,
+    // further entries start a new batch, sent after it by the same flush.
+    // Batches are only ever sent by the flush, so that entries for a node,
+    // such as commands from one client session, arrive in the order they
+    // were queued.
+    static constexpr size_t max_batch_size = 1 << 16;
+
+    struct PendingBatch
+    {
+      // Serialised entries, each prefixed with its size
+      std::vector<uint8_t> entries;
+      size_t count = 0;
+      // Commands in this batch, so that their callers can be told if the
+      // batch cannot be sent. Empty for batches of responses.
+      std::vector<std::shared_ptr<enclave::RpcContext>> contexts;
+    };
+
+    bool batching = false;
+
+    // Batches for each node, oldest first. Only the last may still be added
+    // to.
+    using PendingBatches = std::map<NodeId, std::vector<PendingBatch>>;
+
+    SpinLock pending_lock;
+    PendingBatches pending_commands;
+    PendingBatches pending_responses;
+    bool flush_scheduled = false;
+
+    struct ForwardedCommandMsg
+    {
+      std::shared_ptr<Forwarder<ChannelProxy>> forwarder;
+      std::shared_ptr<enclave::RpcHandler> handler;
+      std::shared_ptr<enclave::RpcContext> ctx;
+      NodeId from_node;
+    };
 
-    void initialize(NodeId self_)
+    struct FlushMsg
     {
-      self = self_;
+      std::shared_ptr<Forwarder<ChannelProxy>> forwarder;
+    };
+
+    // Forwarded commands from the same client session on the same backup are
+    // always executed by the same worker thread, so that they are executed in
+    // the order they were sent, as they would be on the backup
+    static uint16_t execution_thread(NodeId from_node, size_t session_id)
+    {
+      const size_t workers = enclave::ThreadMessaging::thread_count - 1;
+      return ((session_id ^ (from_node << 32)) % workers) + 1;
     }
 
-    bool forward_command(
+    static void process_forwarded_cb(
+      std::unique_ptr<enclave::Tmsg<ForwardedCommandMsg>> msg)
+    {
+      auto& d = msg->data;
+      d.forwarder->process_forwarded_command(d.handler, d.ctx, d.from_node);
+    }
+
+    static void flush_cb(std::unique_ptr<enclave::Tmsg<FlushMsg>> msg)
+    {
+      msg->data.forwarder->flush();
+    }
+
+    void process_forwarded_command(
+      const std::shared_ptr<enclave::RpcHandler>& handler,
+      const std::shared_ptr<enclave::RpcContext>& ctx,
+      NodeId from_node)
+    {
+      auto fwd_handler = dynamic_cast<ForwardedRpcHandler*>(handler.get());
+
+      if (!send_forwarded_response(
+            ctx->session.fwd->client_session_id,
+            from_node,
+            fwd_handler->process_forwarded(ctx)))
+      {
+        LOG_FAIL_FMT("Could not send forwarded response to {}", from_node);
+      }
+      else
+      {
+        LOG_DEBUG_FMT("Sending forwarded response to {}", from_node);
+      }
+    }
+
+    std::vector<uint8_t> serialise_command(
       std::shared_ptr<enclave::RpcContext> rpc_ctx,
-      NodeId to,
       CallerId caller_id,
       const std::vector<uint8_t>& caller_cert)
     {
       IsCallerCertForwarded include_caller = false;
-      const auto method = rpc_ctx->get_method();
       const auto& raw_request = rpc_ctx->get_serialised_request();
       size_t size = sizeof(caller_id) +
         sizeof(rpc_ctx->session.client_session_id) +
@@ -75,29 +149,13 @@ namespace ccf
       }
       serialized::write(data_, size_, raw_request.data(), raw_request.size());
 
-      ForwardedHeader msg = {ForwardedMsg::forwarded_cmd, self};
-
-      return n2n_channels->send_encrypted(to, plain, msg);
+      return plain;
     }
 
-    std::optional<std::tuple<std::shared_ptr<enclave::RpcContext>, NodeId>>
-    recv_forwarded_command(const uint8_t* data, size_t size)
+    std::shared_ptr<enclave::RpcContext> deserialise_command(
+      const uint8_t* data_, size_t size_)
     {
-      std::pair<ForwardedHeader, std::vector<uint8_t>> r;
-      try
-      {
-        r = n2n_channels->template recv_encrypted<ForwardedHeader>(data, size);
-      }
-      catch (const std::logic_error& err)
-      {
-        LOG_FAIL_FMT("Invalid forwarded command: {}", err.what());
-        return {};
-      }
-
       std::vector<uint8_t> caller_cert;
-      const auto& plain_ = r.second;
-      auto data_ = plain_.data();
-      auto size_ = plain_.size();
       auto caller_id = serialized::read<CallerId>(data_, size_);
       auto client_session_id = serialized::read<size_t>(data_, size_);
       auto includes_caller =
@@ -112,21 +170,262 @@ namespace ccf
       const enclave::SessionContext session(
         client_session_id, caller_id, caller_cert);
 
-      auto context = enclave::make_rpc_context(session, raw_request);
-
-      return std::make_tuple(context, r.first.from_node);
+      return enclave::make_rpc_context(session, raw_request);
     }
 
-    bool send_forwarded_response(
-      size_t client_session_id,
-      NodeId from_node,
-      const std::vector<uint8_t>& data)
+    static std::vector<uint8_t> serialise_response(
+      size_t client_session_id, const std::vector<uint8_t>& data)
     {
       std::vector<uint8_t> plain(sizeof(client_session_id) + data.size());
       auto data_ = plain.data();
       auto size_ = plain.size();
       serialized::write(data_, size_, client_session_id);
       serialized::write(data_, size_, data.data(), data.size());
+      return plain;
+    }
+
+    static std::pair<size_t, std::vector<uint8_t>> deserialise_response(
+      const uint8_t* data_, size_t size_)
+    {
+      auto client_session_id = serialized::read<size_t>(data_, size_);
+      std::vector<uint8_t> rpc = serialized::read(data_, size_, size_);
+      return std::make_pair(client_session_id, rpc);
+    }
+
+    // Splits a decrypted batch into its entries
+    template <typename F>
+    static void foreach_batch_entry(const std::vector<uint8_t>& plain, F&& f)
+    {
+      auto data_ = plain.data();
+      auto size_ = plain.size();
+      const auto count = serialized::read<size_t>(data_, size_);
+      for (size_t i = 0; i < count; ++i)
+      {
+        const auto entry_size = serialized::read<size_t>(data_, size_);
+        if (entry_size > size_)
+        {
+          throw std::logic_error("Truncated forwarded batch");
+        }
+        f(data_, entry_size);
+        serialized::skip(data_, size_, entry_size);
+      }
+    }
+
+    std::optional<std::pair<ForwardedHeader, std::vector<uint8_t>>>
+    recv_plain(const uint8_t* data, size_t size, const char* what)
+    {
+      try
+      {
+        return n2n_channels->template recv_encrypted<ForwardedHeader>(
+          data, size);
+      }
+      catch (const std::logic_error& err)
+      {
+        LOG_FAIL_FMT("Invalid forwarded {}: {}", what, err.what());
+        return std::nullopt;
+      }
+    }
+
+    // Adds an entry to the pending batches for a node, to be sent by the
+    // next flush
+    void enqueue(
+      PendingBatches& pending,
+      NodeId to,
+      const std::vector<uint8_t>& entry,
+      std::shared_ptr<enclave::RpcContext> ctx = nullptr)
+    {
+      bool schedule = false;
+
+      {
+        std::lock_guard<SpinLock> guard(pending_lock);
+        auto& batches = pending[to];
+        if (
+          batches.empty() || batches.back().entries.size() >= max_batch_size)
+        {
+          batches.emplace_back();
+        }
+        auto& batch = batches.back();
+
+        const auto offset = batch.entries.size();
+        batch.entries.resize(offset + sizeof(size_t) + entry.size());
+        auto data_ = batch.entries.data() + offset;
+        auto size_ = batch.entries.size() - offset;
+        serialized::write(data_, size_, entry.size());
+        serialized::write(data_, size_, entry.data(), entry.size());
+        ++batch.count;
+        if (ctx != nullptr)
+        {
+          batch.contexts.push_back(ctx);
+        }
+
+        if (!flush_scheduled)
+        {
+          flush_scheduled = true;
+          schedule = true;
+        }
+      }
+
+      if (schedule)
+      {
+        auto msg = std::make_unique<enclave::Tmsg<FlushMsg>>(&flush_cb);
+        msg->data.forwarder = this->shared_from_this();
+        enclave::ThreadMessaging::thread_messaging.add_task<FlushMsg>(
+          enclave::ThreadMessaging::main_thread, std::move(msg));
+      }
+    }
+
+    bool send_batch(NodeId to, ForwardedMsg type, const PendingBatch& batch)
+    {
+      std::vector<uint8_t> plain(sizeof(size_t) + batch.entries.size());
+      auto data_ = plain.data();
+      auto size_ = plain.size();
+      serialized::write(data_, size_, batch.count);
+      serialized::write(
+        data_, size_, batch.entries.data(), batch.entries.size());
+
+      ForwardedHeader msg = {type, self};
+
+      if (n2n_channels->send_encrypted(to, plain, msg))
+      {
+        return true;
+      }
+
+      LOG_FAIL_FMT("Could not send batch of {} to {}", batch.count, to);
+
+      // The callers of forward_command were told their commands had been
+      // forwarded, so must now be told otherwise
+      for (const auto& ctx : batch.contexts)
+      {
+        rpcresponder->reply_async(
+          ctx->session.client_session_id,
+          ctx->error_response(
+            jsonrpc::CCFErrorCodes::RPC_NOT_FORWARDED,
+            "RPC could not be forwarded to primary."));
+      }
+
+      return false;
+    }
+
+  public:
+    Forwarder(
+      std::shared_ptr<enclave::AbstractRPCResponder> rpcresponder,
+      std::shared_ptr<ChannelProxy> n2n_channels,
+      std::shared_ptr<enclave::RPCMap> rpc_map_) :
+      rpcresponder(rpcresponder),
+      n2n_channels(n2n_channels),
+      rpc_map(rpc_map_)
+    {}
+
+    void initialize(NodeId self_)
+    {
+      self = self_;
+    }
+
+    /** Coalesce forwarded commands and responses into batches
+     *
+     * Batches are flushed by a task on the main thread, so this should only
+     * be enabled when ThreadMessaging is running.
+     */
+    void set_batching(bool batching_)
+    {
+      batching = batching_;
+    }
+
+    //! Send all pending batches
+    void flush()
+    {
+      PendingBatches commands;
+      PendingBatches responses;
+
+      {
+        std::lock_guard<SpinLock> guard(pending_lock);
+        std::swap(commands, pending_commands);
+        std::swap(responses, pending_responses);
+        flush_scheduled = false;
+      }
+
+      for (const auto& [to, batches] : commands)
+      {
+        for (const auto& batch : batches)
+        {
+          send_batch(to, ForwardedMsg::forwarded_cmd_batch, batch);
+        }
+      }
+
+      for (const auto& [to, batches] : responses)
+      {
+        for (const auto& batch : batches)
+        {
+          send_batch(to, ForwardedMsg::forwarded_response_batch, batch);
+        }
+      }
+    }
+
+    bool forward_command(
+      std::shared_ptr<enclave::RpcContext> rpc_ctx,
+      NodeId to,
+      CallerId caller_id,
+      const std::vector<uint8_t>& caller_cert)
+    {
+      const auto plain = serialise_command(rpc_ctx, caller_id, caller_cert);
+
+      if (batching)
+      {
+        // Errors are reported to the callers asynchronously
+        enqueue(pending_commands, to, plain, rpc_ctx);
+        return true;
+      }
+
+      ForwardedHeader msg = {ForwardedMsg::forwarded_cmd, self};
+
+      return n2n_channels->send_encrypted(to, plain, msg);
+    }
+
+    std::optional<std::tuple<std::shared_ptr<enclave::RpcContext>, NodeId>>
+    recv_forwarded_command(const uint8_t* data, size_t size)
+    {
+      auto r = recv_plain(data, size, "command");
+      if (!r.has_value())
+      {
+        return {};
+      }
+
+      const auto& plain_ = r->second;
+      auto context = deserialise_command(plain_.data(), plain_.size());
+
+      return std::make_tuple(context, r->first.from_node);
+    }
+
+    std::optional<
+      std::tuple<std::vector<std::shared_ptr<enclave::RpcContext>>, NodeId>>
+    recv_forwarded_command_batch(const uint8_t* data, size_t size)
+    {
+      auto r = recv_plain(data, size, "command batch");
+      if (!r.has_value())
+      {
+        return {};
+      }
+
+      std::vector<std::shared_ptr<enclave::RpcContext>> contexts;
+      foreach_batch_entry(r->second, [&](const uint8_t* d, size_t s) {
+        contexts.push_back(deserialise_command(d, s));
+      });
+
+      return std::make_tuple(contexts, r->first.from_node);
+    }
+
+    bool send_forwarded_response(
+      size_t client_session_id,
+      NodeId from_node,
+      const std::vector<uint8_t>& data)
+    {
+      const auto plain = serialise_response(client_session_id, data);
+
+      if (batching)
+      {
+        enqueue(pending_responses, from_node, plain);
+        return true;
+      }
 
       ForwardedHeader msg = {ForwardedMsg::forwarded_response, self};
 
@@ -136,24 +435,86 @@ namespace ccf
     std::optional<std::pair<size_t, std::vector<uint8_t>>>
     recv_forwarded_response(const uint8_t* data, size_t size)
     {
-      std::pair<ForwardedHeader, std::vector<uint8_t>> r;
-      try
+      auto r = recv_plain(data, size, "response");
+      if (!r.has_value())
       {
-        r = n2n_channels->template recv_encrypted<ForwardedHeader>(data, size);
+        return {};
       }
-      catch (const std::logic_error& err)
+
+      const auto& plain_ = r->second;
+      return deserialise_response(plain_.data(), plain_.size());
+    }
+
+    std::optional<std::vector<std::pair<size_t, std::vector<uint8_t>>>>
+    recv_forwarded_response_batch(const uint8_t* data, size_t size)
+    {
+      auto r = recv_plain(data, size, "response batch");
+      if (!r.has_value())
       {
-        LOG_FAIL_FMT("Invalid forwarded response: {}", err.what());
         return {};
       }
 
-      const auto& plain_ = r.second;
-      auto data_ = plain_.data();
-      auto size_ = plain_.size();
-      auto client_session_id = serialized::read<size_t>(data_, size_);
-      std::vector<uint8_t> rpc = serialized::read(data_, size_, size_);
+      std::vector<std::pair<size_t, std::vector<uint8_t>>> responses;
+      foreach_batch_entry(r->second, [&](const uint8_t* d, size_t s) {
+        responses.push_back(deserialise_response(d, s));
+      });
 
-      return std::make_pair(client_session_id, rpc);
+      return responses;
+    }
+
+    void execute_forwarded_command(
+      std::shared_ptr<enclave::RpcContext> ctx, NodeId from_node)
+    {
+      const auto actor_opt = http::extract_actor(*ctx);
+      if (!actor_opt.has_value())
+      {
+        LOG_FAIL_FMT(
+          "Failed to extract actor from forwarded context. Method is '{}'",
+          ctx->get_method());
+        return;
+      }
+
+      const auto& actor_s = actor_opt.value();
+      auto actor = rpc_map->resolve(actor_s);
+      auto handler = rpc_map->find(actor);
+      if (actor == ccf::ActorsType::unknown || !handler.has_value())
+      {
+        LOG_FAIL_FMT(
+          "Failed to process forwarded command: unknown actor {}", actor_s);
+        return;
+      }
+
+      auto fwd_handler =
+        dynamic_cast<ForwardedRpcHandler*>(handler.value().get());
+      if (!fwd_handler)
+      {
+        LOG_FAIL_FMT(
+          "Failed to process forwarded command: handler is not a "
+          "ForwardedRpcHandler");
+        return;
+      }
+
+      // Forwarded commands are executed on worker threads, like those from
+      // clients connected to this node. The response is sent to the backup
+      // from that thread.
+      if (enclave::ThreadMessaging::thread_count > 1)
+      {
+        auto msg = std::make_unique<enclave::Tmsg<ForwardedCommandMsg>>(
+          &process_forwarded_cb);
+        msg->data.forwarder = this->shared_from_this();
+        msg->data.handler = handler.value();
+        msg->data.ctx = ctx;
+        msg->data.from_node = from_node;
+
+        enclave::ThreadMessaging::thread_messaging
+          .add_task<ForwardedCommandMsg>(
+            execution_thread(from_node, ctx->session.fwd->client_session_id),
+            std::move(msg));
+      }
+      else
+      {
+        process_forwarded_command(handler.value(), ctx, from_node);
+      }
     }
 
     void recv_message(const uint8_t* data, size_t size)
@@ -176,48 +537,26 @@ namespace ccf
             }
 
             auto [ctx, from_node] = std::move(r.value());
+            execute_forwarded_command(ctx, from_node);
+          }
+          break;
+        }
 
-            const auto actor_opt = http::extract_actor(*ctx);
-            if (!actor_opt.has_value())
-            {
-              LOG_FAIL_FMT(
-                "Failed to extract actor from forwarded context. Method is "
-                "'{}'",
-                ctx->get_method());
-            }
-
-            const auto& actor_s = actor_opt.value();
-            auto actor = rpc_map->resolve(actor_s);
-            auto handler = rpc_map->find(actor);
-            if (actor == ccf::ActorsType::unknown || !handler.has_value())
-            {
-              LOG_FAIL_FMT(
-                "Failed to process forwarded command: unknown actor {}",
-                actor_s);
-              return;
-            }
-
-            auto fwd_handler =
-              dynamic_cast<ForwardedRpcHandler*>(handler.value().get());
-            if (!fwd_handler)
+        case ForwardedMsg::forwarded_cmd_batch:
+        {
+          if (rpc_map)
+          {
+            auto r = recv_forwarded_command_batch(data, size);
+            if (!r.has_value())
             {
-              LOG_FAIL_FMT(
-                "Failed to process forwarded command: handler is not a "
-                "ForwardedRpcHandler");
+              LOG_FAIL_FMT("Failed to receive forwarded command batch");
               return;
             }
 
-            if (!send_forwarded_response(
-                  ctx->session.fwd->client_session_id,
-                  from_node,
-                  fwd_handler->process_forwarded(ctx)))
+            auto [contexts, from_node] = std::move(r.value());
+            for (auto& ctx : contexts)
             {
-              LOG_FAIL_FMT(
-                "Could not send forwarded response to {}", from_node);
-            }
-            else
-            {
-              LOG_DEBUG_FMT("Sending forwarded response to {}", from_node);
+              execute_forwarded_command(ctx, from_node);
             }
           }
           break;
@@ -240,6 +579,23 @@ namespace ccf
           break;
         }
 
+        case ForwardedMsg::forwarded_response_batch:
+        {
+          auto reps = recv_forwarded_response_batch(data, size);
+          if (!reps.has_value())
+            return;
+
+          for (const auto& [client_session_id, rpc] : reps.value())
+          {
+            LOG_DEBUG_FMT(
+              "Sending forwarded response to RPC endpoint {}",
+              client_session_id);
+            rpcresponder->reply_async(client_session_id, rpc);
+          }
+
+          break;
+        }
+
         default:
         {
           LOG_FAIL_FMT("Unknown frontend msg type: {}", forwarded_msg);
@@ -248,4 +604,4 @@ namespace ccf
       }
     }
   };
-}
\ No newline at end of file
+}
@@ -4,7 +4,9 @@
 #include "commonhandlerregistry.h"
 #include "consts.h"
 #include "ds/buffer.h"
+#include "ds/ringbuffer.h"
 #include "ds/spinlock.h"
+#include "ds/thread_messaging.h"
 #include "enclave/rpchandler.h"
 #include "forwarder.h"
 #include "jsonrpc.h"
@@ -14,6 +16,7 @@
 #include "rpcexception.h"
 #include "tls/verifier.h"
 
+#include <array>
 #include <fmt/format_header_only.h>
 #include <mutex>
 #include <utility>
@@ -32,6 +35,22 @@ namespace ccf
       request_storing_disabled = true;
     }
 
+    /** Configure how requests whose transactions conflict are executed again
+     *
+     * @param max_attempts_ Number of executions after which a conflicting
+     *  request is abandoned, and a TX_CONFLICT error returned
+     * @param serialise_conflicts_ If true, requests for the same method that
+     *  conflicted are executed again one at a time
+     */
+    void set_conflict_retries(size_t max_attempts_, bool serialise_conflicts_)
+    {
+      if (max_attempts_ == 0)
+        throw std::logic_error("A request must be executed at least once");
+
+      max_attempts = max_attempts_;
+      serialise_conflicts = serialise_conflicts_;
+    }
+
     virtual std::string invalid_caller_error_message() const
     {
       return "Could not find matching actor certificate";
@@ -47,6 +66,7 @@ namespace ccf
     pbft::RequestsMap* pbft_requests_map;
     kv::Consensus* consensus;
     std::shared_ptr<enclave::AbstractForwarder> cmd_forwarder;
+    std::shared_ptr<enclave::AbstractRPCResponder> rpc_responder;
     kv::TxHistory* history;
 
     size_t sig_max_tx = 1000;
@@ -55,6 +75,20 @@ namespace ccf
     std::chrono::milliseconds ms_to_sig = std::chrono::milliseconds(1000);
     bool request_storing_disabled = false;
 
+    // A request whose transaction conflicts is executed again, up to
+    // max_attempts times in total, after a backoff that doubles with each
+    // attempt
+    size_t max_attempts = 30;
+    static constexpr size_t max_backoff_shift = 10;
+
+    // If set, a request is executed again while holding the lane of its
+    // method, so that the conflicting requests of a method are executed again
+    // one at a time rather than in parallel with each other. A lane is held
+    // for a whole execution, so waiters block rather than spin.
+    bool serialise_conflicts = false;
+    static constexpr size_t conflict_lane_count = 8;
+    std::array<std::mutex, conflict_lane_count> conflict_lanes;
+
     void update_consensus()
     {
       auto c = tables.get_consensus().get();
@@ -68,8 +102,130 @@ namespace ccf
 
     void update_history()
     {
-      history = tables.get_history().get();
-      handlers.set_history(history);
+      auto h = tables.get_history().get();
+
+      if (history != h)
+      {
+        history = h;
+        handlers.set_history(history);
+      }
+    }
+
+    /** Find the handler for a command, and make sure the frontend's view of
+     * the history and consensus is current before it runs. Every path which
+     * executes commands, including speculatively on worker threads, goes
+     * through this.
+     *
+     * @param local_method Method of the command, without leading '/'
+     *
+     * @return The handler, or nullptr if the method is unknown
+     */
+    HandlerRegistry::Handler* find_command_handler(
+      const std::string& local_method)
+    {
+      auto handler = handlers.find_handler(local_method);
+      if (handler != nullptr)
+      {
+        update_history();
+        update_consensus();
+      }
+      return handler;
+    }
+
+    struct ReadIndexMsg
+    {
+      RpcFrontend* frontend;
+      std::shared_ptr<enclave::RpcContext> ctx;
+      CallerId caller_id;
+      bool confirmed;
+    };
+
+    static void read_index_cb(std::unique_ptr<enclave::Tmsg<ReadIndexMsg>> msg)
+    {
+      auto& d = msg->data;
+      d.frontend->process_after_read_index(d.ctx, d.caller_id, d.confirmed);
+    }
+
+    // With linearisable reads, a read-only request is only executed once
+    // the local node has committed every transaction committed before the
+    // request was received. Unless the local node holds a read lease, this
+    // waits for the consensus to confirm a read index.
+    bool defer_until_read_index(
+      std::shared_ptr<enclave::RpcContext> ctx, CallerId caller_id)
+    {
+      if (
+        consensus == nullptr || rpc_responder == nullptr ||
+        ctx->is_create_request || !consensus->linearisable_reads() ||
+        consensus->has_read_lease())
+      {
+        return false;
+      }
+
+      const auto method = ctx->get_method();
+      const auto local_method = method.substr(method.find_first_not_of('/'));
+      auto handler = handlers.find_handler(local_method);
+      if (
+        handler == nullptr ||
+        !(handler->rw == HandlerRegistry::Read ||
+          (handler->rw == HandlerRegistry::MayWrite && ctx->read_only_hint)))
+      {
+        return false;
+      }
+
+      const auto execution_thread = enclave::ThreadMessaging::thread_count > 1 ?
+        (ctx->session.client_session_id %
+         (enclave::ThreadMessaging::thread_count - 1)) +
+          1 :
+        enclave::ThreadMessaging::main_thread;
+
+      // The callback may be called with consensus locks held, so the request
+      // is always executed by a separate task
+      consensus->read_index(
+        [this, ctx, caller_id, execution_thread](
+          std::optional<kv::Consensus::SeqNo> read_idx) {
+          auto msg =
+            std::make_unique<enclave::Tmsg<ReadIndexMsg>>(&read_index_cb);
+          msg->data.frontend = this;
+          msg->data.ctx = ctx;
+          msg->data.caller_id = caller_id;
+          msg->data.confirmed = read_idx.has_value();
+
+          enclave::ThreadMessaging::thread_messaging.add_task<ReadIndexMsg>(
+            execution_thread, std::move(msg));
+        });
+
+      return true;
+    }
+
+    void process_after_read_index(
+      std::shared_ptr<enclave::RpcContext> ctx,
+      CallerId caller_id,
+      bool confirmed)
+    {
+      std::optional<std::vector<uint8_t>> rep;
+
+      if (confirmed)
+      {
+        Store::Tx tx;
+        rep = process_command(ctx, tx, caller_id);
+      }
+
+      if (!rep.has_value())
+      {
+        rep = ctx->error_response(
+          jsonrpc::CCFErrorCodes::TX_NOT_PRIMARY,
+          "Could not confirm that this node's state is up to date. Retry "
+          "later, or on the primary.");
+      }
+
+      rpc_responder->reply_async(ctx->session.client_session_id, rep.value());
+    }
+
+    static void backoff(size_t attempts)
+    {
+      const auto shift = std::min(attempts - 1, max_backoff_shift);
+      for (size_t i = 0; i < ((size_t)1 << shift); ++i)
+        CCF_PAUSE();
     }
 
     std::optional<nlohmann::json> forward_or_redirect_json(
@@ -178,6 +334,12 @@ namespace ccf
       cmd_forwarder = cmd_forwarder_;
     }
 
+    void set_rpc_responder(
+      std::shared_ptr<enclave::AbstractRPCResponder> rpc_responder_) override
+    {
+      rpc_responder = rpc_responder_;
+    }
+
     void open() override
     {
       std::lock_guard<SpinLock> mguard(lock);
@@ -290,6 +452,11 @@ namespace ccf
           "PBFT is not yet ready.");
       }
 #else
+      if (defer_until_read_index(ctx, caller_id.value()))
+      {
+        return std::nullopt;
+      }
+
       auto rep = process_command(ctx, tx, caller_id.value());
 
       // If necessary, forward the RPC to the current primary
@@ -372,6 +539,108 @@ namespace ccf
       return {rep.value(), replicated_state_merkle_root, version};
     }
 
+    /** Speculatively execute a PBFT command, without committing it
+     *
+     * The handler's writes are left in tx, to be committed by commit_pbft.
+     * Several commands may be executed like this concurrently, against the
+     * same state.
+     *
+     * @param ctx Context for this RPC
+     * @param tx Transaction to execute the command in
+     *
+     * @return true if tx is ready to be committed. Otherwise the command
+     *  failed or produced an error, and should be executed again normally
+     *  with process_pbft, so that the error is reported consistently
+     */
+    bool execute_pbft(
+      std::shared_ptr<enclave::RpcContext> ctx, Store::Tx& tx) override
+    {
+      const auto method = ctx->get_method();
+      const auto local_method = method.substr(method.find_first_not_of('/'));
+      auto handler = find_command_handler(local_method);
+      if (handler == nullptr)
+      {
+        return false;
+      }
+
+      try
+      {
+        auto req_view = tx.get_view(*pbft_requests_map);
+        req_view->put(
+          0,
+          {ctx->session.fwd.value().caller_id,
+           ctx->session.caller_cert,
+           ctx->get_serialised_request(),
+           ctx->pbft_raw});
+
+        auto args = RequestArgs{ctx, tx, ctx->session.fwd->caller_id};
+        handler->func(args);
+      }
+      catch (const std::exception&)
+      {
+        return false;
+      }
+
+      return !ctx->response_is_error();
+    }
+
+    /** Commit a PBFT command executed by execute_pbft
+     *
+     * @param ctx Context passed to execute_pbft
+     * @param tx Transaction passed to execute_pbft
+     * @param include_merkle_roots If true, the merkle root after this
+     *  transaction is included in the response
+     *
+     * @return The response, or nullopt if tx read state which has been
+     *  written since it was executed. Then tx has been discarded, and the
+     *  command should be executed again normally with process_pbft.
+     */
+    std::optional<ProcessPbftResp> commit_pbft(
+      std::shared_ptr<enclave::RpcContext> ctx,
+      Store::Tx& tx,
+      bool include_merkle_roots) override
+    {
+      update_history();
+      update_consensus();
+
+      std::vector<uint8_t> result;
+
+      switch (tx.commit())
+      {
+        case kv::CommitSuccess::OK:
+        {
+          result = committed_response(ctx, tx);
+          break;
+        }
+
+        case kv::CommitSuccess::CONFLICT:
+        {
+          return std::nullopt;
+        }
+
+        case kv::CommitSuccess::NO_REPLICATE:
+        {
+          result = ctx->error_response(
+            jsonrpc::CCFErrorCodes::TX_FAILED_TO_REPLICATE,
+            "Transaction failed to replicate.");
+          break;
+        }
+      }
+
+      // Counted here rather than in execute_pbft, since a command which
+      // conflicts is executed again by process_command, which counts it
+      tx_count++;
+
+      crypto::Sha256Hash replicated_state_merkle_root;
+      if (include_merkle_roots)
+      {
+        replicated_state_merkle_root = history->get_replicated_state_root();
+      }
+
+      return ProcessPbftResp{
+        result, replicated_state_merkle_root, tx.get_version()};
+    }
+
     /** Process a serialised input forwarded from another node
      *
      * This function assumes that ctx contains the caller_id as read by the
@@ -434,6 +703,39 @@ namespace ccf
       return std::nullopt;
     }
 
+    std::vector<uint8_t> committed_response(
+      std::shared_ptr<enclave::RpcContext> ctx, Store::Tx& tx)
+    {
+      auto cv = tx.commit_version();
+      if (cv == 0)
+        cv = tx.get_read_version();
+      if (cv == kv::NoVersion)
+        cv = tables.current_version();
+      ctx->set_response_headers(COMMIT, cv);
+      if (consensus != nullptr)
+      {
+        ctx->set_response_headers(TERM, consensus->get_view());
+        ctx->set_response_headers(
+          GLOBAL_COMMIT, consensus->get_commit_seqno());
+
+        if (
+          history && consensus->is_primary() &&
+          (cv % sig_max_tx == sig_max_tx / 2))
+        {
+          if (consensus->type() == ConsensusType::Raft)
+          {
+            history->emit_signature();
+          }
+          else
+          {
+            consensus->emit_signature();
+          }
+        }
+      }
+
+      return ctx->serialise_response();
+    }
+
     std::optional<std::vector<uint8_t>> process_command(
       std::shared_ptr<enclave::RpcContext> ctx,
       Store::Tx& tx,
@@ -441,16 +743,13 @@ namespace ccf
     {
       const auto method = ctx->get_method();
       const auto local_method = method.substr(method.find_first_not_of('/'));
-      auto handler = handlers.find_handler(local_method);
+      auto handler = find_command_handler(local_method);
       if (handler == nullptr)
       {
         return ctx->error_response(
           jsonrpc::StandardErrorCodes::METHOD_NOT_FOUND, method);
       }
 
-      update_history();
-      update_consensus();
-
 #ifndef PBFT
       bool is_primary = (consensus == nullptr) || consensus->is_primary() ||
         ctx->is_create_request;
@@ -487,8 +786,13 @@ namespace ccf
 
       tx_count++;
 
+      size_t attempts = 0;
+      std::unique_lock<std::mutex> conflict_lane;
+
       while (true)
       {
+        attempts++;
+
         try
         {
           func(args);
@@ -502,38 +806,40 @@ namespace ccf
           {
             case kv::CommitSuccess::OK:
             {
-              auto cv = tx.commit_version();
-              if (cv == 0)
-                cv = tx.get_read_version();
-              if (cv == kv::NoVersion)
-                cv = tables.current_version();
-              ctx->set_response_headers(COMMIT, cv);
-              if (consensus != nullptr)
+              return committed_response(ctx, tx);
+            }
+
+            case kv::CommitSuccess::CONFLICT:
+            {
+              if (attempts >= max_attempts)
               {
-                ctx->set_response_headers(TERM, consensus->get_view());
-                ctx->set_response_headers(
-                  GLOBAL_COMMIT, consensus->get_commit_seqno());
+                handlers.track_conflict(local_method, false);
+                return ctx->error_response(
+                  jsonrpc::CCFErrorCodes::TX_CONFLICT,
+                  fmt::format(
+                    "Transaction continued to conflict after {} attempts.",
+                    attempts));
+              }
+
+              handlers.track_conflict(local_method, true);
+
+              // The lane is not held while backing off, only while executing
+              if (conflict_lane.owns_lock())
+                conflict_lane.unlock();
 
-                if (
-                  history && consensus->is_primary() &&
-                  (cv % sig_max_tx == sig_max_tx / 2))
+              backoff(attempts);
+
+              if (serialise_conflicts)
+              {
+                if (conflict_lane.mutex() == nullptr)
                 {
-                  if (consensus->type() == ConsensusType::Raft)
-                  {
-                    history->emit_signature();
-                  }
-                  else
-                  {
-                    consensus->emit_signature();
-                  }
+                  const auto lane = std::hash<std::string>()(local_method) %
+                    conflict_lane_count;
+                  conflict_lane = std::unique_lock<std::mutex>(
+                    conflict_lanes[lane], std::defer_lock);
                 }
+                conflict_lane.lock();
               }
-
-              return ctx->serialise_response();
-            }
-
-            case kv::CommitSuccess::CONFLICT:
-            {
               break;
             }
 
@@ -207,6 +207,14 @@ namespace ccf
 
     virtual void tick(std::chrono::milliseconds elapsed, size_t tx_count) {}
 
+    /** Record that a transaction executed for method conflicted
+     *
+     * @param method Method name
+     * @param retried True if the request will be executed again, false if
+     *  it was abandoned
+     */
+    virtual void track_conflict(const std::string& method, bool retried) {}
+
     virtual std::optional<CallerId> valid_caller(
       Store::Tx& tx, const std::vector<uint8_t>& caller)
     {
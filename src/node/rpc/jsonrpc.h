@@ -48,6 +48,7 @@ namespace jsonrpc
   XX(CODE_ID_RETIRED, -32010) \
   XX(RPC_NOT_FORWARDED, -32011) \
   XX(QUOTE_NOT_VERIFIED, -32012) \
+  XX(TX_CONFLICT, -32013) \
   XX(APP_ERROR_START, -32050)
 
   using ErrorBaseType = int;
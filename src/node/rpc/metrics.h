@@ -4,8 +4,11 @@
 
 #include "ds/histogram.h"
 #include "ds/logger.h"
+#include "ds/spinlock.h"
 #include "serialization.h"
 
+#include <map>
+#include <mutex>
 #include <nlohmann/json.hpp>
 
 #define HIST_MAX (1 << 17)
@@ -28,6 +31,15 @@ namespace metrics
       histogram::Global<Hist>("histogram", __FILE__, __LINE__);
     Hist histogram = Hist(global);
 
+    struct ConflictCounts
+    {
+      size_t retried = 0;
+      size_t abandoned = 0;
+    };
+    // Conflicts are tracked from the threads executing transactions
+    SpinLock conflicts_lock;
+    std::map<std::string, ConflictCounts> conflicts;
+
     ccf::GetMetrics::HistogramResults get_histogram_results()
     {
       ccf::GetMetrics::HistogramResults result;
@@ -49,6 +61,18 @@ namespace metrics
       return result;
     }
 
+    nlohmann::json get_conflicts()
+    {
+      std::lock_guard<SpinLock> guard(conflicts_lock);
+      nlohmann::json result = nlohmann::json::object();
+      for (const auto& [method, counts] : conflicts)
+      {
+        result[method]["retried"] = counts.retried;
+        result[method]["abandoned"] = counts.abandoned;
+      }
+      return result;
+    }
+
     nlohmann::json get_tx_rates()
     {
       nlohmann::json result;
@@ -69,6 +93,7 @@ namespace metrics
       nlohmann::json result;
       result["histogram"] = get_histogram_results();
       result["tx_rates"] = get_tx_rates();
+      result["conflicts"] = get_conflicts();
 
       return result;
     }
@@ -93,5 +118,15 @@ namespace metrics
         tick_count++;
       }
     }
+
+    void track_conflict(const std::string& method, bool retried)
+    {
+      std::lock_guard<SpinLock> guard(conflicts_lock);
+      auto& counts = conflicts[method];
+      if (retried)
+        counts.retried++;
+      else
+        counts.abandoned++;
+    }
   };
 }
\ No newline at end of file
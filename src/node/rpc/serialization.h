@@ -66,7 +66,7 @@ namespace ccf
   DECLARE_JSON_REQUIRED_FIELDS(
     GetMetrics::HistogramResults, low, high, overflow, underflow, buckets)
   DECLARE_JSON_TYPE(GetMetrics::Out)
-  DECLARE_JSON_REQUIRED_FIELDS(GetMetrics::Out, histogram, tx_rates)
+  DECLARE_JSON_REQUIRED_FIELDS(GetMetrics::Out, histogram, tx_rates, conflicts)
 
   DECLARE_JSON_TYPE(GetPrimaryInfo::Out)
   DECLARE_JSON_REQUIRED_FIELDS(
@@ -23,6 +23,9 @@
 #  include "node/history.h"
 #endif
 #include <iostream>
+#include <map>
+#include <numeric>
+#include <set>
 #include <string>
 
 extern "C"
@@ -34,6 +37,9 @@ using namespace ccfapp;
 using namespace ccf;
 using namespace std;
 
+enclave::ThreadMessaging enclave::ThreadMessaging::thread_messaging;
+std::atomic<uint16_t> enclave::ThreadMessaging::thread_count = 0;
+
 static constexpr auto default_pack = jsonrpc::Pack::MsgPack;
 
 class TestUserFrontend : public SimpleUserRpcFrontend
@@ -268,6 +274,83 @@ public:
   }
 };
 
+class TestConflictFrontend : public SimpleUserRpcFrontend
+{
+public:
+  using Values = Store::Map<size_t, size_t>;
+  Values& values;
+
+  // Number of executions that will conflict, and number of executions
+  size_t conflicts = 0;
+  size_t executions = 0;
+
+  using SimpleUserRpcFrontend::set_conflict_retries;
+
+  TestConflictFrontend(Store& tables) :
+    SimpleUserRpcFrontend(tables),
+    values(tables.create<size_t, size_t>("values"))
+  {
+    open();
+
+    auto conflicting = [this](RequestArgs& args) {
+      executions++;
+
+      auto view = args.tx.get_view(values);
+      view->get(0);
+      view->put(0, executions);
+
+      if (conflicts > 0)
+      {
+        conflicts--;
+
+        // Another transaction writes the value read by this one
+        Store::Tx tx;
+        tx.get_view(values)->put(0, 0);
+        REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+      }
+
+      args.rpc_ctx->set_response_result(true);
+    };
+    install("conflicting", conflicting, HandlerRegistry::Write);
+  }
+};
+
+class TestSpeculationFrontend : public SimpleUserRpcFrontend
+{
+public:
+  using Values = Store::Map<size_t, size_t>;
+  Values& values;
+
+  TestSpeculationFrontend(Store& tables) :
+    SimpleUserRpcFrontend(tables),
+    values(tables.create<size_t, size_t>("values"))
+  {
+    open();
+
+    auto increment = [this](RequestArgs& args) {
+      auto view = args.tx.get_view(values);
+      const auto value = view->get(0).value_or(0) + 1;
+      view->put(0, value);
+      args.rpc_ctx->set_response_result(value);
+    };
+    install("increment", increment, HandlerRegistry::Write);
+
+    auto read = [this](RequestArgs& args) {
+      auto view = args.tx.get_view(values);
+      args.rpc_ctx->set_response_result(view->get(0).value_or(0));
+    };
+    install("read", read, HandlerRegistry::Read);
+
+    auto fail = [this](RequestArgs& args) {
+      auto view = args.tx.get_view(values);
+      view->put(0, 0);
+      args.rpc_ctx->set_response_error(
+        jsonrpc::StandardErrorCodes::INTERNAL_ERROR, "Failed");
+    };
+    install("fail", fail, HandlerRegistry::Write);
+  }
+};
+
 // used throughout
 auto kp = tls::make_key_pair();
 NetworkState network;
@@ -285,6 +368,15 @@ auto history = std::make_shared<NullTxHistory>(
   pbft_network.signatures,
   pbft_network.nodes);
 
+NetworkState pbft_network2(ConsensusType::Pbft);
+
+auto history2 = std::make_shared<NullTxHistory>(
+  *pbft_network2.tables,
+  0,
+  *history_kp,
+  pbft_network2.signatures,
+  pbft_network2.nodes);
+
 #endif
 
 StubNodeState stub_node;
@@ -419,14 +511,16 @@ void add_callers_primary_store()
 
 #ifdef PBFT
 
-void add_callers_pbft_store()
+void add_callers_pbft_store(
+  NetworkState& network = pbft_network,
+  std::shared_ptr<NullTxHistory> network_history = history)
 {
   Store::Tx gen_tx;
-  pbft_network.tables->set_encryptor(encryptor);
-  pbft_network.tables->clear();
-  pbft_network.tables->set_history(history);
+  network.tables->set_encryptor(encryptor);
+  network.tables->clear();
+  network.tables->set_history(network_history);
 
-  GenesisGenerator g(pbft_network, gen_tx);
+  GenesisGenerator g(network, gen_tx);
   g.init_values();
   user_id = g.add_user(user_caller);
   CHECK(g.finalize() == kv::CommitSuccess::OK);
@@ -461,6 +555,79 @@ TEST_CASE("process_pbft")
   REQUIRE(deserialised_req.caller_cert == user_caller_der);
   REQUIRE(deserialised_req.raw == serialized_call);
 }
+
+TEST_CASE("Speculative PBFT execution matches sequential execution")
+{
+  // Every command after the first reads state written by an earlier one, and
+  // "fail" writes state but responds with an error
+  const std::vector<std::string> batch = {
+    "increment", "read", "increment", "fail", "increment", "read"};
+
+  auto make_ctx = [](const std::string& method) {
+    const auto serialized_call = create_simple_request(method).build_request();
+    const enclave::SessionContext session(
+      enclave::InvalidSessionId, user_id, user_caller_der);
+    return enclave::make_rpc_context(session, serialized_call);
+  };
+
+  add_callers_pbft_store(pbft_network2, history2);
+  TestSpeculationFrontend sequential(*pbft_network2.tables);
+
+  std::vector<enclave::RpcHandler::ProcessPbftResp> expected;
+  for (const auto& method : batch)
+  {
+    expected.push_back(sequential.process_pbft(make_ctx(method), true));
+  }
+
+  add_callers_pbft_store();
+  TestSpeculationFrontend speculative(*pbft_network.tables);
+
+  // As PBFT does, execute every command against the same state first, then
+  // commit them in order, executing again those that cannot be committed
+  std::vector<std::shared_ptr<enclave::RpcContext>> ctxs;
+  std::vector<std::unique_ptr<Store::Tx>> txs;
+  std::vector<bool> ready;
+  for (const auto& method : batch)
+  {
+    ctxs.push_back(make_ctx(method));
+    txs.push_back(std::make_unique<Store::Tx>());
+    txs.back()->set_validate_all_reads();
+    ready.push_back(speculative.execute_pbft(ctxs.back(), *txs.back()));
+  }
+  CHECK_FALSE(ready[3]);
+
+  size_t reexecuted = 0;
+  for (size_t i = 0; i < batch.size(); ++i)
+  {
+    std::optional<enclave::RpcHandler::ProcessPbftResp> rep;
+    if (ready[i])
+    {
+      rep = speculative.commit_pbft(ctxs[i], *txs[i], true);
+    }
+
+    if (!rep.has_value())
+    {
+      ++reexecuted;
+      rep = speculative.process_pbft(make_ctx(batch[i]), true);
+    }
+
+    INFO("Command " << i << ": " << batch[i]);
+    CHECK(rep->version == expected[i].version);
+    CHECK(
+      rep->replicated_state_merkle_root ==
+      expected[i].replicated_state_merkle_root);
+    CHECK(rep->result == expected[i].result);
+  }
+  CHECK(reexecuted == batch.size() - 1);
+
+  Store::Tx seq_tx;
+  Store::Tx spec_tx;
+  const auto seq_value = seq_tx.get_view(sequential.values)->get(0);
+  const auto spec_value = spec_tx.get_view(speculative.values)->get(0);
+  REQUIRE(seq_value.has_value());
+  CHECK(seq_value == spec_value);
+  CHECK(seq_value.value() == 3);
+}
 #else
 
 TEST_CASE("SignedReq to and from json")
@@ -1010,6 +1177,245 @@ TEST_CASE("Memberfrontend forwarding" * doctest::test_suite("forwarding"))
   CHECK(member_frontend_primary.last_caller_id == 0);
 }
 
+TEST_CASE("Batched forwarding" * doctest::test_suite("forwarding"))
+{
+  prepare_callers();
+  add_callers_primary_store();
+
+  TestForwardingUserFrontEnd user_frontend_backup(*network.tables);
+  TestForwardingUserFrontEnd user_frontend_primary(*network2.tables);
+
+  auto channel_stub = std::make_shared<ChannelStubProxy>();
+  auto backup_forwarder = std::make_shared<Forwarder<ChannelStubProxy>>(
+    nullptr, channel_stub, nullptr);
+  backup_forwarder->set_batching(true);
+  user_frontend_backup.set_cmd_forwarder(backup_forwarder);
+
+  auto backup_consensus = std::make_shared<kv::BackupStubConsensus>();
+  network.tables->set_consensus(backup_consensus);
+
+  auto primary_consensus = std::make_shared<kv::PrimaryStubConsensus>();
+  network2.tables->set_consensus(primary_consensus);
+
+  auto simple_call = create_simple_request();
+  auto serialized_call = simple_call.build_request();
+
+  constexpr size_t n = 3;
+  for (size_t i = 0; i < n; ++i)
+  {
+    auto ctx = enclave::make_rpc_context(user_session, serialized_call);
+    const auto r = user_frontend_backup.process(ctx);
+    REQUIRE(!r.has_value());
+  }
+
+  INFO("Commands are not sent until the scheduled flush runs");
+  REQUIRE(channel_stub->is_empty());
+  REQUIRE(enclave::ThreadMessaging::thread_messaging.run_one(
+    enclave::ThreadMessaging::main_thread));
+  REQUIRE(channel_stub->size() == 1);
+
+  auto forwarded_msg = channel_stub->get_pop_back();
+  auto [fwd_ctxs, node_id] =
+    backup_forwarder
+      ->recv_forwarded_command_batch(
+        forwarded_msg.data(), forwarded_msg.size())
+      .value();
+  REQUIRE(fwd_ctxs.size() == n);
+
+  for (auto& fwd_ctx : fwd_ctxs)
+  {
+    auto response =
+      parse_response(user_frontend_primary.process_forwarded(fwd_ctx));
+    CHECK(response[jsonrpc::RESULT] == true);
+  }
+
+  INFO("A flush with nothing pending sends nothing");
+  backup_forwarder->flush();
+  REQUIRE(channel_stub->is_empty());
+
+  INFO("Full batches are sent in order by the scheduled flush");
+  {
+    std::vector<std::vector<uint8_t>> sent_calls;
+    for (size_t i = 0; i < 4; ++i)
+    {
+      // Large enough that they do not all fit in one batch
+      const std::vector<uint8_t> body(30000, i);
+      auto call = create_simple_request();
+      call.set_body(&body);
+
+      auto ctx = enclave::make_rpc_context(user_session, call.build_request());
+      REQUIRE(backup_forwarder->forward_command(ctx, 0, user_id, {}));
+      sent_calls.push_back(ctx->get_serialised_request());
+    }
+    REQUIRE(channel_stub->is_empty());
+
+    REQUIRE(enclave::ThreadMessaging::thread_messaging.run_one(
+      enclave::ThreadMessaging::main_thread));
+    REQUIRE(channel_stub->size() == 2);
+
+    std::vector<std::vector<uint8_t>> received_calls;
+    for (const auto& batch : channel_stub->sent_encrypted_messages)
+    {
+      auto [ctxs, from] = backup_forwarder
+                            ->recv_forwarded_command_batch(
+                              batch.data(), batch.size())
+                            .value();
+      for (const auto& ctx : ctxs)
+      {
+        received_calls.push_back(ctx->get_serialised_request());
+      }
+    }
+    CHECK(received_calls == sent_calls);
+    channel_stub->clear();
+  }
+}
+
+TEST_CASE(
+  "Forwarded commands are executed on worker threads" *
+  doctest::test_suite("forwarding"))
+{
+  prepare_callers();
+  add_callers_primary_store();
+
+  auto primary_consensus = std::make_shared<kv::PrimaryStubConsensus>();
+  network2.tables->set_consensus(primary_consensus);
+
+  auto user_frontend_primary =
+    std::make_shared<TestMinimalHandleFunction>(*network2.tables);
+  auto rpc_map = std::make_shared<enclave::RPCMap>();
+  REGISTER_FRONTEND(rpc_map, users, user_frontend_primary);
+
+  auto channel_stub = std::make_shared<ChannelStubProxy>();
+  auto primary_forwarder = std::make_shared<Forwarder<ChannelStubProxy>>(
+    nullptr, channel_stub, rpc_map);
+
+  // Forwarded client sessions, as (backup, session id on that backup). Session
+  // ids are distinct so that responses can be told apart.
+  const std::vector<std::pair<NodeId, size_t>> sessions = {
+    {1, 10}, {1, 11}, {2, 12}, {2, 13}};
+  constexpr size_t commands_per_session = 5;
+  constexpr uint16_t workers = 2;
+
+  auto forwarded_ctx = [](size_t session_id, size_t i) {
+    auto call = create_simple_request("users/echo");
+    const auto body = jsonrpc::pack(nlohmann::json{{"i", i}}, default_pack);
+    call.set_body(&body);
+    const enclave::SessionContext fwd_session(
+      session_id, user_id, user_caller_der);
+    return enclave::make_rpc_context(fwd_session, call.build_request());
+  };
+
+  auto execute_all = [&]() {
+    for (size_t i = 0; i < commands_per_session; ++i)
+    {
+      for (const auto& [from_node, session_id] : sessions)
+      {
+        primary_forwarder->execute_forwarded_command(
+          forwarded_ctx(session_id, i), from_node);
+      }
+    }
+  };
+
+  // For each session, the workers which executed its commands and the
+  // commands' indices, in the order their responses were sent
+  std::map<size_t, std::set<uint16_t>> executed_by;
+  std::map<size_t, std::vector<size_t>> executed;
+
+  auto record_response =
+    [&](uint16_t worker, size_t session_id, const std::vector<uint8_t>& rpc) {
+      const auto response = parse_response(rpc);
+      executed_by[session_id].insert(worker);
+      executed[session_id].push_back(
+        response[jsonrpc::RESULT]["i"].get<size_t>());
+    };
+
+  auto check_executed = [&]() {
+    std::vector<size_t> expected(commands_per_session);
+    std::iota(expected.begin(), expected.end(), 0);
+
+    REQUIRE(executed.size() == sessions.size());
+    for (const auto& [from_node, session_id] : sessions)
+    {
+      CHECK(executed_by[session_id].size() == 1);
+      CHECK(executed[session_id] == expected);
+    }
+
+    executed_by.clear();
+    executed.clear();
+  };
+
+  enclave::ThreadMessaging::thread_count = workers + 1;
+
+  {
+    INFO("Commands from one session are executed in order by one worker");
+    execute_all();
+    REQUIRE(channel_stub->is_empty());
+
+    for (uint16_t worker = 1; worker <= workers; ++worker)
+    {
+      while (enclave::ThreadMessaging::thread_messaging.run_one(worker))
+      {
+        // Each response is sent to the backup by the worker, as soon as the
+        // command has been executed
+        REQUIRE(channel_stub->size() == 1);
+        auto msg = channel_stub->get_pop_back();
+        auto [session_id, rpc] =
+          primary_forwarder->recv_forwarded_response(msg.data(), msg.size())
+            .value();
+        record_response(worker, session_id, rpc);
+      }
+    }
+
+    check_executed();
+  }
+
+  {
+    INFO("When batching, responses are sent in order by the flush");
+    primary_forwarder->set_batching(true);
+    execute_all();
+
+    for (uint16_t worker = 1; worker <= workers; ++worker)
+    {
+      size_t executed_count = 0;
+      while (enclave::ThreadMessaging::thread_messaging.run_one(worker))
+      {
+        ++executed_count;
+      }
+      // The workers only queue the responses
+      REQUIRE(channel_stub->is_empty());
+
+      if (executed_count > 0)
+      {
+        // A flush is scheduled by the first response queued. It sends a
+        // batch to each backup.
+        REQUIRE(enclave::ThreadMessaging::thread_messaging.run_one(
+          enclave::ThreadMessaging::main_thread));
+        REQUIRE(!channel_stub->is_empty());
+
+        size_t sent_count = 0;
+        for (const auto& msg : channel_stub->sent_encrypted_messages)
+        {
+          const auto responses =
+            primary_forwarder
+              ->recv_forwarded_response_batch(msg.data(), msg.size())
+              .value();
+          for (const auto& [session_id, rpc] : responses)
+          {
+            record_response(worker, session_id, rpc);
+            ++sent_count;
+          }
+        }
+        REQUIRE(sent_count == executed_count);
+        channel_stub->clear();
+      }
+    }
+
+    check_executed();
+  }
+
+  enclave::ThreadMessaging::thread_count = 0;
+}
+
 TEST_CASE("App-defined errors")
 {
   prepare_callers();
@@ -1053,6 +1459,48 @@ TEST_CASE("App-defined errors")
   }
 }
 
+TEST_CASE("Conflicting requests")
+{
+  prepare_callers();
+
+  TestConflictFrontend frontend(*network.tables);
+
+  auto call = [&](const std::string& method) {
+    const auto serialized_call = create_simple_request(method).build_request();
+    auto rpc_ctx = enclave::make_rpc_context(user_session, serialized_call);
+    return parse_response(frontend.process(rpc_ctx).value());
+  };
+
+  INFO("Conflicting requests are executed again");
+  {
+    frontend.conflicts = 2;
+    const auto response = call("conflicting");
+    CHECK(response[jsonrpc::RESULT] == true);
+    CHECK(frontend.executions == 3);
+  }
+
+  INFO("Requests that keep conflicting are abandoned");
+  {
+    frontend.set_conflict_retries(3, true);
+    frontend.executions = 0;
+    frontend.conflicts = 5;
+    const auto response = call("conflicting");
+    CHECK(response[jsonrpc::ERR] != nullptr);
+    CHECK(
+      response[jsonrpc::ERR][jsonrpc::CODE].get<jsonrpc::ErrorBaseType>() ==
+      jsonrpc::CCFErrorCodes::TX_CONFLICT);
+    CHECK(frontend.executions == 3);
+  }
+
+  INFO("Conflicts are counted in the metrics");
+  {
+    const auto response = call(GeneralProcs::GET_METRICS);
+    const auto counts = response[jsonrpc::RESULT]["conflicts"]["conflicting"];
+    CHECK(counts["retried"] == 4);
+    CHECK(counts["abandoned"] == 1);
+  }
+}
+
 #endif
 
 // We need an explicit main to initialize kremlib and EverCrypt
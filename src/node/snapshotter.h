@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#pragma once
+
+#include "consensus/ledgerenclavetypes.h"
+#include "ds/logger.h"
+#include "ds/spinlock.h"
+#include "ds/thread_messaging.h"
+#include "entities.h"
+#include "kv/kvtypes.h"
+
+#include <algorithm>
+
+namespace ccf
+{
+  class Snapshotter : public kv::AbstractSnapshotter,
+                      public std::enable_shared_from_this<Snapshotter>
+  {
+  private:
+    ringbuffer::WriterPtr to_host;
+    Store& store;
+
+    // Number of transactions between two snapshots. 0 disables snapshots.
+    const size_t snapshot_tx_interval;
+    kv::Version last_snapshot_idx = 0;
+
+    SpinLock lock;
+
+    // Snapshots are sent to the host in chunks of at most this size, well
+    // below the host's maximum message size, so that the size of a snapshot
+    // is not limited by it
+    static constexpr size_t max_chunk_size = 1 << 16;
+
+    // Snapshots are serialised and sent by a single worker thread, which is
+    // the only user of to_host, so that their chunks are not interleaved
+    static constexpr uint16_t snapshot_thread = 1;
+
+    struct SnapshotMsg
+    {
+      std::shared_ptr<Snapshotter> self;
+      std::unique_ptr<Store::Snapshot> snapshot;
+    };
+
+    static void snapshot_cb(std::unique_ptr<enclave::Tmsg<SnapshotMsg>> msg)
+    {
+      msg->data.self->serialise_and_send(*msg->data.snapshot);
+    }
+
+    void serialise_and_send(Store::Snapshot& snapshot)
+    {
+      const auto idx = static_cast<consensus::Index>(snapshot.get_version());
+
+      try
+      {
+        auto data = snapshot.serialise(store.get_encryptor());
+
+        LOG_INFO_FMT("Emitting snapshot at {} ({} bytes)", idx, data.size());
+
+        RINGBUFFER_WRITE_MESSAGE(
+          consensus::ledger_snapshot_begin, to_host, idx, data.size());
+
+        for (size_t offset = 0; offset < data.size(); offset += max_chunk_size)
+        {
+          const auto chunk_size =
+            std::min(max_chunk_size, data.size() - offset);
+          RINGBUFFER_WRITE_MESSAGE(
+            consensus::ledger_snapshot_chunk,
+            to_host,
+            idx,
+            serializer::ByteRange{data.data() + offset, chunk_size});
+        }
+
+        RINGBUFFER_WRITE_MESSAGE(
+          consensus::ledger_snapshot_commit, to_host, idx);
+      }
+      catch (const std::exception& e)
+      {
+        // Failing to snapshot is not fatal: the ledger is still complete. A
+        // snapshot which is never committed is discarded by the host.
+        LOG_FAIL_FMT("Could not emit snapshot at {}: {}", idx, e.what());
+      }
+    }
+
+  public:
+    Snapshotter(
+      ringbuffer::AbstractWriterFactory& writer_factory,
+      Store& store_,
+      size_t snapshot_tx_interval_) :
+      to_host(writer_factory.create_writer_to_outside()),
+      store(store_),
+      snapshot_tx_interval(snapshot_tx_interval_)
+    {}
+
+    void set_last_snapshot_idx(kv::Version idx)
+    {
+      // Should be called when the store was started from a snapshot, so that
+      // the next snapshot is only generated after the configured interval
+      std::lock_guard<SpinLock> guard(lock);
+      last_snapshot_idx = idx;
+    }
+
+    void compact(kv::Version v) override
+    {
+      // Called by the store once v has been committed (and compacted). The
+      // snapshot is only taken if enough transactions have been committed
+      // since the last one. Only the (persistent) state is captured here, as
+      // the caller may hold the consensus lock. It is serialised, encrypted
+      // and sent to the host on a worker thread.
+      {
+        std::lock_guard<SpinLock> guard(lock);
+
+        if (
+          snapshot_tx_interval == 0 ||
+          v <
+            last_snapshot_idx + static_cast<kv::Version>(snapshot_tx_interval))
+          return;
+
+        last_snapshot_idx = v;
+      }
+
+      std::unique_ptr<Store::Snapshot> snapshot;
+      try
+      {
+        snapshot = store.snapshot(v);
+      }
+      catch (const std::exception& e)
+      {
+        LOG_FAIL_FMT("Could not snapshot at {}: {}", v, e.what());
+        return;
+      }
+
+      if (enclave::ThreadMessaging::thread_count > 1)
+      {
+        auto msg = std::make_unique<enclave::Tmsg<SnapshotMsg>>(&snapshot_cb);
+        msg->data.self = shared_from_this();
+        msg->data.snapshot = std::move(snapshot);
+
+        enclave::ThreadMessaging::thread_messaging.add_task<SnapshotMsg>(
+          snapshot_thread, std::move(msg));
+      }
+      else
+      {
+        serialise_and_send(*snapshot);
+      }
+    }
+  };
+}
@@ -11,6 +11,7 @@
 #include "node/nodes.h"
 #include "node/signatures.h"
 
+#include <cmath>
 #include <doctest/doctest.h>
 
 extern "C"
@@ -128,6 +129,66 @@ TEST_CASE("Check signature verification")
   }
 }
 
+TEST_CASE("Signatures record the frontier of the merkle tree")
+{
+  INFO("The frontier is enough to compute the root, and grows slowly");
+  {
+    MerkleTreeHistory tree;
+    for (size_t i = 1; i < 1000; ++i)
+    {
+      crypto::Sha256Hash h({{(uint8_t*)&i, sizeof(i)}});
+      tree.append(h);
+      if (i % 100 == 0)
+        tree.flush(i - 50);
+
+      const auto frontier = tree.serialise_frontier();
+      REQUIRE(
+        MerkleTreeHistory::get_frontier_root(frontier) == tree.get_root());
+      REQUIRE(
+        frontier.size() <= sizeof(uint64_t) + sizeof(uint32_t) +
+          crypto::Sha256Hash::SIZE * (1 + std::log2(i + 1)));
+    }
+  }
+
+#ifndef PBFT
+  INFO("The frontier in a signature is that of the signed root");
+  {
+    Store store;
+    auto& nodes = store.create<ccf::Nodes>(
+      ccf::Tables::NODES, kv::SecurityDomain::PUBLIC);
+    auto& signatures = store.create<ccf::Signatures>(
+      ccf::Tables::SIGNATURES, kv::SecurityDomain::PUBLIC);
+    store.set_consensus(std::make_shared<DummyConsensus>(nullptr));
+
+    auto kp = tls::make_key_pair();
+    auto history =
+      std::make_shared<ccf::MerkleTxHistory>(store, 0, *kp, signatures, nodes);
+    store.set_history(history);
+
+    auto& table =
+      store.create<size_t, size_t>("table", kv::SecurityDomain::PUBLIC);
+    for (size_t i = 0; i < 10; ++i)
+    {
+      Store::Tx tx;
+      tx.get_view(table)->put(i, i);
+      REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+    }
+
+    const auto root = history->get_replicated_state_root();
+    history->emit_signature();
+
+    Store::Tx tx;
+    auto sig = tx.get_view(signatures)->get(0);
+    REQUIRE(sig.has_value());
+    REQUIRE(MerkleTreeHistory::get_frontier_root(sig->tree) == root);
+
+    auto verifier = tls::make_verifier(kp->self_sign("CN=name"));
+    REQUIRE(verifier->verify_hash(
+      root.h, root.SIZE, sig->sig.data(), sig->sig.size()));
+  }
+#endif
+}
+
 TEST_CASE("Check signing works across rollback")
 {
   auto encryptor = std::make_shared<ccf::NullTxEncryptor>();
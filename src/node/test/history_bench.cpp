@@ -2,11 +2,13 @@
 // Licensed under the Apache 2.0 License.
 #define PICOBENCH_IMPLEMENT
 #include "kv/test/stub_consensus.h"
+#include "node/encryptor.h"
 #include "node/history.h"
 
 #include <cstdlib>
 #include <ctime>
 #include <picobench/picobench.hpp>
+#include <thread>
 
 extern "C"
 {
@@ -21,6 +23,16 @@ public:
   DummyConsensus() {}
 };
 
+// Discards replicated entries, so that it can be called concurrently
+class DiscardingConsensus : public kv::StubConsensus
+{
+public:
+  bool replicate(const kv::BatchVector& entries) override
+  {
+    return true;
+  }
+};
+
 template <class A>
 inline void do_not_optimize(A const& value)
 {
@@ -204,6 +216,99 @@ static void append_compact(picobench::state& s)
   s.stop_timer();
 }
 
+// Cost of a signature transaction, after L transactions have been appended to
+// the history without compaction
+template <size_t L>
+static void emit_signature(picobench::state& s)
+{
+  ::srand(42);
+
+  Store store;
+  auto& nodes = store.create<ccf::Nodes>(ccf::Tables::NODES);
+  auto& signatures = store.create<ccf::Signatures>(ccf::Tables::SIGNATURES);
+
+  auto kp = tls::make_key_pair();
+
+  std::shared_ptr<kv::Consensus> consensus = std::make_shared<DummyConsensus>();
+  store.set_consensus(consensus);
+
+  std::shared_ptr<kv::TxHistory> history =
+    std::make_shared<ccf::MerkleTxHistory>(store, 0, *kp, signatures, nodes);
+  store.set_history(history);
+
+  std::vector<uint8_t> tx;
+  for (size_t j = 0; j < 100; j++)
+  {
+    tx.push_back(::rand() % 256);
+  }
+
+  for (size_t i = 0; i < L; i++)
+  {
+    history->append(tx);
+  }
+
+  s.start_timer();
+  for (auto _ : s)
+  {
+    (void)_;
+    history->emit_signature();
+    clobber_memory();
+  }
+  s.stop_timer();
+}
+
+// Commits transactions of S bytes from several threads, each writing its own
+// keys, to a store with a merkle tree history
+template <size_t Threads, size_t S>
+static void commit_concurrent(picobench::state& s)
+{
+  ::srand(42);
+
+  Store store;
+  store.set_encryptor(std::make_shared<ccf::NullTxEncryptor>());
+  auto& nodes = store.create<ccf::Nodes>(ccf::Tables::NODES);
+  auto& signatures = store.create<ccf::Signatures>(ccf::Tables::SIGNATURES);
+  auto& table = store.create<size_t, std::vector<uint8_t>>(
+    "table", kv::SecurityDomain::PUBLIC);
+
+  auto kp = tls::make_key_pair();
+
+  std::shared_ptr<kv::Consensus> consensus =
+    std::make_shared<DiscardingConsensus>();
+  store.set_consensus(consensus);
+
+  std::shared_ptr<kv::TxHistory> history =
+    std::make_shared<ccf::MerkleTxHistory>(store, 0, *kp, signatures, nodes);
+  store.set_history(history);
+
+  std::vector<uint8_t> value;
+  for (size_t j = 0; j < S; j++)
+  {
+    value.push_back(::rand() % 256);
+  }
+
+  const size_t txs_per_thread = s.iterations() / Threads;
+  auto worker = [&](size_t t) {
+    for (size_t i = 0; i < txs_per_thread; i++)
+    {
+      Store::Tx tx;
+      tx.get_view(table)->put(t * txs_per_thread + i, value);
+      auto rc = tx.commit();
+      if (rc != kv::CommitSuccess::OK)
+        throw std::logic_error(
+          "Transaction commit failed: " + std::to_string(rc));
+    }
+  };
+
+  s.start_timer();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < Threads; t++)
+    threads.emplace_back(worker, t);
+  for (auto& thread : threads)
+    thread.join();
+  s.stop_timer();
+}
+
 const std::vector<int> sizes = {1000, 10000};
 
 PICOBENCH_SUITE("hash_only");
@@ -231,6 +336,36 @@ PICOBENCH(append_compact<10>).iterations(sizes).samples(10).baseline();
 PICOBENCH(append_compact<100>).iterations(sizes).samples(10);
 PICOBENCH(append_compact<1000>).iterations(sizes).samples(10);
 
+const std::vector<int> concurrent_tx_count = {12000};
+
+PICOBENCH_SUITE("commit_concurrent");
+PICOBENCH(commit_concurrent<1, 100>)
+  .iterations(concurrent_tx_count)
+  .samples(10)
+  .baseline();
+PICOBENCH(commit_concurrent<4, 100>)
+  .iterations(concurrent_tx_count)
+  .samples(10);
+PICOBENCH(commit_concurrent<1, 1000>)
+  .iterations(concurrent_tx_count)
+  .samples(10);
+PICOBENCH(commit_concurrent<4, 1000>)
+  .iterations(concurrent_tx_count)
+  .samples(10);
+PICOBENCH(commit_concurrent<1, 10000>)
+  .iterations(concurrent_tx_count)
+  .samples(10);
+PICOBENCH(commit_concurrent<4, 10000>)
+  .iterations(concurrent_tx_count)
+  .samples(10);
+
+const std::vector<int> sig_counts = {10, 100};
+
+PICOBENCH_SUITE("emit_signature");
+PICOBENCH(emit_signature<1000>).iterations(sig_counts).samples(10).baseline();
+PICOBENCH(emit_signature<10000>).iterations(sig_counts).samples(10);
+PICOBENCH(emit_signature<100000>).iterations(sig_counts).samples(10);
+
 // We need an explicit main to initialize kremlib and EverCrypt
 int main(int argc, char* argv[])
 {
@@ -0,0 +1,216 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the Apache 2.0 License.
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "node/ledgerreplay.h"
+
+#include "kv/test/stub_consensus.h"
+#include "node/encryptor.h"
+
+#include <doctest/doctest.h>
+
+enclave::ThreadMessaging enclave::ThreadMessaging::thread_messaging;
+std::atomic<uint16_t> enclave::ThreadMessaging::thread_count = 0;
+
+using namespace ccf;
+
+static std::vector<std::vector<uint8_t>> make_ledger(size_t entries)
+{
+  auto consensus = std::make_shared<kv::StubConsensus>();
+  Store store(consensus);
+  store.set_encryptor(std::make_shared<NullTxEncryptor>());
+  auto& values = store.create<size_t, size_t>("values");
+
+  for (size_t i = 1; i <= entries; ++i)
+  {
+    Store::Tx tx;
+    tx.get_view(values)->put(i % 7, i);
+    REQUIRE(tx.commit() == kv::CommitSuccess::OK);
+  }
+
+  std::vector<std::vector<uint8_t>> ledger;
+  for (auto e = consensus->pop_oldest_data(); e.second;
+       e = consensus->pop_oldest_data())
+    ledger.push_back(e.first);
+  REQUIRE(ledger.size() == entries);
+  return ledger;
+}
+
+static std::shared_ptr<Store> make_target()
+{
+  auto store = std::make_shared<Store>();
+  store->set_encryptor(std::make_shared<NullTxEncryptor>());
+  store->create<size_t, size_t>("values");
+  return store;
+}
+
+// Responds to range requests from the replay with at most max_entries
+// entries, as the host would. Returns the number of requests served.
+static size_t serve_ledger(
+  ringbuffer::Circuit& eio,
+  LedgerReplay& replay,
+  const std::vector<std::vector<uint8_t>>& ledger,
+  size_t max_entries = LedgerReplay::range_size)
+{
+  std::vector<std::pair<consensus::Index, consensus::Index>> requests;
+  eio.read_from_inside().read(
+    -1, [&](ringbuffer::Message m, const uint8_t* data, size_t size) {
+      REQUIRE(m == consensus::ledger_get_range);
+      auto [from, to] =
+        ringbuffer::read_message<consensus::ledger_get_range>(data, size);
+      requests.emplace_back(from, to);
+    });
+
+  for (auto [from, to] : requests)
+  {
+    to = std::min({to, ledger.size(), from + max_entries - 1});
+    if (from > to)
+    {
+      replay.recv_no_entry(from);
+      continue;
+    }
+
+    std::vector<uint8_t> framed;
+    for (auto idx = from; idx <= to; ++idx)
+    {
+      const auto& entry = ledger[idx - 1];
+      auto entry_size = static_cast<uint32_t>(entry.size());
+      auto p = reinterpret_cast<const uint8_t*>(&entry_size);
+      framed.insert(framed.end(), p, p + sizeof(entry_size));
+      framed.insert(framed.end(), entry.begin(), entry.end());
+    }
+    replay.recv_entries(from, framed);
+  }
+  return requests.size();
+}
+
+TEST_CASE("Replay on the main thread")
+{
+  enclave::ThreadMessaging::thread_count = 1;
+  ringbuffer::Circuit eio(1 << 20);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const auto ledger = make_ledger(2500);
+  auto target = make_target();
+
+  LedgerReplay replay(wf);
+  consensus::Index last_applied = 0;
+  size_t ends = 0;
+  replay.start(
+    target,
+    false,
+    1,
+    [&](
+      consensus::Index idx,
+      const std::vector<uint8_t>& entry,
+      std::unique_ptr<LedgerReplay::Deserialiser> d) {
+      REQUIRE(idx == last_applied + 1);
+      REQUIRE(entry == ledger[idx - 1]);
+      last_applied = idx;
+      return target->deserialise_prepared(entry, std::move(d)) ==
+        kv::DeserialiseSuccess::PASS;
+    },
+    [&]() { ends++; });
+  REQUIRE(replay.is_active());
+
+  INFO("Ranges that are only partially served are requested again");
+  while (serve_ledger(eio, replay, ledger, 300) > 0)
+    ;
+
+  REQUIRE(!replay.is_active());
+  REQUIRE(ends == 1);
+  REQUIRE(last_applied == ledger.size());
+  REQUIRE(target->current_version() == ledger.size());
+
+  Store::Tx tx;
+  auto values = tx.get_view(*target->get<size_t, size_t>("values"));
+  REQUIRE(values->get(ledger.size() % 7) == ledger.size());
+}
+
+TEST_CASE("Replay with worker threads")
+{
+  const uint16_t workers = 3;
+  enclave::ThreadMessaging::thread_count = workers + 1;
+  auto& tm = enclave::ThreadMessaging::thread_messaging;
+  ringbuffer::Circuit eio(1 << 20);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const auto ledger = make_ledger(2500);
+  auto target = make_target();
+
+  LedgerReplay replay(wf);
+  consensus::Index last_applied = 0;
+  size_t ends = 0;
+  replay.start(
+    target,
+    false,
+    1,
+    [&](
+      consensus::Index idx,
+      const std::vector<uint8_t>& entry,
+      std::unique_ptr<LedgerReplay::Deserialiser> d) {
+      REQUIRE(d != nullptr);
+      REQUIRE(idx == last_applied + 1);
+      last_applied = idx;
+      return target->deserialise_prepared(entry, std::move(d)) ==
+        kv::DeserialiseSuccess::PASS;
+    },
+    [&]() { ends++; });
+
+  INFO("The replay starts on the main thread");
+  REQUIRE(!replay.is_active());
+  REQUIRE(tm.run_one(enclave::ThreadMessaging::main_thread));
+  REQUIRE(replay.is_active());
+
+  while (ends == 0)
+  {
+    serve_ledger(eio, replay, ledger);
+
+    // Workers run in reverse order, but entries are still applied in order
+    for (uint16_t tid = workers; tid > 0; --tid)
+      while (tm.run_one(tid))
+        ;
+    while (tm.run_one(enclave::ThreadMessaging::main_thread))
+      ;
+  }
+
+  REQUIRE(ends == 1);
+  REQUIRE(last_applied == ledger.size());
+  REQUIRE(target->current_version() == ledger.size());
+  enclave::ThreadMessaging::thread_count = 0;
+}
+
+TEST_CASE("Stopped replay")
+{
+  enclave::ThreadMessaging::thread_count = 1;
+  ringbuffer::Circuit eio(1 << 20);
+  auto wf = ringbuffer::WriterFactory(eio);
+
+  const auto ledger = make_ledger(50);
+  auto target = make_target();
+
+  LedgerReplay replay(wf);
+  const consensus::Index stop_at = 20;
+  size_t ends = 0;
+  replay.start(
+    target,
+    false,
+    1,
+    [&](
+      consensus::Index idx,
+      const std::vector<uint8_t>& entry,
+      std::unique_ptr<LedgerReplay::Deserialiser> d) {
+      target->deserialise_prepared(entry, std::move(d));
+      return idx < stop_at;
+    },
+    [&]() { ends++; });
+
+  serve_ledger(eio, replay, ledger);
+  REQUIRE(!replay.is_active());
+  REQUIRE(target->current_version() == stop_at);
+
+  INFO("Responses to requests made before the replay stopped are ignored");
+  serve_ledger(eio, replay, ledger);
+  REQUIRE(serve_ledger(eio, replay, ledger) == 0);
+  REQUIRE(ends == 0);
+  REQUIRE(target->current_version() == stop_at);
+}
@@ -54,6 +54,7 @@ class Network:
         "host_log_level",
         "sig_max_tx",
         "sig_max_ms",
+        "snapshot_tx_interval",
         "election_timeout",
         "consensus",
         "memory_reserve_startup",
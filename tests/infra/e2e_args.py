@@ -71,6 +71,11 @@ def cli_args(add=lambda x: None, parser=None, accept_unknown=False):
     parser.add_argument(
         "--sig-max-ms", help="Max milliseconds between signatures", type=int
     )
+    parser.add_argument(
+        "--snapshot-tx-interval",
+        help="Number of committed transactions between snapshots",
+        type=int,
+    )
     parser.add_argument(
         "--memory-reserve-startup",
         help="Reserve this many bytes of memory on startup, to simulate memory restrictions",
@@ -13,6 +13,7 @@ import json
 import uuid
 import ctypes
 import signal
+import stat
 import re
 from collections import deque
 
@@ -167,7 +168,13 @@ class SSHRemote(CmdMixin):
         for path in self.files:
             tgt_path = os.path.join(self.root, os.path.basename(path))
             LOG.info("[{}] copy {} from {}".format(self.hostname, tgt_path, path))
-            session.put(path, tgt_path)
+            if os.path.isdir(path):
+                # Directories (e.g. the ledger) are flat, copy them file by file
+                session.mkdir(tgt_path)
+                for f in os.listdir(path):
+                    session.put(os.path.join(path, f), os.path.join(tgt_path, f))
+            else:
+                session.put(path, tgt_path)
         session.close()
         executable = self.cmd[0]
         if executable.startswith("./"):
@@ -189,7 +196,16 @@ class SSHRemote(CmdMixin):
             for seconds in range(timeout):
                 try:
                     targetname = targetname or filename
-                    session.get(os.path.join(self.root, filename), targetname)
+                    src_path = os.path.join(self.root, filename)
+                    if stat.S_ISDIR(session.stat(src_path).st_mode):
+                        os.makedirs(targetname, exist_ok=True)
+                        for f in session.listdir(src_path):
+                            session.get(
+                                os.path.join(src_path, f),
+                                os.path.join(targetname, f),
+                            )
+                    else:
+                        session.get(src_path, targetname)
                     LOG.debug(
                         "[{}] found {} after {}s".format(
                             self.hostname, filename, seconds
@@ -383,7 +399,7 @@ class LocalRemote(CmdMixin):
         for path in self.data_files:
             dst_path = self.root
             src_path = os.path.join(os.getcwd(), path)
-            assert self._rc("cp {} {}".format(src_path, dst_path)) == 0
+            assert self._rc("cp -r {} {}".format(src_path, dst_path)) == 0
 
     def get(self, filename, timeout=60, targetname=None):
         path = os.path.join(self.root, filename)
@@ -394,7 +410,8 @@ class LocalRemote(CmdMixin):
         else:
             raise ValueError(path)
         targetname = targetname or filename
-        assert self._rc("cp {} {}".format(path, targetname)) == 0
+        assert self._rc("rm -rf {}".format(targetname)) == 0
+        assert self._rc("cp -r {} {}".format(path, targetname)) == 0
 
     def list_files(self):
         return os.listdir(self.root)
@@ -512,6 +529,7 @@ class CCFRemote(object):
         host_log_level="info",
         sig_max_tx=1000,
         sig_max_ms=1000,
+        snapshot_tx_interval=None,
         election_timeout=1000,
         consensus="raft",
         worker_threads=0,
@@ -556,7 +574,7 @@ class CCFRemote(object):
             f"--node-address={host}:{node_port}",
             f"--rpc-address={host}:{rpc_port}",
             f"--public-rpc-address={pubhost}:{rpc_port}",
-            f"--ledger-file={self.ledger_file_name}",
+            f"--ledger-dir={self.ledger_file_name}",
             f"--node-cert-file={self.pem}",
             f"--host-log-level={host_log_level}",
             f"--raft-election-timeout-ms={election_timeout}",
@@ -574,6 +592,9 @@ class CCFRemote(object):
         if sig_max_ms:
             cmd += [f"--sig-max-ms={sig_max_ms}"]
 
+        if snapshot_tx_interval:
+            cmd += [f"--snapshot-tx-interval={snapshot_tx_interval}"]
+
         if memory_reserve_startup:
             cmd += [f"--memory-reserve-startup={memory_reserve_startup}"]
 
@@ -2,12 +2,14 @@
 # Licensed under the Apache 2.0 License.
 import io
 import msgpack
+import os
 import struct
 
 GCM_SIZE_TAG = 16
 GCM_SIZE_IV = 12
 LEDGER_TRANSACTION_SIZE = 4
 LEDGER_DOMAIN_SIZE = 8
+LEDGER_HEADER_SIZE = 8
 
 
 def to_uint_32(buffer):
@@ -101,9 +103,15 @@ class Transaction:
 
     def __init__(self, filename):
         self._file = open(filename, mode="rb")
-        self._file.seek(0, 2)
-        self._file_size = self._file.tell()
-        self._file.seek(0, 0)
+        # Chunks start with the offset of their positions index, which is 0
+        # while the chunk is still being written to
+        index_offset = to_uint_64(_byte_read_safe(self._file, LEDGER_HEADER_SIZE))
+        if index_offset:
+            self._file_size = index_offset
+        else:
+            self._file.seek(0, 2)
+            self._file_size = self._file.tell()
+        self._next_offset = LEDGER_HEADER_SIZE
 
     def __del__(self):
         self._file.close()
@@ -147,12 +155,24 @@ class Transaction:
             raise StopIteration()
 
 
+def _chunk_start(filename):
+    # Chunks are named ledger_<start> or ledger_<start>-<end>
+    return int(filename[len("ledger_") :].split("-")[0])
+
+
 class Ledger:
 
-    _filename = None
+    _chunks = []
 
-    def __init__(self, filename):
-        self._filename = filename
+    def __init__(self, directory):
+        self._chunks = [
+            os.path.join(directory, f)
+            for f in sorted(
+                (f for f in os.listdir(directory) if f.startswith("ledger_")),
+                key=_chunk_start,
+            )
+        ]
 
     def __iter__(self):
-        return Transaction(self._filename)
+        for chunk in self._chunks:
+            yield from Transaction(chunk)